@@ -0,0 +1,244 @@
+// asyncio.cc
+//	Routines to queue file I/O for kernel threads to carry out, while
+//	the user program that asked for it goes on running.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "asyncio.h"
+#include "synch.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// AsyncRequest::AsyncRequest
+// 	Initialize a request to transfer "size" bytes at byte "at" of a
+//	file, to or from "buf".
+//
+//	"of" -- an open file for the request alone; it is closed when
+//		the request is deleted
+//----------------------------------------------------------------------
+
+AsyncRequest::AsyncRequest(OpenFile *of, char *buf, int size, int at,
+                           bool isWrite)
+{
+    file = of;
+    buffer = buf;
+    numBytes = size;
+    position = at;
+    writing = isWrite;
+    done = FALSE;
+    result = 0;
+}
+
+//----------------------------------------------------------------------
+// AsyncRequest::~AsyncRequest
+// 	Close the request's file.  The request must not be queued, or
+//	being carried out.
+//----------------------------------------------------------------------
+
+AsyncRequest::~AsyncRequest()
+{
+    delete file;
+}
+
+//----------------------------------------------------------------------
+// AsyncWorker
+// 	The body of a worker thread.
+//----------------------------------------------------------------------
+
+static void AsyncWorker(void *queue)
+{
+    ((AsyncIO *)queue)->Serve();
+}
+
+//----------------------------------------------------------------------
+// AsyncIO::AsyncIO
+// 	Initialize an empty request queue.  The workers are started by
+//	the first requests.
+//----------------------------------------------------------------------
+
+AsyncIO::AsyncIO()
+{
+    lock = new Lock("async io");
+    queued = new Condition("async io queued");
+    finished = new Condition("async io finished");
+    queue = new List<AsyncRequest *>;
+    numWorkers = idleWorkers = 0;
+}
+
+//----------------------------------------------------------------------
+// AsyncIO::~AsyncIO
+// 	De-allocate the queue.  Nachos is halting: the workers are left
+//	asleep, and whatever is still queued is dropped.
+//----------------------------------------------------------------------
+
+AsyncIO::~AsyncIO()
+{
+    delete queue;
+    delete finished;
+    delete queued;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// AsyncIO::Submit
+// 	Add a request to the queue, for a worker to carry out, and
+//	return at once.  Start another worker if all of them are busy
+//	and we may.
+//----------------------------------------------------------------------
+
+void AsyncIO::Submit(AsyncRequest *request)
+{
+    lock->Acquire();
+    queue->Append(request);
+    if ((int)queue->NumInList() > idleWorkers && numWorkers < AsyncWorkers)
+    {
+        Thread *worker = new Thread("async io", 0);
+
+        numWorkers++;
+        worker->Fork((VoidFunctionPtr)AsyncWorker, (void *)this);
+    }
+    else
+        queued->Signal(lock);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// AsyncIO::Done
+// 	Return TRUE if a request has been carried out.
+//----------------------------------------------------------------------
+
+bool AsyncIO::Done(AsyncRequest *request)
+{
+    bool done;
+
+    lock->Acquire();
+    done = request->done;
+    lock->Release();
+    return done;
+}
+
+//----------------------------------------------------------------------
+// AsyncIO::Wait
+// 	Wait until a request has been carried out.
+//----------------------------------------------------------------------
+
+void AsyncIO::Wait(AsyncRequest *request)
+{
+    lock->Acquire();
+    while (!request->done)
+        finished->Wait(lock);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// AsyncIO::Serve
+// 	Take requests off the queue, one at a time, and carry them out.
+//	The transfer is done without holding the lock, so that the other
+//	workers can take requests meanwhile.
+//----------------------------------------------------------------------
+
+void AsyncIO::Serve()
+{
+    lock->Acquire();
+    for (;;)
+    {
+        AsyncRequest *request;
+        int result;
+
+        while (queue->IsEmpty())
+        {
+            idleWorkers++;
+            queued->Wait(lock);
+            idleWorkers--;
+        }
+        request = queue->RemoveFront();
+        lock->Release();
+
+        DEBUG(dbgFile, "Async " << (request->writing ? "write " : "read ")
+                                << request->numBytes << " bytes at "
+                                << request->position);
+        if (request->writing)
+            result = request->file->WriteAt(request->buffer,
+                                            request->numBytes,
+                                            request->position);
+        else
+            result = request->file->ReadAt(request->buffer,
+                                           request->numBytes,
+                                           request->position);
+
+        lock->Acquire();
+        request->result = result;
+        request->done = TRUE;
+        finished->Broadcast(lock);
+    }
+}
+
+//----------------------------------------------------------------------
+// AsyncRequestTable::AsyncRequestTable
+// 	Initialize a table with no requests outstanding.
+//----------------------------------------------------------------------
+
+AsyncRequestTable::AsyncRequestTable()
+{
+    for (int i = 0; i < MaxAsyncRequests; i++)
+        requests[i] = NULL;
+}
+
+//----------------------------------------------------------------------
+// AsyncRequestTable::~AsyncRequestTable
+// 	The address space is going away.  Its memory must not be written
+//	once it is gone, so wait for the requests still outstanding.
+//----------------------------------------------------------------------
+
+AsyncRequestTable::~AsyncRequestTable()
+{
+    for (int i = 0; i < MaxAsyncRequests; i++)
+        if (requests[i] != NULL)
+        {
+            kernel->asyncIO->Wait(requests[i]);
+            delete requests[i];
+        }
+}
+
+//----------------------------------------------------------------------
+// AsyncRequestTable::Add
+// 	Give a request the lowest free id, and return it; -1 if there is
+//	none.  The table owns the request until the id is removed.
+//----------------------------------------------------------------------
+
+int AsyncRequestTable::Add(AsyncRequest *request)
+{
+    for (int i = 0; i < MaxAsyncRequests; i++)
+        if (requests[i] == NULL)
+        {
+            requests[i] = request;
+            return i;
+        }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// AsyncRequestTable::Get
+// 	Return the request "id" stands for, or NULL.
+//----------------------------------------------------------------------
+
+AsyncRequest *AsyncRequestTable::Get(int id)
+{
+    if (id < 0 || id >= MaxAsyncRequests)
+        return NULL;
+    return requests[id];
+}
+
+//----------------------------------------------------------------------
+// AsyncRequestTable::Remove
+// 	Free the id of a request.
+//----------------------------------------------------------------------
+
+void AsyncRequestTable::Remove(int id)
+{
+    ASSERT(Get(id) != NULL);
+    requests[id] = NULL;
+}
@@ -0,0 +1,105 @@
+// asyncio.h
+//	Data structures for file I/O that a user program starts now and
+//	collects later.
+//
+//	Read and Write keep the calling program waiting until the disk has
+//	done its part.  An asynchronous request is instead put on the
+//	kernel's I/O request queue, and the system call returns at once;
+//	kernel threads take requests off the queue and carry them out.  A
+//	worker that needs the disk sleeps until the disk interrupt wakes
+//	it, meanwhile the program goes on computing.  When the transfer
+//	is over the request is marked done, and the program picks up the
+//	result with AsyncWait or AsyncPoll.
+//
+//	There are a few workers, so that several requests can be waiting
+//	for the disk at once, and the disk queue can order them.
+//
+//	Each request reads or writes through an open file of its own, so
+//	the program may close its descriptor before the request is done.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#include "openfile.h"
+#include "list.h"
+
+class Lock;
+class Condition;
+
+#define MaxAsyncRequests 16 // requests an address space may have
+                            // outstanding (not yet waited for)
+#define AsyncWorkers 4      // kernel threads carrying out requests
+
+// The following class defines one request: what to transfer, and,
+// once it is done, how it went.
+
+class AsyncRequest
+{
+public:
+    AsyncRequest(OpenFile *of, char *buf, int size, int at, bool isWrite);
+    // Initialize a request to transfer
+    // "size" bytes at byte "at" of "of"
+    // to/from "buf"; the request owns "of"
+    ~AsyncRequest(); // Close its file
+
+    OpenFile *file; // Where to read/write
+    char *buffer;   // Where the bytes go to/come from
+    int numBytes;   // How many
+    int position;   // Where in the file
+    bool writing;   // Is this a write?
+    bool done;      // Has it been carried out?
+    int result;     // Bytes transferred, once done
+};
+
+// The following class defines the request queue, and the kernel threads
+// serving it.  Workers are started as they are needed, up to AsyncWorkers.
+
+class AsyncIO
+{
+public:
+    AsyncIO();  // Initialize an empty queue, with no workers yet
+    ~AsyncIO(); // De-allocate the queue
+
+    void Submit(AsyncRequest *request); // Queue "request" and return
+                                        // without waiting for it
+    bool Done(AsyncRequest *request);   // Has "request" been carried out?
+    void Wait(AsyncRequest *request);   // Wait until it has
+
+    void Serve(); // A worker's loop: carry out requests, forever
+
+private:
+    Lock *lock;               // Protects everything below
+    Condition *queued;        // Signalled when there is a new request
+    Condition *finished;      // Broadcast when a request is done
+    List<AsyncRequest *> *queue; // Requests no worker has taken yet
+    int numWorkers;           // Workers started so far
+    int idleWorkers;          // ... of which waiting for a request
+};
+
+// The following class defines the asynchronous requests of one address
+// space, and the ids the program knows them by.
+
+class AsyncRequestTable
+{
+public:
+    AsyncRequestTable();  // Initialize a table with nothing outstanding
+    ~AsyncRequestTable(); // Wait for what is still outstanding
+
+    int Add(AsyncRequest *request); // Give "request" an id;
+                                    // -1 if the table is full
+    AsyncRequest *Get(int id);      // The request "id" stands for, or
+                                    // NULL if there is none
+    void Remove(int id);            // Forget "id"; the caller deletes
+                                    // the request
+
+private:
+    AsyncRequest *requests[MaxAsyncRequests];
+};
+
+#endif // ASYNCIO_H
@@ -0,0 +1,530 @@
+// buffercache.cc
+//	Routines to manage the cache of disk sectors.
+//
+//	Each slot is found through a hash chain keyed by sector number.
+//	A slot is either free, valid (holds the sector's contents), or
+//	busy (a disk read is on its way to fill it).  Fills are queued
+//	with the DiskQueue as asynchronous requests; when one finishes,
+//	the interrupt handler copies the data into its slots and wakes up
+//	any thread that went to sleep waiting for them.
+//
+//	Slots are reused in least recently used order, skipping the ones
+//	that are busy or that a thread is in the middle of using.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "buffercache.h"
+#include "debug.h"
+#include "main.h"
+
+#define NumCacheBuckets NumCacheEntries
+
+// The largest run of sectors handled at once; a bigger request is done
+// in pieces, so that it can never need more slots than the cache has.
+#define MaxCacheRun (NumCacheEntries / 4)
+
+// The following class describes one fill in progress: the slots it is
+// filling, and the buffer the disk reads into.  It is the disk request's
+// "callWhenDone", and deletes itself once the data is in the cache.
+
+class CacheFill : public CallBackObj
+{
+public:
+    CacheFill(BufferCache *owner, int count)
+    {
+        cache = owner;
+        entryList = new int[count];
+        sectorList = new int[count];
+        buffer = new char[count * SectorSize];
+        request = NULL;
+    }
+    ~CacheFill()
+    {
+        delete[] entryList;
+        delete[] sectorList;
+        delete[] buffer;
+        delete request;
+    }
+    void CallBack()
+    {
+        cache->FillDone(entryList, request->numSectors, buffer);
+        delete this;
+    }
+
+    BufferCache *cache;   // Cache being filled
+    int *entryList;       // Slots to fill
+    int *sectorList;      // Sectors to read into them
+    char *buffer;         // Where the disk puts the data
+    DiskRequest *request; // The read itself
+};
+
+// The following class describes a write around the cache that nobody
+// waits for.  When the disk is done, it brings the cache up to date
+// again (a fill may have put older contents there meanwhile), then
+// tells the owner.  It deletes itself, along with the request.
+
+class CacheWrite : public CallBackObj
+{
+public:
+    CacheWrite(BufferCache *owner, DiskRequest *diskRequest, CallBackObj *whenDone)
+    {
+        cache = owner;
+        request = diskRequest;
+        callWhenDone = whenDone;
+    }
+    ~CacheWrite() { delete request; }
+    void CallBack()
+    {
+        cache->WriteDone(request->sectorList, request->numSectors, request->data);
+        callWhenDone->CallBack();
+        delete this;
+    }
+
+    BufferCache *cache;        // Cache to keep up to date
+    DiskRequest *request;      // The write itself
+    CallBackObj *callWhenDone; // Who to tell when it is done
+};
+
+//----------------------------------------------------------------------
+// BufferCache::BufferCache
+// 	Initialize an empty cache.
+//
+//	"diskQueue" -- where to send the requests for uncached sectors
+//----------------------------------------------------------------------
+
+BufferCache::BufferCache(DiskQueue *diskQueue)
+{
+    queue = diskQueue;
+    useClock = 0;
+    entries = new CacheEntry[NumCacheEntries];
+    buckets = new int[NumCacheBuckets];
+    for (int i = 0; i < NumCacheBuckets; i++)
+        buckets[i] = -1;
+    for (int i = 0; i < NumCacheEntries; i++)
+    {
+        entries[i].sector = -1;
+        entries[i].valid = entries[i].busy = entries[i].prefetched = FALSE;
+        entries[i].refs = entries[i].waiting = 0;
+        entries[i].filled = new Semaphore("cache fill", 0);
+        entries[i].lastUse = 0;
+        entries[i].hashNext = -1;
+    }
+}
+
+//----------------------------------------------------------------------
+// BufferCache::~BufferCache
+// 	De-allocate the cache.  Since every write went through to the disk
+//	already, there is nothing to flush.
+//----------------------------------------------------------------------
+
+BufferCache::~BufferCache()
+{
+    for (int i = 0; i < NumCacheEntries; i++)
+        delete entries[i].filled;
+    delete[] entries;
+    delete[] buckets;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Read
+// 	Read a list of sectors.  Cached sectors are copied from memory;
+//	all the others are read with one vectored disk request.  A sector
+//	that read-ahead is already bringing in is waited for, not read
+//	twice.  Return only when all the data is in "data".
+//
+//	"sectorList" -- the disk sectors to read
+//	"numSectors" -- the number of entries in sectorList
+//	"data" -- sectorList[i] goes to data[i * SectorSize]
+//----------------------------------------------------------------------
+
+void BufferCache::Read(int *sectorList, int numSectors, char *data)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    int slot[MaxCacheRun];
+
+    for (int start = 0; start < numSectors; start += MaxCacheRun)
+    {
+        int *sectors = &sectorList[start];
+        char *buf = &data[start * SectorSize];
+        int count = min(numSectors - start, MaxCacheRun);
+        int i;
+
+        // hold on to the hits, so the fill can't take their slots
+        for (i = 0; i < count; i++)
+        {
+            slot[i] = Lookup(sectors[i]);
+            if (slot[i] != -1)
+            {
+                entries[slot[i]].refs++;
+                kernel->stats->numCacheHits++;
+            }
+        }
+        StartFill(sectors, count, FALSE);
+        for (i = 0; i < count; i++)
+            if (slot[i] == -1 && (slot[i] = Lookup(sectors[i])) != -1)
+                entries[slot[i]].refs++;
+
+        for (i = 0; i < count; i++)
+        {
+            CacheEntry *e;
+
+            if (slot[i] == -1)
+            { // every slot was busy; go around the cache
+                DiskRequest *request =
+                    new DiskRequest(&sectors[i], 1, &buf[i * SectorSize], FALSE);
+                queue->Submit(request);
+                request->done->P();
+                delete request;
+                continue;
+            }
+            WaitFor(slot[i]);
+            e = &entries[slot[i]];
+            bcopy(e->data, &buf[i * SectorSize], SectorSize);
+            if (e->prefetched)
+            {
+                e->prefetched = FALSE;
+                kernel->stats->numReadAheadHits++;
+            }
+            e->lastUse = ++useClock;
+            e->refs--;
+        }
+    }
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Write
+// 	Write a list of sectors through the cache: update (or create) the
+//	cached copies, then write the data to disk with one vectored
+//	request.  The slots are held until the disk is done, so a read
+//	can't pull the old contents back in under us.
+//
+//	"sectorList" -- the disk sectors to write
+//	"numSectors" -- the number of entries in sectorList
+//	"data" -- data[i * SectorSize] is written to sectorList[i]
+//----------------------------------------------------------------------
+
+void BufferCache::Write(int *sectorList, int numSectors, char *data)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    int slot[MaxCacheRun];
+
+    for (int start = 0; start < numSectors; start += MaxCacheRun)
+    {
+        int *sectors = &sectorList[start];
+        char *buf = &data[start * SectorSize];
+        int count = min(numSectors - start, MaxCacheRun);
+        DiskRequest *request;
+        int i;
+
+        for (i = 0; i < count; i++)
+        {
+            slot[i] = Lookup(sectors[i]);
+            if (slot[i] == -1)
+                slot[i] = Allocate(sectors[i]);
+            if (slot[i] == -1)
+                continue; // no slot to spare; write around the cache
+            entries[slot[i]].refs++;
+            WaitFor(slot[i]);
+            bcopy(&buf[i * SectorSize], entries[slot[i]].data, SectorSize);
+            entries[slot[i]].valid = TRUE;
+            entries[slot[i]].prefetched = FALSE;
+            entries[slot[i]].lastUse = ++useClock;
+        }
+
+        request = new DiskRequest(sectors, count, buf, TRUE);
+        queue->Submit(request);
+        request->done->P();
+        delete request;
+
+        for (i = 0; i < count; i++)
+            if (slot[i] != -1)
+                entries[slot[i]].refs--;
+    }
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// BufferCache::WriteAround
+// 	Write a list of sectors straight to the disk.  Unlike Write, no
+//	slots are claimed for sectors that aren't cached (the journal's
+//	log, for one, is never read back while we run); cached copies are
+//	updated, now and again when the write completes.
+//
+//	"sectorList" -- the disk sectors to write
+//	"numSectors" -- the number of entries in sectorList
+//	"data" -- data[i * SectorSize] is written to sectorList[i]
+//	"callWhenDone" -- if NULL, return only once the data is on disk;
+//		otherwise, return at once, and call it from the disk
+//		interrupt handler when done.  sectorList and data must
+//		then stay around until that call.
+//----------------------------------------------------------------------
+
+void BufferCache::WriteAround(int *sectorList, int numSectors, char *data,
+                              CallBackObj *callWhenDone)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    DiskRequest *request = new DiskRequest(sectorList, numSectors, data, TRUE);
+
+    Refresh(sectorList, numSectors, data);
+    if (callWhenDone != NULL)
+    {
+        request->callWhenDone = new CacheWrite(this, request, callWhenDone);
+        queue->Submit(request);
+    }
+    else
+    {
+        queue->Submit(request);
+        request->done->P();
+        WriteDone(sectorList, numSectors, data);
+        delete request;
+    }
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Install
+// 	Put new contents for a list of sectors into the cache, without
+//	writing them to disk.  The caller takes care that the disk is
+//	brought up to date later (see Journal), and that reads see the new
+//	contents even if the cache lets go of them first.
+//
+//	"sectorList" -- the disk sectors
+//	"numSectors" -- the number of entries in sectorList
+//	"data" -- the new contents of sectorList[i] are at data[i * SectorSize]
+//----------------------------------------------------------------------
+
+void BufferCache::Install(int *sectorList, int numSectors, char *data)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    for (int i = 0; i < numSectors; i++)
+    {
+        int slot = Lookup(sectorList[i]);
+
+        if (slot == -1 && (slot = Allocate(sectorList[i])) == -1)
+            continue; // every slot is in use; nothing to keep up to date
+        entries[slot].refs++;
+        WaitFor(slot);
+        bcopy(&data[i * SectorSize], entries[slot].data, SectorSize);
+        entries[slot].valid = TRUE;
+        entries[slot].prefetched = FALSE;
+        entries[slot].lastUse = ++useClock;
+        entries[slot].refs--;
+    }
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Peek
+// 	If "sector" is in the cache (and not still on its way), copy it
+//	into "data" and return TRUE.  Never goes to the disk.
+//----------------------------------------------------------------------
+
+bool BufferCache::Peek(int sector, char *data)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    int slot = Lookup(sector);
+    bool found = (slot != -1 && entries[slot].valid && !entries[slot].busy);
+
+    if (found)
+        bcopy(entries[slot].data, data, SectorSize);
+    (void)kernel->interrupt->SetLevel(oldLevel);
+    return found;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Prefetch
+// 	Start bringing a list of sectors into the cache, and return right
+//	away.  Sectors already cached (or on their way) are skipped.
+//
+//	"sectorList" -- the disk sectors to read ahead
+//	"numSectors" -- the number of entries in sectorList
+//----------------------------------------------------------------------
+
+void BufferCache::Prefetch(int *sectorList, int numSectors)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    StartFill(sectorList, min(numSectors, MaxCacheRun), TRUE);
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// BufferCache::FillDone
+// 	A fill has completed (we are in the disk interrupt handler).  Copy
+//	the data into the slots, and wake up whoever is waiting for them.
+//
+//	"entryList" -- the slots that were filled
+//	"numEntries" -- the number of entries in entryList
+//	"buffer" -- the data read, entryList[i]'s at buffer[i * SectorSize]
+//----------------------------------------------------------------------
+
+void BufferCache::FillDone(int *entryList, int numEntries, char *buffer)
+{
+    for (int i = 0; i < numEntries; i++)
+    {
+        CacheEntry *e = &entries[entryList[i]];
+
+        bcopy(&buffer[i * SectorSize], e->data, SectorSize);
+        e->busy = FALSE;
+        e->valid = TRUE;
+        for (; e->waiting > 0; e->waiting--)
+            e->filled->V();
+    }
+}
+
+//----------------------------------------------------------------------
+// BufferCache::WriteDone
+// 	A write around the cache has completed.  A fill that was already
+//	on its way when the write was queued has put the old contents
+//	back in the cache by now; replace them.
+//----------------------------------------------------------------------
+
+void BufferCache::WriteDone(int *sectorList, int numSectors, char *data)
+{
+    Refresh(sectorList, numSectors, data);
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Refresh
+// 	Copy new contents over the cached copies of a list of sectors.
+//	Sectors that aren't cached are left alone, and so are slots still
+//	being filled: when the fill completes after the write, it reads
+//	the new contents; when before, WriteDone catches it.
+//----------------------------------------------------------------------
+
+void BufferCache::Refresh(int *sectorList, int numSectors, char *data)
+{
+    for (int i = 0; i < numSectors; i++)
+    {
+        int slot = Lookup(sectorList[i]);
+
+        if (slot != -1 && entries[slot].valid && !entries[slot].busy)
+            bcopy(&data[i * SectorSize], entries[slot].data, SectorSize);
+    }
+}
+
+//----------------------------------------------------------------------
+// BufferCache::StartFill
+// 	Claim a slot for each sector in the list that isn't cached, and
+//	queue one asynchronous read for all of them.  If we run out of
+//	idle slots, the remaining sectors are simply left out.
+//
+//	"sectorList" -- the sectors wanted
+//	"numSectors" -- the number of entries in sectorList
+//	"readAhead" -- is this a read-ahead, rather than a demand read?
+//----------------------------------------------------------------------
+
+void BufferCache::StartFill(int *sectorList, int numSectors, bool readAhead)
+{
+    CacheFill *fill = new CacheFill(this, numSectors);
+    int count = 0;
+
+    for (int i = 0; i < numSectors; i++)
+    {
+        int slot;
+
+        if (Lookup(sectorList[i]) != -1)
+            continue; // cached, or already on its way
+        if ((slot = Allocate(sectorList[i])) == -1)
+            break;
+        entries[slot].busy = TRUE;
+        entries[slot].prefetched = readAhead;
+        fill->entryList[count] = slot;
+        fill->sectorList[count++] = sectorList[i];
+    }
+    if (count == 0)
+    {
+        delete fill;
+        return;
+    }
+    if (readAhead)
+        kernel->stats->numReadAheads += count;
+    DEBUG(dbgFile, (readAhead ? "Reading ahead " : "Filling cache with ")
+                       << count << " sectors from sector " << fill->sectorList[0]);
+
+    fill->request = new DiskRequest(fill->sectorList, count, fill->buffer, FALSE);
+    fill->request->callWhenDone = fill;
+    queue->Submit(fill->request);
+}
+
+//----------------------------------------------------------------------
+// BufferCache::WaitFor
+// 	Sleep until a slot's fill has completed.  The caller must hold a
+//	reference to the slot, so that it stays ours.
+//----------------------------------------------------------------------
+
+void BufferCache::WaitFor(int entry)
+{
+    while (entries[entry].busy)
+    {
+        entries[entry].waiting++;
+        entries[entry].filled->P();
+    }
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Lookup
+// 	Return the slot holding (or being filled with) "sector", or -1.
+//----------------------------------------------------------------------
+
+int BufferCache::Lookup(int sector)
+{
+    for (int i = buckets[sector % NumCacheBuckets]; i != -1; i = entries[i].hashNext)
+        if (entries[i].sector == sector)
+            return i;
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Allocate
+// 	Find the least recently used slot that nobody is using or filling,
+//	and hand it over to "sector" (not yet valid).  Return -1 if there
+//	is no such slot.
+//----------------------------------------------------------------------
+
+int BufferCache::Allocate(int sector)
+{
+    int victim = -1;
+
+    for (int i = 0; i < NumCacheEntries; i++)
+    {
+        CacheEntry *e = &entries[i];
+
+        if (e->busy || e->refs > 0 || e->waiting > 0)
+            continue;
+        if (victim == -1 || e->lastUse < entries[victim].lastUse)
+            victim = i;
+    }
+    if (victim == -1)
+        return -1;
+
+    if (entries[victim].sector != -1)
+        Unhash(victim);
+    entries[victim].sector = sector;
+    entries[victim].valid = FALSE;
+    entries[victim].prefetched = FALSE;
+    entries[victim].lastUse = ++useClock;
+    entries[victim].hashNext = buckets[sector % NumCacheBuckets];
+    buckets[sector % NumCacheBuckets] = victim;
+    return victim;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Unhash
+// 	Take a slot off the hash chain for its sector.
+//----------------------------------------------------------------------
+
+void BufferCache::Unhash(int entry)
+{
+    int *link = &buckets[entries[entry].sector % NumCacheBuckets];
+
+    while (*link != entry)
+        link = &entries[*link].hashNext;
+    *link = entries[entry].hashNext;
+    entries[entry].hashNext = -1;
+}
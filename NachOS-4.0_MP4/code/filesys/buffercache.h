@@ -0,0 +1,109 @@
+// buffercache.h
+//	Data structures for an in-memory cache of disk sectors.
+//
+//	The cache sits between SynchDisk and the disk request queue.
+//	Reads are satisfied from memory when the sector is cached;
+//	writes go through to the disk (so that the disk is never staler
+//	than it would be without the cache), updating the cached copy.
+//
+//	Sectors can also be brought in asynchronously, ahead of the
+//	reads that will need them: the caller returns right away, and the
+//	disk fills the cache in the background while the thread computes.
+//	A read that finds its sector still on the way simply waits for
+//	that fill rather than issuing a request of its own.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef BUFFERCACHE_H
+#define BUFFERCACHE_H
+
+#include "disk.h"
+#include "diskqueue.h"
+
+#define NumCacheEntries 1024 // sectors kept in memory (128KB)
+
+// The following class defines one cache slot.
+
+class CacheEntry
+{
+public:
+    int sector;         // Disk sector held here, -1 if the slot is free
+    bool valid;         // Does "data" hold the sector's contents?
+    bool busy;          // Is a disk read filling this slot right now?
+    bool prefetched;    // Brought in by read-ahead and not read since?
+    int refs;           // Threads using the slot; it can't be reused
+                        //   while they do
+    int waiting;        // Threads sleeping until the fill is done
+    Semaphore *filled;  // ... and where they sleep
+    int lastUse;        // When the slot was last used, for LRU
+    int hashNext;       // Next slot in the same hash chain, -1 at end
+    char data[SectorSize];
+};
+
+// The following class defines the buffer cache.  All of its state is
+// shared with the disk interrupt handler (which completes fills), so
+// it is only touched with interrupts disabled.
+
+class BufferCache
+{
+public:
+    BufferCache(DiskQueue *diskQueue); // Initialize an empty cache on top
+                                       // of the disk request queue
+    ~BufferCache();
+
+    void Read(int *sectorList, int numSectors, char *data);
+    // Read sectorList[i] into
+    // data[i * SectorSize], going to
+    // disk (in one request) only for
+    // the sectors that aren't cached
+    void Write(int *sectorList, int numSectors, char *data);
+    // Write through the cache
+    void WriteAround(int *sectorList, int numSectors, char *data,
+                     CallBackObj *callWhenDone);
+    // Write straight to disk without
+    // claiming slots, keeping cached
+    // copies up to date; if
+    // callWhenDone is NULL, wait,
+    // otherwise call it when done
+    void Install(int *sectorList, int numSectors, char *data);
+    // Put new contents in the cache
+    // without writing them to disk
+    bool Peek(int sector, char *data);
+    // Copy out a cached sector; FALSE
+    // if it isn't in the cache
+
+    void Prefetch(int *sectorList, int numSectors);
+    // Start reading the sectors that
+    // aren't cached, and return
+    // without waiting for them
+
+    void FillDone(int *entryList, int numEntries, char *buffer);
+    // Called from the disk interrupt
+    // handler when a fill completes
+    void WriteDone(int *sectorList, int numSectors, char *data);
+    // ... and when a write around
+    // the cache completes
+
+private:
+    DiskQueue *queue;     // Where cache misses go
+    CacheEntry *entries;  // The cache slots
+    int *buckets;         // Hash chains of slots, by sector
+    int useClock;         // Ticks up on every access, for LRU
+
+    int Lookup(int sector);   // Return the slot holding "sector", or -1
+    int Allocate(int sector); // Reuse the least recently used idle slot
+                              // for "sector", or return -1 if all busy
+    void Unhash(int entry);   // Take a slot off its hash chain
+    void Refresh(int *sectorList, int numSectors, char *data);
+    // Update the cached copies, if any
+    void StartFill(int *sectorList, int numSectors, bool readAhead);
+    // Claim slots for uncached sectors
+    // and queue one read to fill them
+    void WaitFor(int entry);  // Sleep until a slot's fill is done
+};
+
+#endif // BUFFERCACHE_H
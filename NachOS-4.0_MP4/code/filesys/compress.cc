@@ -0,0 +1,166 @@
+// compress.cc
+//	Routines to compress and expand the chunks of compressed files
+//	(see compress.h for the format).
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "compress.h"
+#include "utility.h"
+
+// Slots in the encoder's table of where 3-byte strings were last seen
+#define HashBits 10
+#define HashSize (1 << HashBits)
+
+//----------------------------------------------------------------------
+// Hash
+// 	Pick the hash table slot for the 3 bytes at "p".
+//----------------------------------------------------------------------
+
+static int Hash(unsigned char *p)
+{
+    unsigned int key = p[0] | (p[1] << 8) | (p[2] << 16);
+
+    return (key * 2654435761u) >> (32 - HashBits);
+}
+
+//----------------------------------------------------------------------
+// Compress
+// 	Compress a buffer, as a series of literal runs and matches.  Give
+//	up as soon as the output would not fit.
+//
+//	Return the length of the compressed form, or -1 if it would take
+//	more than "maxBytes" bytes.
+//
+//	"from" -- the bytes to compress
+//	"numBytes" -- how many there are
+//	"into" -- the buffer for the compressed form
+//	"maxBytes" -- its size
+//----------------------------------------------------------------------
+
+int Compress(char *from, int numBytes, char *into, int maxBytes)
+{
+    unsigned char *in = (unsigned char *)from;
+    unsigned char *out = (unsigned char *)into;
+    int table[HashSize];
+    int pos = 0, literal = 0, length = 0;
+
+    for (int i = 0; i < HashSize; i++)
+        table[i] = -1;
+
+    while (pos < numBytes)
+    {
+        int match = 0, distance = 0;
+
+        if (pos + MinMatch <= numBytes)
+        {
+            int slot = Hash(&in[pos]);
+            int earlier = table[slot];
+
+            table[slot] = pos;
+            if (earlier != -1 && pos - earlier <= MaxMatchDistance)
+                while (pos + match < numBytes && match < MaxMatch &&
+                       in[earlier + match] == in[pos + match])
+                    match++;
+            distance = pos - earlier;
+        }
+
+        if (match < MinMatch)
+        {
+            pos++; // one more byte for the literal run
+            if (pos - literal == MaxLiteralRun)
+            {
+                if (length + 1 + MaxLiteralRun > maxBytes)
+                    return -1;
+                out[length++] = MaxLiteralRun - 1;
+                for (int i = literal; i < pos; i++)
+                    out[length++] = in[i];
+                literal = pos;
+            }
+            continue;
+        }
+
+        // flush the literals in front of the match, then the match
+        if (pos > literal)
+        {
+            if (length + 1 + pos - literal > maxBytes)
+                return -1;
+            out[length++] = pos - literal - 1;
+            for (int i = literal; i < pos; i++)
+                out[length++] = in[i];
+        }
+        if (length + 3 > maxBytes)
+            return -1;
+        out[length++] = 128 + match - MinMatch;
+        out[length++] = distance & 0xff;
+        out[length++] = distance >> 8;
+        pos += match;
+        literal = pos;
+    }
+
+    if (pos > literal)
+    {
+        if (length + 1 + pos - literal > maxBytes)
+            return -1;
+        out[length++] = pos - literal - 1;
+        for (int i = literal; i < pos; i++)
+            out[length++] = in[i];
+    }
+    return length;
+}
+
+//----------------------------------------------------------------------
+// Decompress
+// 	Expand a compressed buffer.  What the compressed form doesn't
+//	cover (it may be followed by padding, or end early) is zeros.
+//
+//	Return FALSE if the compressed form is damaged: it refers to
+//	bytes before the start of the output, or would run past its end.
+//
+//	"from" -- the compressed form
+//	"numBytes" -- its length (or that of the buffer holding it)
+//	"into" -- the buffer for the original bytes
+//	"outBytes" -- how many there are
+//----------------------------------------------------------------------
+
+bool Decompress(char *from, int numBytes, char *into, int outBytes)
+{
+    unsigned char *in = (unsigned char *)from;
+    unsigned char *out = (unsigned char *)into;
+    int pos = 0, length = 0;
+
+    while (length < outBytes && pos < numBytes)
+    {
+        int c = in[pos++];
+
+        if (c < 128)
+        {
+            int run = c + 1;
+
+            if (pos + run > numBytes || length + run > outBytes)
+                return FALSE;
+            for (int i = 0; i < run; i++)
+                out[length++] = in[pos++];
+        }
+        else
+        {
+            int match = c - 128 + MinMatch;
+            int distance;
+
+            if (pos + 2 > numBytes)
+                return FALSE;
+            distance = in[pos] | (in[pos + 1] << 8);
+            pos += 2;
+            if (distance == 0 || distance > length ||
+                length + match > outBytes)
+                return FALSE;
+            for (int i = 0; i < match; i++, length++)
+                out[length] = out[length - distance];
+        }
+    }
+    for (; length < outBytes; length++)
+        out[length] = 0;
+    return TRUE;
+}
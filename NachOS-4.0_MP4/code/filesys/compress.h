@@ -0,0 +1,44 @@
+// compress.h
+//	A small, fast LZ77 codec, for the chunks of compressed files.
+//
+//	The compressed form is a series of items, each starting with a
+//	control byte c:
+//
+//	    c < 128   -- a literal run: the next c + 1 bytes are copied
+//			 to the output as they are
+//	    c >= 128  -- a match: copy c - 128 + MinMatch bytes from
+//			 earlier in the output; the next two bytes
+//			 (low byte first) say how far back
+//
+//	There is no length field and no end marker: the decoder is told
+//	how long the output is, and stops once it has that much.  The
+//	encoder looks for matches through a small hash table of the
+//	places 3-byte strings were last seen, and takes the first one it
+//	finds -- quick, rather than thorough.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#define MinMatch 3                   // Shortest match worth encoding
+#define MaxMatch (127 + MinMatch)    // Longest one a control byte holds
+#define MaxLiteralRun 128            // Longest literal run
+#define MaxMatchDistance 65535       // Farthest back a match can reach
+
+extern int Compress(char *from, int numBytes, char *into, int maxBytes);
+// Compress "numBytes" bytes of "from"
+// into "into"; return the compressed
+// length, or -1 if it would take more
+// than "maxBytes"
+extern bool Decompress(char *from, int numBytes, char *into, int outBytes);
+// Expand "numBytes" compressed bytes
+// into the "outBytes" bytes they
+// stand for; FALSE if they are not
+// a valid compressed form
+
+#endif // COMPRESS_H
@@ -0,0 +1,800 @@
+// defrag.cc
+//	Routines to move the files of the file system into contiguous
+//	runs, while it is in use (see defrag.h).
+//
+//	First the directory tree is walked, and every data sector and
+//	index header is noted (a "node"), along with the entry pointing
+//	to it.  Then the files are taken in the order of their headers on
+//	disk, and each one is given the first usable sectors after its
+//	header, if that makes it faster to read.  A sector is usable if it
+//	is free, or if a node that may be moved is in it -- one of a file
+//	not placed yet, which is moved out of the way first.  (A header,
+//	which stays put, may still be in the way: the file skips it.)
+//
+//	Moving is done in steps.  A step copies up to MaxRoundMoves sectors
+//	to their new homes, and then, as one update, points the headers
+//	at the copies and frees the old sectors; the step is committed
+//	before the next one may reuse them.  A node whose new home is still
+//	taken by another node of the same file waits for a later step.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef FILESYS_STUB
+
+#include "copyright.h"
+#include "defrag.h"
+#include "directory.h"
+#include "filesys.h"
+#include "synchdisk.h"
+#include "synch.h"
+#include "stats.h"
+#include "debug.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// Defragmenter::Defragmenter
+// 	Initialize a defragmenter.  Nothing is looked at until Run.
+//
+//	"table" -- the system-wide open file table
+//----------------------------------------------------------------------
+
+Defragmenter::Defragmenter(OpenFileTable *table)
+{
+    openFileTable = table;
+    freeMap = NULL;
+    files = NULL;
+    nodes = NULL;
+    owner = NULL;
+    numFiles = maxFiles = numNodes = maxNodes = 0;
+    moves = new DefragMove[MaxRoundMoves];
+    numMoves = 0;
+    claimed = new Bitmap(NumSectors);
+    lo = hi = spill = 0;
+    sectorsMoved = filesPinned = 0;
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::~Defragmenter
+// 	De-allocate the defragmenter.
+//----------------------------------------------------------------------
+
+Defragmenter::~Defragmenter()
+{
+    delete[] files;
+    delete[] nodes;
+    delete[] owner;
+    delete[] moves;
+    delete claimed;
+}
+
+//----------------------------------------------------------------------
+// CompareKeys
+// 	Order the keys Run sorts the files by.
+//----------------------------------------------------------------------
+
+static int
+CompareKeys(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::Run
+// 	Defragment every file under the root directory, and print what
+//	a sequential read of all of them costs before and after.
+//
+//	"rootSector" -- where the root directory's header is
+//----------------------------------------------------------------------
+
+void Defragmenter::Run(int rootSector)
+{
+    int runsBefore, runsAfter;
+    long seekBefore, seekAfter, ticksBefore, ticksAfter;
+    long *order;
+
+    ScanAll(rootSector);
+    Cost(&runsBefore, &seekBefore, &ticksBefore);
+    DEBUG(dbgFile, "Defragmenting " << numFiles << " files, " << numNodes << " sectors");
+
+    // lay the files out in the order of their headers, which stay put
+    order = new long[numFiles];
+    for (int f = 0; f < numFiles; f++)
+        order[f] = (long)files[f].sector * maxFiles + f;
+    qsort(order, numFiles, sizeof(long), CompareKeys);
+    freeMap = kernel->fileSystem->FetchFreeMap(); // (see Step)
+    for (int i = 0; i < numFiles; i++)
+        Place(order[i] % maxFiles);
+    kernel->fileSystem->ReleaseFreeMap(freeMap, FALSE);
+    delete[] order;
+    Cost(&runsAfter, &seekAfter, &ticksAfter);
+
+    // sectors taken and not used may have been written out as in use
+    kernel->fileSystem->BeginUpdate();
+    kernel->fileSystem->ReleaseFreeMap(kernel->fileSystem->FetchFreeMap(),
+                                       TRUE);
+    kernel->fileSystem->EndUpdate();
+
+    printf("Defragmented %d files: %d sectors moved, %d files left alone "
+           "(in use, or changed under us)\n",
+           numFiles, sectorsMoved, filesPinned);
+    printf("Sequential read of every file, before: %d runs, %ld seek ticks, "
+           "%ld ticks\n", runsBefore, seekBefore, ticksBefore);
+    printf("                                after: %d runs, %ld seek ticks, "
+           "%ld ticks\n", runsAfter, seekAfter, ticksAfter);
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::Clean
+// 	Clean segments of a log-structured disk, until "wanted" of them
+//	are clean (or there is nothing more that can be done).  The
+//	segments with the fewest sectors in use go first; every sector
+//	in use in one is moved, in steps, to the head of the log.  A
+//	segment holding anything that can't be moved -- a file header, a
+//	node of a file someone has open, a sector allocated while we
+//	looked -- is left as it is.
+//
+//	Return the number of segments cleaned.
+//
+//	"rootSector" -- where the root directory's header is
+//	"wanted" -- how many clean segments to have
+//----------------------------------------------------------------------
+
+int Defragmenter::Clean(int rootSector, int wanted)
+{
+    int numSegments, numVictims = 0, cleaned = 0, head;
+    int *movable;
+    long *victims;
+
+    ScanAll(rootSector);
+    freeMap = kernel->fileSystem->FetchFreeMap(); // (see Step)
+    numSegments = freeMap->NumSegments();
+    head = freeMap->LogHead() / SectorsPerSegment;
+
+    // count the sectors of each segment we may move
+    movable = new int[numSegments];
+    for (int s = 0; s < numSegments; s++)
+        movable[s] = 0;
+    for (int f = 0; f < numFiles; f++)
+        if (!files[f].pinned && InUse(f))
+            Pin(f);
+    for (int n = 0; n < numNodes; n++)
+        if (!files[nodes[n].file].pinned)
+            movable[nodes[n].sector / SectorsPerSegment]++;
+
+    // the segments where all of it may move, emptiest first
+    victims = new long[numSegments];
+    for (int s = 0; s < numSegments; s++)
+    {
+        int used = freeMap->NumUsedIn(s);
+
+        if (s != head && used > 0 && used == movable[s])
+            victims[numVictims++] = (long)used * numSegments + s;
+    }
+    qsort(victims, numVictims, sizeof(long), CompareKeys);
+
+    for (int v = 0; v < numVictims &&
+                    freeMap->NumCleanSegments() < wanted; v++)
+    {
+        int segment = victims[v] % numSegments;
+        int end = min((segment + 1) * SectorsPerSegment, NumSectors);
+
+        for (int sector = segment * SectorsPerSegment; sector < end; sector++)
+        {
+            int n = owner[sector], to;
+
+            if (n == -1 || files[nodes[n].file].pinned || nodes[n].moving)
+                continue;
+            to = freeMap->FindAndSet(0); // the head of the log
+            if (to == -1 || to / SectorsPerSegment == segment)
+            {
+                if (to != -1)
+                    freeMap->Clear(to);
+                break; // nowhere else to go
+            }
+            AddMove(n, to);
+            if (numMoves == MaxRoundMoves)
+                Step();
+        }
+        if (numMoves > 0)
+            Step();
+        if (freeMap->NumUsedIn(segment) == 0)
+            cleaned++;
+    }
+    delete[] movable;
+    delete[] victims;
+    kernel->fileSystem->ReleaseFreeMap(freeMap, FALSE);
+
+    kernel->fileSystem->BeginUpdate();
+    kernel->fileSystem->ReleaseFreeMap(kernel->fileSystem->FetchFreeMap(),
+                                       TRUE);
+    kernel->fileSystem->EndUpdate();
+    DEBUG(dbgFile, "Cleaned " << cleaned << " segments, " << sectorsMoved << " sectors moved, " << freeMap->NumCleanSegments() << " clean");
+    return cleaned;
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::ScanAll
+// 	Note every file under the root directory, and its nodes.  No
+//	directory can be taken away while we look (but files can still
+//	come and go; see Step).
+//
+//	"rootSector" -- where the root directory's header is
+//----------------------------------------------------------------------
+
+void Defragmenter::ScanAll(int rootSector)
+{
+    freeMap = kernel->fileSystem->FetchFreeMap();
+
+    // every node and every file takes a sector; leave some room for
+    // the ones created while we look
+    maxNodes = maxFiles = NumSectors - freeMap->NumClear() + NumSectors / 64;
+    kernel->fileSystem->ReleaseFreeMap(freeMap, FALSE);
+    files = new DefragFile[maxFiles];
+    nodes = new DefragNode[maxNodes];
+    owner = new int[NumSectors];
+    for (int i = 0; i < NumSectors; i++)
+        owner[i] = -1;
+
+    kernel->fileSystem->LockNamespace();
+    Scan(rootSector);
+    kernel->fileSystem->UnlockNamespace();
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::Scan
+// 	Note the directory whose header is at "sector", then the files in
+//	it, then (recursively) its subdirectories.
+//----------------------------------------------------------------------
+
+void Defragmenter::Scan(int sector)
+{
+    OpenFile *file;
+    Directory *directory;
+    DirectoryEntry *entries;
+    int count;
+
+    if (AddFile(sector) == -1)
+        return;
+    file = new OpenFile(sector, openFileTable);
+    directory = new Directory();
+    file->LockContents(FALSE);
+    directory->FetchFrom(file);
+    entries = directory->GetEntries(&count);
+    delete directory;
+    file->UnlockContents();
+    delete file;
+
+    for (int i = 0; i < count; i++)
+        if (!entries[i].isDir)
+            AddFile(entries[i].sector);
+    for (int i = 0; i < count; i++)
+        if (entries[i].isDir)
+            Scan(entries[i].sector);
+    delete[] entries;
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::AddFile
+// 	Note the file whose header is at "sector", and its nodes.  Return
+//	its number, or -1 if there is no room for it.  A file that shares
+//	sectors with a clone is pinned: the others would still point at
+//	the old places.
+//----------------------------------------------------------------------
+
+int Defragmenter::AddFile(int sector)
+{
+    FileHeader *hdr;
+    int f;
+
+    if (numFiles == maxFiles)
+        return -1;
+    f = numFiles++;
+    files[f].sector = sector;
+    files[f].firstNode = numNodes;
+    files[f].pinned = FALSE;
+    files[f].placed = FALSE;
+
+    hdr = new FileHeader;
+    hdr->FetchFrom(sector);
+    if (!hdr->IsInline())
+        AddNodes(hdr, f, -1);
+    if (hdr->IsShared())
+        Pin(f);
+    delete hdr;
+    files[f].numNodes = numNodes - files[f].firstNode;
+    return f;
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::AddNodes
+// 	Note the sectors one of a file's headers points to, each followed
+//	by what is below it, if it is an index header.  A file that points
+//	somewhere odd (or that we run out of room for) is pinned.
+//
+//	"hdr" -- the header
+//	"file" -- the file it belongs to
+//	"parent" -- its node, -1 if it is the file header
+//----------------------------------------------------------------------
+
+void Defragmenter::AddNodes(FileHeader *hdr, int file, int parent)
+{
+    for (int i = 0; i < (int)NumDirect && !files[file].pinned; i++)
+    {
+        int sector = hdr->GetEntry(i);
+        int n;
+
+        if (sector == -1)
+            continue;
+        if (sector < 0 || sector >= NumSectors || owner[sector] != -1 ||
+            numNodes == maxNodes)
+        {
+            Pin(file);
+            return;
+        }
+        n = numNodes++;
+        nodes[n].sector = sector;
+        nodes[n].parent = parent;
+        nodes[n].slot = i;
+        nodes[n].file = file;
+        nodes[n].moving = FALSE;
+        owner[sector] = n;
+
+        if (hdr->Level() > 0)
+        {
+            FileHeader *child = new FileHeader;
+
+            child->FetchFrom(sector);
+            AddNodes(child, file, n);
+            delete child;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::InUse
+// 	Return TRUE if anyone has file "f" open.
+//----------------------------------------------------------------------
+
+bool Defragmenter::InUse(int f)
+{
+    OpenHeader *entry = openFileTable->Lookup(files[f].sector);
+
+    return entry != NULL && entry->refs > 0;
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::Pin
+// 	Leave file "f" where it is.
+//----------------------------------------------------------------------
+
+void Defragmenter::Pin(int f)
+{
+    if (!files[f].pinned)
+    {
+        DEBUG(dbgFile, "Leaving the file at sector " << files[f].sector << " alone");
+        files[f].pinned = TRUE;
+        filesPinned++;
+    }
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::Usable
+// 	Return TRUE if a node can be put at "sector": it is free, or a
+//	node that may move is there.
+//----------------------------------------------------------------------
+
+bool Defragmenter::Usable(int sector)
+{
+    DefragFile *file;
+
+    if (!freeMap->Test(sector))
+        return TRUE;
+    if (owner[sector] == -1)
+        return FALSE;
+    file = &files[nodes[owner[sector]].file];
+    return !file->pinned && !file->placed;
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::Place
+// 	Move the nodes of file "f", in order, to the first usable sectors
+//	after its header -- if that makes the file faster to read.
+//
+//	A node whose new home holds a node of a file further on moves that
+//	node out of the way first; if it holds a node of this file, which
+//	is moving elsewhere, it waits until the next step.  If a step moves
+//	nothing, the nodes of this file are in each other's way; they are
+//	moved aside, to be moved home in the steps after.
+//----------------------------------------------------------------------
+
+void Defragmenter::Place(int f)
+{
+    int first = files[f].firstNode, n = files[f].numNodes;
+    int *target, runs = 0, sector;
+    long seekTicks = 0;
+
+    if (files[f].pinned || n == 0)
+        return;
+    if (InUse(f))
+    {
+        Pin(f);
+        return;
+    }
+    // where each node goes; -1 once we give up on moving it
+    target = new int[n];
+    sector = files[f].sector + 1;
+    for (int k = 0; k < n; k++)
+    {
+        while (sector < NumSectors && !Usable(sector))
+            sector++;
+        target[k] = (sector < NumSectors) ? sector++ : -1;
+    }
+    files[f].placed = TRUE;
+    if (ReadCost(f, target, &runs, &seekTicks) >=
+        ReadCost(f, NULL, &runs, &seekTicks))
+    {
+        delete[] target; // would be no faster to read: leave it be
+        return;
+    }
+    lo = files[f].sector + 1;
+    hi = sector;
+
+    // take the free sectors we are going to (and those our moves free
+    // up there, see Step), so that files growing meanwhile don't
+    for (int k = 0; k < n; k++)
+        if (target[k] != -1 && !freeMap->Test(target[k]))
+        {
+            freeMap->Mark(target[k]);
+            claimed->Mark(target[k]);
+        }
+
+    while (!files[f].pinned)
+    {
+        bool blocked = FALSE;
+
+        for (int k = 0; k < n && numMoves < MaxRoundMoves; k++)
+        {
+            int node = first + k, t = target[k], other;
+
+            if (t == -1 || nodes[node].sector == t || nodes[node].moving)
+                continue;
+            if (claimed->Test(t) || !freeMap->Test(t))
+            {
+                claimed->Clear(t); // the move has it now
+                AddMove(node, t);
+                continue;
+            }
+            other = owner[t];
+            if (other == -1 || files[nodes[other].file].pinned)
+                target[k] = -1; // someone else has taken it since
+            else if (nodes[other].file != f)
+            {
+                int room = FindRoom();
+
+                if (room == -1)
+                    target[k] = -1;
+                else
+                    AddMove(other, room);
+            }
+            else if (!nodes[other].moving)
+                blocked = TRUE;
+        }
+
+        if (numMoves == 0 && blocked)
+            for (int k = 0; k < n && numMoves < MaxRoundMoves; k++)
+            {
+                int t = target[k], other, room;
+
+                if (t == -1 || nodes[first + k].sector == t)
+                    continue;
+                other = owner[t];
+                if (other != -1 && !nodes[other].moving &&
+                    (room = FindRoom()) != -1)
+                    AddMove(other, room);
+            }
+        if (numMoves == 0)
+            break;
+        Step();
+    }
+    for (sector = lo; sector < hi; sector++)
+        if (claimed->Test(sector))
+        {
+            claimed->Clear(sector);
+            freeMap->Clear(sector);
+        }
+    lo = hi = 0;
+    delete[] target;
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::FindRoom
+// 	Return a free sector to move a node out of the way to, outside
+//	the sectors the file being placed is going to; -1 if the disk is
+//	full.
+//----------------------------------------------------------------------
+
+int Defragmenter::FindRoom()
+{
+    int sector;
+
+    for (sector = max(spill, hi); sector < NumSectors; sector++)
+        if (!freeMap->Test(sector))
+        {
+            spill = sector + 1;
+            return sector;
+        }
+    for (sector = 0; sector < lo; sector++)
+        if (!freeMap->Test(sector))
+            return sector;
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::AddMove
+// 	Add moving "node" to sector "to" to the current step.  The sector
+//	is taken right away, so that nobody else allocates it.
+//----------------------------------------------------------------------
+
+void Defragmenter::AddMove(int node, int to)
+{
+    ASSERT(numMoves < MaxRoundMoves);
+    moves[numMoves].node = node;
+    moves[numMoves].to = to;
+    numMoves++;
+    nodes[node].moving = TRUE;
+    freeMap->Mark(to);
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::Step
+// 	Carry out the moves of the current step:
+//	   Open each file involved, and pin it if anyone else has it open,
+//	     or if it no longer points where the scan found
+//	   Copy the sectors
+//	   In one update, with the headers locked: pin any file someone
+//	     opened meanwhile; point the headers of the others at the
+//	     copies, and write the headers back; then free the old sectors
+//	   Wait for the update to be committed
+//
+//	The headers are all changed in memory before anything is written,
+//	so nobody (who could only run while we wait for the disk) sees
+//	some of a file's nodes moved and not others; and the old sectors
+//	are only freed once the headers no longer point to them.
+//
+//	The caller has the free map while it plans the step, and gets it
+//	back afterwards; we let go of it while we wait for the disk, so
+//	that other threads can allocate meanwhile (the sectors we are
+//	moving to are taken already).
+//----------------------------------------------------------------------
+
+void Defragmenter::Step()
+{
+    int held[MaxRoundMoves], opens[MaxRoundMoves], which[MaxRoundMoves];
+    FileHeader *hdrs[MaxRoundMoves], *parents[MaxRoundMoves];
+    bool changed[MaxRoundMoves];
+    int fromList[MaxRoundMoves], toList[MaxRoundMoves];
+    int numHeld = 0, count = 0;
+    char *buffer;
+
+    kernel->fileSystem->ReleaseFreeMap(freeMap, FALSE);
+    for (int i = 0; i < numMoves; i++)
+    {
+        int f = nodes[moves[i].node].file, h;
+
+        for (h = 0; h < numHeld && held[h] != f; h++)
+            ;
+        if (h == numHeld)
+        {
+            OpenHeader *entry;
+
+            held[h] = f;
+            hdrs[h] = openFileTable->Acquire(files[f].sector);
+            entry = openFileTable->Lookup(files[f].sector);
+            opens[h] = entry->opens;
+            changed[h] = FALSE;
+            numHeld++;
+            if (entry->refs > 1)
+                Pin(f);
+        }
+        which[i] = h;
+    }
+
+    // make sure each node is still where its header says, and bring
+    // in the index headers that will have to be changed
+    for (int i = 0; i < numMoves; i++)
+    {
+        DefragNode *node = &nodes[moves[i].node];
+        FileHeader *parent = hdrs[which[i]];
+
+        parents[i] = NULL;
+        if (files[node->file].pinned)
+            continue;
+        if (node->parent != -1)
+        {
+            parent = parents[i] = new FileHeader;
+            parent->FetchFrom(nodes[node->parent].sector);
+        }
+        if (parent->GetEntry(node->slot) != node->sector)
+            Pin(node->file);
+    }
+
+    for (int i = 0; i < numMoves; i++)
+        if (!files[nodes[moves[i].node].file].pinned)
+        {
+            fromList[count] = nodes[moves[i].node].sector;
+            toList[count++] = moves[i].to;
+        }
+    DEBUG(dbgFile, "Defragmenter moving " << count << " sectors");
+    buffer = new char[count * SectorSize];
+    kernel->synchDisk->ReadSectors(fromList, count, buffer);
+    kernel->synchDisk->WriteSectors(toList, count, buffer);
+    delete[] buffer;
+
+    kernel->fileSystem->BeginUpdate();
+    for (int h = 0; h < numHeld; h++)
+    {
+        OpenHeader *entry = openFileTable->Lookup(files[held[h]].sector);
+
+        entry->lock->Acquire();
+        if (entry->refs > 1 || entry->opens != opens[h])
+            Pin(held[h]);
+    }
+
+    // move the nodes, remembering where from; then patch the headers
+    for (int i = 0; i < numMoves; i++)
+    {
+        int n = moves[i].node;
+
+        nodes[n].moving = FALSE;
+        if (files[nodes[n].file].pinned)
+            continue;
+        fromList[i] = nodes[n].sector;
+        if (owner[nodes[n].sector] == n)
+            owner[nodes[n].sector] = -1;
+        nodes[n].sector = moves[i].to;
+        owner[moves[i].to] = n;
+    }
+    for (int i = 0; i < numMoves; i++)
+    {
+        DefragNode *node = &nodes[moves[i].node];
+
+        if (files[node->file].pinned)
+            continue;
+        if (node->parent == -1)
+        {
+            hdrs[which[i]]->SetEntry(node->slot, node->sector);
+            changed[which[i]] = TRUE;
+        }
+        else
+        {
+            // the index header may have more entries moving; keep
+            // one copy of it, wherever it is going
+            for (int j = 0; j < i; j++)
+                if (parents[j] != NULL &&
+                    nodes[moves[j].node].parent == node->parent)
+                {
+                    delete parents[i];
+                    parents[i] = parents[j];
+                    parents[j] = NULL;
+                    break;
+                }
+            parents[i]->SetEntry(node->slot, node->sector);
+        }
+    }
+
+    for (int i = 0; i < numMoves; i++)
+        if (parents[i] != NULL)
+        {
+            DefragNode *node = &nodes[moves[i].node];
+
+            if (!files[node->file].pinned)
+                parents[i]->WriteBack(nodes[node->parent].sector);
+            delete parents[i];
+        }
+    for (int h = 0; h < numHeld; h++)
+        if (changed[h])
+            hdrs[h]->WriteBack(files[held[h]].sector);
+    freeMap = kernel->fileSystem->FetchFreeMap();
+    for (int i = 0; i < numMoves; i++)
+        if (files[nodes[moves[i].node].file].pinned)
+            freeMap->Clear(moves[i].to);
+        else
+        {
+            if (fromList[i] >= lo && fromList[i] < hi)
+                claimed->Mark(fromList[i]); // keep it for the file
+            else                            // being placed
+                freeMap->Clear(fromList[i]);
+            sectorsMoved++;
+        }
+    kernel->fileSystem->ReleaseFreeMap(freeMap, TRUE);
+    for (int h = 0; h < numHeld; h++)
+        openFileTable->Lookup(files[held[h]].sector)->lock->Release();
+    kernel->fileSystem->EndUpdate();
+
+    // the old sectors may only be reused once that is on disk
+    kernel->fileSystem->Flush();
+    for (int h = 0; h < numHeld; h++)
+        openFileTable->Release(files[held[h]].sector);
+    numMoves = 0;
+    freeMap = kernel->fileSystem->FetchFreeMap();
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::ReadCost
+// 	Work out what reading file "f" from start to end would take, once
+//	it is open: its nodes in order, starting with the head over the
+//	first one (as the tool "diskinfo" has it).  Each further run of
+//	adjacent sectors costs a seek to its track and the rotation to its
+//	first sector (as Disk::ComputeLatency has it, leaving out the track
+//	buffer), and each sector costs the time to pass under the head.
+//	Return the time in all.
+//
+//	"at" -- where each node would be (-1 for where it is); NULL for
+//		where they all are
+//	"runs" -- incremented by the number of runs
+//	"seekTicks" -- incremented by the time spent seeking
+//----------------------------------------------------------------------
+
+long Defragmenter::ReadCost(int f, int *at, int *runs, long *seekTicks)
+{
+    long ticks = 0;
+    int last = -1;
+
+    for (int k = 0; k < files[f].numNodes; k++)
+    {
+        int sector;
+
+        if (at == NULL || at[k] == -1)
+            sector = nodes[files[f].firstNode + k].sector;
+        else
+            sector = at[k];
+
+        ticks += RotationTime;
+        if (last != -1 && sector == last + 1 &&
+            sector % SectorsPerTrack != 0)
+        {
+            last = sector;
+            continue;
+        }
+        (*runs)++;
+        if (last != -1)
+        {
+            // the head is just past the last sector read
+            int from = last + 1;
+            int seek = abs(sector / SectorsPerTrack -
+                           from / SectorsPerTrack) * SeekTime;
+            int passed = (from + seek / RotationTime) % SectorsPerTrack;
+            int rotate = (sector % SectorsPerTrack - passed +
+                          SectorsPerTrack) % SectorsPerTrack;
+
+            *seekTicks += seek;
+            ticks += seek + (long)rotate * RotationTime;
+        }
+        last = sector;
+    }
+    return ticks;
+}
+
+//----------------------------------------------------------------------
+// Defragmenter::Cost
+// 	Work out what reading every file from start to end would take
+//	(see ReadCost).
+//
+//	"runs" -- set to the number of runs
+//	"seekTicks" -- set to the time spent seeking
+//	"ticks" -- set to the time in all
+//----------------------------------------------------------------------
+
+void Defragmenter::Cost(int *runs, long *seekTicks, long *ticks)
+{
+    *runs = 0;
+    *seekTicks = *ticks = 0;
+    for (int f = 0; f < numFiles; f++)
+        *ticks += ReadCost(f, NULL, runs, seekTicks);
+}
+
+#endif // FILESYS_STUB
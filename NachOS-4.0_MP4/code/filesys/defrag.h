@@ -0,0 +1,144 @@
+// defrag.h
+//	Data structures for the online defragmenter.
+//
+//	Once files have been created, grown and removed for a while, the
+//	sectors FindAndSet hands out are whatever holes are left near the
+//	goal, and the blocks of a file end up scattered over the disk: reading it
+//	from start to end seeks, and waits for the disk to come around,
+//	again and again.
+//
+//	The defragmenter moves the data sectors and index headers of each
+//	file into one run, in the order a sequential read visits them (an
+//	index header, then what it points to), right after the file's
+//	header -- as far as the headers of other files, which it doesn't
+//	move, allow.  The files are laid out one after another in the order of
+//	their headers, which is the order they were created in: a
+//	directory's files were mostly created together, and so stay
+//	together.
+//
+//	It runs while the file system is in use.  A file is only moved
+//	while nobody else has it open; if someone opens it while its
+//	sectors are being copied, the copies are thrown away.  The header
+//	sector a directory entry names is left where it is, as is
+//	everything of the root directory and the free map, which are
+//	always open.
+//
+//	Each step is a metadata update that points the headers at the
+//	new copies and frees the old sectors.  A sector freed by one step
+//	is only written again once the step is committed, so a crash
+//	leaves each file either where it was or where it was going.
+//
+//	The same machinery is the cleaner of a log-structured disk (see
+//	pbitmap.h): rather than placing whole files, it empties the
+//	segments with the least in them, moving what is there to the
+//	head of the log, so that the log has clean segments to go on in.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include "pbitmap.h"
+#include "filehdr.h"
+#include "filetable.h"
+
+#define MaxRoundMoves 128 // sectors moved in one update; keeps it well
+                          // within what one transaction may change
+
+// The following class defines a sector the defragmenter may move: a
+// data sector, or an index header, of some file.
+
+class DefragNode
+{
+public:
+    int sector;  // Where it is now
+    int parent;  // The node of the index header pointing to it, or
+                 //   -1 if the file header itself does
+    int slot;    // Which entry of that header
+    int file;    // The file it belongs to
+    bool moving; // Being moved in the current step?
+};
+
+// The following class defines a file, as far as the defragmenter
+// is concerned.
+
+class DefragFile
+{
+public:
+    int sector;    // Its header (which stays put)
+    int firstNode; // Its nodes, in the order a sequential read
+    int numNodes;  //   visits them
+    bool pinned;   // In use by someone else, or changed under us:
+                   //   its sectors are left alone
+    bool placed;   // Moved where it goes already?
+};
+
+// The following class records a sector to be moved in the current step.
+
+class DefragMove
+{
+public:
+    int node; // What moves
+    int to;   // Where
+};
+
+// The following class defines the defragmenter.
+
+class Defragmenter
+{
+public:
+    Defragmenter(OpenFileTable *table); // Prepare to defragment the disk
+                                        // whose open files are in "table"
+    ~Defragmenter();
+
+    void Run(int rootSector); // Find every file under the root
+                              // directory, move them, and report
+    int Clean(int rootSector, int wanted);
+                              // Empty segments of the log, until
+                              // "wanted" of them are clean
+
+private:
+    OpenFileTable *openFileTable; // Who has what open
+    PersistentBitmap *freeMap;    // The file system's map of free sectors
+
+    DefragFile *files;  // Every file found, in layout order
+    int numFiles, maxFiles;
+    DefragNode *nodes;  // Their nodes, file by file
+    int numNodes, maxNodes;
+    int *owner;         // The node at each sector, -1 if none
+
+    DefragMove *moves;  // The current step
+    int numMoves;
+    int lo, hi;         // The sectors the file being placed goes to
+    Bitmap *claimed;    // Free sectors there, kept for it
+    int spill;          // Where to look for room to move a node out of
+                        //   the way
+    int sectorsMoved;   // Statistics
+    int filesPinned;
+
+    void ScanAll(int rootSector);     // Find every file, and its nodes
+    void Scan(int sector);            // Find the directory at "sector",
+                                      // and everything below it
+    int AddFile(int sector);          // Find the nodes of one file
+    void AddNodes(FileHeader *hdr, int file, int parent);
+                                      // ... below one of its headers
+    bool InUse(int f);                // Is file "f" open elsewhere?
+    void Pin(int f);                  // Leave file "f" alone from now on
+    bool Usable(int sector);          // Could a node be put at "sector"?
+    void Place(int f);                // Move file "f" next to its header
+    int FindRoom();                   // A free sector out of the way
+    void AddMove(int node, int to);   // Add a move to the current step
+    void Step();                      // Carry out the current step
+    long ReadCost(int f, int *at, int *runs, long *seekTicks);
+                                      // What reading file "f" from start
+                                      // to end takes (or would, if its
+                                      // nodes were "at" other sectors)
+    void Cost(int *runs, long *seekTicks, long *ticks);
+                                      // ... every file
+};
+
+#endif // DEFRAG_H
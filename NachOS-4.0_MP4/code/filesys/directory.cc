@@ -7,13 +7,18 @@
 //	of each directory entry means that we have the restriction
 //	of a fixed maximum size for file names.
 //
-//	The constructor initializes an empty directory of a certain size;
-//	we use ReadFrom/WriteBack to fetch the contents of the directory
-//	from disk, and to write back any modifications back to disk.
+//	The entries are kept in the leaves of a B-tree, keyed by name.
+//	A leaf that fills up is split in two, and the first name of the
+//	new leaf is added to the index node above it (splitting that in
+//	turn, up to the root, if need be); so the directory grows a node
+//	at a time, as far as the disk allows.
 //
-//	Also, this implementation has the restriction that the size
-//	of the directory cannot expand.  In other words, once all the
-//	entries in the directory are used, no more files can be created.
+//	The constructor initializes an empty directory; we use
+//	FetchFrom/WriteBack to fetch the contents of the directory
+//	from disk, and to write back any modifications back to disk.
+//	Only the nodes an operation looks at are read, and only the
+//	sectors it changed are written: adding a name to a leaf with
+//	room for it writes the one sector the new entry is in.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -24,26 +29,49 @@
 #include "filehdr.h"
 #include "directory.h"
 
+#define DirectoryMagic 0x44495242 // marks a B-tree directory file
+
 //----------------------------------------------------------------------
-// Directory::Directory
-// 	Initialize a directory; initially, the directory is completely
-//	empty.  If the disk is being formatted, an empty directory
-//	is all we need, but otherwise, we need to call FetchFrom in order
-//	to initialize it from disk.
-//
-//	"size" is the number of entries in the directory
+// SortEntries
+// 	Sort directory entries by name (insertion sort; a leaf is small).
 //----------------------------------------------------------------------
 
-Directory::Directory(int size)
+static void
+SortEntries(DirectoryEntry *entries, int count)
 {
-    table = new DirectoryEntry[size];
+    for (int i = 1; i < count; i++)
+    {
+        DirectoryEntry entry = entries[i];
+        int j;
+
+        for (j = i; j > 0 && strncmp(entries[j - 1].name, entry.name,
+                                     FileNameMaxLen) > 0; j--)
+            entries[j] = entries[j - 1];
+        entries[j] = entry;
+    }
+}
 
-    // MP4 mod tag
-    memset(table, 0, sizeof(DirectoryEntry) * size); // dummy operation to keep valgrind happy
+//----------------------------------------------------------------------
+// Directory::Directory
+// 	Initialize a directory; initially, the directory is completely
+//	empty: a header, and a root that is an empty leaf.  If the disk
+//	is being formatted, an empty directory is all we need, but
+//	otherwise, we need to call FetchFrom in order to initialize it
+//	from disk.
+//----------------------------------------------------------------------
 
-    tableSize = size;
-    for (int i = 0; i < tableSize; i++)
-        table[i].inUse = FALSE;
+Directory::Directory()
+{
+    ASSERT(sizeof(DirectoryNode) <= DirNodeSize);
+    ASSERT(sizeof(DirectoryHeader) <= SectorSize);
+    ASSERT(SectorSize % sizeof(DirectoryEntry) == 0);
+
+    file = NULL;
+    nodes = new ::List<CachedNode *>;
+    header.magic = DirectoryMagic;
+    header.numNodes = 0;
+    header.root = NewNode(TRUE);
+    headerDirty = TRUE;
 }
 
 //----------------------------------------------------------------------
@@ -53,49 +81,345 @@ Directory::Directory(int size)
 
 Directory::~Directory()
 {
-    delete[] table;
+    Flush();
+    delete nodes;
+}
+
+//----------------------------------------------------------------------
+// Directory::Flush
+// 	Forget the nodes brought into memory, changed or not.
+//----------------------------------------------------------------------
+
+void Directory::Flush()
+{
+    while (!nodes->IsEmpty())
+        delete nodes->RemoveFront();
 }
 
 //----------------------------------------------------------------------
 // Directory::FetchFrom
-// 	Read the contents of the directory from disk.
+// 	Read the header of the directory from disk; the nodes are read
+//	when they are needed, from the same file, so it must stay open
+//	as long as we use the directory.
 //
 //	"file" -- file containing the directory contents
 //----------------------------------------------------------------------
 
 void Directory::FetchFrom(OpenFile *file)
 {
-    (void)file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    Flush();
+    this->file = file;
+    (void)file->ReadAt((char *)&header, sizeof(DirectoryHeader), 0);
+    ASSERT(header.magic == DirectoryMagic);
+    headerDirty = FALSE;
 }
 
 //----------------------------------------------------------------------
 // Directory::WriteBack
-// 	Write any modifications to the directory back to disk
+// 	Write any modifications to the directory back to disk: the header,
+//	if the tree grew, and the sectors of the nodes that changed, in
+//	one request for each run of them.
 //
 //	"file" -- file to contain the new directory contents
 //----------------------------------------------------------------------
 
 void Directory::WriteBack(OpenFile *file)
 {
-    (void)file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    ListIterator<CachedNode *> iter(nodes);
+
+    if (headerDirty)
+    {
+        char sector[SectorSize];
+
+        memset(sector, 0, SectorSize);
+        memcpy(sector, (char *)&header, sizeof(DirectoryHeader));
+        (void)file->WriteAt(sector, SectorSize, 0);
+        headerDirty = FALSE;
+    }
+    for (; !iter.IsDone(); iter.Next())
+    {
+        CachedNode *cached = iter.Item();
+
+        for (int i = 0; i < DirNodeSectors;)
+        {
+            int run = 0;
+
+            while (i + run < DirNodeSectors && cached->dirty[i + run])
+            {
+                cached->dirty[i + run] = FALSE;
+                run++;
+            }
+            if (run > 0)
+                (void)file->WriteAt(cached->data + i * SectorSize, run * SectorSize,
+                                    SectorSize + cached->number * DirNodeSize +
+                                        i * SectorSize);
+            i += run + 1;
+        }
+    }
+    if (this->file == NULL) // a new directory: it lives there now
+        this->file = file;
 }
 
 //----------------------------------------------------------------------
-// Directory::FindIndex
-// 	Look up file name in directory, and return its location in the table of
-//	directory entries.  Return -1 if the name isn't in the directory.
+// Directory::GetNode
+// 	Return node "n" of the tree, reading it in if we haven't yet.
+//----------------------------------------------------------------------
+
+DirectoryNode *Directory::GetNode(int n)
+{
+    ListIterator<CachedNode *> iter(nodes);
+    CachedNode *cached;
+
+    ASSERT(n >= 0 && n < header.numNodes);
+    for (; !iter.IsDone(); iter.Next())
+        if (iter.Item()->number == n)
+            return &iter.Item()->node;
+
+    ASSERT(file != NULL);
+    cached = new CachedNode;
+    cached->number = n;
+    memset(cached->dirty, 0, sizeof(cached->dirty));
+    (void)file->ReadAt(cached->data, DirNodeSize, SectorSize + n * DirNodeSize);
+    if (cached->node.isLeaf)
+    {
+        cached->node.leaf.numEntries = 0;
+        for (int i = 0; i < LeafEntries; i++)
+            if (cached->node.leaf.entries[i].inUse)
+                cached->node.leaf.numEntries++;
+    }
+    nodes->Append(cached);
+    return &cached->node;
+}
+
+//----------------------------------------------------------------------
+// Directory::MarkDirty
+// 	Note that node "n", which is in memory, has to be written back.
+//----------------------------------------------------------------------
+
+void Directory::MarkDirty(int n)
+{
+    ListIterator<CachedNode *> iter(nodes);
+
+    for (; !iter.IsDone(); iter.Next())
+        if (iter.Item()->number == n)
+        {
+            for (int i = 0; i < DirNodeSectors; i++)
+                iter.Item()->dirty[i] = TRUE;
+            return;
+        }
+    ASSERTNOTREACHED();
+}
+
+//----------------------------------------------------------------------
+// Directory::MarkEntryDirty
+// 	Note that entry "slot" of leaf "n" changed, and nothing else in
+//	it did: only the sector holding that entry has to be written back.
+//----------------------------------------------------------------------
+
+void Directory::MarkEntryDirty(int n, int slot)
+{
+    ListIterator<CachedNode *> iter(nodes);
+
+    for (; !iter.IsDone(); iter.Next())
+        if (iter.Item()->number == n)
+        {
+            iter.Item()->dirty[(LeafHeaderSize + slot * sizeof(DirectoryEntry)) /
+                               SectorSize] = TRUE;
+            return;
+        }
+    ASSERTNOTREACHED();
+}
+
+//----------------------------------------------------------------------
+// Directory::NewNode
+// 	Add an empty node to the end of the directory file, and return
+//	its number.
 //
-//	"name" -- the file name to look up
+//	"isLeaf" -- is it to hold entries, rather than keys?
 //----------------------------------------------------------------------
 
-int Directory::FindIndex(char *name)
+int Directory::NewNode(bool isLeaf)
 {
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen))
+    CachedNode *cached = new CachedNode;
+
+    memset(cached->data, 0, DirNodeSize);
+    cached->number = header.numNodes++;
+    for (int i = 0; i < DirNodeSectors; i++)
+        cached->dirty[i] = TRUE;
+    cached->node.isLeaf = isLeaf;
+    if (isLeaf)
+        cached->node.leaf.next = -1;
+    nodes->Append(cached);
+    headerDirty = TRUE;
+    return cached->number;
+}
+
+//----------------------------------------------------------------------
+// Directory::FindLeaf
+// 	Walk down from the root to the leaf where "name" is, or would be,
+//	and return the leaf's number.
+//
+//	"name" -- the file name to look for
+//	"path" -- set to the index nodes passed on the way, root first
+//	"depth" -- set to the number of them
+//----------------------------------------------------------------------
+
+int Directory::FindLeaf(char *name, int *path, int *depth)
+{
+    int n = header.root;
+    DirectoryNode *node = GetNode(n);
+
+    *depth = 0;
+    while (!node->isLeaf)
+    {
+        int i;
+
+        ASSERT(*depth < MaxDirDepth);
+        path[(*depth)++] = n;
+        for (i = 0; i < node->index.numKeys &&
+                    strncmp(name, node->index.keys[i], FileNameMaxLen) >= 0; i++)
+            ;
+        n = node->index.children[i];
+        node = GetNode(n);
+    }
+    return n;
+}
+
+//----------------------------------------------------------------------
+// Directory::FindSlot
+// 	Look up file name in a leaf, and return its slot there.
+//	Return -1 if the name isn't in the leaf.
+//----------------------------------------------------------------------
+
+int Directory::FindSlot(DirectoryNode *leaf, char *name)
+{
+    for (int i = 0; i < LeafEntries; i++)
+        if (leaf->leaf.entries[i].inUse &&
+            !strncmp(leaf->leaf.entries[i].name, name, FileNameMaxLen))
             return i;
     return -1; // name not in directory
 }
 
+//----------------------------------------------------------------------
+// Directory::SplitLeaf
+// 	Leaf "n" is full: keep the lower half of its names, and move the
+//	upper half to a new leaf that follows it in the chain.  The first
+//	name moved is the key the new leaf goes under in the parent.
+//
+//	"path", "depth" -- the index nodes above "n", as from FindLeaf
+//----------------------------------------------------------------------
+
+void Directory::SplitLeaf(int n, int *path, int depth)
+{
+    DirectoryEntry all[LeafEntries];
+    DirectoryNode *left, *right;
+    int count = 0, half, m;
+
+    left = GetNode(n);
+    for (int i = 0; i < LeafEntries; i++)
+        if (left->leaf.entries[i].inUse)
+            all[count++] = left->leaf.entries[i];
+    SortEntries(all, count);
+    half = count / 2;
+
+    m = NewNode(TRUE);
+    left = GetNode(n);
+    right = GetNode(m);
+    memset(left->leaf.entries, 0, sizeof(left->leaf.entries));
+    for (int i = 0; i < half; i++)
+        left->leaf.entries[i] = all[i];
+    for (int i = half; i < count; i++)
+        right->leaf.entries[i - half] = all[i];
+    left->leaf.numEntries = half;
+    right->leaf.numEntries = count - half;
+    right->leaf.next = left->leaf.next;
+    left->leaf.next = m;
+    MarkDirty(n);
+
+    AddKey(path, depth, all[half].name, m);
+}
+
+//----------------------------------------------------------------------
+// Directory::AddKey
+// 	Node "child" was split off the node under path[depth - 1], and
+//	holds the names from "key" on; add it to that index node.  If
+//	there is no room, split the index node around its middle key,
+//	and add the new half to the node above -- or, at the root, grow
+//	the tree a level.
+//----------------------------------------------------------------------
+
+void Directory::AddKey(int *path, int depth, char *key, int child)
+{
+    char keys[IndexKeys + 1][FileNameMaxLen + 1];
+    int children[IndexKeys + 2];
+    DirectoryNode *node;
+    int p, i, count, mid, m;
+
+    if (depth == 0) // split the root
+    {
+        int old = header.root;
+
+        header.root = NewNode(FALSE);
+        node = GetNode(header.root);
+        node->index.numKeys = 1;
+        strncpy(node->index.keys[0], key, FileNameMaxLen);
+        node->index.children[0] = old;
+        node->index.children[1] = child;
+        return;
+    }
+
+    p = path[depth - 1];
+    node = GetNode(p);
+    count = node->index.numKeys;
+    for (i = 0; i < count && strncmp(key, node->index.keys[i], FileNameMaxLen) >= 0; i++)
+        ;
+    if (count < IndexKeys)
+    {
+        for (int j = count; j > i; j--)
+        {
+            strncpy(node->index.keys[j], node->index.keys[j - 1], FileNameMaxLen + 1);
+            node->index.children[j + 1] = node->index.children[j];
+        }
+        memset(node->index.keys[i], 0, FileNameMaxLen + 1);
+        strncpy(node->index.keys[i], key, FileNameMaxLen);
+        node->index.children[i + 1] = child;
+        node->index.numKeys++;
+        MarkDirty(p);
+        return;
+    }
+
+    // full: lay out all the keys and children, the new ones included
+    memset(keys, 0, sizeof(keys));
+    for (int j = 0, k = 0; j <= count; j++)
+        if (j == i)
+            strncpy(keys[j], key, FileNameMaxLen);
+        else
+            strncpy(keys[j], node->index.keys[k++], FileNameMaxLen + 1);
+    for (int j = 0, k = 0; j <= count + 1; j++)
+        children[j] = (j == i + 1) ? child : node->index.children[k++];
+
+    // the lower half stays, the middle key goes up, the upper half moves
+    mid = (count + 1) / 2;
+    m = NewNode(FALSE);
+    node = GetNode(p);
+    memset(node->index.keys, 0, sizeof(node->index.keys));
+    for (int j = 0; j < mid; j++)
+        strncpy(node->index.keys[j], keys[j], FileNameMaxLen + 1);
+    for (int j = 0; j <= mid; j++)
+        node->index.children[j] = children[j];
+    node->index.numKeys = mid;
+    MarkDirty(p);
+
+    DirectoryNode *right = GetNode(m);
+    for (int j = mid + 1; j <= count; j++)
+        strncpy(right->index.keys[j - mid - 1], keys[j], FileNameMaxLen + 1);
+    for (int j = mid + 1; j <= count + 1; j++)
+        right->index.children[j - mid - 1] = children[j];
+    right->index.numKeys = count - mid;
+
+    AddKey(path, depth - 1, keys[mid], m);
+}
+
 //----------------------------------------------------------------------
 // Directory::Find
 // 	Look up file name in directory, and return the disk sector number
@@ -107,19 +431,19 @@ int Directory::FindIndex(char *name)
 
 int Directory::Find(char *name)
 {
-    int i = FindIndex(name);
+    int path[MaxDirDepth], depth;
+    DirectoryNode *leaf = GetNode(FindLeaf(name, path, &depth));
+    int i = FindSlot(leaf, name);
 
     if (i != -1)
-        return table[i].sector;
+        return leaf->leaf.entries[i].sector;
     return -1;
 }
 
 //----------------------------------------------------------------------
 // Directory::Add
 // 	Add a file into the directory.  Return TRUE if successful;
-//	return FALSE if the file name is already in the directory, or if
-//	the directory is completely full, and has no more space for
-//	additional file names.
+//	return FALSE if the file name is already in the directory.
 //
 //	"name" -- the name of the file being added
 //	"newSector" -- the disk sector containing the added file's header
@@ -127,20 +451,38 @@ int Directory::Find(char *name)
 
 bool Directory::Add(char *name, int newSector, bool isDir)
 {
-    if (FindIndex(name) != -1)
+    int path[MaxDirDepth], depth, n;
+    DirectoryNode *leaf;
+
+    n = FindLeaf(name, path, &depth);
+    leaf = GetNode(n);
+    if (FindSlot(leaf, name) != -1)
         return FALSE;
 
-    for (int i = 0; i < tableSize; i++) {
-        if (!table[i].inUse) {
-            table[i].inUse = TRUE;
-            strncpy(table[i].name, name, FileNameMaxLen);
-            table[i].sector = newSector;
-            table[i].isDir = isDir; // MP4
+    if (leaf->leaf.numEntries == LeafEntries)
+    {
+        SplitLeaf(n, path, depth);
+        n = FindLeaf(name, path, &depth);
+        leaf = GetNode(n);
+    }
+    for (int i = 0; i < LeafEntries; i++)
+    {
+        DirectoryEntry *entry = &leaf->leaf.entries[i];
 
+        if (!entry->inUse)
+        {
+            entry->inUse = TRUE;
+            memset(entry->name, 0, FileNameMaxLen + 1);
+            strncpy(entry->name, name, FileNameMaxLen);
+            entry->sector = newSector;
+            entry->isDir = isDir; // MP4
+            leaf->leaf.numEntries++;
+            MarkEntryDirty(n, i);
             return TRUE;
         }
     }
-    return FALSE; // no space.  Fix when we have extensible files.
+    ASSERTNOTREACHED();
+    return FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -153,14 +495,63 @@ bool Directory::Add(char *name, int newSector, bool isDir)
 
 bool Directory::Remove(char *name)
 {
-    int i = FindIndex(name);
+    int path[MaxDirDepth], depth;
+    int n = FindLeaf(name, path, &depth);
+    DirectoryNode *leaf = GetNode(n);
+    int i = FindSlot(leaf, name);
 
     if (i == -1)
         return FALSE; // name not in directory
-    table[i].inUse = FALSE;
+    leaf->leaf.entries[i].inUse = FALSE;
+    leaf->leaf.numEntries--;
+    MarkEntryDirty(n, i);
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// Directory::GetEntries
+// 	Return the entries of the directory, sorted by name, in an array
+//	the caller deletes.  The leaves are visited in the order of their
+//	chain, so only the entries within a leaf need sorting.
+//
+//	"count" -- set to the number of entries
+//----------------------------------------------------------------------
+
+DirectoryEntry *Directory::GetEntries(int *count)
+{
+    int size = LeafEntries, n = header.root;
+    DirectoryEntry *entries = new DirectoryEntry[size];
+    DirectoryNode *node = GetNode(n);
+
+    while (!node->isLeaf) // find the first leaf
+    {
+        n = node->index.children[0];
+        node = GetNode(n);
+    }
+
+    *count = 0;
+    for (; n != -1; n = node->leaf.next)
+    {
+        int first = *count;
+
+        node = GetNode(n);
+        if (*count + node->leaf.numEntries > size)
+        {
+            DirectoryEntry *bigger = new DirectoryEntry[size * 2];
+
+            memcpy(bigger, entries, *count * sizeof(DirectoryEntry));
+            delete[] entries;
+            entries = bigger;
+            size *= 2;
+        }
+        for (int i = 0; i < LeafEntries; i++)
+            if (node->leaf.entries[i].inUse)
+                entries[(*count)++] = node->leaf.entries[i];
+        SortEntries(entries + first, *count - first);
+    }
+    return entries;
+}
+
 //----------------------------------------------------------------------
 // Directory::List
 // 	List all the file names in the directory.
@@ -168,9 +559,12 @@ bool Directory::Remove(char *name)
 
 void Directory::List()
 {
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse)
-            printf("%s\n", table[i].name);
+    int count;
+    DirectoryEntry *entries = GetEntries(&count);
+
+    for (int i = 0; i < count; i++)
+        printf("%s\n", entries[i].name);
+    delete[] entries;
 }
 
 //----------------------------------------------------------------------
@@ -182,16 +576,18 @@ void Directory::List()
 void Directory::Print()
 {
     FileHeader *hdr = new FileHeader;
+    int count;
+    DirectoryEntry *entries = GetEntries(&count);
 
     printf("Directory contents:\n");
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse)
-        {
-            printf("Name: %s, Sector: %d\n", table[i].name, table[i].sector);
-            hdr->FetchFrom(table[i].sector);
-            hdr->Print();
-        }
+    for (int i = 0; i < count; i++)
+    {
+        printf("Name: %s, Sector: %d\n", entries[i].name, entries[i].sector);
+        hdr->FetchFrom(entries[i].sector);
+        hdr->Print();
+    }
     printf("\n");
+    delete[] entries;
     delete hdr;
 }
 
@@ -199,24 +595,33 @@ void Directory::Print()
 
 void Directory::RecursiveList(int level)
 {
-    Directory* subDirectory = new Directory(NumDirEntries);
-
-    for(int i = 0; i < tableSize; i++) {
-        if(table[i].inUse) {
-            for(int j = 0; j < level; j++) printf("    "); // indent
-            printf("[%c] %s\n", (table[i].isDir == true ? 'D' : 'F'), table[i].name);
-            if(table[i].isDir) {
-                // recursive call
-                OpenFile *dir = new OpenFile(table[i].sector); 
-                subDirectory->FetchFrom(dir);
-                subDirectory->RecursiveList(level + 1);
-                delete dir;
-            }
+    int count;
+    DirectoryEntry *entries = GetEntries(&count);
+
+    for(int i = 0; i < count; i++) {
+        for(int j = 0; j < level; j++) printf("    "); // indent
+        printf("[%c] %s\n", (entries[i].isDir == true ? 'D' : 'F'), entries[i].name);
+        if(entries[i].isDir) {
+            // recursive call
+            Directory* subDirectory = new Directory();
+            OpenFile *dir = new OpenFile(entries[i].sector, file->Table());
+            dir->LockContents(FALSE); // (see GetDirSector)
+            subDirectory->FetchFrom(dir);
+            subDirectory->RecursiveList(level + 1);
+            delete subDirectory;
+            dir->UnlockContents();
+            delete dir;
         }
     }
-    delete subDirectory;
+    delete[] entries;
 }
 
+// MP4
+// The directories below are locked to read while we look in them, each
+// before the one above is let go of (see filesys.cc); the caller has
+// this one locked.  So nobody changes one under us, and the locks are
+// always taken from the top down.
+
 int Directory::GetDirSector(char* dirPath) {
     if(!strcmp("/", dirPath)) return 1; // root directory's fileHeader is in sector 1
 
@@ -230,12 +635,14 @@ int Directory::GetDirSector(char* dirPath) {
     int dir_sector = Find(dir); // find the directory in the current directory
     int sector_we_want = -1;
     if(dirPath[index] != '\0') {
-        Directory* directory = new Directory(NumDirEntries);
-        OpenFile* file = new OpenFile(dir_sector);
+        Directory* directory = new Directory();
+        OpenFile* file = new OpenFile(dir_sector, this->file->Table());
+        file->LockContents(FALSE);
         directory->FetchFrom(file);
         sector_we_want = directory->GetDirSector(dirPath + index);
 
         delete directory;
+        file->UnlockContents();
         delete file;
     }
     else sector_we_want = dir_sector;
@@ -244,6 +651,9 @@ int Directory::GetDirSector(char* dirPath) {
 }
 
 bool Directory::isDir(char* fileName) {
-    int index = FindIndex(fileName);
-    return table[index].isDir;
-}
\ No newline at end of file
+    int path[MaxDirDepth], depth;
+    DirectoryNode *leaf = GetNode(FindLeaf(fileName, path, &depth));
+    int i = FindSlot(leaf, fileName);
+
+    return i != -1 && leaf->leaf.entries[i].isDir;
+}
@@ -6,6 +6,10 @@
 //	where to find its file header (the data structure describing
 //	where to find the file's data blocks) on disk.
 //
+//	The table is kept as a B-tree keyed by name, so that a directory
+//	can hold any number of files, and a lookup only reads the few
+//	nodes on the way from the root to the name.
+//
 //      We assume mutual exclusion is provided by the caller.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
@@ -18,33 +22,112 @@
 #define DIRECTORY_H
 
 #include "openfile.h"
+#include "disk.h"
+#include "list.h"
 
 #define FileNameMaxLen 9 // for simplicity, we assume
                          // file names are <= 9 characters long
-                         
-// MP4 add，因spec規定一個directory裡要支援64個file/directory
-#define NumDirEntries 64
+
 #define DirectoryNameMaxLen 9
 
+// MP4 the B-tree.  The directory file starts with a header sector;
+// node n follows at SectorSize + n * DirNodeSize.
+#define DirNodeSectors 8
+#define DirNodeSize (DirNodeSectors * SectorSize)
+#define DirectoryFileSize (SectorSize + DirNodeSize) // an empty directory
+#define MaxDirDepth 16 // deepest a tree can get (far deeper than
+                       // the disk has room for)
+
 // The following class defines a "directory entry", representing a file
 // in the directory.  Each entry gives the name of the file, and where
 // the file's header is to be found on disk.
 //
 // Internal data structures kept public so that Directory operations can
 // access them directly.
+//
+// The fields are ordered so that an entry packs into 16 bytes, a
+// divisor of SectorSize: no entry straddles two sectors, so changing
+// one entry changes one sector.
 
 class DirectoryEntry
 {
 public:
-    bool inUse;                    // Is this directory entry in use?
     int sector;                    // Location on disk to find the
                                    //   FileHeader for this file
     char name[FileNameMaxLen + 1]; // Text name for file, with +1 for
                                    // the trailing '\0'
+    bool inUse;                    // Is this directory entry in use?
     // MP4 add
     bool isDir; //是否是directory
 };
 
+// MP4
+// Entries in a leaf, and keys in an index node, of DirNodeSize bytes.
+// The entries of a leaf start after a header of one entry's size, so
+// that they stay aligned with the sectors.
+#define LeafHeaderSize ((int)sizeof(DirectoryEntry))
+#define LeafEntries ((DirNodeSize - LeafHeaderSize) / (int)sizeof(DirectoryEntry))
+#define IndexKeys ((DirNodeSize - 4 * (int)sizeof(int)) / (FileNameMaxLen + 1 + (int)sizeof(int)))
+
+// The following class defines a node of the B-tree, as stored on disk.
+//
+// Leaves hold the entries, in no particular order (so that adding an
+// entry only changes its slot); each leaf holds names from a range
+// that comes after the ranges of the leaves before it in the "next"
+// chain.  Index nodes hold sorted keys: the names in child i are below
+// key i, and those in child i + 1 are at or above it.
+//
+// Removing an entry just frees its slot; leaves are never merged.
+
+class DirectoryNode
+{
+public:
+    int isLeaf; // Which half of the union is in use
+    union
+    {
+        struct
+        {
+            int numEntries; // Slots in use; counted again whenever
+                            //   the leaf is read, so adding or
+                            //   removing an entry need not write it
+            int next;       // The leaf holding the next names, -1 if last
+            int unused;     // Pads the header to LeafHeaderSize
+            DirectoryEntry entries[LeafEntries];
+        } leaf;
+        struct
+        {
+            int numKeys;
+            char keys[IndexKeys][FileNameMaxLen + 1];
+            int children[IndexKeys + 1];
+        } index;
+    };
+};
+
+// The following class defines the first sector of a directory file.
+
+class DirectoryHeader
+{
+public:
+    int magic;    // DirectoryMagic, in a B-tree directory
+    int root;     // Node at the root of the tree
+    int numNodes; // Nodes in the file
+};
+
+// The following class defines a node brought into memory.
+
+class CachedNode
+{
+public:
+    int number;                  // Which node
+    bool dirty[DirNodeSectors];  // Which of its sectors changed since
+                                 //   it was read or written
+    union
+    {
+        DirectoryNode node;      // Its contents,
+        char data[DirNodeSize];  //   padded out to whole sectors
+    };
+};
+
 // The following class defines a UNIX-like "directory".  Each entry in
 // the directory describes a file, and where to find it on disk.
 //
@@ -53,14 +136,15 @@ public:
 //
 // The constructor initializes a directory structure in memory; the
 // FetchFrom/WriteBack operations shuffle the directory information
-// from/to disk.
+// from/to disk.  FetchFrom only reads the header: the nodes are read
+// as the operations need them, and WriteBack writes the sectors of them
+// that changed.
 
 class Directory
 {
 public:
-    Directory(int size); // Initialize an empty directory
-                         // with space for "size" files
-    ~Directory();        // De-allocate the directory
+    Directory();  // Initialize an empty directory
+    ~Directory(); // De-allocate the directory
 
     void FetchFrom(OpenFile *file); // Init directory contents from disk
     void WriteBack(OpenFile *file); // Write modifications to
@@ -77,28 +161,45 @@ public:
     void Print(); // Verbose print of the contents
                   //  of the directory -- all the file
                   //  names and their contents.
-                  
+
     // MP4
     void RecursiveList(int level);          // print the directory recursively
     int GetDirSector(char* dirPath);    // return the sector number of the directory
 
     // for Recursive Remove (-rr)
     bool isDir(char* fileName);                 // return whether the file is a directory
-    int GetTableSize() {return tableSize;}      // return tableSize
-    DirectoryEntry* GetTable() {return table;}  // return table
+    DirectoryEntry *GetEntries(int *count);     // return all the entries, sorted
+                                                // by name (caller deletes)
 
 private:
     /*
 		MP4 Hint:
 		Directory is actually a "file", be careful of how it works with OpenFile and FileHdr.
-		Disk part: table
-		In-core part: tableSize
+		Disk part: header, nodes
+		In-core part: the nodes read so far
 	*/
 
-    int tableSize;         // Number of directory entries
-    DirectoryEntry *table; // Table of pairs: <file name, file header location>
-
-    int FindIndex(char *name); // Find the index into the directory table corresponding to "name"
+    OpenFile *file;              // Where the nodes are read from
+    DirectoryHeader header;      // The tree's root and size
+    bool headerDirty;            // Header changed since last written?
+    ::List<CachedNode *> *nodes; // Nodes brought into memory (the
+                                 //   "::" as List() is a method here)
+
+    void Flush();                         // Forget the nodes in memory
+    DirectoryNode *GetNode(int n);        // Bring node "n" into memory
+    void MarkDirty(int n);                // Node "n" has changed
+    void MarkEntryDirty(int n, int slot); // ... only in entry "slot"
+    int NewNode(bool isLeaf);             // Add an empty node to the tree
+    int FindLeaf(char *name, int *path, int *depth);
+                                          // Return the leaf "name" belongs
+                                          // in, and the index nodes above it
+    int FindSlot(DirectoryNode *leaf, char *name);
+                                          // Return its slot there, or -1
+    void SplitLeaf(int n, int *path, int depth);
+                                          // Move the upper half of a full
+                                          // leaf to a new one
+    void AddKey(int *path, int depth, char *key, int child);
+                                          // Put a new child in an index node
 };
 
 #endif // DIRECTORY_H
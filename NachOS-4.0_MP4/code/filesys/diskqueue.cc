@@ -0,0 +1,206 @@
+// diskqueue.cc
+//	Routines to queue disk requests and schedule them on the raw disk.
+//
+//	Any number of threads can have a request outstanding.  The disk
+//	works on one of them (the "active" request); the rest wait on the
+//	pending list.  When the disk interrupt says the active request is
+//	done, we immediately start the next one, chosen by the queue's
+//	policy, and only then wake up the thread that was waiting for the
+//	finished request.
+//
+//	The pending list is shared with the interrupt handler, so it is
+//	only touched with interrupts disabled.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "diskqueue.h"
+#include "debug.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// DiskRequest::DiskRequest
+// 	Initialize a request to transfer "count" sectors.  Note that we
+//	don't copy the sector list or the buffer; both have to stay
+//	around until the request completes.
+//
+//	"sectors" -- the disk sectors to transfer
+//	"count" -- number of entries in "sectors"
+//	"buffer" -- sectors[i] is transferred to/from buffer[i * SectorSize]
+//	"isWrite" -- is this a write request?
+//----------------------------------------------------------------------
+
+DiskRequest::DiskRequest(int *sectors, int count, char *buffer, bool isWrite)
+{
+    sectorList = sectors;
+    numSectors = count;
+    data = buffer;
+    writing = isWrite;
+    position = sectors[0];
+    for (int i = 1; i < count; i++)
+        position = min(position, sectors[i]);
+    submitTime = 0;
+    done = new Semaphore("disk request", 0);
+    callWhenDone = NULL;
+}
+
+DiskRequest::~DiskRequest()
+{
+    delete done;
+}
+
+//----------------------------------------------------------------------
+// DiskQueue::DiskQueue
+// 	Initialize the request queue, in turn initializing the raw disk.
+//
+//	"policy" -- the order in which to service pending requests
+//----------------------------------------------------------------------
+
+DiskQueue::DiskQueue(DiskPolicy policy)
+{
+    this->policy = policy;
+    pending = new List<DiskRequest *>;
+    active = NULL;
+    disk = new Disk(this);
+}
+
+//----------------------------------------------------------------------
+// DiskQueue::~DiskQueue
+// 	De-allocate the queue, and the raw disk.  Every thread waits for
+//	its own requests, so the only ones that can still be outstanding
+//	are reads nobody is waiting for (read-ahead); those are dropped.
+//----------------------------------------------------------------------
+
+DiskQueue::~DiskQueue()
+{
+    delete pending;
+    delete disk;
+}
+
+//----------------------------------------------------------------------
+// DiskQueue::Submit
+// 	Queue a disk request.  If the disk is idle the request is started
+//	right away; otherwise it waits until the scheduling policy picks
+//	it.  Either way we return immediately; the caller waits on
+//	request->done if it needs the data.
+//
+//	"request" -- the request to queue
+//----------------------------------------------------------------------
+
+void DiskQueue::Submit(DiskRequest *request)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    request->submitTime = kernel->stats->totalTicks;
+    if (active == NULL)
+        Dispatch(request);
+    else
+        pending->Append(request);
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// DiskQueue::CallBack
+// 	Disk interrupt handler.  Start the next request, so that the disk
+//	never sits idle while there is work queued, then wake up the
+//	thread waiting for the one that just finished (or, for an
+//	asynchronous request, let its owner know).
+//----------------------------------------------------------------------
+
+void DiskQueue::CallBack()
+{
+    DiskRequest *finished = active;
+
+    ASSERT(finished != NULL);
+    active = NULL;
+    if (!pending->IsEmpty())
+        Dispatch(SelectNext());
+    if (finished->callWhenDone != NULL)
+        finished->callWhenDone->CallBack();
+    else
+        finished->done->V();
+}
+
+//----------------------------------------------------------------------
+// DiskQueue::SelectNext
+// 	Remove and return the pending request to service next.  The head
+//	is over the last sector the disk worked on.
+//
+//	For C-LOOK, the distance from the head to a request is measured
+//	upwards, wrapping around past the last sector, so the nearest
+//	request at or beyond the head wins, and once none is left the
+//	lowest one starts the next sweep.  For SSTF, we simply ask the
+//	disk how long each request would take from here.
+//----------------------------------------------------------------------
+
+DiskRequest *DiskQueue::SelectNext()
+{
+    ListIterator<DiskRequest *> iter(pending);
+    DiskRequest *best = NULL;
+    int bestCost = 0;
+    int head = disk->HeadSector();
+
+    if (policy == DiskFCFS)
+        return pending->RemoveFront();
+
+    for (; !iter.IsDone(); iter.Next())
+    {
+        DiskRequest *request = iter.Item();
+        int cost;
+
+        if (policy == DiskCLOOK)
+            cost = (request->position - head + NumSectors) % NumSectors;
+        else
+            cost = disk->ComputeLatency(request->position, request->writing);
+        if (best == NULL || cost < bestCost)
+        {
+            best = request;
+            bestCost = cost;
+        }
+    }
+    pending->Remove(best);
+    return best;
+}
+
+//----------------------------------------------------------------------
+// DiskQueue::Dispatch
+// 	Hand a request to the disk, and account for how long it waited
+//	in the queue.
+//
+//	"request" -- the request to start
+//----------------------------------------------------------------------
+
+void DiskQueue::Dispatch(DiskRequest *request)
+{
+    int wait = kernel->stats->totalTicks - request->submitTime;
+
+    ASSERT(active == NULL);
+    active = request;
+
+    kernel->stats->diskWaitTicks += wait;
+    if (wait > kernel->stats->maxDiskWaitTicks)
+        kernel->stats->maxDiskWaitTicks = wait;
+    DEBUG(dbgDisk, "Dispatching request at sector " << request->position
+                       << " (" << request->numSectors << " sectors), waited "
+                       << wait << " ticks, " << pending->NumInList()
+                       << " still pending");
+
+    if (request->numSectors == 1)
+    {
+        if (request->writing)
+            disk->WriteRequest(request->sectorList[0], request->data);
+        else
+            disk->ReadRequest(request->sectorList[0], request->data);
+    }
+    else
+    {
+        if (request->writing)
+            disk->WriteMultiRequest(request->sectorList, request->numSectors,
+                                    request->data);
+        else
+            disk->ReadMultiRequest(request->sectorList, request->numSectors,
+                                   request->data);
+    }
+}
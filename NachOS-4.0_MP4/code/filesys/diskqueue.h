@@ -0,0 +1,94 @@
+// diskqueue.h
+// 	Data structures to keep several disk requests outstanding, and
+//	to decide in which order the disk services them.
+//
+//	The raw disk can only work on one request at a time.  Rather
+//	than making every thread wait for the disk in turn (in arrival
+//	order), threads hand their requests to a DiskQueue, which keeps
+//	the ones the disk cannot start yet, and each time the disk
+//	finishes, dispatches the pending request that is cheapest to
+//	reach from where the head now is.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef DISKQUEUE_H
+#define DISKQUEUE_H
+
+#include "disk.h"
+#include "synch.h"
+#include "callback.h"
+#include "list.h"
+
+// Order in which pending requests are handed to the disk.
+//
+//	DiskFCFS -- arrival order (what a single lock around the disk gives)
+//	DiskCLOOK -- elevator: sweep towards higher sectors, serving the
+//		nearest request at or past the head; when nothing is left
+//		ahead, jump back to the lowest pending sector
+//	DiskSSTF -- shortest positioning time first: the request with the
+//		least Disk::ComputeLatency from the current head position
+
+enum DiskPolicy { DiskFCFS, DiskCLOOK, DiskSSTF };
+
+// The following class defines one disk request: a list of sectors to
+// read or write, the buffer to transfer them to/from, and how to tell
+// the requester that the request has completed.
+
+class DiskRequest
+{
+public:
+    DiskRequest(int *sectors, int count, char *buffer, bool isWrite);
+    // Initialize a request for "count"
+    // sectors; sectors[i] is transferred
+    // to/from buffer[i * SectorSize]
+    ~DiskRequest();
+
+    int *sectorList; // Disk sectors to transfer
+    int numSectors;  // Number of entries in sectorList
+    char *data;      // Buffer to transfer to/from
+    bool writing;    // Is this a write request?
+    int position;    // Lowest sector in the request -- where
+                     //   the disk head has to go first
+    int submitTime;  // When the request was queued
+    Semaphore *done; // V()'ed when the request completes
+    CallBackObj *callWhenDone; // If set, called instead, from the
+                               //   disk interrupt handler, so that
+                               //   no thread needs to wait
+};
+
+// The following class defines the disk request queue.  It owns the raw
+// Disk: every request goes through Submit, and the disk interrupt comes
+// back here, so that the next request can be started right away.
+
+class DiskQueue : public CallBackObj
+{
+public:
+    DiskQueue(DiskPolicy policy); // Initialize the queue, and the raw disk
+    ~DiskQueue();                 // De-allocate the queue and the disk
+
+    void Submit(DiskRequest *request);
+    // Queue a request (start it at once
+    // if the disk is idle) and return
+    // immediately; request->done is
+    // signalled (or callWhenDone called)
+    // when it finishes
+
+    void CallBack(); // Disk interrupt: the active request
+                     // is done, dispatch the next one
+
+private:
+    Disk *disk;                     // Raw disk device
+    DiskPolicy policy;              // How to pick the next request
+    List<DiskRequest *> *pending;   // Requests not yet sent to the disk
+    DiskRequest *active;            // Request the disk is working on
+
+    DiskRequest *SelectNext(); // Remove and return the pending request
+                               // to service next, according to policy
+    void Dispatch(DiskRequest *request); // Hand a request to the disk
+};
+
+#endif // DISKQUEUE_H
@@ -18,6 +18,17 @@
 //	     to point to the newly allocated data blocks
 //	   for a file already on disk, by reading the file header from disk
 //
+//	MP4: a file need not have all of its blocks allocated.  An entry
+//	of -1 in dataSectors is a hole: no data block (or, above level 0,
+//	no index header and nothing below it) has been allocated for that
+//	part of the file yet.  Index headers below the top one always
+//	describe their full span, so only the top header knows how long
+//	the file really is.
+//
+//	MP4: a small file is inline: its data takes the place of the
+//	sector table, so reading it costs no more than opening it, and it
+//	takes up just the header sector.
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
@@ -29,6 +40,28 @@
 #include "synchdisk.h"
 #include "main.h"
 
+// MP4
+//----------------------------------------------------------------------
+// LevelSize, EntrySize
+// 	The number of bytes a header at "level" can describe, and the
+//	number of bytes described by each of its entries.
+//----------------------------------------------------------------------
+
+static int LevelSize(int level)
+{
+	switch(level) {
+		case 0: return MaxDirectSize;
+		case 1: return MaxSingleIndirectSize;
+		case 2: return MaxDoubleIndirectSize;
+		default: return MaxTripleIndirectSize;
+	}
+}
+
+static int EntrySize(int level)
+{
+	return (level == 0) ? SectorSize : LevelSize(level - 1);
+}
+
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::FileHeader
@@ -40,7 +73,10 @@ FileHeader::FileHeader()
 {
 	numBytes = -1;
 	numSectors = -1;
+	level = 0;
 	memset(dataSectors, -1, sizeof(dataSectors));
+	compressed = FALSE;
+	shared = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -55,6 +91,53 @@ FileHeader::~FileHeader()
 	// nothing to do now
 }
 
+//----------------------------------------------------------------------
+// MP4
+// CountIndex
+// 	The number of index headers needed below a header at "level" to
+//	describe the first "size" bytes of its span.
+//----------------------------------------------------------------------
+
+static int CountIndex(int size, int level)
+{
+	if(level == 0)
+		return 0;
+
+	int childSize = EntrySize(level);
+	int full = size / childSize; // children describing their whole span
+	int rest = size % childSize;
+	int count = full * (1 + CountIndex(childSize, level - 1));
+
+	if(rest > 0)
+		count += 1 + CountIndex(rest, level - 1);
+	return count;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// CountRange
+// 	The number of index headers needed below a header at "level" to
+//	describe "size" bytes of its span from "offset" on, none of which
+//	are there yet.
+//----------------------------------------------------------------------
+
+static int CountRange(int offset, int size, int level)
+{
+	if(level == 0)
+		return 0;
+
+	int childSize = EntrySize(level);
+	int count = 0;
+
+	for(int idx = offset / childSize; idx * childSize < offset + size; idx++) {
+		int start = max(offset, idx * childSize);
+		int end = min(offset + size, (idx + 1) * childSize);
+
+		count += 1 + CountRange(start - idx * childSize, end - start, level - 1);
+	}
+	return count;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Allocate
 // 	Initialize a fresh file header for a newly created file.
@@ -62,115 +145,275 @@ FileHeader::~FileHeader()
 //	Return FALSE if there are not enough free blocks to accomodate
 //	the new file.
 //
+//	MP4: the whole tree of index headers is built in memory, and
+//	written with a single vectored request.  The index headers take
+//	one run of sectors from "goal" on, in the order a sequential read
+//	visits them, and the data blocks the run after it; so the request
+//	writes consecutive sectors, and the file is read without seeking
+//	back and forth.  The caller writes back this header.
+//
 //	"freeMap" is the bit map of free disk sectors
 //	"fileSize" is the size of the new file
+//	"goal" is where the data should start, if there is room: just
+//		past the header
 //----------------------------------------------------------------------
 
-bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
+bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize, int goal)
 {
 	numBytes = fileSize;
 	// MP4
-	if(fileSize <= MaxDirectSize) {
-		// Direct allocation
-		level = 0;
-		numSectors = divRoundUp(fileSize, SectorSize);
-		if (freeMap->NumClear() < numSectors)
-			return FALSE; // not enough space
-		
-		for (int i = 0; i < numSectors; i++) {
-			dataSectors[i] = freeMap->FindAndSet();
-			// since we checked that there was enough free space,
-			// we expect this to succeed
+	if(fileSize == 0) {
+		// A new, empty file: inline until it grows
+		level = InlineLevel;
+		numSectors = 0;
+		memset(dataSectors, 0, sizeof(dataSectors));
+		return TRUE;
+	}
+	if(fileSize > MaxFileSize)
+		return FALSE; // File size exceeds the maximum size
+
+	for(level = 0; fileSize > LevelSize(level); level++)
+		;
+	numSectors = divRoundUp(fileSize, EntrySize(level));
+	memset(dataSectors, -1, sizeof(dataSectors));
+
+	int numIndex = CountIndex(fileSize, level);
+	if(freeMap->NumClear() < numIndex + divRoundUp(fileSize, SectorSize))
+		return FALSE; // not enough space
+
+	FileHeader *index = new FileHeader[numIndex];
+	int *indexSectors = new int[numIndex];
+	char *buf;
+	int used = 0;
+
+	for(int i = 0; i < numIndex; i++) {
+		indexSectors[i] = freeMap->FindAndSet(goal);
+		// since we checked that there was enough free space,
+		// we expect this to succeed
+		ASSERT(indexSectors[i] >= 0);
+		goal = indexSectors[i] + 1;
+	}
+	Fill(freeMap, fileSize, index, indexSectors, &used, &goal);
+	ASSERT(used == numIndex);
+
+	buf = new char[numIndex * SectorSize];
+	for(int i = 0; i < numIndex; i++)
+		index[i].Encode(&buf[i * SectorSize]);
+	if(numIndex > 0)
+		kernel->synchDisk->WriteSectors(indexSectors, numIndex, buf);
+	delete [] buf;
+	delete [] index;
+	delete [] indexSectors;
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::Fill
+// 	Point the entries of a header that describe the first "size" bytes
+//	of its span at sectors that are already set aside: index headers
+//	from "indexSectors", in order, each of them filled in turn (in
+//	memory, in "index"), and data blocks from "goal" on.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"size" is how much of the span the file covers
+//	"index", "indexSectors" are the index headers, and their sectors
+//	"used" is how many of them are taken so far
+//	"goal" is where the next data block should go
+//----------------------------------------------------------------------
+
+void FileHeader::Fill(PersistentBitmap *freeMap, int size, FileHeader *index, int *indexSectors, int *used, int *goal)
+{
+	int childSize = EntrySize(level);
+
+	for(int i = 0; i * childSize < size; i++) {
+		if(level == 0) {
+			dataSectors[i] = freeMap->FindAndSet(*goal);
 			ASSERT(dataSectors[i] >= 0);
+			*goal = dataSectors[i] + 1;
+			continue;
 		}
+		FileHeader *child = &index[*used];
+
+		dataSectors[i] = indexSectors[(*used)++];
+		child->InitIndex(level - 1);
+		child->Fill(freeMap, min(childSize, size - i * childSize), index, indexSectors, used, goal);
 	}
-	else if(fileSize <= MaxSingleIndirectSize) {
-		// Single indirect allocation
-		level = 1;
-		numSectors = divRoundUp(fileSize, MaxDirectSize);
-		if(freeMap->NumClear() < numSectors)
-			return FALSE; // not enough space
-		
-		int remainSize = fileSize;
-		for(int i = 0; i < numSectors; i++) {
-			dataSectors[i] = freeMap->FindAndSet();
-			ASSERT(dataSectors[i] >= 0);
+}
 
-			FileHeader *nextHdr = new FileHeader;
-			int nextLevelSize = (remainSize > MaxDirectSize) ? MaxDirectSize : remainSize;
-			remainSize -= nextLevelSize;
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::MapIndex
+// 	Allocate the index headers missing below this one for the
+//	"numSectors" file sectors from the sector-aligned byte "offset"
+//	on, leaving the data sectors holes, for MapSectors to fill in.
+//	The range must be within the file's length (Extend first).
+//
+//	As in Allocate, the new index headers take one run of sectors from
+//	"goal" on (from the next track, if they would straddle two), in the
+//	order a sequential read visits them; and they are
+//	written, with the index headers already there that now point to
+//	them, in one vectored request.  So a large range written after
+//	this has its index in one place, and its data in one run after it
+//	(MapSectors puts each data sector just past the one before).  The
+//	caller writes back this header if anything was allocated.
+//
+//	Index headers shared with other files are left alone: MapSectors
+//	copies them as they are written.
+//
+//	Return the number of index headers allocated, or -1 if there is
+//	not enough room for all of them (then nothing is allocated).
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"offset" is the location within the file of the first sector
+//	"numSectors" is the number of sectors in the range
+//	"goal" is where the run should start, if there is room
+//----------------------------------------------------------------------
 
-			if(!nextHdr->Allocate(freeMap, nextLevelSize))
-				return FALSE;
-			else
-				nextHdr->WriteBack(dataSectors[i]);
-			
-			delete nextHdr;
-			if(remainSize <= 0)	 break;
+int FileHeader::MapIndex(PersistentBitmap *freeMap, int offset, int numSectors, int goal)
+{
+	int size = numSectors * SectorSize;
+	int count, used = 0, taken = 0;
+
+	if(level == InlineLevel || level == 0 || numSectors == 0)
+		return 0;
+	ASSERT(offset + size <= LevelSize(level));
+	count = CountMissing(freeMap, offset, size);
+	if(count == 0)
+		return 0;
+	if(freeMap->NumClear() < count)
+		return -1; // not enough space
+
+	// every new header, and at most one already there for each
+	FileHeader *index = new FileHeader[2 * count];
+	int *indexSectors = new int[2 * count];
+	int *run = new int[count];
+	char *buf;
+
+	for(int i = 0; i < count; i++) {
+		run[i] = freeMap->FindAndSet(goal);
+		// don't let the run straddle two tracks: a read of the range's
+		// data that has moved on to the second would go back to the
+		// first for the rest of the index, at the cost of a rotation
+		if(i == 0 && !freeMap->Logging() && run[0] >= 0 &&
+		   run[0] / SectorsPerTrack != (run[0] + count - 1) / SectorsPerTrack &&
+		   (run[0] / SectorsPerTrack + 1) * SectorsPerTrack < NumSectors) {
+			freeMap->Clear(run[0]);
+			run[0] = freeMap->FindAndSet((run[0] / SectorsPerTrack + 1) * SectorsPerTrack);
 		}
+		// since we checked that there was enough free space,
+		// we expect this to succeed
+		ASSERT(run[i] >= 0);
+		goal = run[i] + 1;
 	}
-	else if(fileSize <= MaxDoubleIndirectSize) {
-		// Double indirect allocation
-		level = 2;
-		numSectors = divRoundUp(fileSize, MaxSingleIndirectSize);
-		if(freeMap->NumClear() < numSectors)
-			return FALSE; // not enough space
-		
-		int remainSize = fileSize;
-		for(int i = 0; i < numSectors; i++) {
-			dataSectors[i] = freeMap->FindAndSet();
-			ASSERT(dataSectors[i] >= 0);
+	FillIndex(freeMap, offset, size, run, &taken, index, indexSectors, &used);
+	ASSERT(taken == count);
+
+	buf = new char[used * SectorSize];
+	for(int i = 0; i < used; i++)
+		index[i].Encode(&buf[i * SectorSize]);
+	kernel->synchDisk->WriteSectors(indexSectors, used, buf);
+	delete [] buf;
+	delete [] run;
+	delete [] index;
+	delete [] indexSectors;
+	return count;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::CountMissing
+// 	The number of index headers missing below this one to describe
+//	"size" bytes of its span from "offset" on.  The index headers that
+//	are there are read in to look below them (except shared ones,
+//	which MapIndex leaves alone).
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"offset", "size" are the part of the span
+//----------------------------------------------------------------------
+
+int FileHeader::CountMissing(PersistentBitmap *freeMap, int offset, int size)
+{
+	if(level <= 0)
+		return 0;
+
+	int childSize = EntrySize(level);
+	int count = 0;
+
+	for(int idx = offset / childSize; idx * childSize < offset + size; idx++) {
+		int start = max(offset, idx * childSize);
+		int end = min(offset + size, (idx + 1) * childSize);
 
+		if(dataSectors[idx] == -1)
+			count += 1 + CountRange(start - idx * childSize, end - start, level - 1);
+		else if(level > 1 && !freeMap->IsShared(dataSectors[idx])) {
 			FileHeader *nextHdr = new FileHeader;
-			int nextLevelSize = (remainSize > MaxSingleIndirectSize) ? MaxSingleIndirectSize : remainSize;
-			remainSize -= nextLevelSize;
 
-			if(!nextHdr->Allocate(freeMap, nextLevelSize))
-				return FALSE;
-			else
-				nextHdr->WriteBack(dataSectors[i]);
-			
+			nextHdr->FetchFrom(dataSectors[idx]);
+			count += nextHdr->CountMissing(freeMap, start - idx * childSize, end - start);
 			delete nextHdr;
-			if(remainSize <= 0)	 break;
 		}
 	}
-	else if(fileSize <= MaxTripleIndirectSize) {
-		// Triple indirect allocation
-		level = 3;
-		numSectors = divRoundUp(fileSize, MaxDoubleIndirectSize);
-		if(freeMap->NumClear() < numSectors)
-			return FALSE; // not enough space
-		
-		int remainSize = fileSize;
-		for(int i = 0; i < numSectors; i++) {
-			dataSectors[i] = freeMap->FindAndSet();
-			ASSERT(dataSectors[i] >= 0);
+	return count;
+}
 
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::FillIndex
+// 	Point the entries of this header that are missing for "size" bytes
+//	of its span from "offset" on at index headers set aside by
+//	MapIndex, from "run", in order; each of them is filled in turn (in
+//	memory, in "index"), as are the index headers already there below
+//	this one that get new entries.  Return TRUE if this header changed.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"offset", "size" are the part of the span
+//	"run", "taken" are the sectors set aside, and how many are used
+//	"index", "indexSectors" receive the headers to write, and where
+//	"used" is how many of them there are so far
+//----------------------------------------------------------------------
+
+bool FileHeader::FillIndex(PersistentBitmap *freeMap, int offset, int size, int *run, int *taken, FileHeader *index, int *indexSectors, int *used)
+{
+	int childSize = EntrySize(level);
+	bool changed = FALSE;
+
+	if(level <= 0)
+		return FALSE;
+	for(int idx = offset / childSize; idx * childSize < offset + size; idx++) {
+		int start = max(offset, idx * childSize);
+		int end = min(offset + size, (idx + 1) * childSize);
+
+		if(dataSectors[idx] == -1) {
+			FileHeader *child = &index[*used];
+
+			dataSectors[idx] = run[(*taken)++];
+			indexSectors[(*used)++] = dataSectors[idx];
+			child->InitIndex(level - 1);
+			child->FillIndex(freeMap, start - idx * childSize, end - start, run, taken, index, indexSectors, used);
+			changed = TRUE;
+		}
+		else if(level > 1 && !freeMap->IsShared(dataSectors[idx])) {
 			FileHeader *nextHdr = new FileHeader;
-			int nextLevelSize = (remainSize > MaxDoubleIndirectSize) ? MaxDoubleIndirectSize : remainSize;
-			remainSize -= nextLevelSize;
 
-			if(!nextHdr->Allocate(freeMap, nextLevelSize))
-				return FALSE;
-			else
-				nextHdr->WriteBack(dataSectors[i]);
-			
+			nextHdr->FetchFrom(dataSectors[idx]);
+			if(nextHdr->FillIndex(freeMap, start - idx * childSize, end - start, run, taken, index, indexSectors, used)) {
+				index[*used] = *nextHdr;
+				indexSectors[(*used)++] = dataSectors[idx];
+			}
 			delete nextHdr;
-			if(remainSize <= 0)	 break;
 		}
 	}
-	else {
-		// File size exceeds the maximum size
-		return FALSE;
-	}
-
-	return TRUE;
+	return changed;
 }
 
 //----------------------------------------------------------------------
 // FileHeader::Deallocate
 // 	De-allocate all the space allocated for data blocks for this file.
 //
+//	MP4: a sector another file shares (and so everything below it,
+//	if it is an index header) just loses a reference.
+//
 //	"freeMap" is the bit map of free disk sectors
 //----------------------------------------------------------------------
 
@@ -183,16 +426,23 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap)
 	// }
 
 	// MP4
+	// (holes, and inline files, have nothing to free)
+	if(level == InlineLevel)
+		return;
 	if(level == 0) {
 		// Direct deallocation
-		for(int i = 0; i < numSectors; i++) {
+		for(int i = 0; i < NumDirect; i++) {
+			if(dataSectors[i] == -1 || freeMap->Unshare(dataSectors[i]))
+				continue;
 			ASSERT(freeMap->Test((int)dataSectors[i])); // ought to be marked!
 			freeMap->Clear((int)dataSectors[i]);
 		}
 	}
 	else {
 		// Indirect deallocation
-		for(int i = 0; i < numSectors; i++) {
+		for(int i = 0; i < NumDirect; i++) {
+			if(dataSectors[i] == -1 || freeMap->Unshare(dataSectors[i]))
+				continue;
 			FileHeader *nextHdr = new FileHeader;
 			// Recursively deallocate the next level
 			nextHdr->FetchFrom(dataSectors[i]);
@@ -204,6 +454,387 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap)
 	}
 }
 
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::Extend
+// 	Make the file "newSize" bytes long.  Nothing is allocated for the
+//	new part of the file (it is a hole until written); but if the file
+//	no longer fits in its level, the header is pushed one level down:
+//	its entries move to a new index header, which becomes the first
+//	entry of this one.  Return FALSE if the file would be too big, or
+//	if there is no sector left for the new index header.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"newSize" is the new length of the file
+//	"goal" is where a new sector should go, if there is room: just
+//		past the header
+//----------------------------------------------------------------------
+
+bool FileHeader::Extend(PersistentBitmap *freeMap, int newSize, int goal)
+{
+	if(newSize > MaxFileSize)
+		return FALSE;
+	if(newSize <= numBytes)
+		return TRUE;
+
+	if(level == InlineLevel) {
+		if(newSize <= MaxInlineSize) {
+			numBytes = newSize; // the bytes past the old end are zero already
+			return TRUE;
+		}
+		if(!Spill(freeMap, goal))
+			return FALSE;
+	}
+
+	while(newSize > LevelSize(level)) {
+		bool empty = TRUE;
+
+		for(int i = 0; i < NumDirect; i++)
+			if(dataSectors[i] != -1)
+				empty = FALSE;
+		if(!empty) {
+			// an empty file has nothing to push down
+			int sector = freeMap->FindAndSet(goal);
+			if(sector == -1)
+				return FALSE;
+
+			FileHeader *nextHdr = new FileHeader;
+			nextHdr->InitIndex(level);
+			memcpy(nextHdr->dataSectors, dataSectors, sizeof(dataSectors));
+			nextHdr->WriteBack(sector);
+			delete nextHdr;
+
+			memset(dataSectors, -1, sizeof(dataSectors));
+			dataSectors[0] = sector;
+		}
+		level++;
+	}
+	numBytes = newSize;
+	numSectors = divRoundUp(newSize, EntrySize(level));
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::Spill
+// 	An inline file is growing too big for its header: turn it into an
+//	ordinary level 0 file, writing its data to a sector of its own.
+//	(An empty file has no data, and gets no sector.)  Return FALSE if
+//	the disk is full.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"goal" is where the data sector should go, if there is room
+//----------------------------------------------------------------------
+
+bool FileHeader::Spill(PersistentBitmap *freeMap, int goal)
+{
+	char data[SectorSize];
+	int sector = -1;
+
+	ASSERT(level == InlineLevel);
+	if(numBytes > 0) {
+		if((sector = freeMap->FindAndSet(goal)) == -1)
+			return FALSE;
+		memset(data, 0, SectorSize);
+		memcpy(data, (char *)dataSectors, numBytes);
+		kernel->synchDisk->WriteSector(sector, data);
+	}
+
+	level = 0;
+	numSectors = divRoundUp(numBytes, SectorSize);
+	memset(dataSectors, -1, sizeof(dataSectors));
+	dataSectors[0] = sector;
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::ReadInline/WriteInline
+// 	Copy bytes out of, or into, the data of an inline file.  A write
+//	may make the file longer, up to MaxInlineSize; the caller writes
+//	back the header.
+//
+//	"into" -- the buffer to contain the data
+//	"from" -- the buffer containing the data to be written
+//	"numBytes" -- the number of bytes to transfer
+//	"position" -- the offset within the file of the first byte
+//----------------------------------------------------------------------
+
+void FileHeader::ReadInline(char *into, int numBytes, int position)
+{
+	ASSERT(level == InlineLevel && position + numBytes <= this->numBytes);
+	memcpy(into, (char *)dataSectors + position, numBytes);
+}
+
+void FileHeader::WriteInline(char *from, int numBytes, int position)
+{
+	ASSERT(level == InlineLevel && position + numBytes <= MaxInlineSize);
+	memcpy((char *)dataSectors + position, from, numBytes);
+	if(position + numBytes > this->numBytes)
+		this->numBytes = position + numBytes;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::MapSectors
+// 	Translate "numSectors" consecutive file sectors, starting at the
+//	sector-aligned byte "offset", into their disk sectors, as
+//	ByteToSectors does; but allocate a data sector for every hole,
+//	and an index header for every missing part of the tree, on the
+//	way.  Index headers that change are written back here; the caller
+//	writes back this header if anything was allocated.
+//
+//	The sectors are about to be written: a data sector this file
+//	shares with others is replaced by a new one (the caller writes
+//	all of it), and a shared index header on the way by a copy (see
+//	CopyIndex).  These count as allocated too.
+//
+//	On a log-structured disk, a data sector being written over can be
+//	"relocate"d as well: it is replaced by a new one at the head of
+//	the log, and freed, so that the data the file system writes goes
+//	to the log (see pbitmap.h) and the segments it leaves behind empty
+//	out for the cleaner, rather than being rewritten in place.
+//
+//	Return the number of sectors allocated, or -1 if the disk filled
+//	up (what was allocated until then stays allocated).
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"offset" is the location within the file of the first sector
+//	"numSectors" is the number of sectors to translate
+//	"sectorList" receives the disk sector numbers
+//	"goal" is where a new sector should go, if there is room and the
+//		sector before it in this header is a hole: just past the
+//		header (otherwise, just past that sector; and below an index
+//		header, past the data sector before, in the entry before)
+//	"relocate" is TRUE if the sectors that are there already should
+//		move to the log head, too (the caller writes all of them)
+//----------------------------------------------------------------------
+
+int FileHeader::MapSectors(PersistentBitmap *freeMap, int offset, int numSectors, int *sectorList, int goal, bool relocate)
+{
+	int allocated = 0;
+
+	ASSERT(level != InlineLevel);
+	relocate = relocate && freeMap->Logging();
+	if(level == 0) {
+		for(int i = 0; i < numSectors; i++) {
+			int slot = offset / SectorSize + i;
+			int old = dataSectors[slot];
+
+			if(old == -1 || freeMap->IsShared(old) || relocate) {
+				int sector;
+
+				if(slot > 0 && dataSectors[slot - 1] != -1)
+					goal = dataSectors[slot - 1] + 1;
+				if((sector = freeMap->FindAndSet(goal)) == -1)
+					return -1;
+				if(old != -1 && !freeMap->Unshare(old)) // the others keep it
+					freeMap->Clear(old);
+				dataSectors[slot] = sector;
+				allocated++;
+			}
+			sectorList[i] = dataSectors[slot];
+		}
+		return allocated;
+	}
+
+	int childSize = EntrySize(level);
+	int next = -1; // just past the last data sector so far
+	while(numSectors > 0) {
+		int idx = offset / childSize;
+		int within = offset % childSize;
+		int n = min(numSectors, (childSize - within) / SectorSize); // sectors left in this child
+		int result;
+
+		FileHeader *nextHdr = new FileHeader;
+		if(dataSectors[idx] == -1) {
+			if(idx > 0 && dataSectors[idx - 1] != -1)
+				goal = dataSectors[idx - 1] + 1;
+			if((dataSectors[idx] = freeMap->FindAndSet(goal)) == -1) {
+				delete nextHdr;
+				return -1;
+			}
+			allocated++;
+			nextHdr->InitIndex(level - 1);
+			result = nextHdr->MapSectors(freeMap, within, n, sectorList, (next != -1) ? next : dataSectors[idx] + 1, relocate);
+			nextHdr->WriteBack(dataSectors[idx]);
+		}
+		else if(freeMap->IsShared(dataSectors[idx])) {
+			if(!CopyIndex(freeMap, idx, nextHdr, goal)) {
+				delete nextHdr;
+				return -1;
+			}
+			allocated++;
+			result = nextHdr->MapSectors(freeMap, within, n, sectorList, (next != -1) ? next : dataSectors[idx] + 1, relocate);
+			nextHdr->WriteBack(dataSectors[idx]);
+		}
+		else {
+			nextHdr->FetchFrom(dataSectors[idx]);
+			result = nextHdr->MapSectors(freeMap, within, n, sectorList, (next != -1) ? next : dataSectors[idx] + 1, relocate);
+			if(result != 0)
+				nextHdr->WriteBack(dataSectors[idx]);
+		}
+		delete nextHdr;
+		if(result == -1)
+			return -1;
+		allocated += result;
+
+		next = sectorList[n - 1] + 1;
+		sectorList += n;
+		numSectors -= n;
+		offset += n * SectorSize;
+	}
+	return allocated;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::Unmap
+// 	Free the data sectors of "numSectors" consecutive file sectors,
+//	starting at the sector-aligned byte "offset", leaving a hole
+//	there.  Index headers that change are written back here (they
+//	stay allocated, even if nothing is left below them); the caller
+//	writes back this header if anything was freed.
+//
+//	A data sector other files share just loses a reference; a shared
+//	index header on the way is copied first (see CopyIndex), or, if
+//	there is no room for the copy, left as it is.
+//
+//	Return the number of sectors freed (copies made count too).
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"offset" is the location within the file of the first sector
+//	"numSectors" is the number of sectors to free
+//----------------------------------------------------------------------
+
+int FileHeader::Unmap(PersistentBitmap *freeMap, int offset, int numSectors)
+{
+	int freed = 0;
+
+	ASSERT(level != InlineLevel);
+	if(level == 0) {
+		for(int i = 0; i < numSectors; i++) {
+			int slot = offset / SectorSize + i;
+
+			if(dataSectors[slot] != -1) {
+				if(!freeMap->Unshare(dataSectors[slot]))
+					freeMap->Clear(dataSectors[slot]);
+				dataSectors[slot] = -1;
+				freed++;
+			}
+		}
+		return freed;
+	}
+
+	int childSize = EntrySize(level);
+	while(numSectors > 0) {
+		int idx = offset / childSize;
+		int within = offset % childSize;
+		int n = min(numSectors, (childSize - within) / SectorSize); // sectors left in this child
+
+		if(dataSectors[idx] != -1 && freeMap->IsShared(dataSectors[idx])) {
+			FileHeader *nextHdr = new FileHeader;
+
+			if(CopyIndex(freeMap, idx, nextHdr, dataSectors[idx])) {
+				freed += 1 + nextHdr->Unmap(freeMap, within, n);
+				nextHdr->WriteBack(dataSectors[idx]);
+			}
+			delete nextHdr;
+		}
+		else if(dataSectors[idx] != -1) {
+			FileHeader *nextHdr = new FileHeader;
+			int result;
+
+			nextHdr->FetchFrom(dataSectors[idx]);
+			result = nextHdr->Unmap(freeMap, within, n);
+			if(result != 0)
+				nextHdr->WriteBack(dataSectors[idx]);
+			delete nextHdr;
+			freed += result;
+		}
+
+		numSectors -= n;
+		offset += n * SectorSize;
+	}
+	return freed;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::InitIndex
+// 	Initialize an index header with nothing below it yet.  It always
+//	describes its whole span.
+//
+//	"childLevel" is the level of the new header
+//----------------------------------------------------------------------
+
+void FileHeader::InitIndex(int childLevel)
+{
+	level = childLevel;
+	numBytes = LevelSize(childLevel);
+	numSectors = NumDirect;
+	memset(dataSectors, -1, sizeof(dataSectors));
+	compressed = FALSE;
+	shared = FALSE;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::Share
+// 	This header is a copy of another file's: make the two share what
+//	it points to, by counting one more reference to each sector (which
+//	stands for everything below it, too).  Return FALSE, having
+//	changed nothing, if the disk keeps no counts or a sector has as
+//	many references as can be counted.
+//
+//	"freeMap" is the bit map of free disk sectors
+//----------------------------------------------------------------------
+
+bool FileHeader::Share(PersistentBitmap *freeMap)
+{
+	if(level == InlineLevel)
+		return TRUE; // the data is in the header itself
+	for(int i = 0; i < NumDirect; i++) {
+		if(dataSectors[i] == -1 || freeMap->Share(dataSectors[i]))
+			continue;
+		while(--i >= 0) // take back the references counted so far
+			if(dataSectors[i] != -1)
+				freeMap->Unshare(dataSectors[i]);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::CopyIndex
+// 	Entry "i" points to an index header other files share: point it at
+//	a copy of its own instead, which shares what the original points
+//	to.  The original loses a reference.  The caller changes the copy
+//	and writes it back.  Return FALSE if there is no room for the copy.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"i" is the entry
+//	"child" receives the copy
+//	"goal" is where the copy should go, if there is room
+//----------------------------------------------------------------------
+
+bool FileHeader::CopyIndex(PersistentBitmap *freeMap, int i, FileHeader *child, int goal)
+{
+	int copy = freeMap->FindAndSet(goal);
+
+	if(copy == -1)
+		return FALSE;
+	child->FetchFrom(dataSectors[i]);
+	if(!child->Share(freeMap)) {
+		freeMap->Clear(copy);
+		return FALSE;
+	}
+	freeMap->Unshare(dataSectors[i]);
+	dataSectors[i] = copy;
+	return TRUE;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::FetchFrom
 // 	Fetch contents of file header from disk.
@@ -213,12 +844,10 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap)
 
 void FileHeader::FetchFrom(int sector)
 {
-	kernel->synchDisk->ReadSector(sector, (char *)this);
+	char buf[SectorSize];
 
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you will need to rebuild the header's structure
-	*/
+	kernel->synchDisk->ReadSector(sector, buf);
+	Decode(buf);
 }
 
 //----------------------------------------------------------------------
@@ -230,16 +859,48 @@ void FileHeader::FetchFrom(int sector)
 
 void FileHeader::WriteBack(int sector)
 {
-	kernel->synchDisk->WriteSector(sector, (char *)this);
-
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you may not want to write all fields into disk.
-		Use this instead:
-		char buf[SectorSize];
-		memcpy(buf + offset, &dataToBeWritten, sizeof(dataToBeWritten));
-		...
-	*/
+	char buf[SectorSize];
+
+	Encode(buf);
+	kernel->synchDisk->WriteSector(sector, buf);
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileHeader::Encode/Decode
+// 	Convert between the header and what it looks like on disk: the
+//	length, the sector count, the level, and the sector table.  That
+//	the file is compressed is kept in the level, as CompressedBias
+//	added to it; that it shares sectors, as SharedBias.
+//
+//	"buf" -- a sector's worth of bytes
+//----------------------------------------------------------------------
+
+void FileHeader::Encode(char *buf)
+{
+	int *disk = (int *)buf;
+
+	disk[0] = numBytes;
+	disk[1] = numSectors;
+	disk[2] = level + (compressed ? CompressedBias : 0) +
+			  (shared ? SharedBias : 0);
+	memcpy(&disk[3], dataSectors, sizeof(dataSectors));
+}
+
+void FileHeader::Decode(char *buf)
+{
+	int *disk = (int *)buf;
+
+	numBytes = disk[0];
+	numSectors = disk[1];
+	level = disk[2];
+	memcpy(dataSectors, &disk[3], sizeof(dataSectors));
+	shared = (level >= InlineLevel + SharedBias);
+	if(shared)
+		level -= SharedBias;
+	compressed = (level >= InlineLevel + CompressedBias);
+	if(compressed)
+		level -= CompressedBias;
 }
 
 //----------------------------------------------------------------------
@@ -249,6 +910,8 @@ void FileHeader::WriteBack(int sector)
 //	offset in the file) to a physical address (the sector where the
 //	data at the offset is stored).
 //
+//	Return -1 if the byte is in a hole.
+//
 //	"offset" is the location within the file of the byte in question
 //----------------------------------------------------------------------
 
@@ -257,11 +920,14 @@ int FileHeader::ByteToSector(int offset)
 	// return (dataSectors[offset / SectorSize]);
 
 	// MP4
+	ASSERT(level != InlineLevel);
 	if(level == 0) {
 		return dataSectors[offset / SectorSize];
 	}
 	else if(level == 1) {
 		int idx = offset / MaxDirectSize;
+		if(dataSectors[idx] == -1)
+			return -1;
 		FileHeader *nextHdr = new FileHeader;
 		nextHdr->FetchFrom(dataSectors[idx]);
 		int ret = nextHdr->ByteToSector(offset % MaxDirectSize); //取mod可以得知其在nextHdr裡的offset，遞迴直到找到資料在level 0裡所在的sector
@@ -270,6 +936,8 @@ int FileHeader::ByteToSector(int offset)
 	}
 	else if(level == 2) {
 		int idx = offset / MaxSingleIndirectSize;
+		if(dataSectors[idx] == -1)
+			return -1;
 		FileHeader *nextHdr = new FileHeader;
 		nextHdr->FetchFrom(dataSectors[idx]);
 		int ret = nextHdr->ByteToSector(offset % MaxSingleIndirectSize);
@@ -278,6 +946,8 @@ int FileHeader::ByteToSector(int offset)
 	}
 	else if(level == 3) {
 		int idx = offset / MaxDoubleIndirectSize;
+		if(dataSectors[idx] == -1)
+			return -1;
 		FileHeader *nextHdr = new FileHeader;
 		nextHdr->FetchFrom(dataSectors[idx]);
 		int ret = nextHdr->ByteToSector(offset % MaxDoubleIndirectSize);
@@ -290,6 +960,75 @@ int FileHeader::ByteToSector(int offset)
 	}
 }
 
+//----------------------------------------------------------------------
+// FileHeader::ByteToSectors
+// 	Translate "numSectors" consecutive file sectors, starting at the
+//	sector-aligned byte "offset", into their disk sectors.  Unlike
+//	calling ByteToSector once per sector, each index header on the way
+//	is fetched only once, so a whole request costs a handful of header
+//	reads instead of one chain of them per sector.  Sectors in holes
+//	come back as -1.
+//
+//	An index header that starts a run of them (as MapIndex lays them
+//	out) brings the rest of the run into the cache with it, in the
+//	same request: so a sequential read doesn't go back from the data
+//	to the index for every header.
+//
+//	"offset" is the location within the file of the first sector
+//	"numSectors" is the number of sectors to translate
+//	"sectorList" receives the disk sector numbers
+//----------------------------------------------------------------------
+
+void FileHeader::ByteToSectors(int offset, int numSectors, int *sectorList)
+{
+	int childSize;
+
+	// MP4
+	ASSERT(level != InlineLevel);
+	if(level == 0) {
+		for(int i = 0; i < numSectors; i++)
+			sectorList[i] = dataSectors[offset / SectorSize + i];
+		return;
+	}
+	else if(level == 1)
+		childSize = MaxDirectSize;
+	else if(level == 2)
+		childSize = MaxSingleIndirectSize;
+	else if(level == 3)
+		childSize = MaxDoubleIndirectSize;
+	else {
+		ASSERT(FALSE);
+		return;
+	}
+
+	while(numSectors > 0) {
+		int idx = offset / childSize;
+		int within = offset % childSize;
+		int n = min(numSectors, (childSize - within) / SectorSize); // sectors left in this child
+
+		if(dataSectors[idx] == -1) {
+			for(int i = 0; i < n; i++)
+				sectorList[i] = -1;
+		}
+		else {
+			FileHeader *nextHdr = new FileHeader;
+			int run = 1;
+
+			while(idx + run < (int)NumDirect && dataSectors[idx + run] == dataSectors[idx] + run)
+				run++;
+			if(run > 1)
+				kernel->synchDisk->Prefetch(&dataSectors[idx], run);
+			nextHdr->FetchFrom(dataSectors[idx]);
+			nextHdr->ByteToSectors(within, n, sectorList);
+			delete nextHdr;
+		}
+
+		sectorList += n;
+		numSectors -= n;
+		offset += n * SectorSize;
+	}
+}
+
 //----------------------------------------------------------------------
 // FileHeader::FileLength
 // 	Return the number of bytes in the file.
@@ -313,12 +1052,28 @@ void FileHeader::Print()
 
 	printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
 
+	if(level == InlineLevel) {
+		// MP4 no blocks: the data is right here
+		printf("(inline)\n\nFile contents:\n");
+		for (k = 0; k < numBytes; k++) {
+			char c = ((char *)dataSectors)[k];
+
+			if ('\040' <= c && c <= '\176') // isprint(c)
+				printf("%c", c);
+			else
+				printf("\\%x", (unsigned char)c);
+		}
+		printf("\n");
+		delete[] data;
+		return;
+	}
+
 
     int totalHeaders = 1; // 計算當前層級的 FileHeader
     for (i = 0; i < numSectors; i++) {
         printf("%d ", dataSectors[i]);
 
-		if(this->level > 0) {
+		if(this->level > 0 && dataSectors[i] != -1) {
 			FileHeader nextHdr;
 			nextHdr.FetchFrom(dataSectors[i]);
 			totalHeaders += nextHdr.CountHeaders();
@@ -330,7 +1085,10 @@ void FileHeader::Print()
 	printf("\nFile contents:\n");
 	for (i = k = 0; i < numSectors; i++)
 	{
-		kernel->synchDisk->ReadSector(dataSectors[i], data);
+		if (dataSectors[i] == -1)
+			memset(data, 0, SectorSize); // a hole
+		else
+			kernel->synchDisk->ReadSector(dataSectors[i], data);
 		for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++)
 		{
 			if ('\040' <= data[j] && data[j] <= '\176') // isprint(data[j])
@@ -347,23 +1105,11 @@ void FileHeader::Print()
 int FileHeader::CountHeaders() {
     int count = 1; // Count the current header
 
-    if (numBytes > MaxDirectSize && numBytes <= MaxSingleIndirectSize) {
-        // Count single indirect headers
-        for (int i = 0; i < numSectors; i++) {
-            FileHeader nextHdr;
-            nextHdr.FetchFrom(dataSectors[i]);
-            count += nextHdr.CountHeaders();
-        }
-    } else if (numBytes > MaxSingleIndirectSize && numBytes <= MaxDoubleIndirectSize) {
-        // Count double indirect headers
-        for (int i = 0; i < numSectors; i++) {
-            FileHeader nextHdr;
-            nextHdr.FetchFrom(dataSectors[i]);
-            count += nextHdr.CountHeaders();
-        }
-    } else if (numBytes > MaxDoubleIndirectSize && numBytes <= MaxTripleIndirectSize) {
-        // Count triple indirect headers
-        for (int i = 0; i < numSectors; i++) {
+    if (level > 0) {
+        // Count the index headers below, skipping holes
+        for (int i = 0; i < NumDirect; i++) {
+            if (dataSectors[i] == -1)
+                continue;
             FileHeader nextHdr;
             nextHdr.FetchFrom(dataSectors[i]);
             count += nextHdr.CountHeaders();
@@ -371,4 +1117,4 @@ int FileHeader::CountHeaders() {
     }
 
     return count;
-}
\ No newline at end of file
+}
@@ -22,6 +22,29 @@
 #define MaxSingleIndirectSize (NumDirect * NumDirect * SectorSize)
 #define MaxDoubleIndirectSize (NumDirect * MaxSingleIndirectSize)
 #define MaxTripleIndirectSize (NumDirect * MaxDoubleIndirectSize)
+#define MaxFileSize MaxTripleIndirectSize
+
+// MP4 a file this small keeps its bytes in the header itself, where the
+// sector table would be
+#define InlineLevel -1
+#define MaxInlineSize ((int)(NumDirect * sizeof(int)))
+
+// MP4 the data of a compressed file is kept in chunks of this many
+// sectors, each compressed on its own (see openfile.h)
+#define ChunkSectors 16
+#define ChunkSize (ChunkSectors * SectorSize)
+
+// MP4 on disk, a compressed file's header has this added to its level
+#define CompressedBias 16
+
+// MP4 ... and the header of a file that shares sectors with a clone
+// (or is one), this
+#define SharedBias 32
+
+// MP4 most file sectors a new file gets the index of ahead of its data:
+// as many as a write maps at once (cf. MaxReserveRun in openfile.cc),
+// so that the index headers of a range lie just ahead of its data
+#define MaxIndexSpan 256
 
 
 // The following class defines the Nachos "file header" (in UNIX terms,
@@ -38,6 +61,44 @@
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
 // reading it from disk.
+//
+// Files grow on demand: Extend raises the length (adding a level of
+// indirection when the file outgrows the current one), and MapSectors
+// allocates data and index sectors the first time they are written.
+// A sector that was never written is a hole, recorded as -1; it
+// takes no space on disk and reads as zeros.
+//
+// The routines that allocate take a "goal": the sector the caller
+// would like the file to grow from (just past the file's header, in
+// the same allocation group; cf. pbitmap.h).  A data sector goes just
+// past the one before it, and an index header's entries just past it,
+// so that a file written from start to end lies in one run, in the
+// order a sequential read visits it.  Before a large range is written,
+// MapIndex builds the index headers it is missing in bulk: they take
+// one run of their own, in that order, written in one request, and the
+// range's data then follows them.
+//
+// A new file starts out inline (level InlineLevel): as long as it is at
+// most MaxInlineSize bytes long, its data is kept in the header sector,
+// in place of the sector table, and it has no data sectors at all.
+// Extending it past that spills the data into a sector of its own.
+//
+// A file may be compressed (see OpenFile::WriteChunks): then its data
+// is in chunks of ChunkSectors sectors, and a chunk that compresses
+// well only has its first few sectors allocated; the rest of it is a
+// hole.  The header only records that the file is compressed; the
+// sector table, at every level, is the same as for any other file, so
+// finding the sectors of a chunk is as quick as ever.
+//
+// A clone of a file starts out with a copy of the file's header, and
+// shares everything below it (see Share): each sector the two headers
+// point to counts one more reference in the free map, which covers
+// everything below that sector too.  Both files are then marked as
+// sharing.  Writing to such a file maps its sectors with MapSectors
+// first, which gives it copies of its own of the sectors it writes,
+// and of the index headers on the way to them -- each copy sharing
+// what the original points to.  A file stays marked once it has
+// shared, even after the sectors it shared are its own again.
 
 class FileHeader
 {
@@ -46,16 +107,33 @@ public:
 	FileHeader(); // dummy constructor to keep valgrind happy
 	~FileHeader();
 
-	bool Allocate(PersistentBitmap *bitMap, int fileSize); // Initialize a file header, including allocating space on disk for the file data
+	bool Allocate(PersistentBitmap *bitMap, int fileSize, int goal); // Initialize a file header, including allocating space on disk for the file data (from "goal" on, if there is room)
 	void Deallocate(PersistentBitmap *bitMap);			   // De-allocate this file's data blocks
+	bool Extend(PersistentBitmap *bitMap, int newSize, int goal); // Grow the file to "newSize" bytes, leaving the new part a hole
+	int MapSectors(PersistentBitmap *bitMap, int offset, int numSectors, int *sectorList, int goal, bool relocate = FALSE); // Like ByteToSectors, allocating the holes (near "goal")
+	int MapIndex(PersistentBitmap *bitMap, int offset, int numSectors, int goal); // Allocate just the index headers such a range is missing, in one run
+	int Unmap(PersistentBitmap *bitMap, int offset, int numSectors); // Free "numSectors" data sectors from "offset" on, leaving a hole
 
 	void FetchFrom(int sectorNumber); // Initialize file header from disk
 	void WriteBack(int sectorNumber); // Write modifications to file header back to disk
 
-	int ByteToSector(int offset); // Convert a byte offset into the file to the disk sector containing the byte
+	int ByteToSector(int offset); // Convert a byte offset into the file to the disk sector containing the byte (-1 in a hole)
+	void ByteToSectors(int offset, int numSectors, int *sectorList); // Same, for "numSectors" consecutive sectors starting at "offset", fetching each index header once
 
 	int FileLength(); // Return the length of the file in bytes
 
+	bool IsInline() { return level == InlineLevel; } // Is the data in the header?
+	bool IsCompressed() { return compressed; } // Is the data kept in compressed chunks?
+	void SetCompressed(bool on) { compressed = on; } // Say so (for a new, empty file)
+	bool IsShared() { return shared; } // May sectors below be shared with another file?
+	void SetShared(bool on) { shared = on; } // Say so
+	bool Share(PersistentBitmap *bitMap); // Count one more reference to everything this header points to
+	int Level() { return level; } // Levels of index headers below this one
+	int GetEntry(int i) { return dataSectors[i]; } // Where entry "i" points: a data sector at level 0, an index header above; -1 in a hole
+	void SetEntry(int i, int sector) { dataSectors[i] = sector; } // Point entry "i" elsewhere (the caller moves the sector)
+	void ReadInline(char *into, int numBytes, int position);  // Copy data out of an inline file,
+	void WriteInline(char *from, int numBytes, int position); // or into it, growing it if need be
+
 	void Print(); // Print the contents of the file.
 
 	int CountHeaders(); // Count the number of headers in the file (MP4 bonus2)
@@ -72,7 +150,7 @@ private:
 		
 		Disk Part - numBytes, numSectors, dataSectors occupy exactly 128 bytes and will be
 		written to a sector on disk.
-		In-core part - none
+		In-core part - compressed, shared (kept on disk in the level word, cf. CompressedBias, SharedBias)
 		
 	*/
 
@@ -80,7 +158,20 @@ private:
     int numSectors; 			// Number of data sectors in the file
 	int level; 					// Indicate the level of the file	
     int dataSectors[NumDirect]; // Disk sector numbers for each data block in the file
-
+								// (or index header below this one), -1 if not allocated;
+								// the data itself, in an inline file
+	bool compressed;			// MP4 is the data in compressed chunks?
+	bool shared;				// MP4 may its sectors be shared?
+
+	// MP4
+	void InitIndex(int childLevel); // Initialize an empty index header
+	bool Spill(PersistentBitmap *freeMap, int goal); // Move inline data out to a data sector
+	void Encode(char *buf); // Lay out the disk part in a sector's worth of "buf"
+	void Decode(char *buf); // ... and back
+	void Fill(PersistentBitmap *freeMap, int size, FileHeader *index, int *indexSectors, int *used, int *goal); // Point the entries at index headers set aside by Allocate, and at new data blocks
+	int CountMissing(PersistentBitmap *freeMap, int offset, int size); // Index headers missing below this one for a range
+	bool FillIndex(PersistentBitmap *freeMap, int offset, int size, int *run, int *taken, FileHeader *index, int *indexSectors, int *used); // Point the missing entries at index headers set aside by MapIndex
+	bool CopyIndex(PersistentBitmap *freeMap, int i, FileHeader *child, int goal); // Give entry "i", an index header shared with other files, a copy of its own
 };
 
 #endif // FILEHDR_H
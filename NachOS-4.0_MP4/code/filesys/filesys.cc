@@ -10,7 +10,9 @@
 //	   An entry in the file system directory
 //
 // 	The file system consists of several data structures:
-//	   A bitmap of free disk sectors (cf. bitmap.h)
+//	   A bitmap of free disk sectors (cf. bitmap.h), kept in memory
+//	    while the disk is mounted; an operation writes back only the
+//	    sectors of it that changed
 //	   A directory of file names and file headers
 //
 //      Both the bitmap and the directory are represented as normal
@@ -25,19 +27,59 @@
 //	directory and/or bitmap, if the operation succeeds, the changes
 //	are written immediately back to disk (the two files are kept
 //	open during all this time).  If the operation fails, and we have
-//	modified part of the directory and/or bitmap, we simply discard
-//	the changed version, without writing it back to disk.
+//	modified part of the directory, we simply discard the changed
+//	version, without writing it back to disk; bits we set in the
+//	bitmap are cleared again.
+//
+//	Each such operation is an update of the journal (cf. journal.h):
+//	everything it writes is committed to the log as a whole, and only
+//	later copied to where it belongs.  If Nachos stops in the middle,
+//	mounting the disk replays the log, so the operation either happens
+//	entirely or not at all.
+//
+//	A disk can also be formatted log-structured.  Then every sector
+//	the file system allocates -- for a header, an index header, data
+//	-- is taken at the head of a log that goes through the disk one
+//	clean segment at a time (see pbitmap.h), whichever file it is for;
+//	a write to a file moves what it writes over there too, rather
+//	than writing in place (see FileHeader::MapSectors); and a small
+//	write goes into the journal together with the metadata it changes
+//	(see OpenFile::WriteAt).  So writing is
+//	mostly appending: to the journal, in one request per commit, and
+//	to the segment the log is in, when a checkpoint copies home the
+//	data and headers it wrote there.  A cleaner thread empties the
+//	segments with the least left in them once clean ones run short
+//	(see Defragmenter::Clean).  The journal header doubles as the
+//	checkpoint region: it records the layout, and where the log was.
+//
+//	Threads can use the file system at the same time.  Each part of
+//	what they share has a lock of its own, so that operations that
+//	don't touch the same things go on together, one running while the
+//	others wait for the disk:
+//	   the namespace: a reader/writer lock, held to read by every
+//	    operation that looks up a path, and alone by the removal of a
+//	    directory (which takes the paths through it away) and by a
+//	    clone (which involves two directories)
+//	   each directory: a reader/writer lock (see filetable.h), held to
+//	    read while its entries are looked at, and alone while an
+//	    operation reads, changes and writes them back
+//	   each file header: a lock, held while the header is looked up in
+//	    or changed (see openfile.cc)
+//	   the free map: a lock, held from FetchFreeMap to ReleaseFreeMap
+//	A thread takes them in that order, the directories on a path from
+//	the top down, and only after starting its journal update.  So a
+//	create in one directory waits for nothing but the disk while a
+//	create in another goes on: their updates are committed together.
 //
 // 	Our implementation at this point has the following restrictions:
 //
-//	   there is no synchronization for concurrent accesses
-//	   files have a fixed size, set when the file is created
-//	   files cannot be bigger than about 3KB in size
-//	   there is no hierarchical directory structure, and only a limited
-//	     number of files can be added to the system
-//	   there is no attempt to make the system robust to failures
-//	    (if Nachos exits in the middle of an operation that modifies
-//	    the file system, it may corrupt the disk)
+//	   a file grows when it is written past its end, but no further
+//	    than MaxFileSize (about 90MB: what three levels of indirect
+//	    blocks reach, see filehdr.h); the 64MB disk runs out first
+//	   files cannot be truncated; a file only gives its sectors back
+//	    when it is removed
+//	   only the metadata is journaled; the data written to a file
+//	    may be lost in a failure (but never shows up in the wrong file)
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -51,6 +93,12 @@
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "journal.h"
+#include "filetable.h"
+#include "defrag.h"
+#include "synchdisk.h"
+#include "synch.h"
+#include "main.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
 // and the directory of files.  These file headers are placed in well-known
@@ -58,12 +106,28 @@
 #define FreeMapSector 0
 #define DirectorySector 1
 
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number
-// of files that can be loaded onto the disk.
-#define FreeMapFileSize (NumSectors / BitsInByte)
-#define NumDirEntries 64 // MP4 add，因spec規定一個directory裡要支援64個file/directory
-#define DirectoryFileSize (sizeof(DirectoryEntry) * NumDirEntries)
+// Initial file sizes for the bitmap and directory; a directory grows
+// from DirectoryFileSize (cf. directory.h) as files are added to it.
+// The bitmap file also has room after the bits for the table counting
+// the files that share a sector, for the few sectors that are
+// (cf. pbitmap.h).
+#define FreeMapFileSize (NumSectors / BitsInByte + SharedTableSize)
+
+// Clean segments the log of a log-structured disk keeps at hand: the
+// cleaner starts when there are fewer than CleanLowWater, and cleans
+// until there are CleanHighWater
+#define CleanLowWater 8
+#define CleanHighWater 16
+
+//----------------------------------------------------------------------
+// SegmentCleaner
+// 	The body of the cleaner thread of a log-structured disk.
+//----------------------------------------------------------------------
+
+static void SegmentCleaner(void *fileSystem)
+{
+    ((FileSystem *)fileSystem)->CleanSegments();
+}
 
 //----------------------------------------------------------------------
 // FileSystem::FileSystem
@@ -75,16 +139,29 @@
 //	If format = FALSE, we just have to open the files
 //	representing the bitmap and the directory.
 //
+//	Either way, if the disk is (to be) log-structured, its free map
+//	then starts handing out sectors at the head of the log.
+//
 //	"format" -- should we initialize the disk?
+//	"logStructured" -- if so, should it be laid out as a log?  (A
+//		disk that is already formatted says for itself.)
 //----------------------------------------------------------------------
 
-FileSystem::FileSystem(bool format)
+FileSystem::FileSystem(bool format, bool logStructured)
 {
     DEBUG(dbgFile, "Initializing the file system.");
+    openFileTable = new OpenFileTable;
+    freeMapLock = new Lock("free map");
+    freeMapDepth = 0;
+    namespaceLock = new RWLock("namespace");
+    cleaner = NULL;
+    cleanerWork = NULL;
+    cleanerAwake = FALSE;
+    cleanedAt = -1;
     if (format)
     {
-        PersistentBitmap *freeMap = new PersistentBitmap(NumSectors);
-        Directory *directory = new Directory(NumDirEntries);
+        freeMap = new PersistentBitmap(NumSectors);
+        Directory *directory = new Directory();
         FileHeader *mapHdr = new FileHeader;
         FileHeader *dirHdr = new FileHeader;
 
@@ -94,12 +171,13 @@ FileSystem::FileSystem(bool format)
         // (make sure no one else grabs these!)
         freeMap->Mark(FreeMapSector);
         freeMap->Mark(DirectorySector);
+        Journal::Format(freeMap, logStructured);
 
         // Second, allocate space for the data blocks containing the contents
         // of the directory and bitmap files.  There better be enough space!
 
-        ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize));
-        ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize));
+        ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize, FreeMapSector));
+        ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize, DirectorySector));
 
         // Flush the bitmap and directory FileHeaders back to disk
         // We need to do this before we can "Open" the file, since open
@@ -115,7 +193,7 @@ FileSystem::FileSystem(bool format)
         // while Nachos is running.
 
         freeMapFile = new OpenFile(FreeMapSector);
-        directoryFile = new OpenFile(DirectorySector);
+        directoryFile = new OpenFile(DirectorySector, openFileTable);
 
         // Once we have the files "open", we can write the initial version
         // of each file back to disk.  The directory at this point is completely
@@ -132,40 +210,204 @@ FileSystem::FileSystem(bool format)
             freeMap->Print();
             directory->Print();
         }
-        delete freeMap;
         delete directory;
         delete mapHdr;
         delete dirHdr;
+        MountJournal();
     }
     else
     {
-        // if we are not formatting the disk, just open the files representing
-        // the bitmap and directory; these are left open while Nachos is running
+        // if we are not formatting the disk, bring the metadata up to date
+        // from the journal, then just open the files representing the
+        // bitmap and directory; these are left open while Nachos is running
+        MountJournal();
         freeMapFile = new OpenFile(FreeMapSector);
-        directoryFile = new OpenFile(DirectorySector);
+        directoryFile = new OpenFile(DirectorySector, openFileTable);
+        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+    }
+
+    if (journal != NULL && journal->LogStructured())
+    {
+        DEBUG(dbgFile, "Log-structured disk, log head at " << journal->LogHead());
+        freeMap->StartLog(journal->LogHead());
+        cleanerWork = new Semaphore("segment cleaner", 0);
     }
 }
 
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileSystem::~FileSystem
+//	The disk is gone by now, so the journal is not checkpointed;
+//	whatever it still holds is replayed at the next mount.
 //----------------------------------------------------------------------
 FileSystem::~FileSystem()
 {
+    delete freeMap;
     delete freeMapFile;
     delete directoryFile;
+    delete openFileTable;
+    delete journal;
+    delete cleanerWork;
+    delete freeMapLock;
+    delete namespaceLock;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::MountJournal
+// 	Replay whatever the journal committed and did not copy home yet,
+//	and from now on send metadata writes through it.  A disk formatted
+//	without a journal is used without one.
+//----------------------------------------------------------------------
+
+void FileSystem::MountJournal()
+{
+    journal = new Journal;
+    if (journal->Recover())
+        kernel->synchDisk->AttachJournal(journal);
+    else
+    {
+        DEBUG(dbgFile, "No journal on this disk.");
+        delete journal;
+        journal = NULL;
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystem::BeginUpdate/EndUpdate
+// 	Bracket an operation that changes the metadata (headers,
+//	directories, the free map), so that its writes are committed
+//	together.  Updates can nest; the outermost one commits.  InUpdate
+//	tells whether the current thread is in one.
+//----------------------------------------------------------------------
+
+void FileSystem::BeginUpdate()
+{
+    if (journal != NULL)
+        journal->Begin();
+}
+
+void FileSystem::EndUpdate()
+{
+    if (journal != NULL)
+        journal->End();
+}
+
+bool FileSystem::InUpdate()
+{
+    return journal != NULL && journal->Updating();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::BeginBatch/EndBatch
+// 	Bracket a series of updates (say, creating and writing a file) so
+//	that they are committed in as few groups as possible.  Nothing in
+//	the batch is safe on disk until EndBatch returns.
+//----------------------------------------------------------------------
+
+void FileSystem::BeginBatch()
+{
+    if (journal != NULL)
+        journal->Hold();
+}
+
+void FileSystem::EndBatch()
+{
+    if (journal != NULL)
+        journal->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Flush
+// 	Return once every update finished so far is committed.
+//----------------------------------------------------------------------
+
+void FileSystem::Flush()
+{
+    if (journal != NULL)
+        journal->Flush();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Sync
+// 	Store everything written so far: what the open files gather in
+//	their write buffers (see OpenFile::BufferWrites), and the updates
+//	not committed yet.  Nachos calls this before halting, while the
+//	disk is still there; the files may stay open.
+//----------------------------------------------------------------------
+
+void FileSystem::Sync()
+{
+    openFileTable->Sync();
+    Flush();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::LogStructured
+// 	Return TRUE if the disk is laid out as a log of segments.
+//----------------------------------------------------------------------
+
+bool FileSystem::LogStructured()
+{
+    return freeMap->Logging();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::WakeCleaner
+// 	The log is running short of clean segments: get the cleaner going,
+//	starting its thread the first time.  If it gave up last time, it
+//	is only worth trying again once more sectors have been freed.
+//----------------------------------------------------------------------
+
+void FileSystem::WakeCleaner()
+{
+    if (cleanerAwake || freeMap->NumClear() <= cleanedAt)
+        return;
+    cleanerAwake = TRUE;
+    if (cleaner == NULL)
+    {
+        cleaner = new Thread("segment cleaner", 0);
+        cleaner->Fork((VoidFunctionPtr)SegmentCleaner, (void *)this);
+    }
+    cleanerWork->V();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::CleanSegments
+// 	The cleaner thread: each time it is woken up, clean segments until
+//	there are enough of them, while the file system stays in use.
+//----------------------------------------------------------------------
+
+void FileSystem::CleanSegments()
+{
+    for (;;)
+    {
+        Defragmenter *defragmenter;
+
+        cleanerWork->P();
+        defragmenter = new Defragmenter(openFileTable);
+        defragmenter->Clean(DirectorySector, CleanHighWater);
+        delete defragmenter;
+        if (freeMap->NumCleanSegments() < CleanHighWater)
+            cleanedAt = freeMap->NumClear(); // nothing more to be done
+        else
+            cleanedAt = -1;
+        cleanerAwake = FALSE;
+    }
 }
 
 //----------------------------------------------------------------------
 // FileSystem::Create
 // 	Create a file in the Nachos file system (similar to UNIX create).
-//	Since we can't increase the size of files dynamically, we have
-//	to give Create the initial size of the file.
+//	The file starts out "initialSize" bytes long, but no data blocks
+//	are allocated: the file is all hole, and it gets its blocks as
+//	they are written (see OpenFile::WriteAt).  Only the index headers
+//	of its first MaxIndexSpan sectors are, if it is that big: in one
+//	run just past its header, so that the data written there follows
+//	them (see FileHeader::MapIndex).
 //
 //	The steps to create a file are:
 //	  Make sure the file doesn't already exist
 //        Allocate a sector for the file header
-// 	  Allocate space on disk for the data blocks for the file
 //	  Add the name to the directory
 //	  Store the new file header on disk
 //	  Flush the changes to the bitmap and the directory back to disk
@@ -176,71 +418,204 @@ FileSystem::~FileSystem()
 //   		file is already in directory
 //	 	no free space for file header
 //	 	no free entry for file in directory
-//	 	no free space for data blocks for the file
+//	 	file too big, or no free space for its index headers
 //
-// 	Note that this implementation assumes there is no concurrent access
-//	to the file system!
+//	The directory is locked from when it is read until it is written
+//	back, so that two creates in it can't both find the name missing,
+//	or write back copies with only their own file in them.
 //
 //	"name" -- name of file to be created
 //	"initialSize" -- size of file to be created
+//	"compressed" -- should its data be kept in compressed chunks?
+//		(see OpenFile::WriteChunks)
 //----------------------------------------------------------------------
 
-bool FileSystem::Create(char *name, int initialSize)
+bool FileSystem::Create(char *name, int initialSize, bool compressed)
 {
     Directory *directory;
-    PersistentBitmap *freeMap;
     FileHeader *hdr;
     int sector;
     bool success;
 
     // MP4
     OpenFile* file;     // final directory file
-    Directory* root;    // root directory
+    PersistentBitmap *map;
     int direcSector;    // final directory file's sector
     char dirPath[256], fileName[10];
 
     SplitPath(name, dirPath, fileName); //進行拆解動作
 
     DEBUG(dbgFile, "Creating file " << fileName << " size " << initialSize);
+    BeginUpdate();
+    namespaceLock->AcquireRead();
 
     // MP4 add
-    root = new Directory(NumDirEntries);
-    directory = new Directory(NumDirEntries);
-    root->FetchFrom(directoryFile); //將root directory讀進來
-    direcSector = root->GetDirSector(dirPath); //找到最終directory的sector
-    file = new OpenFile(direcSector); //開啟最終directory檔案
+    directory = new Directory();
+    direcSector = LookUp(dirPath); //找到最終directory的sector
+    file = new OpenFile(direcSector, openFileTable); //開啟最終directory檔案
+    file->LockContents(TRUE);
     directory->FetchFrom(file); //把directory抓進來
 
     if (directory->Find(fileName) != -1)
         success = FALSE; // file is already in directory
     else
     {
-        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-        sector = freeMap->FindAndSet(); // find a sector to hold the file header
+        // find a sector to hold the file header, in the group of its
+        // directory (cf. pbitmap.h)
+        map = FetchFreeMap();
+        sector = map->FindAndSet(direcSector + 1);
         if (sector == -1)
             success = FALSE; // no free block for file header
         else if (!directory->Add(fileName, sector, FALSE)) //此為file，isDir是FALSE
+        {
+            map->Clear(sector);
             success = FALSE; // no space in directory
+        }
         else
         {
             hdr = new FileHeader;
-            if (!hdr->Allocate(freeMap, initialSize))
+            hdr->SetCompressed(compressed);
+            if (!hdr->Allocate(map, 0, sector + 1) ||
+                !hdr->Extend(map, initialSize, sector + 1) ||
+                hdr->MapIndex(map, 0, min(divRoundUp(initialSize, SectorSize),
+                                          MaxIndexSpan), sector + 1) == -1)
+            {
+                hdr->Deallocate(map); // give back what was allocated
+                map->Clear(sector);
                 success = FALSE; // no space on disk for data
+            }
             else
             {
                 success = TRUE;
                 // everthing worked, flush all changes back to disk
                 hdr->WriteBack(sector);
-                directory->WriteBack(file); //更新directory
-                freeMap->WriteBack(freeMapFile);
             }
             delete hdr;
         }
-        delete freeMap;
+        ReleaseFreeMap(map, success);
+        if (success)
+            directory->WriteBack(file); //更新directory
     }
     delete directory;
-    delete root;
+    file->UnlockContents();
+    delete file;
+    namespaceLock->Release();
+    EndUpdate();
+    return success;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileSystem::Clone
+// 	Make a new file with the same contents as an existing one, without
+//	copying them: the clone gets a header of its own, pointing at the
+//	same sectors, which count one more reference each (cf. pbitmap.h).
+//	Whichever of the two is written to later gets copies of the
+//	sectors it changes (see FileHeader::MapSectors); the rest stay
+//	shared until the last file using them lets go of them.
+//
+//	As sharing is counted at the top of the tree, a clone costs a
+//	header, a directory entry, and a few sectors of the free map,
+//	however big the file is.  Both headers are marked shared, for
+//	good: from then on, every write to either checks what it writes
+//	over (see OpenFile::WriteAt).
+//
+//	A clone involves two directories (or the same one twice); rather
+//	than lock them in some order, it has the namespace to itself.
+//	It gets what the file's opens have written so far, including what
+//	they only have in their write buffer (see OpenFile::BufferWrites).
+//
+//	Return TRUE if the clone was made; FALSE if "from" doesn't exist
+//	or is a directory, "to" exists already, or there is no room.
+//
+//	"from" -- the text name of the file to be cloned
+//	"to" -- the text name of the clone
+//----------------------------------------------------------------------
+
+bool FileSystem::Clone(char *from, char *to)
+{
+    Directory *directory = new Directory();
+    OpenFile *file;
+    FileHeader *original, *hdr;
+    PersistentBitmap *map;
+    Lock *originalLock;
+    int fromSector, direcSector, sector;
+    bool success = FALSE;
+    char dirPath[256], fileName[10];
+
+    DEBUG(dbgFile, "Cloning file " << from << " as " << to);
+
+    // what the opens of the file have in their write buffer belongs in
+    // the clone too: write it out first (before our update: a write
+    // starts one of its own)
+    namespaceLock->AcquireRead();
+    fromSector = LookUp(from);
+    namespaceLock->Release();
+    if (fromSector != -1)
+    {
+        file = new OpenFile(fromSector, openFileTable);
+        file->Flush();
+        delete file;
+    }
+
+    BeginUpdate();
+    namespaceLock->AcquireWrite();
+
+    // the file to clone, which must not be a directory
+    SplitPath(from, dirPath, fileName);
+    direcSector = LookUp(dirPath);
+    file = new OpenFile(direcSector, openFileTable);
+    directory->FetchFrom(file);
+    fromSector = directory->Find(fileName);
+    if (fromSector != -1 && directory->isDir(fileName))
+        fromSector = -1;
+    delete file;
+
+    // and where the clone goes, as Create does
+    SplitPath(to, dirPath, fileName);
+    direcSector = LookUp(dirPath);
+    file = new OpenFile(direcSector, openFileTable);
+    directory->FetchFrom(file);
+
+    if (fromSector != -1 && directory->Find(fileName) == -1)
+    {
+        // the header the file's opens share, if it is open; they may
+        // be writing to it
+        original = openFileTable->Acquire(fromSector);
+        originalLock = openFileTable->Lookup(fromSector)->lock;
+        originalLock->Acquire();
+        map = FetchFreeMap();
+        if (map->CanShare() &&
+            (sector = map->FindAndSet(direcSector + 1)) != -1)
+        {
+            hdr = new FileHeader;
+            *hdr = *original;
+            if (!directory->Add(fileName, sector, FALSE) || !hdr->Share(map))
+                map->Clear(sector); // no space in directory, or too many
+                                    // clones of the file already
+            else
+            {
+                success = TRUE;
+                if (!hdr->IsInline())
+                {
+                    original->SetShared(TRUE);
+                    hdr->SetShared(TRUE);
+                    original->WriteBack(fromSector);
+                }
+                hdr->WriteBack(sector);
+            }
+            delete hdr;
+        }
+        ReleaseFreeMap(map, success);
+        originalLock->Release();
+        openFileTable->Release(fromSector);
+        if (success)
+            directory->WriteBack(file);
+    }
     delete file;
+    delete directory;
+    namespaceLock->Release();
+    EndUpdate();
     return success;
 }
 
@@ -249,50 +624,116 @@ bool FileSystem::Create(char *name, int initialSize)
 // 	Open a file for reading and writing.
 //	To open a file:
 //	  Find the location of the file's header, using the directory
-//	  Bring the header into memory
+//	  Bring the header into memory, unless the file is open already;
+//	    then share the header its other opens use
+//	  Have small writes to it gathered into whole sectors (see
+//	    OpenFile::BufferWrites); the file system's own opens of
+//	    directories don't, as their writes are metadata
 //
 //	"name" -- the text name of the file to be opened
 //----------------------------------------------------------------------
 
 OpenFile * FileSystem::Open(char *name)
 {
-    Directory *directory = new Directory(NumDirEntries);
     OpenFile *openFile = NULL;
     int sector;
 
     DEBUG(dbgFile, "Opening file" << name);
-    directory->FetchFrom(directoryFile);
+    namespaceLock->AcquireRead();
     // MP4 add
-    sector = directory->GetDirSector(name); //傳入的路徑有可能是多層的
+    sector = LookUp(name); //傳入的路徑有可能是多層的
     if (sector >= 0)
-        openFile = new OpenFile(sector); // name was found in directory
-    delete directory;
+    {
+        openFile = new OpenFile(sector, openFileTable); // name was found in directory
+        openFile->BufferWrites();
+    }
+    namespaceLock->Release();
+    return openFile; // return NULL if not found
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileSystem::LookUp
+// 	Return the sector of the header of a file or directory, given
+//	its path; -1 if there is no such file.  Each directory on the
+//	way down is locked to read while we look in it (see
+//	Directory::GetDirSector).  The caller holds the namespace lock,
+//	so that none of them goes away while it uses what we found.
+//
+//	"path" -- the absolute path of the file
+//----------------------------------------------------------------------
 
-    this->openedFile = openFile;
+int FileSystem::LookUp(char *path)
+{
+    Directory *root = new Directory();
+    int sector;
 
-    return openFile; // return NULL if not found
+    directoryFile->LockContents(FALSE);
+    root->FetchFrom(directoryFile);
+    sector = root->GetDirSector(path);
+    delete root;
+    directoryFile->UnlockContents();
+    return sector;
 }
 
+//----------------------------------------------------------------------
 // MP4
-int FileSystem::Read(char *buffer, int size, OpenFileId id) {
-    if(this->openedFile != NULL) {
-        return this->openedFile->Read(buffer, size);
-    }
+// FileSystem::LockNamespace/UnlockNamespace
+// 	Keep directories from being removed (by Remove), for someone
+//	going through them other than by path, as the defragmenter does.
+//----------------------------------------------------------------------
+
+void FileSystem::LockNamespace()
+{
+    namespaceLock->AcquireRead();
 }
 
-int FileSystem::Write(char *buffer, int size, OpenFileId id) {
-    if(this->openedFile != NULL) {
-        return this->openedFile->Write(buffer, size);
-    }
+void FileSystem::UnlockNamespace()
+{
+    namespaceLock->Release();
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileSystem::FetchFreeMap
+// 	Return the map of free disk sectors, so that a file can allocate
+//	the blocks it grows into.  Must be handed back to ReleaseFreeMap.
+//	Until then, no other thread can get at it: one that tries waits.
+//	The thread that has the map can fetch it again; it is only let
+//	go of when each fetch has been released.
+//----------------------------------------------------------------------
+
+PersistentBitmap *FileSystem::FetchFreeMap()
+{
+    if (!freeMapLock->IsHeldByCurrentThread())
+        freeMapLock->Acquire();
+    freeMapDepth++;
+    return freeMap;
 }
 
-int FileSystem::Close(OpenFileId id) {
-    if(this->openedFile != NULL) {
-        delete this->openedFile;
-        this->openedFile = NULL;
-        return 1;
+//----------------------------------------------------------------------
+// MP4
+// FileSystem::ReleaseFreeMap
+// 	Done with the map of free disk sectors.
+//
+//	"map" -- the map returned by FetchFreeMap
+//	"changed" -- were any sectors allocated or freed?  If so, write
+//		the parts of the map that changed back to disk.
+//----------------------------------------------------------------------
+
+void FileSystem::ReleaseFreeMap(PersistentBitmap *map, bool changed)
+{
+    ASSERT(map == freeMap && freeMapLock->IsHeldByCurrentThread());
+    if (changed)
+        freeMap->WriteDirty(freeMapFile);
+    if (freeMap->Logging())
+    {
+        journal->SetLogHead(freeMap->LogHead());
+        if (freeMap->NumCleanSegments() < CleanLowWater)
+            WakeCleaner();
     }
-    return 0;
+    if (--freeMapDepth == 0)
+        freeMapLock->Release();
 }
 
 //----------------------------------------------------------------------
@@ -303,80 +744,148 @@ int FileSystem::Close(OpenFileId id) {
 //	    Delete the space for its data blocks
 //	    Write changes to directory, bitmap back to disk
 //
+//	A directory removed recursively goes, with everything under it,
+//	in the same single update (see FreeTree): the path is looked up
+//	once, and the free map and the parent directory are written
+//	once, however many files there are.
+//
+//	Taking a directory away takes the paths through it with it; so
+//	once we find that is what we are removing, we start over with the
+//	namespace to ourselves.
+//
 //	Return TRUE if the file was deleted, FALSE if the file wasn't
 //	in the file system.
 //
 //	"name" -- the text name of the file to be removed
+//	"recursive" -- if "name" is a directory, delete what is in it too
 //----------------------------------------------------------------------
 
 bool FileSystem::Remove(char *name , bool recursive)
 {
     Directory *directory;
-    PersistentBitmap *freeMap;
-    FileHeader *fileHdr;
     int sector;
+    bool isDir, exclusive = FALSE;
     // MP4 add
-    Directory* root; //存根目錄
     OpenFile* file;  //用來開啟檔案所在的directory
     int direcSector; //檔案所在的directory的fileHeader所在的sector
     char dirPath[256], fileName[10]; //size多加一，來存'\0'在最後
 
     SplitPath(name, dirPath, fileName); //進行拆解動作
 
-    root = new Directory(NumDirEntries);
-    directory = new Directory(NumDirEntries);
-    root->FetchFrom(directoryFile);
-    direcSector = root->GetDirSector(dirPath);
-    file = new OpenFile(direcSector);
-    directory->FetchFrom(file);
+    BeginUpdate();
+    for (;;)
+    {
+        if (exclusive)
+            namespaceLock->AcquireWrite();
+        else
+            namespaceLock->AcquireRead();
+        directory = new Directory();
+        direcSector = LookUp(dirPath);
+        file = new OpenFile(direcSector, openFileTable);
+        file->LockContents(TRUE);
+        directory->FetchFrom(file);
 
-    sector = directory->Find(fileName); //找到檔案所在的sector
+        sector = directory->Find(fileName); //找到檔案所在的sector
+        isDir = (sector != -1 && directory->isDir(fileName)); // 看看要刪除的entry是不是directory
+        if (!isDir || exclusive)
+            break;
+        delete directory;
+        file->UnlockContents();
+        delete file;
+        namespaceLock->Release();
+        exclusive = TRUE;
+    }
 
-    if (recursive)
+    if (sector != -1)
     {
-        bool isDir = directory->isDir(fileName); // 看看要刪除的entry是不是directory
-        if(isDir)
-        {
-            //開啟要刪除的directory，並遞迴呼叫Remove()，來刪除其table裡的entry
-            OpenFile* f = new OpenFile(sector); 
-            Directory* d = new Directory(NumDirEntries);
-            d->FetchFrom(f);
-            int tableSize = d->GetTableSize(); //取得table的size
-            DirectoryEntry* table = d->GetTable(); //取得table
-            // 遍歷此directory，遞迴呼叫來刪除所有裡面的資料
-            for(int i = 0; i < tableSize; i++)
-            {
-                if(table[i].inUse)
-                {
-                    // 將絕對路徑做增加，來呼叫此檔案的Remove
-                    char nextName[256];
-                    strcpy(nextName, name); 
-                    strcat(nextName, "/");
-                    strcat(nextName, table[i].name);
-                    Remove(nextName, TRUE); //遞迴呼叫
-                }
-            }
+        FreeTree(sector, recursive && isDir);
+        directory->Remove(fileName);
 
-        }
+        ReleaseFreeMap(FetchFreeMap(), TRUE); // flush the changed sectors to disk
+        directory->WriteBack(file); // 將更新完的directory寫回disk
     }
-    // 遞迴結束，刪除目標directory
-    fileHdr = new FileHeader;
-    fileHdr->FetchFrom(sector);
+    delete directory;
+    file->UnlockContents();
+    delete file;
+    namespaceLock->Release();
+    EndUpdate();
+    return sector != -1; // FALSE if the file was not found
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FreeTree
+// 	Clear, in the free map, the header and data sectors of a file --
+//	and, for a directory, of every file under it, depth first.  Only
+//	the bits in memory change; the caller removes the entry naming
+//	the file, and writes the free map back.  The directories below
+//	are going away, so their entries are left as they are (and
+//	nobody else can be looking at them: the caller has the namespace
+//	to itself).
+//
+//	A file someone has open keeps its sectors until the last open of
+//	it is closed (see Reclaim); only its name goes now.
+//
+//	"sector" -- the file's header
+//	"isDir" -- is it a directory, whose files go too?
+//----------------------------------------------------------------------
 
-    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+void FileSystem::FreeTree(int sector, bool isDir)
+{
+    FileHeader *fileHdr = openFileTable->Acquire(sector); // the header
+                                  // others (say, the defragmenter) may share
+    OpenHeader *entry = openFileTable->Lookup(sector);
+    PersistentBitmap *map;
 
-    fileHdr->Deallocate(freeMap); // remove data blocks
-    freeMap->Clear(sector);       // remove header block
-    directory->Remove(fileName);
+    if (isDir)
+    {
+        OpenFile *dirFile = new OpenFile(sector, openFileTable);
+        Directory *dir = new Directory();
+        DirectoryEntry *entries;
+        int count;
 
-    freeMap->WriteBack(freeMapFile);     // flush to disk
-    directory->WriteBack(file); // 將更新完的directory寫回disk
-    delete fileHdr;
-    delete directory;
-    delete root;
-    delete freeMap;
-    delete file;
-    return TRUE;
+        dir->FetchFrom(dirFile);
+        entries = dir->GetEntries(&count);
+        for (int i = 0; i < count; i++)
+            FreeTree(entries[i].sector, entries[i].isDir);
+        delete[] entries;
+        delete dir;
+        delete dirFile;
+    }
+    if (entry->refs > 1)
+        entry->removed = TRUE; // still open: freed at the last close
+    else
+    {
+        map = FetchFreeMap();
+        fileHdr->Deallocate(map); // remove data blocks
+        map->Clear(sector);       // remove header block
+        ReleaseFreeMap(map, FALSE);
+    }
+    openFileTable->Release(sector);
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileSystem::Reclaim
+// 	The last open of a file that was removed while it was open has
+//	been closed: free its header and data sectors, as FreeTree would
+//	have, in an update of their own.  Nobody else can get at the
+//	header any more.
+//
+//	"sector" -- the file's header
+//	"hdr" -- the header, as its opens left it
+//----------------------------------------------------------------------
+
+void FileSystem::Reclaim(int sector, FileHeader *hdr)
+{
+    PersistentBitmap *map;
+
+    DEBUG(dbgFile, "Freeing removed file " << sector << " at its last close");
+    BeginUpdate();
+    map = FetchFreeMap();
+    hdr->Deallocate(map);
+    map->Clear(sector);
+    ReleaseFreeMap(map, TRUE);
+    EndUpdate();
 }
 
 //----------------------------------------------------------------------
@@ -387,17 +896,18 @@ bool FileSystem::Remove(char *name , bool recursive)
 void FileSystem::List(char* dirPath)
 {
     // MP4 add
-    Directory* root = new Directory(NumDirEntries);
-    Directory* directoryToBeList = new Directory(NumDirEntries);
+    Directory* directoryToBeList = new Directory();
 
-    root->FetchFrom(directoryFile);
-    int sector = root->GetDirSector(dirPath); //找到目標directory所在的sector
-    OpenFile* file = new OpenFile(sector);
+    namespaceLock->AcquireRead();
+    int sector = LookUp(dirPath); //找到目標directory所在的sector
+    OpenFile* file = new OpenFile(sector, openFileTable);
+    file->LockContents(FALSE);
     directoryToBeList->FetchFrom(file);
     directoryToBeList->List(); //開始遍歷去list
-    delete root;
     delete directoryToBeList;
+    file->UnlockContents();
     delete file;
+    namespaceLock->Release();
 }
 
 //----------------------------------------------------------------------
@@ -414,8 +924,7 @@ void FileSystem::Print()
 {
     FileHeader *bitHdr = new FileHeader;
     FileHeader *dirHdr = new FileHeader;
-    PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-    Directory *directory = new Directory(NumDirEntries);
+    Directory *directory = new Directory();
 
     printf("Bit map file header:\n");
     bitHdr->FetchFrom(FreeMapSector);
@@ -432,7 +941,6 @@ void FileSystem::Print()
 
     delete bitHdr;
     delete dirHdr;
-    delete freeMap;
     delete directory;
 }
 
@@ -441,77 +949,111 @@ void FileSystem::Print()
 bool FileSystem::CreateDirectory(char* name)
 {
     Directory *directory;
-    PersistentBitmap *freeMap;
     FileHeader *hdr;
     int sector;
     bool success;
     // MP4 add
     OpenFile* file; //用來開啟最終directory的file header
-    Directory* root; //存根目錄
+    PersistentBitmap *map;
     int direcSector; //最終directory的fileHeader所在的sector
     char dirPath[256], fileName[10]; //size多加一，來存'\0'在最後
 
     SplitPath(name, dirPath, fileName); //進行拆解動作
 
     DEBUG(dbgFile, "Creating file " << fileName << " size " << DirectoryFileSize);
+    BeginUpdate();
+    namespaceLock->AcquireRead();
 
     // MP4 add
-    root = new Directory(NumDirEntries);
-    directory = new Directory(NumDirEntries);
-    root->FetchFrom(directoryFile); //將root directory讀進來
-    direcSector = root->GetDirSector(dirPath); //找到最終directory的sector
-    file = new OpenFile(direcSector); //開啟最終directory檔案
+    directory = new Directory();
+    direcSector = LookUp(dirPath); //找到最終directory的sector
+    file = new OpenFile(direcSector, openFileTable); //開啟最終directory檔案
+    file->LockContents(TRUE);
     directory->FetchFrom(file); //把directory抓進來
 
     if (directory->Find(fileName) != -1)
         success = FALSE; // file is already in directory
     else
     {
-        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-        sector = freeMap->FindAndSet(); // find a sector to hold the file header
+        // find a sector to hold the directory's header, in the emptiest
+        // group, so that directories spread out over the disk, each with
+        // room for its files around it
+        map = FetchFreeMap();
+        sector = map->FindAndSet(map->EmptiestGroup() * SectorsPerGroup);
         if (sector == -1)
             success = FALSE; // no free block for file header
         else if (!directory->Add(fileName, sector, TRUE)) //此為file，isDir是FALSE
+        {
+            map->Clear(sector);
             success = FALSE; // no space in directory
+        }
         else
         {
             hdr = new FileHeader;
-            if (!hdr->Allocate(freeMap, DirectoryFileSize))
+            if (!hdr->Allocate(map, DirectoryFileSize, sector + 1))
+            {
+                map->Clear(sector);
                 success = FALSE; // no space on disk for data
+            }
             else
             {
                 success = TRUE;
                 // everthing worked, flush all changes back to disk
                 hdr->WriteBack(sector);
-                directory->WriteBack(file); //更新directory
-                freeMap->WriteBack(freeMapFile);
-                // 要將初始化完的directory也寫回disk
-                OpenFile* f = new OpenFile(sector);
-                Directory* d = new Directory(NumDirEntries);
-                d->WriteBack(f);
             }
             delete hdr;
         }
-        delete freeMap;
+        ReleaseFreeMap(map, success);
+        if (success)
+        {
+            directory->WriteBack(file); //更新directory
+            // 要將初始化完的directory也寫回disk (nobody can look in
+            // it before we unlock the directory it is in)
+            OpenFile* f = new OpenFile(sector, openFileTable);
+            Directory* d = new Directory();
+            d->WriteBack(f);
+            delete d;
+            delete f;
+        }
     }
     delete directory;
-    delete root;
+    file->UnlockContents();
     delete file;
+    namespaceLock->Release();
+    EndUpdate();
     return success;
 }
 
 void FileSystem::RecursiveList(char* dirPath)
 {
-    Directory* root = new Directory(NumDirEntries);
-    Directory* directoryToBeList = new Directory(NumDirEntries);
-    root->FetchFrom(directoryFile);
-    int sector = root->GetDirSector(dirPath); //找到目標directory所在的sector
-    OpenFile* file = new OpenFile(sector);
+    Directory* directoryToBeList = new Directory();
+    namespaceLock->AcquireRead();
+    int sector = LookUp(dirPath); //找到目標directory所在的sector
+    OpenFile* file = new OpenFile(sector, openFileTable);
+    file->LockContents(FALSE);
     directoryToBeList->FetchFrom(file);
     directoryToBeList->RecursiveList(0); //從第0層(自己)開始遍歷去list
-    delete root;
     delete directoryToBeList;
+    file->UnlockContents();
     delete file;
+    namespaceLock->Release();
+}
+
+//----------------------------------------------------------------------
+// MP4
+// FileSystem::Defragment
+// 	Move the blocks of every file into one run of sectors, the files
+//	laid out in the order of the directory tree, while the file system
+//	stays in use (see defrag.h).  Print what a sequential read of all
+//	the files costs before and after.
+//----------------------------------------------------------------------
+
+void FileSystem::Defragment()
+{
+    Defragmenter *defragmenter = new Defragmenter(openFileTable);
+
+    defragmenter->Run(DirectorySector);
+    delete defragmenter;
 }
 
 void FileSystem::SplitPath(char* name, char* dirPath, char* fileName)
@@ -72,32 +72,76 @@ public:
 
 	bool Remove(char *name) { return Unlink(name) == 0; }
 
+	void Sync() {} // UNIX writes aren't buffered here
+
 	OpenFile *fileDescriptorTable[20];
 };
 
 #else // FILESYS
+class PersistentBitmap;
+class FileHeader;
+class Journal;
+class OpenFileTable;
+class Thread;
+class Semaphore;
+class Lock;
+class RWLock;
+
 class FileSystem
 {
 public:
-	FileSystem(bool format); // Initialize the file system.
+	FileSystem(bool format, bool logStructured = FALSE);
+							 // Initialize the file system.
 							 // Must be called *after* "synchDisk"
 							 // has been initialized.
 							 // If "format", there is nothing on
 							 // the disk, so initialize the directory
-							 // and the bitmap of free blocks.
+							 // and the bitmap of free blocks (laid
+							 // out as a log, if "logStructured").
 	// MP4 mod tag
 	~FileSystem();
 
-	bool Create(char *name, int initialSize); // Create a file (UNIX creat)
+	bool Create(char *name, int initialSize) // Create a file (UNIX creat)
+	{ return Create(name, initialSize, FALSE); }
+	bool Create(char *name, int initialSize, bool compressed);
+							 // ... whose data may be compressed
 
 	OpenFile *Open(char *name); // Open a file (UNIX open)
-
-	int Read(char *buffer, int size, OpenFileId id);
-	int Write(char *buffer, int size, OpenFileId id);
-	int Close(OpenFileId id);
+	bool Clone(char *from, char *to); // Make "to" a copy of "from",
+								 // sharing its sectors until either
+								 // one is written
+
+	// MP4
+	PersistentBitmap *FetchFreeMap();	// Get the map of free sectors, to
+										// allocate space for a growing file
+										// (the one kept in memory), and
+										// keep other threads off it
+	void ReleaseFreeMap(PersistentBitmap *freeMap, bool changed);
+										// Done with it; write it back to
+										// disk if "changed"
+	void LockNamespace();	// Keep directories from being taken
+	void UnlockNamespace();	// away until UnlockNamespace
+
+	void BeginUpdate();	// The current thread starts changing
+						// metadata; the changes are committed
+						// as a whole after EndUpdate
+	void EndUpdate();
+	bool InUpdate();	// Is the current thread in one?
+	void BeginBatch();	// Commit the updates made from here to
+	void EndBatch();	// EndBatch in as few groups as possible
+	void Flush();		// Wait until the updates made so far
+						// are committed
+	void Sync();		// Write out every open file's write
+						// buffer, and Flush; before halting
+	bool LogStructured();	// Is the disk laid out as a log of
+							// segments?
+	void CleanSegments();	// Body of the thread that keeps clean
+							// segments at hand for the log
 
 	// MP4 add ，判斷是否需要遞迴刪除
 	bool Remove(char *name, bool recursive); // Delete a file (UNIX unlink)
+	void Reclaim(int sector, FileHeader *hdr); // MP4 free a file that was
+							 // removed while open, at its last close
 
 	// MP4 add
 	void List(char* dirPath); // List all the files in the file system
@@ -107,14 +151,41 @@ public:
 	// MP4 add
 	bool CreateDirectory(char* name);
 	void RecursiveList(char* dirPath);
+	void Defragment();	// Move each file into one run of sectors
 
 private:
 	OpenFile *freeMapFile;	 // Bit map of free disk blocks,
 							 // represented as a file
 	OpenFile *directoryFile; // "Root" directory -- list of
 							 // file names, represented as a file
-
-	OpenFile *openedFile;	 // The file that is currently opened
+	PersistentBitmap *freeMap; // The contents of freeMapFile, kept
+							 // in memory while the disk is mounted
+	Lock *freeMapLock;		 // MP4 held from FetchFreeMap to
+	int freeMapDepth;		 // ReleaseFreeMap, which can nest
+	RWLock *namespaceLock;	 // MP4 held to look up paths, or alone
+							 // to take directories away
+
+	OpenFileTable *openFileTable; // Headers of the files open right
+							 // now, shared by all their opens
+
+	Journal *journal;		 // Write-ahead log of metadata updates,
+							 // NULL if the disk has none
+
+	Thread *cleaner;		 // Cleans segments of the log; NULL
+							 // until it is first needed
+	Semaphore *cleanerWork;	 // Where it waits to be needed
+	bool cleanerAwake;		 // Is it cleaning?
+	int cleanedAt;			 // Clear sectors when it last gave up
+							 // short of enough clean segments
+
+	void MountJournal();	 // Replay the journal, and route
+							 // metadata writes through it
+	int LookUp(char *path);	 // Find the header of a file or
+							 // directory, by its path
+	void FreeTree(int sector, bool isDir);
+							 // Free a file, or a directory and
+							 // everything under it, in the free map
+	void WakeCleaner();		 // The log is short of clean segments
 
 	// MP4 add
 	void SplitPath(char* name, char* dirPath, char* fileName); //拆解絕對路徑
@@ -0,0 +1,269 @@
+// filetable.cc
+//	Routines to manage the system-wide open file table, and the file
+//	descriptors of each address space.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "filetable.h"
+#include "debug.h"
+
+#ifndef FILESYS_STUB
+#include "filehdr.h"
+#include "filesys.h"
+#include "synch.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// OpenHeader::OpenHeader
+// 	Initialize an entry for a file header just fetched from disk, with
+//	no users yet, and an empty write buffer.
+//
+//	"sector" -- the location on disk of the file header
+//	"hdr" -- the header; the entry owns it from now on
+//----------------------------------------------------------------------
+
+OpenHeader::OpenHeader(int sector, FileHeader *hdr)
+{
+    this->sector = sector;
+    this->hdr = hdr;
+    refs = opens = 0;
+    removed = FALSE;
+    lock = new Lock("file header");
+    contents = new RWLock("directory");
+    buffer = NULL;
+    bufferSector = -1;
+    bufferLost = FALSE;
+    bufferLock = new Lock("write buffer");
+}
+
+//----------------------------------------------------------------------
+// OpenHeader::~OpenHeader
+// 	De-allocate an entry, and the header in it.
+//----------------------------------------------------------------------
+
+OpenHeader::~OpenHeader()
+{
+    delete hdr;
+    delete lock;
+    delete contents;
+    delete[] buffer;
+    delete bufferLock;
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::OpenFileTable
+// 	Initialize an empty open file table.
+//----------------------------------------------------------------------
+
+OpenFileTable::OpenFileTable()
+{
+    headers = new List<OpenHeader *>;
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::~OpenFileTable
+// 	De-allocate the open file table.
+//----------------------------------------------------------------------
+
+OpenFileTable::~OpenFileTable()
+{
+    while (!headers->IsEmpty())
+    {
+        delete headers->RemoveFront();
+    }
+    delete headers;
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::Acquire
+// 	Return the in-core header of a file being opened.  If the file is
+//	open already, share the header we have; otherwise, bring it into
+//	memory.
+//
+//	"sector" -- the location on disk of the file header
+//----------------------------------------------------------------------
+
+FileHeader *OpenFileTable::Acquire(int sector)
+{
+    OpenHeader *entry = Lookup(sector);
+    FileHeader *hdr;
+
+    if (entry == NULL)
+    {
+        hdr = new FileHeader;
+        hdr->FetchFrom(sector);
+
+        // someone else may have opened the file while we waited for
+        // the disk; then theirs is the copy to share
+        if ((entry = Lookup(sector)) != NULL)
+            delete hdr;
+        else
+        {
+            entry = new OpenHeader(sector, hdr);
+            headers->Append(entry);
+        }
+    }
+    entry->refs++;
+    entry->opens++;
+    return entry->hdr;
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::Release
+// 	An OpenFile sharing the header at "sector" was closed.  When the
+//	last one is, drop the header.  (It went back to disk every time
+//	it changed, so there is nothing to write.)  If the file was removed
+//	meanwhile, free its sectors now (see FileSystem::Reclaim).
+//
+//	"sector" -- the location on disk of the file header
+//----------------------------------------------------------------------
+
+void OpenFileTable::Release(int sector)
+{
+    ListIterator<OpenHeader *> iter(headers);
+
+    for (; !iter.IsDone(); iter.Next())
+    {
+        OpenHeader *entry = iter.Item();
+
+        if (entry->sector == sector)
+        {
+            if (--entry->refs == 0)
+            {
+                headers->Remove(entry);
+                if (entry->removed)
+                    kernel->fileSystem->Reclaim(sector, entry->hdr);
+                delete entry;
+            }
+            return;
+        }
+    }
+    ASSERTNOTREACHED();
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::Lookup
+// 	Return the table entry of an open file, or NULL if it isn't open.
+//
+//	"sector" -- the location on disk of the file header
+//----------------------------------------------------------------------
+
+OpenHeader *OpenFileTable::Lookup(int sector)
+{
+    ListIterator<OpenHeader *> iter(headers);
+
+    for (; !iter.IsDone(); iter.Next())
+        if (iter.Item()->sector == sector)
+            return iter.Item();
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::Sync
+// 	Write out the write buffer of every open file that has something
+//	in it not on disk yet, through an open of our own (the files stay
+//	open).  The sectors are noted first: writing out a buffer can
+//	give the CPU to threads that open and close files meanwhile.
+//----------------------------------------------------------------------
+
+void OpenFileTable::Sync()
+{
+    ListIterator<OpenHeader *> iter(headers);
+    int *sectors = new int[headers->NumInList()];
+    int count = 0;
+
+    for (; !iter.IsDone(); iter.Next())
+        if (iter.Item()->bufferDirty)
+            sectors[count++] = iter.Item()->sector;
+    for (int i = 0; i < count; i++)
+        if (Lookup(sectors[i]) != NULL) // (unless closed meanwhile)
+        {
+            OpenFile *file = new OpenFile(sectors[i], this);
+
+            if (!file->Flush())
+            {
+                DEBUG(dbgFile, "Lost the buffered writes to file " << sectors[i]);
+            }
+            delete file;
+        }
+    delete[] sectors;
+}
+
+#endif // FILESYS_STUB
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::FileDescriptorTable
+// 	Initialize a table of file descriptors with no files open.
+//----------------------------------------------------------------------
+
+FileDescriptorTable::FileDescriptorTable()
+{
+    for (int i = 0; i < MaxOpenFiles; i++)
+        files[i] = NULL;
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::~FileDescriptorTable
+// 	Close every file the address space left open.
+//----------------------------------------------------------------------
+
+FileDescriptorTable::~FileDescriptorTable()
+{
+    for (int i = 0; i < MaxOpenFiles; i++)
+        delete files[i];
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::Add
+// 	Give an open file the lowest free descriptor, and return it;
+//	-1 if there is none.  The table owns the file from now on.
+//
+//	"file" -- the newly opened file
+//----------------------------------------------------------------------
+
+OpenFileId FileDescriptorTable::Add(OpenFile *file)
+{
+    for (int i = 2; i < MaxOpenFiles; i++) // 0 and 1 are the console
+        if (files[i] == NULL)
+        {
+            files[i] = file;
+            return i;
+        }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::Get
+// 	Return the open file descriptor "id" stands for, or NULL.
+//----------------------------------------------------------------------
+
+OpenFile *FileDescriptorTable::Get(OpenFileId id)
+{
+    if (id < 0 || id >= MaxOpenFiles)
+        return NULL;
+    return files[id];
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::Close
+// 	Close the file descriptor "id" stands for, and free the
+//	descriptor.  Return FALSE if "id" isn't open -- or if what was
+//	written through it could not all be stored (see OpenFile::Flush);
+//	it is closed all the same.
+//----------------------------------------------------------------------
+
+bool FileDescriptorTable::Close(OpenFileId id)
+{
+    OpenFile *file = Get(id);
+    bool stored;
+
+    if (file == NULL)
+        return FALSE;
+    stored = file->Flush();
+    delete file;
+    files[id] = NULL;
+    return stored;
+}
@@ -0,0 +1,129 @@
+// filetable.h
+//	Data structures to keep track of the files user programs have open.
+//
+//	There are two levels, as in UNIX.  The system-wide open file table
+//	holds one in-core file header for each file that is open at all,
+//	no matter how many times; every OpenFile on that file shares it,
+//	so the header is fetched from disk once, and a file growing
+//	through one OpenFile is seen through all the others.
+//
+//	A file removed while it is open stays on disk, without a name,
+//	until its last open is closed, as in UNIX: its header sector isn't
+//	free to be taken by a new file meanwhile, so an entry in the table
+//	is never mistaken for another file's, and writes through the opens
+//	left can't land in sectors another file has been given.
+//
+//	MP4: each entry also has the locks that keep threads from changing
+//	the file at the same time (see filesys.cc): one for the header,
+//	and, for a directory, one for the entries in it.  And it has the
+//	sector the opens of the file gather small writes in, so that
+//	whatever one open wrote, the others read.
+//
+//	Each address space has a table of file descriptors, the small
+//	integers (OpenFileId) a user program names its open files with.
+//	Each descriptor is an OpenFile of its own, with its own seek
+//	position.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef FILETABLE_H
+#define FILETABLE_H
+
+#include "list.h"
+#include "openfile.h"
+
+typedef int OpenFileId;
+
+#define MaxOpenFiles 16 // descriptors per address space; 0 and 1
+                        // stand for the console and are never given out
+
+#ifndef FILESYS_STUB
+class FileHeader;
+class Lock;
+class RWLock;
+
+// The following class defines an entry of the system-wide open file
+// table.  (An OpenFile that doesn't share its header has an entry of
+// its own, in no table.)
+
+class OpenHeader
+{
+public:
+    OpenHeader(int sector, FileHeader *hdr); // An entry for the header
+                     //   "hdr", fetched from "sector"; nobody uses it yet
+    ~OpenHeader();   // De-allocate it, header and all
+
+    int sector;      // Where the header lives on disk
+    FileHeader *hdr; // The shared in-core copy
+    int refs;        // OpenFiles using it
+    int opens;       // Times the file was opened since the header
+                     //   was brought in (so that the defragmenter
+                     //   can tell nobody came and went meanwhile)
+    Lock *lock;      // Held while the header changes, and goes
+                     //   back to disk
+    RWLock *contents; // For a directory: held to look at its
+                     //   entries, or alone to change them
+    bool removed;    // Was the file removed while open?  Then its
+                     //   sectors are freed at the last close
+
+    // MP4 write buffer of sequential small writes, shared by the opens
+    // so that each of them reads what the others wrote (see
+    // OpenFile::BufferWrites)
+    char *buffer;     // A sector of the file, the last one written
+                     //   to, NULL until an open buffers writes
+    int bufferSector; // Which one it is, -1 if the buffer is empty
+    int bufferStart;  // The bytes of it written: from bufferStart
+    int bufferEnd;    //   to bufferEnd
+    bool bufferDirty; // Are some of them not on disk yet?
+    bool bufferLost;  // Did writing them out find the disk full, and
+                     //   has no open that buffers writes been told?
+    Lock *bufferLock; // Held while the buffer is used, and written out
+};
+
+// The following class defines the system-wide open file table.
+
+class OpenFileTable
+{
+public:
+    OpenFileTable();  // Initialize an empty table
+    ~OpenFileTable(); // De-allocate it; every file must be closed
+
+    FileHeader *Acquire(int sector); // Get the header of the file whose
+                                     // header is at "sector", fetching it
+                                     // if the file isn't open yet
+    void Release(int sector);        // One less user; free the header
+                                     // when the last one goes (and the
+                                     // file, if it was removed)
+    OpenHeader *Lookup(int sector);  // The entry of the file whose header
+                                     // is at "sector", NULL if not open
+    void Sync();                     // Write out what every file has
+                                     // in its write buffer
+
+private:
+    List<OpenHeader *> *headers; // The files open right now
+};
+#endif // FILESYS_STUB
+
+// The following class defines the file descriptors of an address space.
+
+class FileDescriptorTable
+{
+public:
+    FileDescriptorTable();  // Initialize a table with nothing open
+    ~FileDescriptorTable(); // Close whatever is still open
+
+    OpenFileId Add(OpenFile *file); // Give "file" a descriptor;
+                                    // -1 if the table is full
+    OpenFile *Get(OpenFileId id);   // The file "id" stands for, or
+                                    // NULL if it isn't open
+    bool Close(OpenFileId id);      // Close "id"; FALSE if it isn't open
+
+private:
+    OpenFile *files[MaxOpenFiles];
+};
+
+#endif // FILETABLE_H
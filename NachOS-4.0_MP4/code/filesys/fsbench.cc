@@ -0,0 +1,566 @@
+// fsbench.cc
+//	Routines to run the file system benchmark, and report how long
+//	each workload took.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "fsbench.h"
+#include "filesys.h"
+#include "openfile.h"
+#include "sysdep.h"
+#include "synch.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// FSBenchmark::FSBenchmark
+// 	Open the UNIX file the results go to, at its end.  A new (or
+//	empty) file gets a line naming the columns first.
+//----------------------------------------------------------------------
+
+FSBenchmark::FSBenchmark(char *csvFile)
+{
+    static char columns[] = "workload,ops,bytes,ticks,disk_reads,"
+                            "disk_writes,seek_ticks,seek_tracks,host_seconds\n";
+
+    if ((csv = OpenForReadWrite(csvFile, FALSE)) < 0)
+        csv = OpenForWrite(csvFile);
+    Lseek(csv, 0, 2);
+    if (Tell(csv) == 0)
+        ::WriteFile(csv, columns, strlen(columns));
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::~FSBenchmark
+// 	Close the file of results.
+//----------------------------------------------------------------------
+
+FSBenchmark::~FSBenchmark()
+{
+    Close(csv);
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::Run
+// 	Run a workload, by name, or all of them, one after another.
+//	Return FALSE if there is no such workload.
+//----------------------------------------------------------------------
+
+bool FSBenchmark::Run(char *workload)
+{
+    bool all = !strcmp(workload, "all");
+    bool found = all;
+
+    if (all || !strcmp(workload, "create"))
+    {
+        CreateStorm();
+        found = TRUE;
+    }
+    if (all || !strcmp(workload, "tree"))
+    {
+        DeepTree();
+        found = TRUE;
+    }
+    if (all || !strcmp(workload, "large"))
+    {
+        LargeFile();
+        found = TRUE;
+    }
+    if (all || !strcmp(workload, "random"))
+    {
+        RandomReads();
+        found = TRUE;
+    }
+    if (all || !strcmp(workload, "small"))
+    {
+        SmallFiles();
+        found = TRUE;
+    }
+    if (all || !strcmp(workload, "append"))
+    {
+        AppendRecords();
+        found = TRUE;
+    }
+    if (all || !strcmp(workload, "concurrent"))
+    {
+        Concurrent();
+        found = TRUE;
+    }
+    if (all || !strcmp(workload, "batch"))
+    {
+        Batch();
+        found = TRUE;
+    }
+    return found;
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::Start
+// 	Note where the counters are, as the measured part of a workload
+//	begins.
+//----------------------------------------------------------------------
+
+void FSBenchmark::Start()
+{
+    Statistics *stats = kernel->stats;
+
+    startTicks = stats->totalTicks;
+    startReads = stats->numDiskReads;
+    startWrites = stats->numDiskWrites;
+    startSeekTicks = stats->diskSeekTicks;
+    startSeekTracks = stats->diskSeekTracks;
+    startTime = HostTime();
+    ops = bytes = 0;
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::Stop
+// 	The measured part of a workload is over: wait for its updates
+//	to be committed, and write out how far the counters moved.
+//----------------------------------------------------------------------
+
+void FSBenchmark::Stop(char *workload)
+{
+    Statistics *stats = kernel->stats;
+    char line[256];
+
+    kernel->fileSystem->Flush();
+    snprintf(line, sizeof(line), "%s,%d,%d,%d,%d,%d,%d,%d,%.3f\n",
+             workload, ops, bytes, stats->totalTicks - startTicks,
+             stats->numDiskReads - startReads,
+             stats->numDiskWrites - startWrites,
+             stats->diskSeekTicks - startSeekTicks,
+             stats->diskSeekTracks - startSeekTracks,
+             HostTime() - startTime);
+    ::WriteFile(csv, line, strlen(line));
+    printf("%s", line);
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::CreateStorm
+// 	Create a lot of empty files in one directory, and remove them
+//	again, a few times over.
+//----------------------------------------------------------------------
+
+void FSBenchmark::CreateStorm()
+{
+    char name[32];
+
+    kernel->fileSystem->CreateDirectory("/storm");
+    Start();
+    for (int round = 0; round < BenchStormRounds; round++)
+    {
+        for (int i = 0; i < BenchStormFiles; i++)
+        {
+            snprintf(name, sizeof(name), "/storm/f%d", i);
+            kernel->fileSystem->Create(name, 0);
+            ops++;
+        }
+        for (int i = 0; i < BenchStormFiles; i++)
+        {
+            snprintf(name, sizeof(name), "/storm/f%d", i);
+            kernel->fileSystem->Remove(name, FALSE);
+            ops++;
+        }
+    }
+    Stop("create");
+    kernel->fileSystem->Remove("/storm", TRUE);
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::DeepTree
+// 	Build a chain of directories, each holding a few small files and
+//	the next directory, then open the files at the bottom again and
+//	again: every open looks up each directory on the way down.
+//----------------------------------------------------------------------
+
+void FSBenchmark::DeepTree()
+{
+    char path[256], name[sizeof(path) + 16];  // (room for "/f" and an int)
+    int length;
+
+    Start();
+    strcpy(path, "/tree");
+    kernel->fileSystem->CreateDirectory(path);
+    ops++;
+    for (int depth = 0; depth < BenchTreeDepth; depth++)
+    {
+        length = strlen(path);
+        snprintf(path + length, sizeof(path) - length, "/d%d", depth);
+        kernel->fileSystem->CreateDirectory(path);
+        ops++;
+        for (int i = 0; i < BenchTreeFiles; i++)
+        {
+            snprintf(name, sizeof(name), "%s/f%d", path, i);
+            MakeFile(name, SectorSize, SectorSize);
+        }
+    }
+    for (int i = 0; i < BenchTreeLookups; i++)
+    {
+        OpenFile *file;
+
+        snprintf(name, sizeof(name), "%s/f%d", path, i % BenchTreeFiles);
+        file = kernel->fileSystem->Open(name);
+        ASSERT(file != NULL);
+        delete file;
+        ops++;
+    }
+    Stop("tree");
+    kernel->fileSystem->Remove("/tree", TRUE);
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::LargeFile
+// 	Write a file big enough to need triple indirection, from start
+//	to end, and read it back.
+//----------------------------------------------------------------------
+
+void FSBenchmark::LargeFile()
+{
+    Start();
+    MakeFile("/large", BenchLargeSize, BenchLargeChunk);
+    ReadBack("/large", BenchLargeChunk);
+    Stop("large");
+    kernel->fileSystem->Remove("/large", FALSE);
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::RandomReads
+// 	Read single sectors from all over a file, in an order that is
+//	random, but the same in every run.
+//----------------------------------------------------------------------
+
+void FSBenchmark::RandomReads()
+{
+    OpenFile *file;
+    char buffer[SectorSize];
+    int numSectors = BenchRandomSize / SectorSize;
+
+    MakeFile("/random", BenchRandomSize, BenchLargeChunk);
+    file = kernel->fileSystem->Open("/random");
+    RandomInit(1);
+    Start();
+    for (int i = 0; i < BenchRandomReads; i++)
+    {
+        int sector = RandomNumber() % numSectors;
+
+        bytes += file->ReadAt(buffer, SectorSize, sector * SectorSize);
+        ops++;
+    }
+    Stop("random");
+    delete file;
+    kernel->fileSystem->Remove("/random", FALSE);
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::SmallFiles
+// 	Write many small files, of sizes from one byte up to a few
+//	sectors, spread over a few directories, and read them all back.
+//----------------------------------------------------------------------
+
+void FSBenchmark::SmallFiles()
+{
+    char name[32];
+
+    kernel->fileSystem->CreateDirectory("/small");
+    Start();
+    for (int d = 0; d < BenchSmallDirs; d++)
+    {
+        snprintf(name, sizeof(name), "/small/d%d", d);
+        kernel->fileSystem->CreateDirectory(name);
+        ops++;
+    }
+    for (int i = 0; i < BenchSmallFiles; i++)
+    {
+        snprintf(name, sizeof(name), "/small/d%d/f%d", i % BenchSmallDirs, i);
+        MakeFile(name, 1 + (i * 997) % BenchSmallMaxSize, BenchSmallMaxSize);
+    }
+    for (int i = 0; i < BenchSmallFiles; i++)
+    {
+        snprintf(name, sizeof(name), "/small/d%d/f%d", i % BenchSmallDirs, i);
+        ReadBack(name, BenchSmallMaxSize);
+    }
+    Stop("small");
+    kernel->fileSystem->Remove("/small", TRUE);
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::AppendRecords
+// 	Grow a file by small records, one Write each, as a program keeping
+//	a log would (so nothing is allocated up front), and read it back.
+//----------------------------------------------------------------------
+
+void FSBenchmark::AppendRecords()
+{
+    char record[BenchAppendRecordSize];
+    OpenFile *file;
+
+    if (!kernel->fileSystem->Create("/append", 0))
+    {
+        printf("Benchmark: couldn't create /append\n");
+        return;
+    }
+    Start();
+    file = kernel->fileSystem->Open("/append");
+    ASSERT(file != NULL);
+    for (int i = 0; i < BenchAppendRecords; i++)
+    {
+        for (int j = 0; j < BenchAppendRecordSize; j++)
+            record[j] = 'a' + (i + j) % 26;
+        bytes += file->Write(record, BenchAppendRecordSize);
+        ops++;
+    }
+    delete file;
+    ReadBack("/append", SectorSize);
+    Stop("append");
+    kernel->fileSystem->Remove("/append", FALSE);
+}
+
+//----------------------------------------------------------------------
+// BenchWorkerThread
+// 	The body of a thread of the concurrent workload.
+//----------------------------------------------------------------------
+
+static void BenchWorkerThread(void *arg)
+{
+    BenchWorker *worker = (BenchWorker *)arg;
+
+    worker->bench->Work(worker->id);
+    worker->done->V();
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::Concurrent
+// 	Do the work of BenchConcurrentThreads threads with one thread,
+//	then with that many, each a line of results.
+//----------------------------------------------------------------------
+
+void FSBenchmark::Concurrent()
+{
+    ConcurrentRound(1, FALSE);
+    ConcurrentRound(BenchConcurrentThreads, FALSE);
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::Batch
+// 	Do the batched work of BenchConcurrentThreads threads, with that
+//	many threads.
+//----------------------------------------------------------------------
+
+void FSBenchmark::Batch()
+{
+    ConcurrentRound(BenchConcurrentThreads, TRUE);
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::ConcurrentRound
+// 	Give each of BenchConcurrentThreads directories its files, by
+//	"numThreads" threads: one for everything, or one per directory.
+//	Then see that every file made in the directory they share is
+//	there.
+//
+//	"batched" -- give each directory BenchBatchFiles files of
+//		BenchBatchSize bytes instead, all in one batch
+//----------------------------------------------------------------------
+
+void FSBenchmark::ConcurrentRound(int numThreads, bool batched)
+{
+    BenchWorker workers[BenchConcurrentThreads];
+    Semaphore *done = new Semaphore("benchmark workers", 0);
+    char name[32];
+    int lost = 0;
+
+    kernel->fileSystem->CreateDirectory("/conc");
+    for (int t = 0; t < BenchConcurrentThreads; t++)
+    {
+        snprintf(name, sizeof(name), "/conc/t%d", t);
+        kernel->fileSystem->CreateDirectory(name);
+    }
+    workFiles = batched ? BenchBatchFiles : BenchConcurrentFiles;
+    workSize = batched ? BenchBatchSize : BenchConcurrentSize;
+    Start();
+    wrong = 0;
+    if (batched)
+        kernel->fileSystem->BeginBatch();
+    if (numThreads == 1)
+        for (int t = 0; t < BenchConcurrentThreads; t++)
+            Work(t);
+    else
+    {
+        for (int t = 0; t < numThreads; t++)
+        {
+            Thread *thread = new Thread("benchmark worker", 0);
+
+            workers[t].bench = this;
+            workers[t].id = t;
+            workers[t].done = done;
+            thread->Fork((VoidFunctionPtr)BenchWorkerThread,
+                         (void *)&workers[t]);
+        }
+        for (int t = 0; t < numThreads; t++)
+            done->P();
+    }
+    if (batched)
+        kernel->fileSystem->EndBatch();
+    snprintf(name, sizeof(name), "%s-%d", batched ? "batch" : "concurrent",
+             numThreads);
+    Stop(name);
+
+    for (int t = 0; t < BenchConcurrentThreads; t++)
+        for (int i = 0; i < workFiles; i++)
+        {
+            OpenFile *file;
+
+            snprintf(name, sizeof(name), "/conc/s%d_%d", t, i);
+            if ((file = kernel->fileSystem->Open(name)) == NULL)
+                lost++;
+            delete file;
+        }
+    if (lost > 0 || wrong > 0)
+        printf("Benchmark: %d files lost, %d read back wrong\n", lost, wrong);
+    kernel->fileSystem->Remove("/conc", TRUE);
+    delete done;
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::Work
+// 	The part of the concurrent workload one thread does: make files
+//	in a directory of its own, BenchConcurrentChunk bytes at a time,
+//	each file with contents of its own, and an empty one for each in
+//	the directory all the threads share; read its files back, and
+//	check them; then remove them.
+//
+//	"id" -- which directory is ours
+//----------------------------------------------------------------------
+
+void FSBenchmark::Work(int id)
+{
+    char *data = new char[workSize];
+    char *back = new char[workSize];
+    char name[32];
+    OpenFile *file;
+
+    for (int i = 0; i < workFiles; i++)
+    {
+        for (int j = 0; j < workSize; j++)
+            data[j] = 'a' + (id * workFiles + i + j) % 26;
+        snprintf(name, sizeof(name), "/conc/t%d/f%d", id, i);
+        if (!kernel->fileSystem->Create(name, 0) ||
+            (file = kernel->fileSystem->Open(name)) == NULL)
+        {
+            printf("Benchmark: couldn't create %s\n", name);
+            continue;
+        }
+        for (int done = 0; done < workSize;
+             done += BenchConcurrentChunk)
+        {
+            bytes += file->Write(&data[done], min(BenchConcurrentChunk,
+                                                  workSize - done));
+            ops++;
+        }
+        delete file;
+        ops++;
+
+        snprintf(name, sizeof(name), "/conc/s%d_%d", id, i);
+        kernel->fileSystem->Create(name, 0);
+        ops++;
+    }
+
+    for (int i = 0; i < workFiles; i++)
+    {
+        int amountRead, total = 0;
+
+        for (int j = 0; j < workSize; j++)
+            data[j] = 'a' + (id * workFiles + i + j) % 26;
+        snprintf(name, sizeof(name), "/conc/t%d/f%d", id, i);
+        if ((file = kernel->fileSystem->Open(name)) == NULL)
+        {
+            wrong++;
+            continue;
+        }
+        while ((amountRead = file->Read(&back[total],
+                                        min(BenchConcurrentChunk,
+                                            workSize - total))) > 0)
+        {
+            total += amountRead;
+            bytes += amountRead;
+            ops++;
+        }
+        if (total != workSize || file->Length() != total ||
+            memcmp(data, back, total) != 0)
+            wrong++;
+        delete file;
+    }
+
+    for (int i = 0; i < workFiles; i++)
+    {
+        snprintf(name, sizeof(name), "/conc/t%d/f%d", id, i);
+        kernel->fileSystem->Remove(name, FALSE);
+        ops++;
+    }
+    delete[] data;
+    delete[] back;
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::MakeFile
+// 	Create a file and write it, the way -cp does: its sectors are
+//	allocated up front, and the updates are committed as a batch.
+//
+//	"name" -- the file to create
+//	"size" -- how many bytes to write
+//	"chunk" -- how many to write at a time
+//----------------------------------------------------------------------
+
+void FSBenchmark::MakeFile(char *name, int size, int chunk)
+{
+    char *buffer = new char[chunk];
+    OpenFile *file;
+
+    for (int i = 0; i < chunk; i++)
+        buffer[i] = 'a' + i % 26;
+    kernel->fileSystem->BeginBatch();
+    if (!kernel->fileSystem->Create(name, 0))
+        printf("Benchmark: couldn't create %s\n", name);
+    else
+    {
+        file = kernel->fileSystem->Open(name);
+        ASSERT(file != NULL);
+        if (!file->Preallocate(size))
+            printf("Benchmark: not enough space for %s\n", name);
+        for (int done = 0; done < size; done += chunk)
+        {
+            bytes += file->Write(buffer, min(chunk, size - done));
+            ops++;
+        }
+        delete file;
+    }
+    kernel->fileSystem->EndBatch();
+    delete[] buffer;
+}
+
+//----------------------------------------------------------------------
+// FSBenchmark::ReadBack
+// 	Read a file from start to end.
+//
+//	"name" -- the file to read
+//	"chunk" -- how many bytes to read at a time
+//----------------------------------------------------------------------
+
+void FSBenchmark::ReadBack(char *name, int chunk)
+{
+    char *buffer = new char[chunk];
+    OpenFile *file = kernel->fileSystem->Open(name);
+    int amountRead;
+
+    ASSERT(file != NULL);
+    while ((amountRead = file->Read(buffer, chunk)) > 0)
+    {
+        bytes += amountRead;
+        ops++;
+    }
+    delete file;
+    delete[] buffer;
+}
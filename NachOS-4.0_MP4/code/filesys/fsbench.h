@@ -0,0 +1,140 @@
+// fsbench.h
+//	Data structures for a benchmark of the file system.
+//
+//	Each workload works one part of the file system hard, and is
+//	measured in simulated time, disk requests, how far the disk head
+//	had to move, and how long the host took to simulate it all.  The
+//	numbers go into a line of CSV, so that runs before and after a
+//	change can be compared.  The workloads are:
+//
+//	create -- a storm of empty files created in one directory and
+//		removed again, a few times over
+//	tree -- a deep chain of directories with a few files in each,
+//		and lookups of the files at the bottom
+//	large -- a file too large for double indirection (see filehdr.h),
+//		written and read back sequentially
+//	random -- reads of single sectors at random places in a file
+//	small -- many small files of various sizes, over a few
+//		directories, written and read back
+//	append -- a log file grown by small records, each written on
+//		its own, and read back
+//	concurrent -- a few kernel threads, each making, reading back and
+//		removing files in a directory of its own, and adding files
+//		to one they share; done once by a single thread, one
+//		directory after another, and once by a thread for each,
+//		at the same time (see filesys.cc), which checks too that
+//		no file was lost or mixed up with another
+//	batch -- the same, by a thread for each, with more (and smaller)
+//		files, all in one batch (see FileSystem::BeginBatch), so
+//		that the running transaction gets big enough for new
+//		updates to wait for it to commit (see Journal::Begin)
+//
+//	What a workload needs before it starts (a file to read, say) is
+//	set up before the measurement starts, and what it leaves behind
+//	is removed after it ends.  The updates it makes are committed
+//	before the measurement ends.
+//
+//	Simulated time is kept in an int, and one revolution of the disk
+//	takes millions of ticks, so the workloads are sized to run well
+//	within that range, one workload per run of Nachos.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef FSBENCH_H
+#define FSBENCH_H
+
+#include "filehdr.h"
+
+#define BenchStormFiles 20    // files created and removed per round
+#define BenchStormRounds 3
+#define BenchTreeDepth 20     // directories in the chain
+#define BenchTreeFiles 3      // files in each
+#define BenchTreeLookups 50   // opens of the files at the bottom
+#define BenchLargeSize (MaxDoubleIndirectSize + 64 * 1024)
+#define BenchLargeChunk (64 * 1024) // bytes per Write/Read
+#define BenchRandomSize (1024 * 1024)
+#define BenchRandomReads 500
+#define BenchSmallDirs 5
+#define BenchSmallFiles 40    // over all the directories
+#define BenchSmallMaxSize 2048
+#define BenchAppendRecords 200
+#define BenchAppendRecordSize 40 // not a divisor of SectorSize
+#define BenchConcurrentThreads 4
+#define BenchConcurrentFiles 10  // per thread
+#define BenchConcurrentSize (4 * SectorSize + 40)
+#define BenchConcurrentChunk 100 // bytes per Write/Read
+#define BenchBatchFiles 80       // per thread
+#define BenchBatchSize MaxInlineSize
+
+class FSBenchmark;
+class Semaphore;
+
+// The following class defines what one thread of the concurrent
+// workload is given.
+
+class BenchWorker
+{
+public:
+    FSBenchmark *bench;
+    int id;          // Its directory is "t<id>"
+    Semaphore *done; // V()'ed when it is finished
+};
+
+// The following class defines the benchmark, and where its results go.
+
+class FSBenchmark
+{
+public:
+    FSBenchmark(char *csvFile); // Append results to the UNIX file
+                                // "csvFile", creating it (with a
+                                // line of column names) if need be
+    ~FSBenchmark();
+
+    bool Run(char *workload); // Run "workload", or every one if it
+                              // is "all"; FALSE if there is none
+                              // by that name
+
+    void Work(int id);        // The files thread "id" of the
+                              // concurrent workload works on
+
+private:
+    int csv; // The UNIX file results go to
+
+    int startTicks; // The counters when the measurement started
+    int startReads;
+    int startWrites;
+    int startSeekTicks;
+    int startSeekTracks;
+    double startTime;
+    int ops;   // Operations done ...
+    int bytes; // ... and bytes read or written, so far
+    int wrong; // Files that didn't read back as written
+    int workFiles; // Files each thread of the concurrent
+    int workSize;  // workload makes this round, and their size
+
+    void Start();              // Start measuring
+    void Stop(char *workload); // Stop, and write out a line of results
+
+    void CreateStorm(); // The workloads
+    void DeepTree();
+    void LargeFile();
+    void RandomReads();
+    void SmallFiles();
+    void AppendRecords();
+    void Concurrent();
+    void Batch();
+    void ConcurrentRound(int numThreads, bool batched);
+
+    void MakeFile(char *name, int size, int chunk);
+    // Create "name", and write "size" bytes
+    // of it, "chunk" bytes at a time
+    void ReadBack(char *name, int chunk);
+    // Read all of "name", "chunk" bytes
+    // at a time
+};
+
+#endif // FSBENCH_H
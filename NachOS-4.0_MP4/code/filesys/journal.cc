@@ -0,0 +1,823 @@
+// journal.cc
+//	Routines to log metadata updates ahead of writing them in place.
+//
+//	A metadata update is bracketed by Begin and End.  While a thread
+//	is inside one, SynchDisk hands its writes to Absorb, which copies
+//	each changed sector into a JournalBlock of the running transaction
+//	(the cache gets the new contents too, but no disk write is done).
+//	Reads are patched with Overlay, so everyone sees the new contents
+//	even though the home sectors still hold the old ones.
+//
+//	When the last update in progress ends, the running transaction is
+//	committed: descriptors, images and a commit sector are appended to
+//	the log in a single request, and we wait for it.  Then, if the log
+//	is filling up, a checkpoint starts: the committed images are written
+//	to their home sectors with one asynchronous request (the disk sorts
+//	it into runs), and when that is done, the journal header is moved
+//	past the transactions the checkpoint covered.  Nobody waits for a
+//	checkpoint, unless the log or the block pool runs out.
+//
+//	A sector that the journal holds must not be written in place behind
+//	its back (a later replay would put the older logged contents back);
+//	so any write to such a sector is absorbed, even outside an update.
+//
+//	Recovery starts at the header's log position, and replays every
+//	transaction with the expected number that has its commit sector.
+//	Replaying an update twice does no harm.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "journal.h"
+#include "synchdisk.h"
+#include "debug.h"
+#include "main.h"
+
+#define JournalMagic 0x4a524e4c    // "JRNL", in the header
+#define DescriptorMagic 0x44455343 // "DESC"
+#define CommitMagic 0x434d4954     // "CMIT"
+#define LogLayoutMagic 0x4c4f4753  // "LOGS", in the header of a disk
+                                   //   formatted log-structured
+
+#define NumJournalBuckets MaxJournalBlocks
+
+// The following classes are the disk interrupt handlers for the two
+// stages of a checkpoint.
+
+class HomeWritten : public CallBackObj
+{
+public:
+    HomeWritten(Journal *owner) { journal = owner; }
+    void CallBack() { journal->CheckpointDone(); }
+
+private:
+    Journal *journal;
+};
+
+class HeaderWritten : public CallBackObj
+{
+public:
+    HeaderWritten(Journal *owner) { journal = owner; }
+    void CallBack() { journal->HeaderDone(); }
+
+private:
+    Journal *journal;
+};
+
+//----------------------------------------------------------------------
+// Journal::Journal
+// 	Initialize an empty journal.  Nothing is known about the log on
+//	disk until Recover is called.
+//----------------------------------------------------------------------
+
+Journal::Journal()
+{
+    blocks = new JournalBlock[MaxJournalBlocks];
+    buckets = new int[NumJournalBuckets];
+    for (int i = 0; i < NumJournalBuckets; i++)
+        buckets[i] = -1;
+    for (int i = 0; i < MaxJournalBlocks; i++)
+    {
+        blocks[i].sector = -1;
+        blocks[i].running = blocks[i].committed = FALSE;
+        blocks[i].hashNext = -1;
+    }
+    numBlocks = 0;
+
+    updaters = new List<JournalUpdate *>;
+    holds = 0;
+    runningList = new int[MaxRunning];
+    numRunning = 0;
+
+    head = tail = 0;
+    sequence = 1;
+    commitLock = new Lock("journal commit");
+
+    checkpointing = FALSE;
+    checkpointSectors = new int[MaxJournalBlocks];
+    checkpointData = new char[MaxJournalBlocks * SectorSize];
+    headerSector = JournalSector;
+    logStructured = FALSE;
+    logHead = 0;
+    homeWritten = new HomeWritten(this);
+    headerWritten = new HeaderWritten(this);
+    spaceFreed = new Semaphore("journal space", 0);
+    spaceWaiters = 0;
+    committed = new Semaphore("journal commit done", 0);
+    commitWaiters = 0;
+}
+
+//----------------------------------------------------------------------
+// Journal::~Journal
+// 	De-allocate the journal.  Every finished update has been committed
+//	to the log, so nothing is lost: whatever was not checkpointed yet
+//	is replayed the next time the disk is mounted.
+//----------------------------------------------------------------------
+
+Journal::~Journal()
+{
+    delete[] blocks;
+    delete[] buckets;
+    delete updaters;
+    delete[] runningList;
+    delete commitLock;
+    delete[] checkpointSectors;
+    delete[] checkpointData;
+    delete homeWritten;
+    delete headerWritten;
+    delete spaceFreed;
+    delete committed;
+}
+
+//----------------------------------------------------------------------
+// Journal::Format
+// 	Set aside the journal header and the log on a disk being formatted,
+//	and write an empty header.
+//
+//	Transaction numbers carry on from any journal the disk had before,
+//	skipping far enough ahead that nothing left over in the old log can
+//	be mistaken for part of the new one.
+//
+//	"freeMap" -- the bit map of free sectors of the new file system
+//	"logStructured" -- is it laid out as a log of segments?
+//----------------------------------------------------------------------
+
+void Journal::Format(PersistentBitmap *freeMap, bool logStructured)
+{
+    char data[SectorSize];
+    int *header = (int *)data;
+    int seq = 1;
+
+    freeMap->Mark(JournalSector);
+    for (int i = 0; i < JournalSize; i++)
+        freeMap->Mark(JournalStart + i);
+
+    kernel->synchDisk->ReadSector(JournalSector, data);
+    if (header[0] == JournalMagic)
+        seq = header[2] + JournalSize;
+
+    SetHeader(data, 0, seq, logStructured, 0);
+    kernel->synchDisk->WriteSector(JournalSector, data);
+}
+
+//----------------------------------------------------------------------
+// Journal::Recover
+// 	Read the journal header, and replay every committed transaction
+//	the log holds beyond it, writing the images to their home sectors.
+//	Stop at the first transaction that is missing or incomplete.
+//
+//	Return FALSE if the disk was formatted without a journal.
+//----------------------------------------------------------------------
+
+bool Journal::Recover()
+{
+    char data[SectorSize];
+    int *record = (int *)data;
+    int *homes = new int[JournalSize];
+    int *logList = new int[RecordsPerDescriptor];
+    char *images = new char[JournalSize * SectorSize];
+    int replayed = 0;
+
+    kernel->synchDisk->ReadSector(JournalSector, data);
+    if (record[0] != JournalMagic)
+    {
+        delete[] homes;
+        delete[] logList;
+        delete[] images;
+        return FALSE;
+    }
+    head = tail = record[1];
+    sequence = record[2];
+    logStructured = (record[3] == LogLayoutMagic);
+    logHead = record[4];
+
+    for (;;)
+    {
+        int position = head, count = 0;
+        bool complete = FALSE;
+
+        while (position - head < JournalSize)
+        {
+            kernel->synchDisk->ReadSector(LogSector(position), data);
+            if (record[1] != sequence)
+                break;
+            if (record[0] == CommitMagic)
+            {
+                complete = TRUE;
+                position++;
+                break;
+            }
+            if (record[0] != DescriptorMagic || record[2] <= 0 ||
+                record[2] > RecordsPerDescriptor ||
+                count + record[2] > JournalSize)
+                break;
+
+            for (int i = 0; i < record[2]; i++)
+            {
+                homes[count + i] = record[3 + i];
+                logList[i] = LogSector(position + 1 + i);
+            }
+            kernel->synchDisk->ReadSectors(logList, record[2],
+                                           &images[count * SectorSize]);
+            count += record[2];
+            position += 1 + record[2];
+        }
+        if (!complete)
+            break;
+
+        DEBUG(dbgFile, "Replaying transaction " << sequence << ", " << count << " sectors");
+        kernel->synchDisk->WriteThrough(homes, count, images, NULL);
+        head = position;
+        sequence++;
+        replayed++;
+    }
+
+    // the log is empty now; start it where replay stopped
+    if (replayed > 0)
+    {
+        tail = head;
+        SetHeader(headerData, tail, sequence, logStructured, logHead);
+        kernel->synchDisk->WriteThrough(&headerSector, 1, headerData, NULL);
+    }
+    delete[] homes;
+    delete[] logList;
+    delete[] images;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Begin
+// 	The current thread starts a metadata update.  Until the matching
+//	End, everything it writes is part of the running transaction.
+//	Updates can nest.
+//
+//	Once the running transaction has MaxRunning / 2 sectors, a new
+//	update waits for it to be committed before it joins in: otherwise
+//	threads that keep starting updates would never let it commit, and
+//	it would fill up (see Log).  An update nested in one the thread is
+//	in already goes ahead, as the transaction can't commit without it.
+//----------------------------------------------------------------------
+
+void Journal::Begin()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    while (FindUpdate(kernel->currentThread) == NULL &&
+           numRunning >= MaxRunning / 2)
+    {
+        if (updaters->IsEmpty())
+        {
+            (void)kernel->interrupt->SetLevel(oldLevel);
+            Commit();
+            (void)kernel->interrupt->SetLevel(IntOff);
+        }
+        else
+        {
+            // the updates in it commit it when the last one ends
+            commitWaiters++;
+            committed->P();
+        }
+    }
+    (void)kernel->interrupt->SetLevel(oldLevel);
+    Join();
+}
+
+//----------------------------------------------------------------------
+// Journal::Join
+// 	Make the current thread part of the running transaction, until
+//	the matching End; Begin, without waiting for it to get smaller.
+//----------------------------------------------------------------------
+
+void Journal::Join()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    JournalUpdate *update = FindUpdate(kernel->currentThread);
+
+    if (update == NULL)
+    {
+        update = new JournalUpdate;
+        update->thread = kernel->currentThread;
+        update->depth = 0;
+        updaters->Append(update);
+    }
+    update->depth++;
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// Journal::End
+// 	The current thread has finished an update.  If no other update is
+//	in progress, commit everything finished so far -- unless the
+//	journal is being held, in which case the commit waits for Release
+//	(or for the running transaction to get big).
+//----------------------------------------------------------------------
+
+void Journal::End()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    JournalUpdate *update = FindUpdate(kernel->currentThread);
+    bool commit;
+
+    ASSERT(update != NULL);
+    if (--update->depth == 0)
+    {
+        updaters->Remove(update);
+        delete update;
+    }
+    commit = updaters->IsEmpty() && numRunning > 0 &&
+             (holds == 0 || numRunning >= MaxRunning / 2);
+    (void)kernel->interrupt->SetLevel(oldLevel);
+    if (commit)
+        Commit();
+}
+
+//----------------------------------------------------------------------
+// Journal::Updating
+// 	Return TRUE if the current thread is in the middle of an update
+//	(so that what it writes is metadata, on its way to the log).
+//----------------------------------------------------------------------
+
+bool Journal::Updating()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    bool updating = (FindUpdate(kernel->currentThread) != NULL);
+
+    (void)kernel->interrupt->SetLevel(oldLevel);
+    return updating;
+}
+
+//----------------------------------------------------------------------
+// Journal::Hold/Release
+// 	Group all the updates made between Hold and Release into as few
+//	commits as possible.  A batch of updates that keep writing the same
+//	few sectors (a directory, part of the free map) then costs one
+//	commit, instead of one per update.
+//----------------------------------------------------------------------
+
+void Journal::Hold()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    holds++;
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+void Journal::Release()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    bool commit;
+
+    ASSERT(holds > 0);
+    holds--;
+    commit = (holds == 0 && updaters->IsEmpty() && numRunning > 0);
+    (void)kernel->interrupt->SetLevel(oldLevel);
+    if (commit)
+        Commit();
+}
+
+//----------------------------------------------------------------------
+// Journal::Flush
+// 	Return once every update finished so far is in the log.  Updates
+//	other threads are in the middle of belong to the running
+//	transaction too, so it can't be committed before they end; we give
+//	them the CPU until they have.  A commit another thread started is
+//	finished once we can get the commit lock.
+//----------------------------------------------------------------------
+
+void Journal::Flush()
+{
+    for (;;)
+    {
+        IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+        bool pending = (numRunning > 0);
+        bool busy = !updaters->IsEmpty();
+
+        (void)kernel->interrupt->SetLevel(oldLevel);
+        if (!pending)
+            break;
+        if (busy)
+            kernel->currentThread->Yield();
+        else
+            Commit();
+    }
+    commitLock->Acquire();
+    commitLock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Absorb
+// 	SynchDisk offers us every write.  Take it into the running
+//	transaction if the current thread is in the middle of an update,
+//	or if we hold any of the sectors (so that they don't reach the disk
+//	ahead of, and then get overwritten by, the contents we logged).
+//	A write taken outside of an update is an update of its own; it
+//	doesn't wait for a big transaction to commit (see Begin), as the
+//	writer may hold locks the updates in it need to finish.
+//
+//	Return TRUE if the write was taken; the caller must not write it
+//	to disk then.
+//
+//	"sectorList" -- the disk sectors being written
+//	"numSectors" -- the number of entries in sectorList
+//	"data" -- the new contents of sectorList[i] are at data[i * SectorSize]
+//----------------------------------------------------------------------
+
+bool Journal::Absorb(int *sectorList, int numSectors, char *data)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    bool absorb = (FindUpdate(kernel->currentThread) != NULL);
+
+    for (int i = 0; i < numSectors && !absorb; i++)
+        absorb = (Lookup(sectorList[i]) != -1);
+    (void)kernel->interrupt->SetLevel(oldLevel);
+    if (!absorb)
+        return FALSE;
+
+    Join();
+    for (int i = 0; i < numSectors; i++)
+        Log(sectorList[i], &data[i * SectorSize]);
+    End();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Overlay
+// 	Replace the contents read from disk of any sector we hold with the
+//	newest contents.
+//
+//	"sectorList" -- the disk sectors that were read
+//	"numSectors" -- the number of entries in sectorList
+//	"data" -- what was read; sectorList[i] is at data[i * SectorSize]
+//----------------------------------------------------------------------
+
+void Journal::Overlay(int *sectorList, int numSectors, char *data)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    if (numBlocks > 0)
+        for (int i = 0; i < numSectors; i++)
+        {
+            int b = Lookup(sectorList[i]);
+
+            if (b != -1)
+                bcopy(blocks[b].image, &data[i * SectorSize], SectorSize);
+        }
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// Journal::Log
+// 	Record the new contents of a sector in the running transaction.
+//	A sector written with the contents it already has is left out;
+//	that is what keeps a rewrite of the whole free map down to the
+//	sectors that actually changed.
+//
+//	One transaction may only change MaxRunning sectors.  An update
+//	that changes more (removing a large tree, say) is committed in
+//	pieces: once the running transaction is full, it goes to the log
+//	as it stands, and the update carries on in the next one.  If we
+//	crash in between, only part of that update is replayed -- each
+//	piece is still whole, so what is on disk is consistent, but a
+//	removal may leave behind sectors it had not freed yet.
+//
+//	"sector" -- the home sector
+//	"data" -- its new contents
+//----------------------------------------------------------------------
+
+void Journal::Log(int sector, char *data)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    int b;
+
+    for (;;)
+    {
+        b = Lookup(sector);
+        if (b != -1 && blocks[b].running)
+            break; // changed already; there is room for it
+        if (b == -1)
+        {
+            char current[SectorSize];
+
+            if (kernel->synchDisk->Cached(sector, current) &&
+                memcmp(current, data, SectorSize) == 0)
+            {
+                (void)kernel->interrupt->SetLevel(oldLevel);
+                return; // unchanged
+            }
+        }
+        else if (memcmp(blocks[b].image, data, SectorSize) == 0)
+        {
+            (void)kernel->interrupt->SetLevel(oldLevel);
+            return; // unchanged since it was committed
+        }
+
+        if (numRunning == MaxRunning)
+        {
+            // the transaction is full; commit it, updates and all
+            (void)kernel->interrupt->SetLevel(oldLevel);
+            Commit();
+            (void)kernel->interrupt->SetLevel(IntOff);
+        }
+        else if (b == -1 && numBlocks == MaxJournalBlocks)
+        {
+            // every block is taken; wait for a checkpoint to free some
+            (void)kernel->interrupt->SetLevel(oldLevel);
+            commitLock->Acquire();
+            (void)kernel->interrupt->SetLevel(IntOff);
+            if (numBlocks == MaxJournalBlocks)
+                WaitForSpace();
+            (void)kernel->interrupt->SetLevel(oldLevel);
+            commitLock->Release();
+            (void)kernel->interrupt->SetLevel(IntOff);
+        }
+        else
+            break;
+        // we may have slept; look again
+    }
+
+    if (b == -1)
+        b = NewBlock(sector);
+    bcopy(data, blocks[b].image, SectorSize);
+    if (!blocks[b].running)
+    {
+        blocks[b].running = TRUE;
+        runningList[numRunning++] = b;
+    }
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// Journal::Commit
+// 	Append the running transaction to the log, and wait until it is
+//	there.  If the log is too full to take it, wait for a checkpoint
+//	first.  Afterwards, start a checkpoint if the log (or the block
+//	pool) is more than half full.
+//
+//	If another update has started by the time we get to commit, leave
+//	it alone: the running transaction is no longer complete, and that
+//	update will commit it when it ends.  Unless the transaction is
+//	full: then it is committed all the same (see Log).
+//----------------------------------------------------------------------
+
+void Journal::Commit()
+{
+    int count, needed, position, seq, k;
+    int *logList;
+    char *buffer;
+    IntStatus oldLevel;
+
+    commitLock->Acquire();
+    oldLevel = kernel->interrupt->SetLevel(IntOff);
+    for (;;)
+    {
+        if (numRunning == 0 ||
+            (!updaters->IsEmpty() && numRunning < MaxRunning))
+        {
+            (void)kernel->interrupt->SetLevel(oldLevel);
+            commitLock->Release();
+            return;
+        }
+        count = numRunning;
+        needed = divRoundUp(count, RecordsPerDescriptor) + count + 1;
+        if (head + needed - tail <= JournalSize)
+            break;
+        WaitForSpace();
+    }
+
+    // lay out the transaction, and move its blocks over to committed
+    seq = sequence++;
+    position = head;
+    head += needed;
+    logList = new int[needed];
+    buffer = new char[needed * SectorSize];
+    memset(buffer, 0, needed * SectorSize);
+    k = 0;
+    for (int i = 0; i < count; i += RecordsPerDescriptor)
+    {
+        int n = min(RecordsPerDescriptor, count - i);
+        int *descriptor = (int *)&buffer[k++ * SectorSize];
+
+        descriptor[0] = DescriptorMagic;
+        descriptor[1] = seq;
+        descriptor[2] = n;
+        for (int j = 0; j < n; j++)
+        {
+            JournalBlock *block = &blocks[runningList[i + j]];
+
+            descriptor[3 + j] = block->sector;
+            bcopy(block->image, &buffer[k++ * SectorSize], SectorSize);
+            bcopy(block->image, block->committedImage, SectorSize);
+            block->running = FALSE;
+            block->committed = TRUE;
+            block->commitSeq = seq;
+        }
+    }
+    ((int *)&buffer[k * SectorSize])[0] = CommitMagic;
+    ((int *)&buffer[k * SectorSize])[1] = seq;
+    ((int *)&buffer[k * SectorSize])[2] = count;
+    for (int i = 0; i < needed; i++)
+        logList[i] = LogSector(position + i);
+    numRunning = 0;
+    for (; commitWaiters > 0; commitWaiters--)
+        committed->V();
+    (void)kernel->interrupt->SetLevel(oldLevel);
+
+    DEBUG(dbgFile, "Committing transaction " << seq << ", " << count << " sectors at log position " << position);
+    kernel->synchDisk->WriteThrough(logList, needed, buffer, NULL);
+    kernel->stats->numJournalCommits++;
+    kernel->stats->numJournalSectors += count;
+    delete[] logList;
+    delete[] buffer;
+
+    oldLevel = kernel->interrupt->SetLevel(IntOff);
+    if (head - tail > JournalSize / 2 || numBlocks > MaxJournalBlocks / 2)
+        StartCheckpoint();
+    (void)kernel->interrupt->SetLevel(oldLevel);
+    commitLock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::StartCheckpoint
+// 	Start copying every committed image to its home sector, unless a
+//	checkpoint is already under way.  We return right away; the disk
+//	interrupt handler carries on from CheckpointDone.
+//
+//	Called with interrupts off, and holding commitLock: a transaction
+//	that is still on its way to the log must never be written home.
+//----------------------------------------------------------------------
+
+void Journal::StartCheckpoint()
+{
+    int n = 0;
+
+    if (checkpointing)
+        return;
+    checkpointing = TRUE;
+    checkpointUpTo = sequence - 1;
+    checkpointHead = head;
+    for (int b = 0; b < MaxJournalBlocks; b++)
+        if (blocks[b].sector != -1 && blocks[b].committed)
+        {
+            checkpointSectors[n] = blocks[b].sector;
+            bcopy(blocks[b].committedImage, &checkpointData[n * SectorSize],
+                  SectorSize);
+            n++;
+        }
+
+    DEBUG(dbgFile, "Checkpointing " << n << " sectors, log positions " << tail << " to " << checkpointHead);
+    kernel->stats->numCheckpoints++;
+    if (n == 0)
+        CheckpointDone(); // nothing to copy; just move the log's start
+    else
+        kernel->synchDisk->WriteThrough(checkpointSectors, n, checkpointData,
+                                        homeWritten);
+}
+
+//----------------------------------------------------------------------
+// Journal::CheckpointDone
+// 	The committed images are in their home sectors.  Let go of the ones
+//	that weren't committed again meanwhile, and write the journal
+//	header, so that recovery starts past the transactions we covered.
+//----------------------------------------------------------------------
+
+void Journal::CheckpointDone()
+{
+    for (int b = 0; b < MaxJournalBlocks; b++)
+    {
+        JournalBlock *block = &blocks[b];
+
+        if (block->sector != -1 && block->committed &&
+            block->commitSeq <= checkpointUpTo)
+        {
+            block->committed = FALSE;
+            if (!block->running)
+                FreeBlock(b);
+        }
+    }
+    SetHeader(headerData, checkpointHead, checkpointUpTo + 1, logStructured,
+              logHead);
+    kernel->synchDisk->WriteThrough(&headerSector, 1, headerData,
+                                    headerWritten);
+}
+
+//----------------------------------------------------------------------
+// Journal::HeaderDone
+// 	The checkpoint is complete; the log before checkpointHead can be
+//	reused.  Wake up anyone waiting for space.
+//----------------------------------------------------------------------
+
+void Journal::HeaderDone()
+{
+    tail = checkpointHead;
+    checkpointing = FALSE;
+    for (; spaceWaiters > 0; spaceWaiters--)
+        spaceFreed->V();
+}
+
+//----------------------------------------------------------------------
+// Journal::WaitForSpace
+// 	Sleep until a checkpoint completes, starting one if need be.
+//	Called with interrupts off, and holding commitLock.
+//----------------------------------------------------------------------
+
+void Journal::WaitForSpace()
+{
+    StartCheckpoint();
+    spaceWaiters++;
+    spaceFreed->P();
+}
+
+//----------------------------------------------------------------------
+// Journal::SetHeader
+// 	Lay out a journal header in "data".
+//
+//	"start" -- the log position recovery starts from
+//	"seq" -- the number of the transaction it expects there
+//	"logStructured", "logHead" -- the checkpoint region of a disk
+//		formatted log-structured: is it one, and where is the head
+//		of its segment log?
+//----------------------------------------------------------------------
+
+void Journal::SetHeader(char *data, int start, int seq, bool logStructured,
+                        int logHead)
+{
+    int *header = (int *)data;
+
+    memset(data, 0, SectorSize);
+    header[0] = JournalMagic;
+    header[1] = start;
+    header[2] = seq;
+    if (logStructured)
+    {
+        header[3] = LogLayoutMagic;
+        header[4] = logHead;
+    }
+}
+
+//----------------------------------------------------------------------
+// Journal::FindUpdate
+// 	Return the record of the update "thread" is in, or NULL if it is
+//	not in the middle of one.
+//----------------------------------------------------------------------
+
+JournalUpdate *Journal::FindUpdate(Thread *thread)
+{
+    ListIterator<JournalUpdate *> iter(updaters);
+
+    for (; !iter.IsDone(); iter.Next())
+        if (iter.Item()->thread == thread)
+            return iter.Item();
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// Journal::Lookup
+// 	Return the block holding "sector", or -1.
+//----------------------------------------------------------------------
+
+int Journal::Lookup(int sector)
+{
+    for (int b = buckets[sector % NumJournalBuckets]; b != -1;
+         b = blocks[b].hashNext)
+        if (blocks[b].sector == sector)
+            return b;
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// Journal::NewBlock
+// 	Claim a free block for "sector".  There must be one.
+//----------------------------------------------------------------------
+
+int Journal::NewBlock(int sector)
+{
+    int b;
+
+    for (b = 0; blocks[b].sector != -1; b++)
+        ASSERT(b < MaxJournalBlocks - 1);
+    blocks[b].sector = sector;
+    blocks[b].running = blocks[b].committed = FALSE;
+    blocks[b].hashNext = buckets[sector % NumJournalBuckets];
+    buckets[sector % NumJournalBuckets] = b;
+    numBlocks++;
+    return b;
+}
+
+//----------------------------------------------------------------------
+// Journal::FreeBlock
+// 	Take a block off its hash chain and return it to the free pool.
+//----------------------------------------------------------------------
+
+void Journal::FreeBlock(int b)
+{
+    int *link = &buckets[blocks[b].sector % NumJournalBuckets];
+
+    while (*link != b)
+        link = &blocks[*link].hashNext;
+    *link = blocks[b].hashNext;
+    blocks[b].hashNext = -1;
+    blocks[b].sector = -1;
+    numBlocks--;
+}
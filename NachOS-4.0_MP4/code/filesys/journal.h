@@ -0,0 +1,195 @@
+// journal.h
+//	Data structures for a write-ahead journal of file system metadata.
+//
+//	Without a journal, each update to the metadata (a file header, a
+//	directory, the bitmap of free sectors) writes every sector it
+//	changed in place, synchronously, wherever on the disk it lives;
+//	and a crash in the middle leaves the update half done.
+//
+//	With the journal, the sectors an update writes are collected in
+//	memory instead, and then appended to the log -- a fixed region of
+//	the disk, written sequentially -- in one request.  Once that
+//	request is done, the update is committed: if we crash, mounting the
+//	disk replays the log, so the update happens entirely or not at all.
+//	The sectors are copied to their home locations later, in the
+//	background and all in one batch (a "checkpoint"), after which
+//	their part of the log can be reused.
+//
+//	Commits are made in groups.  A commit covers every update finished
+//	since the last one: those that ended while another thread was in
+//	the middle of an update, and those made while the caller held the
+//	journal open for a batch.  A sector written by several of them is
+//	logged once, with its latest contents.
+//
+//	On disk, the log is a sequence of transactions, each made of one or
+//	more descriptor sectors (a descriptor lists the home sectors of the
+//	images that follow it), the images, and a commit sector.  The
+//	journal header records where the oldest transaction that may not
+//	be checkpointed yet starts.
+//
+//	The header is also the checkpoint region of a disk formatted
+//	log-structured (see filesys.h): it says so, and records where the
+//	head of the segment log was as of the last checkpoint, so that
+//	mounting the disk carries on from there.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "disk.h"
+#include "pbitmap.h"
+#include "synch.h"
+#include "callback.h"
+#include "list.h"
+
+#define JournalSector 2                  // Journal header, right after the
+                                         //   free map's and the root
+                                         //   directory's headers
+#define JournalStart (JournalSector + 1) // First sector of the log
+#define JournalSize 2048                 // Sectors in the log
+
+#define MaxRunning (JournalSize / 2)     // Most sectors one transaction
+                                         //   may change
+#define MaxJournalBlocks (MaxRunning + JournalSize / 4)
+                                         // Most sectors the journal holds
+                                         //   in memory at once
+
+// Sectors listed by one descriptor: it has a magic number, the
+// transaction number and the number of images in front of the list.
+#define RecordsPerDescriptor ((int)(SectorSize / sizeof(int)) - 3)
+
+class HomeWritten;
+class HeaderWritten;
+
+// The following class defines a sector the journal is holding: changed
+// by the transaction still running, or committed to the log and not yet
+// copied to its home sector -- or both.
+
+class JournalBlock
+{
+public:
+    int sector;                      // Home sector, -1 if the block is free
+    bool running;                    // Changed by the running transaction?
+    bool committed;                  // Committed, not yet checkpointed?
+    int commitSeq;                   // Transaction that committed it last
+    int hashNext;                    // Next block in the same hash chain
+    char image[SectorSize];          // The newest contents
+    char committedImage[SectorSize]; // The contents as of commitSeq
+};
+
+// The following class records a thread in the middle of an update.
+
+class JournalUpdate
+{
+public:
+    Thread *thread; // Who is updating
+    int depth;      // How many Begin calls are unmatched
+};
+
+// The following class defines the journal.  Its state is shared with
+// the disk interrupt handler (which completes checkpoints), so it is
+// only touched with interrupts disabled.
+
+class Journal
+{
+public:
+    Journal();  // Initialize an empty journal
+    ~Journal(); // De-allocate it; everything committed is in
+                // the log already
+
+    static void Format(PersistentBitmap *freeMap, bool logStructured);
+    // Set aside the log on a new disk
+    bool Recover(); // Replay the committed transactions in the
+                    // log; FALSE if the disk has no journal
+
+    bool LogStructured() { return logStructured; } // How the disk was
+                                                   // formatted
+    int LogHead() { return logHead; }  // Where the segment log was at
+    void SetLogHead(int sector) { logHead = sector; } // the last
+                                       // checkpoint; where it is now
+
+    void Begin(); // Start an update: the current thread's
+                  // writes go to the journal until End
+                  // (once the running transaction is
+                  // big, after it commits)
+    void End();   // Done; commit, unless other updates are
+                  // in progress or the journal is held
+    bool Updating(); // Is the current thread between the two?
+    void Hold();    // Don't commit at the end of each update,
+    void Release(); // ... until now
+    void Flush();   // Commit every update finished so far, and
+                    // wait until it is in the log
+
+    bool Absorb(int *sectorList, int numSectors, char *data);
+    // Take a write, if it belongs to an
+    // update (or touches sectors we hold)
+    void Overlay(int *sectorList, int numSectors, char *data);
+    // Patch what was read from disk
+    // with the contents we hold
+
+    void CheckpointDone(); // Disk interrupt handler: the home sectors
+                           // are written
+    void HeaderDone();     // ... and so is the new start of the log
+
+private:
+    JournalBlock *blocks; // Sectors held in memory
+    int *buckets;         // Hash chains of blocks, by sector
+    int numBlocks;        // Blocks in use
+
+    List<JournalUpdate *> *updaters; // Threads in the middle of an update
+    int holds;                // Outstanding Hold calls
+    int *runningList;         // Blocks changed by the running transaction
+    int numRunning;
+
+    int head;     // Where the next transaction goes in the log,
+    int tail;     //   and where the oldest one still needed is;
+                  //   counted from the start of time, so that
+                  //   head - tail is the part of the log in use
+    int sequence; // Number of the next transaction
+    Lock *commitLock; // One commit (or checkpoint start) at a time,
+                      //   so transactions reach the log in order
+
+    bool checkpointing;     // Is a checkpoint in progress?
+    int checkpointUpTo;     // Last transaction it covers
+    int checkpointHead;     // Where the log will start once it's done
+    int *checkpointSectors; // Home sectors it is writing,
+    char *checkpointData;   //   and what it writes there
+    int headerSector;       // JournalSector, as a sector list
+    char headerData[SectorSize];
+    bool logStructured;     // Checkpoint region of a log-structured disk?
+    int logHead;            // ... where its segment log is
+    HomeWritten *homeWritten;     // Disk interrupt handlers for the two
+    HeaderWritten *headerWritten; //   stages of a checkpoint
+    Semaphore *spaceFreed;  // Where threads wait for log space,
+    int spaceWaiters;       //   and how many of them
+    Semaphore *committed;   // Where new updates wait for a big
+    int commitWaiters;      //   transaction to commit, and how many
+
+    JournalUpdate *FindUpdate(Thread *thread);
+    // The update "thread" is in, or NULL
+    void Join();              // Begin, without waiting for room
+    int Lookup(int sector);   // Return the block holding "sector", or -1
+    int NewBlock(int sector); // Claim a free block for "sector"
+    void FreeBlock(int b);    // Return a block to the free pool
+
+    void Log(int sector, char *data); // Add a sector to the running
+                                      // transaction
+    void Commit();          // Append the running transaction to the log
+    void StartCheckpoint(); // Start copying committed sectors home
+    void WaitForSpace();    // Sleep until a checkpoint frees log space
+
+    int LogSector(int position) // Where a log position is on disk
+    {
+        return JournalStart + position % JournalSize;
+    }
+    static void SetHeader(char *data, int start, int seq,
+                          bool logStructured, int logHead);
+    // Lay out a journal header
+};
+
+#endif // JOURNAL_H
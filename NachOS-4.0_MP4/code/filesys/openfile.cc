@@ -7,6 +7,18 @@
 //	Also as in UNIX, for convenience, we keep the file header in
 //	memory while the file is open.
 //
+//	MP4: threads may use the same file at once, through one OpenFile
+//	each; they share its in-core header (see filetable.h), and its
+//	lock.  Whoever changes the header holds the lock from the start
+//	of the change until it is back on disk, and whoever looks up
+//	sectors in it holds the lock while doing so: the index headers
+//	below it are read from disk as they are needed, and one being
+//	added may not be there yet.  A write holds the lock until its
+//	data is on disk too (see WriteRun), and for a compressed file, a
+//	chunk is read, changed and stored again with the lock held, so
+//	that two writes to one sector can't lose each other.  Reads only
+//	hold it to look up their sectors.
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
@@ -17,6 +29,22 @@
 #include "filehdr.h"
 #include "openfile.h"
 #include "synchdisk.h"
+#include "pbitmap.h"
+#include "filetable.h"
+#include "compress.h"
+#include "synch.h"
+
+// Bounds on the read-ahead window, in sectors.  The window starts small
+// and doubles on every further sequential read, up to the maximum.
+#define MinReadAhead 4
+#define MaxReadAhead 64
+
+// Most sectors of a file Reserve maps in one metadata update
+#define MaxReserveRun 256
+
+// On a log-structured disk, a write of at most this many sectors goes
+// into the journal along with the metadata it changes, in one commit
+#define MaxLoggedWrite 16
 
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
@@ -30,30 +58,84 @@ OpenFile::OpenFile(int sector)
 {
     hdr = new FileHeader;
     hdr->FetchFrom(sector);
+    hdrSector = sector;
+    sharedIn = NULL;
+    entry = new OpenHeader(sector, hdr);
+    hdrLock = entry->lock;
+    contentsLock = entry->contents;
+    seekPosition = 0;
+    seqPosition = 0;
+    readAheadWindow = 0;
+    readAheadNext = 0;
+    buffering = FALSE;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::OpenFile
+// 	Open a Nachos file, using the in-core header every other open of
+//	the file shares (see filetable.h).  The seek position is still
+//	our own.
+//
+//	"sector" -- the location on disk of the file header for this file
+//	"table" -- the system-wide open file table; if NULL, the header
+//		is our own, as with OpenFile(sector)
+//----------------------------------------------------------------------
+
+OpenFile::OpenFile(int sector, OpenFileTable *table)
+{
+    if (table != NULL)
+    {
+        hdr = table->Acquire(sector);
+        entry = table->Lookup(sector);
+    }
+    else
+    {
+        hdr = new FileHeader;
+        hdr->FetchFrom(sector);
+        entry = new OpenHeader(sector, hdr);
+    }
+    hdrLock = entry->lock;
+    contentsLock = entry->contents;
+    hdrSector = sector;
+    sharedIn = table;
     seekPosition = 0;
+    seqPosition = 0;
+    readAheadWindow = 0;
+    readAheadNext = 0;
+    buffering = FALSE;
 }
 
 //----------------------------------------------------------------------
 // OpenFile::~OpenFile
 // 	Close a Nachos file, de-allocating any in-memory data structures.
+//	What is left in the write buffer is written out; to hear whether
+//	it fit on the disk, Flush first.
 //----------------------------------------------------------------------
 
 OpenFile::~OpenFile()
 {
-    delete hdr;
+    Drain();
+    if (sharedIn != NULL)
+        sharedIn->Release(hdrSector);
+    else
+        delete entry;
 }
 
 //----------------------------------------------------------------------
 // OpenFile::Seek
 // 	Change the current location within the open file -- the point at
-//	which the next Read or Write will start from.
+//	which the next Read or Write will start from.  Return FALSE if
+//	some of what was written before could not be stored (see Flush).
 //
 //	"position" -- the location within the file for the next Read/Write
 //----------------------------------------------------------------------
 
-void OpenFile::Seek(int position)
+bool OpenFile::Seek(int position)
 {
+    bool stored = Flush();
+
     seekPosition = position;
+    return stored;
 }
 
 //----------------------------------------------------------------------
@@ -102,6 +184,28 @@ int OpenFile::Write(char *into, int numBytes)
 //	   in the data that will be modified, and write back all the full
 //	   or partial sectors that are part of the request.
 //
+//	MP4: files grow.  A write past the end of the file extends it, and
+//	a write into a hole gets blocks allocated for it (see Reserve).
+//	Holes read as zeros; they are never read from the disk.
+//
+//	MP4: the data of an inline file is in its header, which is in
+//	memory: reading it takes no disk I/O, and writing it writes just
+//	the header.  A write that doesn't fit makes it an ordinary file.
+//
+//	MP4: the data of a compressed file is read and written a whole
+//	chunk at a time (see ReadChunks, WriteChunks).
+//
+//	MP4: if the file buffers writes (see BufferWrites), a write within
+//	one sector stays in memory, and the writes that continue it fill
+//	the sector up; only then, or when a write goes elsewhere, is it
+//	written out.  So a stream of small writes costs one disk write
+//	per sector, and no reads.  A longer write goes to the disk at
+//	once, but keeps the partial sector it ends in, for the next one
+//	to continue.  A sector only needs reading first if what is
+//	written of it doesn't cover what the file has in it (see
+//	WriteThrough).  If writing out the buffer found the disk full,
+//	the next write returns 0, and so does nothing else.
+//
 //	"into" -- the buffer to contain the data to be read from disk
 //	"from" -- the buffer containing the data to be written to disk
 //	"numBytes" -- the number of bytes to transfer
@@ -111,25 +215,85 @@ int OpenFile::Write(char *into, int numBytes)
 
 int OpenFile::ReadAt(char *into, int numBytes, int position)
 {
-    int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
+    int fileLength;
+    int firstSector, lastSector, numSectors;
+    int i, j;
+    int *sectors;
     char *buf;
 
+    Drain(); // so that what was written can be read back
+    fileLength = hdr->FileLength();
+
     if ((numBytes <= 0) || (position >= fileLength))
         return 0; // check request
     if ((position + numBytes) > fileLength)
         numBytes = fileLength - position;
     DEBUG(dbgFile, "Reading " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    if (hdr->IsInline())
+    {
+        hdrLock->Acquire();
+        if (hdr->IsInline()) // (unless it spilled meanwhile)
+        {
+            hdr->ReadInline(into, numBytes, position);
+            hdrLock->Release();
+            return numBytes;
+        }
+        hdrLock->Release();
+    }
+
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
 
-    // read in all the full and partial sectors that we need
+    // a read that starts where the last one ended continues a
+    // sequential stream: widen the read-ahead window; anything else
+    // closes it
+    if (position == seqPosition)
+        readAheadWindow = (readAheadWindow == 0)
+                              ? MinReadAhead
+                              : min(2 * readAheadWindow, MaxReadAhead);
+    else
+        readAheadWindow = readAheadNext = 0;
+    seqPosition = position + numBytes;
+
+    if (hdr->IsCompressed())
+    {
+        // expand the chunks the request falls in
+        int firstChunk = position / ChunkSize;
+        int numChunks = 1 + (position + numBytes - 1) / ChunkSize - firstChunk;
+
+        buf = new char[numChunks * ChunkSize];
+        hdrLock->Acquire();
+        ReadChunks(buf, firstChunk, numChunks, position, numBytes);
+        hdrLock->Release();
+        if (readAheadWindow > 0)
+            ReadAhead((firstChunk + numChunks) * ChunkSectors);
+        bcopy(&buf[position - firstChunk * ChunkSize], into, numBytes);
+        delete[] buf;
+        return numBytes;
+    }
+
+    // read in all the full and partial sectors that we need,
+    // as one vectored request per run of allocated sectors
     buf = new char[numSectors * SectorSize];
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize),
-                                      &buf[(i - firstSector) * SectorSize]);
+    memset(buf, 0, numSectors * SectorSize); // holes read as zeros
+    sectors = new int[numSectors];
+    hdrLock->Acquire();
+    hdr->ByteToSectors(firstSector * SectorSize, numSectors, sectors);
+    hdrLock->Release();
+    for (i = 0; i < numSectors; i = j + 1)
+    {
+        for (j = i; j < numSectors && sectors[j] != -1; j++)
+            ;
+        if (j > i)
+            kernel->synchDisk->ReadSectors(&sectors[i], j - i,
+                                           &buf[i * SectorSize]);
+    }
+    delete[] sectors;
+
+    if (readAheadWindow > 0)
+        ReadAhead(lastSector + 1);
 
     // copy the part we want
     bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
@@ -139,53 +303,813 @@ int OpenFile::ReadAt(char *into, int numBytes, int position)
 
 int OpenFile::WriteAt(char *from, int numBytes, int position)
 {
-    int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    bool firstAligned, lastAligned;
-    char *buf;
+    int done = 0, start, end, last, written;
+    int maxSize = (int)MaxFileSize;
+    bool through;
 
-    if ((numBytes <= 0) || (position >= fileLength))
+    if ((numBytes <= 0) || (position < 0) || (position >= maxSize))
         return 0; // check request
-    if ((position + numBytes) > fileLength)
-        numBytes = fileLength - position;
+    if ((position + numBytes) > maxSize)
+        numBytes = maxSize - position;
+    if (!buffering || hdr->IsInline() || hdr->IsCompressed())
+    {
+        Drain(); // (what another open buffered goes first)
+        return WriteThrough(from, numBytes, position);
+    }
+
+    entry->bufferLock->Acquire();
+    // a write that continues the buffered one fills up its sector
+    if (!entry->bufferLost && entry->bufferSector != -1 &&
+        position != entry->bufferSector * SectorSize + entry->bufferEnd)
+        DrainLocked();
+    if (!entry->bufferLost && entry->bufferSector != -1)
+    {
+        done = min(numBytes, SectorSize - entry->bufferEnd);
+        bcopy(from, &entry->buffer[entry->bufferEnd], done);
+        entry->bufferEnd += done;
+        entry->bufferDirty = TRUE;
+        if (entry->bufferEnd == SectorSize)
+            DrainLocked();
+    }
+    if (entry->bufferLost)
+    {
+        // what was buffered didn't fit on the disk: say so
+        entry->bufferLost = FALSE;
+        entry->bufferLock->Release();
+        return 0;
+    }
+
+    // the rest goes to the disk -- but for a write within one sector,
+    // which waits in the buffer.  The partial sector a longer write
+    // ends in goes to the disk with the rest, and stays in the buffer
+    // too, so that the next write can continue it without reading it.
+    start = position + done;
+    end = position + numBytes;
+    last = divRoundDown(end, SectorSize) * SectorSize;
+    through = (start < last);
+    if (start < end && through &&
+        (written = WriteThrough(from + done, end - start, start)) < end - start)
+        numBytes = done + written;
+    else if (start < end && last < end)
+    {
+        start = max(start, last);
+        entry->bufferSector = last / SectorSize;
+        entry->bufferStart = start - last;
+        entry->bufferEnd = end - last;
+        entry->bufferDirty = !through;
+        bcopy(from + (start - position), &entry->buffer[entry->bufferStart],
+              end - start);
+    }
+    entry->bufferLock->Release();
+    return numBytes;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::WriteThrough
+// 	Write to the file, and to the disk, now (the rest of what WriteAt
+//	does).  A long write goes in runs of at most MaxReserveRun sectors
+//	(see WriteRun), so that no metadata update maps more sectors than
+//	the journal can commit at once.
+//
+//	Return the number of bytes written: fewer than asked for (maybe 0)
+//	if the disk is full.
+//----------------------------------------------------------------------
+
+int OpenFile::WriteThrough(char *from, int numBytes, int position)
+{
+    int fileLength = hdr->FileLength();
+    int done, n;
+
     DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
-    firstSector = divRoundDown(position, SectorSize);
-    lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
+    if (hdr->IsInline() && position + numBytes <= MaxInlineSize)
+    {
+        bool inlined;
 
-    buf = new char[numSectors * SectorSize];
+        kernel->fileSystem->BeginUpdate();
+        hdrLock->Acquire();
+        inlined = hdr->IsInline(); // (unless it spilled meanwhile)
+        if (inlined)
+        {
+            hdr->WriteInline(from, numBytes, position);
+            hdr->WriteBack(hdrSector);
+        }
+        hdrLock->Release();
+        kernel->fileSystem->EndUpdate();
+        if (inlined)
+            return numBytes;
+    }
+
+    if (hdr->IsCompressed())
+    {
+        int newLength = max(fileLength, position + numBytes);
+        int firstChunk = position / ChunkSize;
+        int lastChunk = (position + numBytes - 1) / ChunkSize;
+        int oldLast = fileLength / ChunkSize;
+
+        // a partial last chunk gets longer if the file grows: store it
+        // again, first, even if the write doesn't touch it
+        if (newLength > fileLength && fileLength % ChunkSize != 0 &&
+            oldLast < firstChunk &&
+            !WriteChunks(from, 0, position, oldLast, oldLast, newLength))
+            return 0;
+        if (!WriteChunks(from, numBytes, position, firstChunk, lastChunk,
+                         newLength))
+            return 0;
+        return numBytes;
+    }
+
+    if (hdr->IsInline())
+    {
+        // too big now: spill the data to a sector of its own first
+        if (!Reserve(position + numBytes, 0, 0, NULL))
+            return 0;
+    }
+
+    for (done = 0; done < numBytes; done += n)
+    {
+        int start = position + done;
+        int end = min(position + numBytes,
+                      (divRoundDown(start, SectorSize) + MaxReserveRun) *
+                          SectorSize);
+
+        n = end - start;
+        if (!WriteRun(from + done, n, start))
+            break;
+    }
+    return done;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::WriteRun
+// 	Write at most MaxReserveRun sectors' worth of the file to the
+//	disk.  The first and last sectors of the write are read in first
+//	if it covers only part of them -- unless what it doesn't cover of
+//	the last one is past the end of the file, and so is only zeros.
+//
+//	The header's lock is held from when the sectors are looked up
+//	until the data is on disk: so two writes to one sector (through
+//	different opens) can't each read it, change their part and write
+//	it back over the other's; and a read that finds the file longer,
+//	or its holes filled, finds the data there too -- not what the
+//	sectors held before they were allocated.  If the file has to grow,
+//	or have sectors allocated, the write starts a metadata update
+//	first (see Reserve), as the lock comes after it.
+//
+//	Return FALSE if the disk is full.
+//----------------------------------------------------------------------
+
+bool OpenFile::WriteRun(char *from, int numBytes, int position)
+{
+    int firstSector = divRoundDown(position, SectorSize);
+    int lastSector = divRoundDown(position + numBytes - 1, SectorSize);
+    int numSectors = 1 + lastSector - firstSector;
+    int fileLength, oldSectors;
+    int *sectors = new int[numSectors];
+    bool firstAligned, lastAligned, complete, logged, relocate, update;
+    char *buf = new char[numSectors * SectorSize];
 
     memset(buf, 0, sizeof(char) * numSectors * SectorSize); // dummy operation to keep valgrind happy
 
-    firstAligned = (position == (firstSector * SectorSize));
-    lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
+    // on a log-structured disk, a small write is one update together
+    // with the space it takes: its data is committed along with the
+    // header and free map, and reaches the log head at the checkpoint
+    // (not while the file system is still being set up, though)
+    logged = (kernel->fileSystem != NULL &&
+              kernel->fileSystem->LogStructured() &&
+              numSectors <= MaxLoggedWrite);
+
+    // there, data isn't written over in place either: what the write
+    // covers moves to the log head (see MapSectors) -- unless it is
+    // metadata, written in an update, which goes through the journal
+    relocate = (kernel->fileSystem != NULL &&
+                kernel->fileSystem->LogStructured() &&
+                !kernel->fileSystem->InUpdate());
+
+    // find the sectors we are writing over; past the end of the file
+    // there are none yet (and a write into the rest of the last one
+    // still makes the file longer), and in a file that shares sectors
+    // with a clone, they may have to be copied first (see MapSectors)
+    for (update = logged;; update = TRUE)
+    {
+        if (update)
+            kernel->fileSystem->BeginUpdate();
+        hdrLock->Acquire();
+        fileLength = hdr->FileLength();
+        oldSectors = max(0, min(numSectors,
+                                divRoundUp(fileLength, SectorSize) - firstSector));
+        hdr->ByteToSectors(firstSector * SectorSize, oldSectors, sectors);
+        complete = (oldSectors == numSectors && !hdr->IsShared() &&
+                    !relocate && position + numBytes <= fileLength);
+        for (int i = oldSectors; i < numSectors; i++)
+            sectors[i] = -1;
+        for (int i = 0; i < oldSectors; i++)
+            if (sectors[i] == -1)
+                complete = FALSE;
+        if (complete || update)
+            break;
+        hdrLock->Release(); // and start over, in an update
+    }
 
     // read in first and last sector, if they are to be partially modified
-    if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize],
-               SectorSize, lastSector * SectorSize);
+    // (straight from the disk, so as not to disturb read-ahead); a sector
+    // that doesn't exist yet is all zeros.  (What the write leaves of the
+    // last sector past the end of the file needn't be read in: it is
+    // zeros.)
+    firstAligned = (position == (firstSector * SectorSize));
+    lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize) ||
+                   position + numBytes >= fileLength);
+    if (!firstAligned && sectors[0] != -1)
+        kernel->synchDisk->ReadSector(sectors[0], buf);
+    if (!lastAligned && ((firstSector != lastSector) || firstAligned) &&
+        sectors[numSectors - 1] != -1)
+        kernel->synchDisk->ReadSector(sectors[numSectors - 1],
+                                      &buf[(lastSector - firstSector) * SectorSize]);
 
     // copy in the bytes we want to change
     bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
 
-    // write modified sectors back
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize),
-                                       &buf[(i - firstSector) * SectorSize]);
+    // make room for them, if the file has to grow
+    if (!complete && !Map(position + numBytes, firstSector, numSectors,
+                          sectors, relocate))
+    {
+        DEBUG(dbgFile, "Out of disk space writing " << numBytes << " bytes at " << position);
+        hdrLock->Release();
+        kernel->fileSystem->EndUpdate();
+        delete[] sectors;
+        delete[] buf;
+        return FALSE;
+    }
+
+    // the new metadata is committed before the data is written (unless
+    // they go together); then write modified sectors back, as one
+    // vectored request
+    if (update && !logged)
+        kernel->fileSystem->EndUpdate();
+    kernel->synchDisk->WriteSectors(sectors, numSectors, buf);
+    if (logged)
+        kernel->fileSystem->EndUpdate();
+    hdrLock->Release();
+    delete[] sectors;
     delete[] buf;
-    return numBytes;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::Reserve
+// 	Make sure a range of the file has disk sectors to write to: extend
+//	the file to "newLength" if it is shorter, and allocate whatever
+//	data blocks (and index headers) the range is missing (see Map).
+//
+//	A long range is mapped MaxReserveRun sectors at a time, each run
+//	a metadata update of its own, so that no update changes more
+//	sectors than the journal can commit at once; the file grows in
+//	the same update as the first run is mapped.  Each run holds the
+//	header's lock from its start until the header is back on disk.
+//
+//	Return FALSE if the disk is full.
+//
+//	"newLength" -- the length the file must have at least
+//	"firstSector", "numSectors" -- the range of file sectors needed
+//	"sectorList" -- receives the disk sectors for the range
+//----------------------------------------------------------------------
+
+bool OpenFile::Reserve(int newLength, int firstSector, int numSectors,
+                       int *sectorList)
+{
+    bool extend = (newLength > hdr->FileLength());
+    bool success = TRUE;
+
+    for (int i = 0; success && (i < numSectors || extend); i += MaxReserveRun)
+    {
+        int n = max(0, min(MaxReserveRun, numSectors - i));
+
+        kernel->fileSystem->BeginUpdate();
+        hdrLock->Acquire();
+        success = Map(newLength, firstSector + i, n, &sectorList[i], FALSE);
+        extend = FALSE;
+        hdrLock->Release();
+        kernel->fileSystem->EndUpdate();
+    }
+    return success;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::Map
+// 	Extend the file to "newLength" if it is shorter (another write may
+//	have made it longer meanwhile), and allocate whatever data blocks
+//	(and index headers) a range of at most MaxReserveRun of its
+//	sectors is missing.  If the range spans at least a level 0
+//	header's worth of sectors, its index headers are allocated first,
+//	in bulk (see FileHeader::MapIndex): in one run, just ahead of the
+//	range's data, and written in one request.  (Not the index of the
+//	whole file at once: a sequential read would then go back from the
+//	data to the index every so often -- across tracks, on a big file,
+//	which costs a rotation each time.)  The file header and the free
+//	map go back to disk if they change.  The caller is in a metadata
+//	update, and holds the header's lock; the free map's is taken after
+//	it (the order filesys.cc has them taken in).
+//
+//	Return FALSE if the disk is full.
+//
+//	"newLength" -- the length the file must have at least
+//	"firstSector", "numSectors" -- the range of file sectors needed
+//	"sectorList" -- receives the disk sectors for the range
+//	"relocate" -- move the sectors the range has already to the log
+//		head (the caller writes all of them)
+//----------------------------------------------------------------------
+
+bool OpenFile::Map(int newLength, int firstSector, int numSectors,
+                   int *sectorList, bool relocate)
+{
+    PersistentBitmap *freeMap = kernel->fileSystem->FetchFreeMap();
+    bool changed = FALSE, success = TRUE;
+
+    ASSERT(numSectors <= MaxReserveRun);
+    if (newLength > hdr->FileLength())
+    {
+        success = hdr->Extend(freeMap, newLength, hdrSector + 1);
+        changed = TRUE;
+    }
+    if (success && numSectors >= (int)NumDirect)
+    {
+        int allocated = hdr->MapIndex(freeMap, firstSector * SectorSize,
+                                      numSectors, hdrSector + 1);
+
+        success = (allocated != -1);
+        if (allocated > 0)
+            changed = TRUE;
+    }
+    if (success && numSectors > 0)
+    {
+        int allocated = hdr->MapSectors(freeMap, firstSector * SectorSize,
+                                        numSectors, sectorList, hdrSector + 1,
+                                        relocate);
+
+        success = (allocated != -1);
+        if (allocated != 0) // (or it failed part way)
+            changed = TRUE;
+    }
+    if (changed)
+        hdr->WriteBack(hdrSector);
+    kernel->fileSystem->ReleaseFreeMap(freeMap, changed);
+    return success;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::ReadChunks
+// 	Read chunks of a compressed file, and expand them.  A chunk is
+//	ChunkSize bytes of the file (the last one may be shorter), and
+//	is stored in the first sectors of its own span of the file: if
+//	all of them are allocated, it is stored as it is; if fewer are,
+//	those hold the compressed form; if none are, it is all zeros.
+//	The sectors of all the chunks are read in one vectored request
+//	per run of allocated sectors, as ReadAt does; of a chunk stored as
+//	it is, only the sectors the caller wants.
+//
+//	"into" -- receives the chunks, ChunkSize bytes each (zeros past
+//		the end of the file)
+//	"firstChunk" -- the first chunk to read
+//	"numChunks" -- how many
+//	"position", "numBytes" -- the part of them that is wanted; the
+//		rest may be left zero
+//----------------------------------------------------------------------
+
+void OpenFile::ReadChunks(char *into, int firstChunk, int numChunks,
+                          int position, int numBytes)
+{
+    int fileLength = hdr->FileLength();
+    int firstSector = firstChunk * ChunkSectors;
+    int numSectors = max(0, min(numChunks * ChunkSectors,
+                                divRoundUp(fileLength, SectorSize) - firstSector));
+    int *sectors = new int[numChunks * ChunkSectors];
+    char *stored = new char[numChunks * ChunkSize];
+    int *used = new int[numChunks]; // sectors each chunk is stored in
+    int wantFirst = position / SectorSize - firstSector;
+    int wantLast = (position + numBytes - 1) / SectorSize - firstSector;
+    int i, j;
+
+    memset(into, 0, numChunks * ChunkSize);
+    if (hdr->IsInline())
+    {
+        // not spilled yet: it is all in the first chunk
+        if (firstChunk == 0)
+            hdr->ReadInline(into, fileLength, 0);
+        delete[] used;
+        delete[] sectors;
+        delete[] stored;
+        return;
+    }
+
+    for (i = 0; i < numChunks * ChunkSectors; i++)
+        sectors[i] = -1;
+    hdr->ByteToSectors(firstSector * SectorSize, numSectors, sectors);
+
+    // leave out the sectors of chunks stored as they are that aren't wanted
+    for (int c = 0; c < numChunks; c++)
+    {
+        int *chunk = &sectors[c * ChunkSectors];
+        int length = min(ChunkSize, fileLength - (firstChunk + c) * ChunkSize);
+        int count = divRoundUp(max(length, 0), SectorSize);
+
+        used[c] = 0;
+        while (used[c] < count && chunk[used[c]] != -1)
+            used[c]++;
+        if (used[c] == count)
+            for (i = 0; i < count; i++)
+                if (c * ChunkSectors + i < wantFirst ||
+                    c * ChunkSectors + i > wantLast)
+                    chunk[i] = -1;
+    }
+    for (i = 0; i < numSectors; i = j + 1)
+    {
+        for (j = i; j < numSectors && sectors[j] != -1; j++)
+            ;
+        if (j > i)
+            kernel->synchDisk->ReadSectors(&sectors[i], j - i,
+                                           &stored[i * SectorSize]);
+    }
+
+    for (int c = 0; c < numChunks; c++)
+    {
+        int length = min(ChunkSize, fileLength - (firstChunk + c) * ChunkSize);
+        int count = divRoundUp(max(length, 0), SectorSize);
+
+        if (used[c] == count)
+            bcopy(&stored[c * ChunkSize], &into[c * ChunkSize], max(length, 0));
+        else if (used[c] > 0 &&
+                 !Decompress(&stored[c * ChunkSize], used[c] * SectorSize,
+                             &into[c * ChunkSize], length))
+        {
+            DEBUG(dbgFile, "Chunk " << firstChunk + c << " of file " << hdrSector << " is damaged");
+        }
+    }
+    delete[] used;
+    delete[] sectors;
+    delete[] stored;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::WriteChunks
+// 	Write part of a compressed file: read the chunks the bytes fall
+//	in, copy the bytes in, and store each chunk again in as few
+//	sectors as it takes -- compressed, if that saves at least a
+//	sector; not at all, if it is all zeros.  The sectors of its span
+//	it no longer needs are freed, and the ones it now needs allocated.
+//
+//	Chunks are done a group at a time; each group is a metadata
+//	update of its own (that is small enough for the journal, as in
+//	Reserve), and its data goes to the disk in one vectored request.
+//	The header stays locked from when a group is read until its data
+//	is on its way to the disk.  On a log-structured disk, the chunks
+//	are stored at the log head, wherever they were before.
+//
+//	Return FALSE if the disk is full.
+//
+//	"from" -- the bytes to write
+//	"numBytes", "position" -- how many, and where in the file
+//	"firstChunk", "lastChunk" -- the chunks to store again: the ones
+//		the bytes fall in, and maybe more
+//	"newLength" -- the length of the file once the write is done
+//----------------------------------------------------------------------
+
+bool OpenFile::WriteChunks(char *from, int numBytes, int position,
+                           int firstChunk, int lastChunk, int newLength)
+{
+    int groupChunks = MaxReserveRun / ChunkSectors;
+    char *chunks = new char[groupChunks * ChunkSize];
+    char *out = new char[groupChunks * ChunkSize];
+    int *sectors = new int[groupChunks * ChunkSectors];
+    int used[MaxReserveRun / ChunkSectors];
+    bool success = TRUE;
+
+    for (int first = firstChunk; success && first <= lastChunk;
+         first += groupChunks)
+    {
+        int numChunks = min(groupChunks, lastChunk - first + 1);
+        int start = first * ChunkSize;
+        int begin = max(position, start); // the part of the write
+        int end = min(position + numBytes, start + numChunks * ChunkSize);
+        int numSectors = 0, changed = 0;
+        PersistentBitmap *freeMap;
+
+        kernel->fileSystem->BeginUpdate();
+        hdrLock->Acquire();
+
+        // bring in the chunks, and change them
+        ReadChunks(chunks, first, numChunks, start, numChunks * ChunkSize);
+        if (end > begin)
+            bcopy(&from[begin - position], &chunks[begin - start], end - begin);
+
+        // see how each of them is best stored
+        for (int c = 0; c < numChunks; c++)
+        {
+            char *chunk = &chunks[c * ChunkSize];
+            char *stored = &out[numSectors * SectorSize];
+            int length = min(ChunkSize, newLength - (start + c * ChunkSize));
+            int count = divRoundUp(length, SectorSize);
+            int size = -1;
+            bool zero = TRUE;
+
+            for (int i = 0; i < length && zero; i++)
+                zero = (chunk[i] == 0);
+            if (zero)
+                used[c] = 0;
+            else if ((size = Compress(chunk, length, stored,
+                                      (count - 1) * SectorSize)) > 0)
+            {
+                used[c] = divRoundUp(size, SectorSize);
+                memset(&stored[size], 0, used[c] * SectorSize - size);
+            }
+            else
+            {
+                used[c] = count;
+                memset(stored, 0, count * SectorSize);
+                bcopy(chunk, stored, length);
+            }
+            numSectors += used[c];
+        }
+
+        // give each chunk the sectors it needs, and no more
+        freeMap = kernel->fileSystem->FetchFreeMap();
+        if (newLength > hdr->FileLength())
+        {
+            success = hdr->Extend(freeMap, newLength, hdrSector + 1);
+            changed++;
+        }
+        for (int c = 0, n = 0; success && c < numChunks; n += used[c], c++)
+        {
+            int offset = start + c * ChunkSize;
+            int count = divRoundUp(min(ChunkSize, newLength - offset), SectorSize);
+            int allocated;
+
+            changed += hdr->Unmap(freeMap, offset + used[c] * SectorSize,
+                                  count - used[c]);
+            if (used[c] == 0)
+                continue;
+            allocated = hdr->MapSectors(freeMap, offset, used[c], &sectors[n],
+                                        hdrSector + 1, TRUE);
+            success = (allocated != -1);
+            changed += allocated;
+        }
+        if (changed != 0)
+            hdr->WriteBack(hdrSector);
+        kernel->fileSystem->ReleaseFreeMap(freeMap, changed != 0);
+        kernel->fileSystem->EndUpdate();
+
+        // and write them there
+        if (success && numSectors > 0)
+            kernel->synchDisk->WriteSectors(sectors, numSectors, out);
+        hdrLock->Release();
+    }
+    if (!success)
+    {
+        DEBUG(dbgFile, "Out of disk space writing " << numBytes << " bytes at " << position);
+    }
+    delete[] chunks;
+    delete[] out;
+    delete[] sectors;
+    return success;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadAhead
+// 	Start reading the next window of the file into the buffer cache,
+//	so that the reads that follow in a sequential stream find their
+//	data already in memory (or on its way).  Sectors already read
+//	ahead are not asked for again, and no new request is made until
+//	the reader has used up half of what is ahead of it, so that each
+//	request covers at least half a window.
+//
+//	Unless NOTRACKBUF is defined, the disk keeps the track it last
+//	read in its track buffer; so the window stops at the end of the
+//	track, where read-ahead is cheapest.  Going further would put a
+//	seek in front of the next demand read; the following call picks
+//	up the next track instead.
+//
+//	"fromSector" -- the first file sector past the current read
+//----------------------------------------------------------------------
+
+void OpenFile::ReadAhead(int fromSector)
+{
+    int fileSectors = divRoundUp(hdr->FileLength(), SectorSize);
+    int first = max(fromSector, readAheadNext);
+    int last = min(fromSector + readAheadWindow, fileSectors) - 1;
+    int numSectors = 1 + last - first;
+    int *sectors;
+
+    if (numSectors <= 0 || readAheadNext - fromSector > readAheadWindow / 2)
+        return; // nothing left, or still well ahead of the reader
+    sectors = new int[numSectors];
+    hdrLock->Acquire();
+    hdr->ByteToSectors(first * SectorSize, numSectors, sectors);
+    hdrLock->Release();
+#ifndef NOTRACKBUF
+    int track = -1;
+    for (int i = 0; i < numSectors; i++)
+    {
+        if (sectors[i] == -1)
+            continue;
+        if (track == -1)
+            track = sectors[i] / SectorsPerTrack;
+        else if (sectors[i] / SectorsPerTrack != track)
+        {
+            numSectors = i; // the rest waits for next time
+            break;
+        }
+    }
+#endif
+    readAheadNext = first + numSectors;
+
+    // there is nothing to read in a hole
+    int n = 0;
+    for (int i = 0; i < numSectors; i++)
+        if (sectors[i] != -1)
+            sectors[n++] = sectors[i];
+    numSectors = n;
+    if (numSectors > 0)
+    {
+        DEBUG(dbgFile, "Read-ahead of " << numSectors << " sectors from file sector " << first);
+        kernel->synchDisk->Prefetch(sectors, numSectors);
+    }
+    delete[] sectors;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::Preallocate
+// 	Get a file about to be written sequentially ready for all of its
+//	data at once: extend it to "numBytes", and allocate every sector
+//	of that now, in a few large metadata updates, instead of a little
+//	at a time as each write comes.  The sectors come out of the free
+//	map in one sweep, so they are mostly contiguous (see Map); and
+//	the writes that follow find them allocated, and write nothing but
+//	data.  A file that small stays inline, needing no sectors at all;
+//	and a compressed file is left as it is.
+//
+//	On a log-structured disk, the writes move the data to the log head
+//	anyway (see WriteRun), and they allocate as they go, in order: so
+//	the file is only extended, once there is room for it.
+//
+//	Return FALSE if the disk is full.
+//
+//	"numBytes" -- the length the file is going to have
+//----------------------------------------------------------------------
+
+bool OpenFile::Preallocate(int numBytes)
+{
+    int numSectors = divRoundUp(numBytes, SectorSize);
+    int *sectors;
+    bool success;
+
+    if (hdr->IsInline() && numBytes <= MaxInlineSize)
+        return TRUE;
+    if (hdr->IsCompressed())
+        return TRUE; // how many sectors it takes isn't known until then
+    if (kernel->fileSystem->LogStructured())
+    {
+        PersistentBitmap *freeMap = kernel->fileSystem->FetchFreeMap();
+
+        success = (freeMap->NumClear() >= numSectors);
+        kernel->fileSystem->ReleaseFreeMap(freeMap, FALSE);
+        return success && Reserve(numBytes, 0, 0, NULL);
+    }
+    sectors = new int[numSectors];
+    success = Reserve(numBytes, 0, numSectors, sectors);
+    delete[] sectors;
+    return success;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::BufferWrites
+// 	From now on, gather small writes into whole sectors before they
+//	go to the disk (see WriteAt).  The buffer is in the file's entry
+//	of the open file table, for all the opens of the file to share:
+//	each of them writes it out before reading, or writing elsewhere,
+//	and counts it in the length of the file.  Anything else that goes
+//	to the file's sectors on disk, such as a clone, writes it out
+//	first too.  Otherwise it is written out when the sector fills up,
+//	or the next write goes elsewhere, on a seek or Flush, or when the
+//	file is closed; so this is for files of data, not metadata, which
+//	must be on disk by the end of the update changing it.
+//
+//	If writing it out finds the disk full, the data is lost, as a
+//	delayed write in UNIX would be; the next write, seek or Flush
+//	through an open of the file that buffers writes says so.
+//----------------------------------------------------------------------
+
+void OpenFile::BufferWrites()
+{
+    entry->bufferLock->Acquire();
+    if (entry->buffer == NULL)
+        entry->buffer = new char[SectorSize];
+    entry->bufferLock->Release();
+    buffering = TRUE;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::Flush
+// 	Write out the sector in the write buffer, if it has anything not
+//	on disk yet, and empty the buffer.  Return FALSE if it didn't fit
+//	on the disk -- or if, since we last said so, writing it out
+//	didn't some other time (which we now forget, if this open buffers
+//	writes: it has heard).
+//----------------------------------------------------------------------
+
+bool OpenFile::Flush()
+{
+    bool lost;
+
+    entry->bufferLock->Acquire();
+    DrainLocked();
+    lost = entry->bufferLost;
+    if (buffering)
+        entry->bufferLost = FALSE;
+    entry->bufferLock->Release();
+    return !lost;
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::Drain/DrainLocked
+// 	Write out the sector in the write buffer, if it has anything not
+//	on disk yet, and empty the buffer, as Flush does; but if it doesn't
+//	fit on the disk, only note that it was lost, for an open that
+//	buffers writes to hear of it.  Drain takes the buffer's lock (if
+//	there is anything in the buffer at all); DrainLocked is for the
+//	holder of the lock.
+//----------------------------------------------------------------------
+
+void OpenFile::Drain()
+{
+    if (entry->bufferSector == -1)
+        return;
+    entry->bufferLock->Acquire();
+    DrainLocked();
+    entry->bufferLock->Release();
+}
+
+void OpenFile::DrainLocked()
+{
+    int sector = entry->bufferSector;
+
+    if (sector == -1)
+        return;
+    if (entry->bufferDirty &&
+        WriteThrough(&entry->buffer[entry->bufferStart],
+                     entry->bufferEnd - entry->bufferStart,
+                     sector * SectorSize + entry->bufferStart) <
+            entry->bufferEnd - entry->bufferStart)
+    {
+        DEBUG(dbgFile, "Out of disk space writing out sector " << sector << " of file " << hdrSector);
+        entry->bufferLost = TRUE;
+    }
+    entry->bufferSector = -1; // (only now: readers wait until it's on disk)
+}
+
+//----------------------------------------------------------------------
+// MP4
+// OpenFile::LockContents/UnlockContents
+// 	Keep other threads from changing the entries of the directory
+//	this is an open of -- or, if "exclusive", from looking at them
+//	too -- until UnlockContents (see filesys.cc).  Every open of
+//	the directory shares the lock.
+//----------------------------------------------------------------------
+
+void OpenFile::LockContents(bool exclusive)
+{
+    ASSERT(contentsLock != NULL);
+    if (exclusive)
+        contentsLock->AcquireWrite();
+    else
+        contentsLock->AcquireRead();
+}
+
+void OpenFile::UnlockContents()
+{
+    contentsLock->Release();
 }
 
 //----------------------------------------------------------------------
 // OpenFile::Length
-// 	Return the number of bytes in the file.
+// 	Return the number of bytes in the file, counting what is in the
+//	write buffer (by whichever open of the file put it there).
 //----------------------------------------------------------------------
 
 int OpenFile::Length()
 {
+    int sector = entry->bufferSector;
+
+    if (sector != -1)
+        return max(hdr->FileLength(), sector * SectorSize + entry->bufferEnd);
     return hdr->FileLength();
 }
 
@@ -67,6 +67,8 @@ public:
 		return Tell(file);
 	}
 
+	bool Flush() { return TRUE; } // UNIX writes aren't buffered here
+
 private:
 	int file;
 	int currentOffset;
@@ -74,16 +76,26 @@ private:
 
 #else // FILESYS
 class FileHeader;
+class OpenFileTable;
+class OpenHeader;
+class Lock;
+class RWLock;
 
 class OpenFile
 {
 public:
 	OpenFile(int sector); // Open a file whose header is located
 						  // at "sector" on the disk
+	OpenFile(int sector, OpenFileTable *table);
+						  // ... sharing its header with the
+						  // other opens of the file in "table"
+						  // (if it isn't NULL)
 	~OpenFile();		  // Close the file
 
-	void Seek(int position); // Set the position from which to
-							 // start reading/writing -- UNIX lseek
+	bool Seek(int position); // Set the position from which to
+							 // start reading/writing -- UNIX lseek;
+							 // FALSE if an earlier write was lost
+							 // (see Flush)
 
 	int Read(char *into, int numBytes); // Read/write bytes from the file,
 										// starting at the implicit position.
@@ -101,9 +113,73 @@ public:
 				  // than the UNIX idiom -- lseek to
 				  // end of file, tell, lseek back
 
+	OpenFileTable *Table() { return sharedIn; } // The table the header
+					// is shared in, NULL if it isn't
+	int HeaderSector() { return hdrSector; } // Where its header is;
+					// to open the file once more
+
+	bool Preallocate(int numBytes); // MP4 make the file at least
+					// "numBytes" long, with disk sectors
+					// for all of it, ahead of writing it
+
+	void BufferWrites(); // MP4 gather small writes that follow
+					// each other into whole sectors (for
+					// data, not metadata: see WriteAt)
+	bool Flush();		 // Write out what is gathered so far;
+					// FALSE if some of what was written
+					// didn't fit on the disk
+
+	void LockContents(bool exclusive); // MP4 for a directory: wait
+					// until nobody is changing its entries
+					// (or, if "exclusive", looking at them)
+	void UnlockContents();		// Let the others in again
+
 private:
 	FileHeader *hdr;  // Header for this file
+	int hdrSector;	  // Where the header lives on disk
+	OpenFileTable *sharedIn; // Where hdr comes from, if it is shared
+	OpenHeader *entry; // MP4 its entry there (or one of our own),
+					// with the locks and the write buffer
+	Lock *hdrLock;	  // MP4 held while hdr is looked at or changed
+	RWLock *contentsLock; // MP4 the directory's lock (see filetable.h)
 	int seekPosition; // Current position within the file
+
+	// MP4 read-ahead of sequential streams
+	int seqPosition;	 // Where the next read starts if the
+						 // reads are sequential
+	int readAheadWindow; // Sectors to read ahead; 0 when the
+						 // last read was not sequential
+	int readAheadNext;	 // First file sector not yet read ahead
+
+	void ReadAhead(int fromSector); // Prefetch the next window
+
+	bool buffering;		 // MP4 are our writes gathered in the
+						 // entry's write buffer?
+
+	void Drain();		 // MP4 write out the write buffer (whoever
+						 // filled it), if it has anything
+	void DrainLocked();	 // ... with its lock held
+	int WriteThrough(char *from, int numBytes, int position);
+	// Write straight to the disk
+	bool WriteRun(char *from, int numBytes, int position);
+	// MP4 ... a run of sectors of it
+
+	bool Reserve(int newLength, int firstSector, int numSectors, int *sectorList);
+	// MP4 grow the file and allocate its
+	// holes, so a write has somewhere to go
+	bool Map(int newLength, int firstSector, int numSectors, int *sectorList, bool relocate);
+	// ... a run of them at a time, in
+	// an update, with the header locked
+
+	void ReadChunks(char *into, int firstChunk, int numChunks,
+					int position, int numBytes);
+	// MP4 read and expand chunks of a
+	// compressed file (at least the
+	// part of them that is wanted)
+	bool WriteChunks(char *from, int numBytes, int position,
+					 int firstChunk, int lastChunk, int newLength);
+	// ... and change, compress and store
+	// them, for a file "newLength" long
 };
 
 #endif // FILESYS
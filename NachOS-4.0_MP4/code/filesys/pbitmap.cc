@@ -7,8 +7,17 @@
 // of liability and disclaimer of warranty provisions.
 
 #include "copyright.h"
+#include "debug.h"
 #include "pbitmap.h"
 
+// Bits held by one sector of the bitmap on disk
+#define BitsPerSector (SectorSize * BitsInByte)
+
+// Where the sector and the count of slot "s" are in the table of counts
+// (the first pair says how many slots are in use)
+#define SlotSector(s) (2 + 2 * (s))
+#define SlotCount(s) (3 + 2 * (s))
+
 //----------------------------------------------------------------------
 // PersistentBitmap::PersistentBitmap(int)
 // 	Initialize a bitmap with "numItems" bits, so that every bit is clear.
@@ -21,6 +30,22 @@
 
 PersistentBitmap::PersistentBitmap(int numItems) : Bitmap(numItems)
 {
+    numSectors = divRoundUp(numWords * sizeof(unsigned), SectorSize);
+    refSectors = divRoundUp(SharedTableSize, SectorSize);
+    dirty = new bool[numSectors + refSectors];
+    shared = new int[SharedTableSize / sizeof(int)];
+    memset(shared, 0, SharedTableSize);
+    sharedNext = new int[MaxSharedSectors];
+    sharedBuckets = new int[NumSharedBuckets];
+    HashShared();
+    numGroups = divRoundUp(numItems, SectorsPerGroup);
+    groupClear = new int[numGroups];
+    firstClear = new int[numGroups];
+    numSegments = divRoundUp(numItems, SectorsPerSegment);
+    segmentClear = new int[numSegments];
+    logHead = -1;
+    MarkClean();
+    Summarize();
 }
 
 //----------------------------------------------------------------------
@@ -37,10 +62,24 @@ PersistentBitmap::PersistentBitmap(int numItems) : Bitmap(numItems)
 
 PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numItems)
 {
+    numSectors = divRoundUp(numWords * sizeof(unsigned), SectorSize);
+    refSectors = divRoundUp(SharedTableSize, SectorSize);
+    dirty = new bool[numSectors + refSectors];
+    shared = NULL;
+    sharedNext = new int[MaxSharedSectors];
+    sharedBuckets = new int[NumSharedBuckets];
+    numShared = 0;
+    numGroups = divRoundUp(numItems, SectorsPerGroup);
+    groupClear = new int[numGroups];
+    firstClear = new int[numGroups];
+    numSegments = divRoundUp(numItems, SectorsPerSegment);
+    segmentClear = new int[numSegments];
+    logHead = -1;
+
     // map has already been initialized by the BitMap constructor,
     // but we will just overwrite that with the contents of the
     // map found in the file
-    file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    FetchFrom(file);
 }
 
 //----------------------------------------------------------------------
@@ -50,18 +89,397 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
 
 PersistentBitmap::~PersistentBitmap()
 {
+    delete[] dirty;
+    delete[] shared;
+    delete[] sharedNext;
+    delete[] sharedBuckets;
+    delete[] groupClear;
+    delete[] firstClear;
+    delete[] segmentClear;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Mark/Clear
+// 	Set or clear the "nth" bit, remembering that the sector holding
+//	it has to be written back.
+//
+//	"which" is the number of the bit to be set or cleared.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::Mark(int which)
+{
+    if (!Test(which))
+    {
+        int segment = which / SectorsPerSegment;
+
+        groupClear[which / SectorsPerGroup]--;
+        if (segmentClear[segment]-- == SegmentSize(segment))
+            cleanSegments--;
+    }
+    Bitmap::Mark(which);
+    MarkDirty(which);
+}
+
+void PersistentBitmap::Clear(int which)
+{
+    int group = which / SectorsPerGroup;
+    int segment = which / SectorsPerSegment;
+
+    if (Test(which))
+    {
+        groupClear[group]++;
+        if (++segmentClear[segment] == SegmentSize(segment))
+            cleanSegments++;
+    }
+    Bitmap::Clear(which);
+    MarkDirty(which);
+    if (which < firstClear[group])
+        firstClear[group] = which;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindAndSet
+// 	Return the number of the first bit which is clear, and set it;
+//	-1 if no bits are clear.  Same as Bitmap::FindAndSet, but the
+//	search skips full groups, and starts each group where its first
+//	clear bit can be, so that it doesn't start over from the
+//	beginning of a large, mostly full disk every time.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindAndSet()
+{
+    return FindAndSet(0);
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindAndSet(int)
+// 	Return the number of a clear bit near "goal", and set it; -1 if no
+//	bits are clear.  If there is a log, the goal doesn't matter: the
+//	bit at the log head is taken (see FindInLog).
+//
+//	"goal" -- where the caller would like the bit to be, say just
+//		past a sector of the same file
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindAndSet(int goal)
+{
+    if (logHead != -1)
+        return FindInLog();
+    return FindNear(goal);
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindNear
+// 	Set a clear bit near "goal", and return its number; -1 if no bits
+//	are clear.  The first clear bit at or after "goal" in its group is
+//	taken, failing that the first one in the group, failing that the
+//	first one in the groups after it (wrapping around to the first
+//	group).
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindNear(int goal)
+{
+    int group, which;
+
+    if (goal < 0 || goal >= numBits)
+        goal = 0;
+    group = goal / SectorsPerGroup;
+    if ((which = FindIn(group, goal)) != -1)
+        return which;
+    for (int i = 0; i < numGroups; i++)
+    {
+        if ((which = FindIn((group + i) % numGroups, 0)) != -1)
+            return which;
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindInLog
+// 	Set the clear bit at the log head, and return its number; -1 if no
+//	bits are clear.  The head moves through its segment, skipping the
+//	bits that are set; at the end, it moves on to the next clean
+//	segment.  If there is none, the log makes do with whatever clear
+//	bit comes first after the head, until the cleaner makes some.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindInLog()
+{
+    int segment = logHead / SectorsPerSegment;
+    int end = min((segment + 1) * SectorsPerSegment, numBits);
+    int which;
+
+    for (; logHead < end; logHead++)
+        if (!Test(logHead))
+        {
+            Mark(logHead);
+            return logHead++;
+        }
+
+    for (int i = 1; i <= numSegments; i++)
+    {
+        int next = (segment + i) % numSegments;
+
+        if (segmentClear[next] == SegmentSize(next))
+        {
+            logHead = next * SectorsPerSegment;
+            Mark(logHead);
+            return logHead++;
+        }
+    }
+
+    which = FindNear(logHead % numBits);
+    if (which != -1)
+        logHead = which + 1;
+    else
+        logHead = 0;
+    return which;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::StartLog
+// 	From now on, hand out clear bits at the head of a log, one segment
+//	after another, instead of near the goal FindAndSet is given.
+//
+//	"head" -- where the log starts
+//----------------------------------------------------------------------
+
+void PersistentBitmap::StartLog(int head)
+{
+    logHead = (head >= 0 && head < numBits) ? head : 0;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::NumUsedIn
+// 	Return the number of set bits in "segment".
+//----------------------------------------------------------------------
+
+int PersistentBitmap::NumUsedIn(int segment) const
+{
+    return SegmentSize(segment) - segmentClear[segment];
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::SegmentSize
+// 	Return the number of bits in "segment" (the last one may be short).
+//----------------------------------------------------------------------
+
+int PersistentBitmap::SegmentSize(int segment) const
+{
+    return min(SectorsPerSegment, numBits - segment * SectorsPerSegment);
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Share
+// 	One more file uses sector "which" (whose bit is set).  A sector
+//	shared for the first time takes a free slot of the table of
+//	counts.  Return FALSE if the disk keeps no counts, the sector has
+//	as many references as can be counted, or the table is full.
+//----------------------------------------------------------------------
+
+bool PersistentBitmap::Share(int which)
+{
+    int slot;
+
+    ASSERT(Test(which));
+    if (shared == NULL)
+        return FALSE;
+    if ((slot = FindShared(which)) == -1)
+    {
+        if (freeShared != -1)
+        {
+            slot = freeShared;
+            freeShared = sharedNext[slot];
+        }
+        else if (shared[0] < MaxSharedSectors)
+        {
+            slot = shared[0]++;
+            dirty[numSectors] = TRUE;
+        }
+        else
+            return FALSE; // no room to count another one
+        shared[SlotSector(slot)] = which;
+        shared[SlotCount(slot)] = 0;
+        sharedNext[slot] = sharedBuckets[which % NumSharedBuckets];
+        sharedBuckets[which % NumSharedBuckets] = slot;
+        numShared++;
+    }
+    else if (shared[SlotCount(slot)] == MaxExtraRefs)
+        return FALSE;
+    shared[SlotCount(slot)]++;
+    dirty[numSectors + SlotSector(slot) * sizeof(int) / SectorSize] = TRUE;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Unshare
+// 	A file lets go of sector "which".  If others still use it, count
+//	one reference less, and return TRUE; if it was the only one,
+//	return FALSE, and leave it to the caller to free the sector.  A
+//	sector down to one reference gives up its slot.
+//----------------------------------------------------------------------
+
+bool PersistentBitmap::Unshare(int which)
+{
+    int slot, *prev;
+
+    if (shared == NULL || (slot = FindShared(which)) == -1)
+        return FALSE;
+    dirty[numSectors + SlotSector(slot) * sizeof(int) / SectorSize] = TRUE;
+    if (--shared[SlotCount(slot)] > 0)
+        return TRUE;
+
+    for (prev = &sharedBuckets[which % NumSharedBuckets]; *prev != slot;
+         prev = &sharedNext[*prev])
+        ;
+    *prev = sharedNext[slot];
+    sharedNext[slot] = freeShared;
+    freeShared = slot;
+    numShared--;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindShared
+// 	Return the slot of the table of counts that counts sector "which",
+//	or -1 if it isn't shared.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindShared(int which) const
+{
+    if (shared == NULL)
+        return -1;
+    for (int slot = sharedBuckets[which % NumSharedBuckets]; slot != -1;
+         slot = sharedNext[slot])
+        if (shared[SlotSector(slot)] == which)
+            return slot;
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::HashShared
+// 	Put the slots in use of the table of counts on their hash chains,
+//	and the others on the list of free ones.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::HashShared()
+{
+    for (int b = 0; b < NumSharedBuckets; b++)
+        sharedBuckets[b] = -1;
+    freeShared = -1;
+    numShared = 0;
+    for (int slot = shared[0] - 1; slot >= 0; slot--)
+    {
+        int which = shared[SlotSector(slot)];
+
+        if (shared[SlotCount(slot)] > 0 && which >= 0 && which < numBits)
+        {
+            sharedNext[slot] = sharedBuckets[which % NumSharedBuckets];
+            sharedBuckets[which % NumSharedBuckets] = slot;
+            numShared++;
+        }
+        else
+        {
+            sharedNext[slot] = freeShared;
+            freeShared = slot;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindIn
+// 	Set the first clear bit of "group" at or after "from" (the start
+//	of the group if "from" is before it), and return its number; -1
+//	if there is none.  Whole words of set bits are skipped.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindIn(int group, int from)
+{
+    int end = min((group + 1) * SectorsPerGroup, numBits);
+
+    if (groupClear[group] == 0)
+        return -1;
+    from = max(from, firstClear[group]);
+    for (int w = from / BitsInWord; w * BitsInWord < end; w++)
+    {
+        if (map[w] == ~0u)
+            continue; // all set
+        for (int i = max(w * BitsInWord, from);
+             i < (w + 1) * BitsInWord && i < end; i++)
+            if (!Test(i))
+            {
+                if (i == firstClear[group])
+                    firstClear[group] = i + 1;
+                Mark(i);
+                return i;
+            }
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::NumClear
+// 	Return the number of clear bits, from the summary of the groups.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::NumClear() const
+{
+    int count = 0;
+
+    for (int g = 0; g < numGroups; g++)
+        count += groupClear[g];
+    return count;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::EmptiestGroup
+// 	Return the group with the most clear bits (the first of them, if
+//	several tie).  New directories go there, so that they spread out
+//	over the disk, each with room for its files to grow next to it.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::EmptiestGroup() const
+{
+    int best = 0;
+
+    for (int g = 1; g < numGroups; g++)
+        if (groupClear[g] > groupClear[best])
+            best = g;
+    return best;
 }
 
 //----------------------------------------------------------------------
 // PersistentBitmap::FetchFrom
-// 	Initialize the contents of a persistent bitmap from a Nachos file.
+// 	Initialize the contents of a persistent bitmap from a Nachos file,
+//	and the reference counts after it, if the file has room for them.
+//	Of the table of counts, only the slots in use are read.
 //
 //	"file" is the place to read the bitmap from
 //----------------------------------------------------------------------
 
 void PersistentBitmap::FetchFrom(OpenFile *file)
 {
+    int offset = numSectors * SectorSize;
+
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    delete[] shared;
+    shared = NULL;
+    numShared = 0;
+    if (file->Length() >= offset + SharedTableSize)
+    {
+        shared = new int[SharedTableSize / sizeof(int)];
+        memset(shared, 0, SharedTableSize);
+        file->ReadAt((char *)shared, 2 * sizeof(int), offset);
+        if (shared[0] < 0 || shared[0] > MaxSharedSectors)
+            shared[0] = 0; // not a table; count nothing
+        if (shared[0] > 0)
+            file->ReadAt((char *)&shared[SlotSector(0)],
+                         shared[0] * 2 * sizeof(int),
+                         offset + SlotSector(0) * sizeof(int));
+        HashShared();
+    }
+    MarkClean();
+    Summarize();
 }
 
 //----------------------------------------------------------------------
@@ -74,4 +492,108 @@ void PersistentBitmap::FetchFrom(OpenFile *file)
 void PersistentBitmap::WriteBack(OpenFile *file)
 {
     file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+    if (shared != NULL)
+        file->WriteAt((char *)shared, (1 + shared[0]) * 2 * sizeof(int),
+                      numSectors * SectorSize);
+    MarkClean();
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::WriteDirty
+// 	Store the parts of a persistent bitmap that changed since it was
+//	last fetched or written, one write per run of changed sectors.
+//
+//	"file" is the place to write the bitmap to
+//----------------------------------------------------------------------
+
+void PersistentBitmap::WriteDirty(OpenFile *file)
+{
+    WriteRuns(file, 0, numSectors, (char *)map, numWords * sizeof(unsigned));
+    if (shared != NULL)
+        WriteRuns(file, numSectors, numSectors + refSectors, (char *)shared,
+                  (1 + shared[0]) * 2 * sizeof(int));
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::WriteRuns
+// 	Write the changed sectors among sectors "first" to "last" - 1 of
+//	the map on disk, one write per run of them.
+//
+//	"file" is the place to write the bitmap to
+//	"data", "bytes" -- what those sectors hold, and how much of it
+//----------------------------------------------------------------------
+
+void PersistentBitmap::WriteRuns(OpenFile *file, int first, int last,
+                                 char *data, int bytes)
+{
+    for (int i = first, j; i < last; i = j)
+    {
+        if (!dirty[i])
+        {
+            j = i + 1;
+            continue;
+        }
+        for (j = i; j < last && dirty[j]; j++)
+            dirty[j] = FALSE;
+        file->WriteAt(data + (i - first) * SectorSize,
+                      min((j - first) * SectorSize, bytes) -
+                          (i - first) * SectorSize,
+                      i * SectorSize);
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::MarkDirty
+// 	Remember that the sector holding bit "which" has changed.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::MarkDirty(int which)
+{
+    dirty[which / BitsPerSector] = TRUE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::MarkClean
+// 	The bitmap on disk matches the one in memory.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::MarkClean()
+{
+    for (int i = 0; i < numSectors + refSectors; i++)
+        dirty[i] = FALSE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Summarize
+// 	Count the clear bits of each group, which are all a search of the
+//	group needs to look at, and of each segment of the log.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::Summarize()
+{
+    cleanSegments = 0;
+    for (int s = 0; s < numSegments; s++)
+    {
+        int end = s * SectorsPerSegment + SegmentSize(s);
+
+        segmentClear[s] = 0;
+        for (int i = s * SectorsPerSegment; i < end; i++)
+            if (!Test(i))
+                segmentClear[s]++;
+        if (segmentClear[s] == SegmentSize(s))
+            cleanSegments++;
+    }
+    for (int g = 0; g < numGroups; g++)
+    {
+        int end = min((g + 1) * SectorsPerGroup, numBits);
+
+        groupClear[g] = 0;
+        firstClear[g] = end;
+        for (int i = g * SectorsPerGroup; i < end; i++)
+            if (!Test(i))
+            {
+                if (groupClear[g]++ == 0)
+                    firstClear[g] = i;
+            }
+    }
 }
@@ -6,6 +6,41 @@
 //    when it is created, or it can be initialized later using
 //    the FetchFrom method
 //
+//    The bitmap remembers which of its sectors on disk are out of
+//    date, so that a change to a few bits only costs writing the
+//    sectors that hold them (see WriteDirty).
+//
+//    The bits are divided into allocation groups of SectorsPerGroup
+//    bits -- for the map of free sectors, one group per track, so that
+//    what is allocated in one group can be reached without a seek.
+//    Each group's bits are a region of the bitmap of their own, and
+//    the bitmap keeps a summary of how many of them are clear, so that
+//    a search can pass over full groups, and pick out empty ones,
+//    without looking at their bits.
+//
+//    On a disk formatted log-structured, the bits are also divided
+//    into segments of SectorsPerSegment bits.  The map then keeps a
+//    log head, and hands out sectors in order from there, whatever
+//    the goal, in one segment at a time: when the head has used up a
+//    segment, it moves on to the next clean one (with no bit set),
+//    so that sectors allocated one after another -- for any file --
+//    are next to each other on disk.  Segments only become clean
+//    again as what is in them is freed, or moved out by the cleaner
+//    (see Defragmenter::Clean).
+//
+//    A sector can belong to more than one file, once a file has been
+//    cloned (see FileSystem::Clone).  For each sector that is, the map
+//    counts the references to it beyond the first one: a shared sector
+//    is only freed when the last file using it lets go of it.  Only a
+//    few sectors are ever shared (a clone shares the entries of the
+//    headers it copies, not every sector below them), so the counts
+//    are kept sparse, in a table of up to MaxSharedSectors (sector,
+//    count) slots stored on disk after all the bits, led by the number
+//    of slots in use: mounting the disk reads only those.  In memory,
+//    the slots are found by hash chains, as in the journal.  A disk
+//    formatted before there were counts has no room for them, and
+//    can't share.
+//
 // Copyright (c) 1992,1993,1995 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
@@ -16,6 +51,16 @@
 #include "copyright.h"
 #include "bitmap.h"
 #include "openfile.h"
+#include "disk.h"
+
+#define SectorsPerGroup SectorsPerTrack // Bits in an allocation group
+#define SectorsPerSegment 1024          // Bits in a segment of the log
+#define MaxExtraRefs 255                // Most references a sector can
+                                        // have beyond the first
+#define MaxSharedSectors 8192           // Most sectors shared at once
+#define SharedTableSize ((1 + MaxSharedSectors) * 2 * (int)sizeof(int))
+                                        // Bytes the counts take on disk
+#define NumSharedBuckets 1024           // Hash chains of the counts
 
 // The following class defines a persistent bitmap.  It inherits all
 // the behavior of a bitmap (see bitmap.h), adding the ability to
@@ -29,8 +74,72 @@ public:
 
     ~PersistentBitmap(); // deallocate bitmap
 
-    void FetchFrom(OpenFile *file); // read bitmap from the disk
-    void WriteBack(OpenFile *file); // write bitmap contents to disk
+    void Mark(int which);  // Set the "nth" bit, and note the change
+    void Clear(int which); // Clear the "nth" bit, and note the change
+    int FindAndSet();      // Set the first clear bit; -1 if none
+    int FindAndSet(int goal); // Set the first clear bit from "goal" on,
+                              // in its group if possible -- or, if
+                              // there is a log, at its head
+    int NumClear() const;     // Return the number of clear bits
+
+    int NumGroups() const { return numGroups; }
+    int NumClearIn(int group) const { return groupClear[group]; }
+    int EmptiestGroup() const; // The group with the most clear bits
+
+    void StartLog(int head);   // Hand out bits from "head" on, in
+                               // clean segments, from now on
+    bool Logging() const { return logHead != -1; }
+    int LogHead() const { return logHead; }
+    int NumSegments() const { return numSegments; }
+    int NumUsedIn(int segment) const; // Set bits in a segment
+    int NumCleanSegments() const { return cleanSegments; }
+
+    bool CanShare() const { return shared != NULL; } // Are there counts?
+    bool IsShared(int which) const     // Does more than one file use
+    { return numShared > 0 && FindShared(which) != -1; } // sector "which"?
+    bool Share(int which);   // One more file uses sector "which";
+                             // FALSE if that can't be counted
+    bool Unshare(int which); // One less; FALSE (and the bit is left
+                             // as it is) if only one file used it
+
+    void FetchFrom(OpenFile *file);  // read bitmap from the disk
+    void WriteBack(OpenFile *file);  // write bitmap contents to disk
+    void WriteDirty(OpenFile *file); // write only the sectors changed
+                                     // since the last write or fetch
+
+private:
+    int numSectors;   // Sectors the bitmap takes up on disk
+    int refSectors;   // ... and the counts after it
+    bool *dirty;      // Which of them have changed
+    int *shared;      // The counts, as on disk: the slots in use, then
+                      // a (sector, references beyond the first) pair
+                      // per slot; NULL if the disk has no counts
+    int *sharedNext;  // Next slot in the same hash chain, or free one
+    int *sharedBuckets; // Hash chains of the slots, by sector
+    int freeShared;   // First free slot below the ones in use, -1 if none
+    int numShared;    // Sectors shared
+    int numGroups;    // Allocation groups
+    int *groupClear;  // Clear bits in each group
+    int *firstClear;  // In each group, no bit below this one is clear
+    int numSegments;   // Segments of the log
+    int *segmentClear; // Clear bits in each segment
+    int cleanSegments; // Segments with no bit set
+    int logHead;       // Next bit the log hands out, -1 if no log
+
+    void MarkDirty(int which); // The sector holding bit "which" changed
+    int FindShared(int which) const; // The slot counting sector "which",
+                                     // -1 if it isn't shared
+    void HashShared();         // Chain up the slots just read or cleared
+    void WriteRuns(OpenFile *file, int first, int last, char *data,
+                   int bytes);     // Write the changed sectors among
+                                   // "first" to "last" of the map
+    void MarkClean();          // The disk is up to date
+    void Summarize();          // Count the clear bits of each group
+    int FindIn(int group, int from); // Set a clear bit of "group" at or
+                                     // after "from"; -1 if none
+    int FindNear(int goal);          // Set a clear bit near "goal"
+    int FindInLog();                 // Set the clear bit at the log head
+    int SegmentSize(int segment) const; // Bits in a segment
 };
 
 #endif // PBITMAP_H
@@ -5,10 +5,19 @@
 //	the disk providing a synchronous interface (requests wait until
 //	the request completes).
 //
-//	Use a semaphore to synchronize the interrupt handlers with the
-//	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	Each request carries a semaphore to synchronize the interrupt
+//	handler with the thread waiting for it.  The physical disk can
+//	only handle one operation at a time, but rather than a lock
+//	(which would service threads strictly in arrival order), requests
+//	go through a DiskQueue that schedules them on the disk.
+//
+//	Everything goes through a BufferCache first, so that sectors read
+//	recently, or read ahead, don't need the disk at all.
+//
+//	When a Journal is attached, it gets first look at every write: the
+//	ones it absorbs are only installed in the cache, and reach their
+//	home sectors later, from the journal.  Reads are patched with the
+//	contents the journal holds, in case the cache let go of them.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -16,19 +25,21 @@
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "journal.h"
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
-//	initializing the physical disk.
+//	initializing the cache, the request queue and the physical disk.
 //
+//	"policy" -- the order in which concurrent requests are serviced
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk()
+SynchDisk::SynchDisk(DiskPolicy policy)
 {
-    semaphore = new Semaphore("synch disk", 0);
-    lock = new Lock("synch disk lock");
-    disk = new Disk(this);
+    queue = new DiskQueue(policy);
+    cache = new BufferCache(queue);
+    journal = NULL;
 }
 
 //----------------------------------------------------------------------
@@ -39,9 +50,8 @@ SynchDisk::SynchDisk()
 
 SynchDisk::~SynchDisk()
 {
-    delete disk;
-    delete lock;
-    delete semaphore;
+    delete cache;
+    delete queue;
 }
 
 //----------------------------------------------------------------------
@@ -55,10 +65,7 @@ SynchDisk::~SynchDisk()
 
 void SynchDisk::ReadSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
-    lock->Release();
+    ReadSectors(&sectorNumber, 1, data);
 }
 
 //----------------------------------------------------------------------
@@ -72,19 +79,89 @@ void SynchDisk::ReadSector(int sectorNumber, char *data)
 
 void SynchDisk::WriteSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
-    lock->Release();
+    WriteSectors(&sectorNumber, 1, data);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectors/WriteSectors
+// 	Read/write a list of disk sectors; whatever has to go to the disk
+//	goes as a single vectored request.
+//	Return only after all of them have been transferred.
+//
+//	"sectorList" -- the disk sectors to read/write
+//	"numSectors" -- the number of entries in sectorList
+//	"data" -- sectorList[i] is transferred to/from data[i * SectorSize]
+//----------------------------------------------------------------------
+
+void SynchDisk::ReadSectors(int *sectorList, int numSectors, char *data)
+{
+    cache->Read(sectorList, numSectors, data);
+    if (journal != NULL)
+        journal->Overlay(sectorList, numSectors, data);
+}
+
+void SynchDisk::WriteSectors(int *sectorList, int numSectors, char *data)
+{
+    if (journal != NULL && journal->Absorb(sectorList, numSectors, data))
+        cache->Install(sectorList, numSectors, data);
+    else
+        cache->Write(sectorList, numSectors, data);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Prefetch
+// 	Start reading a list of disk sectors into the cache, and return
+//	without waiting for the disk.  A later ReadSector(s) of any of them
+//	finds the data in memory, or waits only for what is left of the
+//	transfer.
+//
+//	"sectorList" -- the disk sectors to read ahead
+//	"numSectors" -- the number of entries in sectorList
+//----------------------------------------------------------------------
+
+void SynchDisk::Prefetch(int *sectorList, int numSectors)
+{
+    cache->Prefetch(sectorList, numSectors);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::AttachJournal
+// 	From now on, offer every write to "log" first (see Journal::Absorb).
+//	NULL detaches the journal.
+//----------------------------------------------------------------------
+
+void SynchDisk::AttachJournal(Journal *log)
+{
+    journal = log;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteThrough
+// 	Write a list of disk sectors straight to the disk, around the
+//	journal.  This is how the journal itself writes, both to its log
+//	and to the sectors' home locations.
+//
+//	"sectorList" -- the disk sectors to write
+//	"numSectors" -- the number of entries in sectorList
+//	"data" -- data[i * SectorSize] is written to sectorList[i]
+//	"callWhenDone" -- if NULL, return once the write is done;
+//		otherwise return at once, and call it from the disk
+//		interrupt handler when done
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteThrough(int *sectorList, int numSectors, char *data,
+                             CallBackObj *callWhenDone)
+{
+    cache->WriteAround(sectorList, numSectors, data, callWhenDone);
 }
 
 //----------------------------------------------------------------------
-// SynchDisk::CallBack
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// SynchDisk::Cached
+// 	If "sector" is in the cache, copy it to "data" and return TRUE.
+//	Never goes to the disk.
 //----------------------------------------------------------------------
 
-void SynchDisk::CallBack()
+bool SynchDisk::Cached(int sector, char *data)
 {
-    semaphore->V();
+    return cache->Peek(sector, data);
 }
@@ -12,8 +12,10 @@
 #define SYNCHDISK_H
 
 #include "disk.h"
-#include "synch.h"
-#include "callback.h"
+#include "diskqueue.h"
+#include "buffercache.h"
+
+class Journal;
 
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
@@ -24,33 +26,56 @@
 //
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
-// returning.
+// returning.  Requests from different threads do not wait for each
+// other: they all go to a DiskQueue, which keeps the disk busy and
+// picks the order in which they are serviced.
+//
+// Requests are served from a BufferCache when they can be; sectors
+// can also be prefetched, to be read later without waiting for the disk.
+//
+// Once the file system attaches its Journal, writes that are part of
+// a metadata update go to the journal instead of their home sectors,
+// and reads see the journal's newer contents.
 
-class SynchDisk : public CallBackObj
+class SynchDisk
 {
 public:
-    SynchDisk();  // Initialize a synchronous disk,
-                  // by initializing the raw Disk.
-    ~SynchDisk(); // De-allocate the synch disk data
+    SynchDisk(DiskPolicy policy); // Initialize a synchronous disk,
+                                  // by initializing the request queue
+                                  // and the raw Disk.
+    ~SynchDisk();                 // De-allocate the synch disk data
 
     void ReadSector(int sectorNumber, char *data);
     // Read/write a disk sector, returning
     // only once the data is actually read
-    // or written.  These call
-    // Disk::ReadRequest/WriteRequest and
-    // then wait until the request is done.
+    // or written.  Reads of cached
+    // sectors don't go to the disk.
     void WriteSector(int sectorNumber, char *data);
 
-    void CallBack(); // Called by the disk device interrupt
-                     // handler, to signal that the
-                     // current disk operation is complete.
+    void ReadSectors(int *sectorList, int numSectors, char *data);
+    // Read/write "numSectors" sectors,
+    // sectorList[i] to/from
+    // data[i * SectorSize], as one
+    // vectored disk request.
+    void WriteSectors(int *sectorList, int numSectors, char *data);
+
+    void Prefetch(int *sectorList, int numSectors);
+    // Start reading sectors into the
+    // cache, without waiting for them
+
+    void AttachJournal(Journal *log); // Route writes through "log"
+    void WriteThrough(int *sectorList, int numSectors, char *data,
+                      CallBackObj *callWhenDone);
+    // Write to disk, bypassing the
+    // journal; if callWhenDone is
+    // not NULL, don't wait for it
+    bool Cached(int sector, char *data);
+    // Copy out "sector" if it's cached
 
 private:
-    Disk *disk;           // Raw disk device
-    Semaphore *semaphore; // To synchronize requesting thread
-                          // with the interrupt handler
-    Lock *lock;           // Only one read/write request
-                          // can be sent to the disk at a time
+    DiskQueue *queue;   // Outstanding requests, and the raw disk
+    BufferCache *cache; // Recently used and prefetched sectors
+    Journal *journal;   // Where metadata writes go, if not NULL
 };
 
 #endif // SYNCHDISK_H
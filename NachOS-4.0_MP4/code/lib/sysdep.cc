@@ -32,6 +32,11 @@
 #include <sys/file.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <limits.h>
 #include <cerrno>
 
 #ifdef SOLARIS
@@ -132,6 +137,21 @@ Delay(int seconds)
     (void) sleep((unsigned) seconds);
 }
 
+//----------------------------------------------------------------------
+// HostTime
+// 	Return the host's wall clock time, in seconds, to measure how long
+//	the UNIX process running Nachos takes to do something.
+//----------------------------------------------------------------------
+
+double
+HostTime()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
 //----------------------------------------------------------------------
 // UDelay
 // 	Put the UNIX process running Nachos to sleep for x microseconds,
@@ -379,6 +399,99 @@ Lseek(int fd, int offset, int whence)
     ASSERT(retVal >= 0);
 }
 
+//----------------------------------------------------------------------
+// ReadVector/WriteVector
+// 	Scatter/gather "count" buffers to/from an open file, starting at
+//	byte "offset", without moving the file position.  The buffers
+//	are transferred back to back, so a run of adjacent disk sectors
+//	costs a single preadv/pwritev no matter where the pieces live
+//	in memory.  Abort if the transfer fails.
+//----------------------------------------------------------------------
+
+static void
+TransferVector(int fd, char **buffers, int *lengths, int count, int offset,
+		bool writing)
+{
+    struct iovec iov[IOV_MAX];
+
+    while (count > 0) {
+	int n = (count < IOV_MAX) ? count : IOV_MAX;
+	int total = 0;
+	for (int i = 0; i < n; i++) {
+	    iov[i].iov_base = buffers[i];
+	    iov[i].iov_len = lengths[i];
+	    total += lengths[i];
+	}
+	int retVal = writing ? pwritev(fd, iov, n, offset)
+			     : preadv(fd, iov, n, offset);
+	ASSERT(retVal == total);
+	buffers += n;
+	lengths += n;
+	count -= n;
+	offset += total;
+    }
+}
+
+void
+ReadVector(int fd, char **buffers, int *lengths, int count, int offset)
+{
+    TransferVector(fd, buffers, lengths, count, offset, FALSE);
+}
+
+void
+WriteVector(int fd, char **buffers, int *lengths, int count, int offset)
+{
+    TransferVector(fd, buffers, lengths, count, offset, TRUE);
+}
+
+//----------------------------------------------------------------------
+// MapFile
+// 	Map the first "length" bytes of an open file into memory, shared
+//	with the file and readable and writable.  Return NULL if the host
+//	can't map it.
+//----------------------------------------------------------------------
+
+char *
+MapFile(int fd, int length)
+{
+    void *start = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       fd, 0);
+
+    return (start == MAP_FAILED) ? NULL : (char *)start;
+}
+
+//----------------------------------------------------------------------
+// SyncMappedFile
+// 	Flush the stores made to part of a mapped file back to the file.
+//	msync wants a page-aligned start, so the range is widened to the
+//	page it begins in.  Abort on error.
+//
+//	"wait" -- return only once the data is written (or just schedule
+//		the writes)?
+//----------------------------------------------------------------------
+
+void
+SyncMappedFile(char *start, int length, bool wait)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    char *aligned = (char *)((unsigned long)start & ~(page - 1));
+    int retVal = msync(aligned, length + (start - aligned),
+		       wait ? MS_SYNC : MS_ASYNC);
+    ASSERT(retVal == 0);
+}
+
+//----------------------------------------------------------------------
+// UnmapFile
+// 	Undo MapFile.  Abort on error.
+//----------------------------------------------------------------------
+
+void
+UnmapFile(char *start, int length)
+{
+    int retVal = munmap(start, length);
+    ASSERT(retVal == 0);
+}
+
 //----------------------------------------------------------------------
 // Tell
 // 	Report the current location within an open file.
@@ -420,6 +533,43 @@ Unlink(char *name)
     return unlink(name);
 }
 
+//----------------------------------------------------------------------
+// OpenDirectory/NextDirectoryEntry/CloseDirectory
+// 	List the entries of a UNIX directory.  OpenDirectory returns NULL
+//	if "name" can't be opened as a directory.  NextDirectoryEntry
+//	skips "." and "..", and sets "isDir" by looking the entry up in
+//	"dirName" (the name the directory was opened with).
+//----------------------------------------------------------------------
+
+void *
+OpenDirectory(char *name)
+{
+    return opendir(name);
+}
+
+char *
+NextDirectoryEntry(void *dir, char *dirName, bool *isDir)
+{
+    struct dirent *entry;
+    struct stat info;
+    char path[PATH_MAX];
+
+    while ((entry = readdir((DIR *)dir)) != NULL) {
+	if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", dirName, entry->d_name);
+	*isDir = (stat(path, &info) == 0) && S_ISDIR(info.st_mode);
+	return entry->d_name;
+    }
+    return NULL;
+}
+
+void
+CloseDirectory(void *dir)
+{
+    closedir((DIR *)dir);
+}
+
 //----------------------------------------------------------------------
 // OpenSocket
 // 	Open an interprocess communication (IPC) connection.  For now, 
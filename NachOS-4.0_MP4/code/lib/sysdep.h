@@ -25,6 +25,10 @@ extern void Exit(int exitCode);
 extern void Delay(int seconds);
 extern void UDelay(unsigned int usec);// rcgood - to avoid spinners.
 
+// Seconds of host (wall clock) time since some fixed point in the past,
+// to time how long Nachos itself takes
+extern double HostTime();
+
 // Initialize system so that cleanUp routine is called when user hits ctl-C
 extern void CallOnUserAbort(void (*cleanup)(int));
 
@@ -50,9 +54,27 @@ extern int ReadPartial(int fd, char *buffer, int nBytes);
 extern void WriteFile(int fd, char *buffer, int nBytes);
 extern void Lseek(int fd, int offset, int whence);
 extern int Tell(int fd);
+extern void ReadVector(int fd, char **buffers, int *lengths, int count,
+			int offset);
+extern void WriteVector(int fd, char **buffers, int *lengths, int count,
+			int offset);
 extern int Close(int fd);
 extern bool Unlink(char *name);
 
+// Walk the entries of a UNIX directory, "." and ".." left out.
+// NextDirectoryEntry returns NULL at the end; the name it returns is
+// good until the next call.
+extern void *OpenDirectory(char *name);
+extern char *NextDirectoryEntry(void *dir, char *dirName, bool *isDir);
+extern void CloseDirectory(void *dir);
+
+// Map an open file into memory, shared, so that stores to the memory
+// are stores to the file; flush the stores in a range to the file
+// (waiting for them to reach it, or not); and unmap it.
+extern char *MapFile(int fd, int length);
+extern void SyncMappedFile(char *start, int length, bool wait);
+extern void UnmapFile(char *start, int length);
+
 // Other C library routines that are used by Nachos.
 // These are assumed to be portable, so we don't include a wrapper.
 extern "C" {
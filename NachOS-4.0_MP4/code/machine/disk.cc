@@ -45,7 +45,9 @@ Disk::Disk(CallBackObj *toCall)
     callWhenDone = toCall;
     lastSector = 0;
     bufferInit = 0;
+    ticksAhead = 0;
 
+    image = NULL;
     sprintf(diskname, "DISK_%d", kernel->hostName);
     fileno = OpenForReadWrite(diskname, FALSE);
     if (fileno >= 0)
@@ -63,17 +65,38 @@ Disk::Disk(CallBackObj *toCall)
         Lseek(fileno, DiskSize - sizeof(int), 0);
         WriteFile(fileno, (char *)&tmp, sizeof(int));
     }
+
+    if (kernel->diskMap != NULL)
+    { // map the file, if the host lets us
+        if (strcmp(kernel->diskMap, "never") == 0)
+            syncPolicy = DiskSyncNever;
+        else if (strcmp(kernel->diskMap, "write") == 0)
+            syncPolicy = DiskSyncEachWrite;
+        else                    // "exit", checked when it was parsed
+            syncPolicy = DiskSyncAtExit;
+        image = MapFile(fileno, DiskSize);
+        if (image == NULL)
+        {
+            DEBUG(dbgDisk, "Can't map the disk; reading and writing it instead.");
+        }
+    }
     active = FALSE;
 }
 
 //----------------------------------------------------------------------
 // Disk::~Disk()
 // 	Clean up disk simulation, by closing the UNIX file representing the
-//	disk.
+//	disk.  If the file is mapped, flush it first as the policy says.
 //----------------------------------------------------------------------
 
 Disk::~Disk()
 {
+    if (image != NULL)
+    {
+        if (syncPolicy != DiskSyncNever)
+            SyncMappedFile(image, DiskSize, TRUE);
+        UnmapFile(image, DiskSize);
+    }
     Close(fileno);
 }
 
@@ -116,13 +139,13 @@ PrintSector(bool writing, int sector, char *data)
 void Disk::ReadRequest(int sectorNumber, char *data)
 {
     int ticks = ComputeLatency(sectorNumber, FALSE);
+    int length = SectorSize;
 
     ASSERT(!active); // only one request at a time
     ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
 
     DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
+    Transfer(sectorNumber, &data, &length, 1, FALSE);
     if (debug->IsEnabled('d'))
         PrintSector(FALSE, sectorNumber, data);
 
@@ -135,13 +158,13 @@ void Disk::ReadRequest(int sectorNumber, char *data)
 void Disk::WriteRequest(int sectorNumber, char *data)
 {
     int ticks = ComputeLatency(sectorNumber, TRUE);
+    int length = SectorSize;
 
     ASSERT(!active);
     ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
 
     DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    Transfer(sectorNumber, &data, &length, 1, TRUE);
     if (debug->IsEnabled('d'))
         PrintSector(TRUE, sectorNumber, data);
 
@@ -151,6 +174,143 @@ void Disk::WriteRequest(int sectorNumber, char *data)
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
+//----------------------------------------------------------------------
+// Disk::ReadMultiRequest/WriteMultiRequest
+// 	Simulate a request to read/write several disk sectors at once.
+//	   The sectors are serviced in ascending order, grouped into runs
+//	      of consecutive sectors on the same track.
+//	   Each run pays for one seek and rotational delay, after which
+//	      its sectors pass under the head back to back, so a run of
+//	      n sectors costs ComputeLatency(first) + (n - 1) * RotationTime.
+//	   Each run is a single preadv/pwritev on the UNIX file (or,
+//	      if it is mapped, a memcpy per buffer).
+//	   One interrupt is scheduled, when the last run has finished.
+//
+//	"sectorList" -- the disk sectors to read/write
+//	"numSectors" -- the number of entries in sectorList
+//	"data" -- sectorList[i] is transferred to/from data[i * SectorSize]
+//----------------------------------------------------------------------
+
+void Disk::ReadMultiRequest(int *sectorList, int numSectors, char *data)
+{
+    MultiRequest(sectorList, numSectors, data, FALSE);
+    kernel->stats->numDiskReads++;
+}
+
+void Disk::WriteMultiRequest(int *sectorList, int numSectors, char *data)
+{
+    MultiRequest(sectorList, numSectors, data, TRUE);
+    kernel->stats->numDiskWrites++;
+}
+
+void Disk::MultiRequest(int *sectorList, int numSectors, char *data,
+                        bool writing)
+{
+    int *order = new int[numSectors];    // request indices, by sector
+    char **buffers = new char *[numSectors];
+    int *lengths = new int[numSectors];
+    int i, j, k, ticks;
+
+    ASSERT(!active);
+    ASSERT(numSectors > 0);
+
+    // Sort by sector number.  Callers almost always hand us the sectors
+    // of a file in ascending order, so insertion sort is linear here.
+    for (i = 0; i < numSectors; i++)
+    {
+        ASSERT((sectorList[i] >= 0) && (sectorList[i] < NumSectors));
+        for (j = i; (j > 0) && (sectorList[order[j - 1]] > sectorList[i]); j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    for (i = 0; i < numSectors; i = j)
+    {
+        int first = sectorList[order[i]];
+        int count = 0;
+
+        // extend the run while the next sector follows on the same track
+        for (j = i + 1; j < numSectors; j++)
+        {
+            int next = sectorList[order[j]];
+            if ((next != sectorList[order[j - 1]] + 1) ||
+                ((next % SectorsPerTrack) == 0))
+                break;
+        }
+        ticks = ComputeLatency(first, writing) + (j - i - 1) * RotationTime;
+
+        // gather the run's buffers, merging the ones adjacent in memory
+        for (k = i; k < j; k++)
+        {
+            char *buf = &data[order[k] * SectorSize];
+            if ((count > 0) && (buffers[count - 1] + lengths[count - 1] == buf))
+                lengths[count - 1] += SectorSize;
+            else
+            {
+                buffers[count] = buf;
+                lengths[count++] = SectorSize;
+            }
+        }
+
+        DEBUG(dbgDisk, (writing ? "Writing " : "Reading ") << (j - i)
+                           << " sectors from sector " << first);
+        Transfer(first, buffers, lengths, count, writing);
+        if (debug->IsEnabled('d'))
+            for (k = i; k < j; k++)
+                PrintSector(writing, sectorList[order[k]],
+                            &data[order[k] * SectorSize]);
+
+        UpdateLast(first);
+        UpdateLast(sectorList[order[j - 1]]);
+        ticksAhead += ticks; // the next run starts where this one ends
+    }
+    ticks = ticksAhead;
+    ticksAhead = 0;
+
+    delete[] order;
+    delete[] buffers;
+    delete[] lengths;
+
+    active = TRUE;
+    kernel->interrupt->Schedule(this, ticks, DiskInt);
+}
+
+//----------------------------------------------------------------------
+// Disk::Transfer
+// 	Move "count" buffers, back to back, to or from the disk starting
+//	at "sector": through the mapping if there is one, or with a
+//	preadv/pwritev on the UNIX file.  A write to a mapped disk
+//	schedules a flush of what it changed, if that is the policy.
+//----------------------------------------------------------------------
+
+void Disk::Transfer(int sector, char **buffers, int *lengths, int count,
+                    bool writing)
+{
+    int offset = SectorSize * sector + MagicSize;
+
+    if (image == NULL)
+    {
+        if (writing)
+            WriteVector(fileno, buffers, lengths, count, offset);
+        else
+            ReadVector(fileno, buffers, lengths, count, offset);
+        return;
+    }
+
+    char *start = &image[offset];
+    char *p = start;
+    for (int i = 0; i < count; i++)
+    {
+        if (writing)
+            bcopy(buffers[i], p, lengths[i]);
+        else
+            bcopy(p, buffers[i], lengths[i]);
+        p += lengths[i];
+    }
+    if (writing && syncPolicy == DiskSyncEachWrite)
+        SyncMappedFile(start, p - start, FALSE);
+}
+
 //----------------------------------------------------------------------
 // Disk::CallBack()
 // 	Called by the machine simulation when the disk interrupt occurs.
@@ -179,7 +339,7 @@ int Disk::TimeToSeek(int newSector, int *rotation)
     int oldTrack = lastSector / SectorsPerTrack;
     int seek = abs(newTrack - oldTrack) * SeekTime;
     // how long will seek take?
-    int over = (kernel->stats->totalTicks + seek) % RotationTime;
+    int over = (Now() + seek) % RotationTime;
     // will we be in the middle of a sector when
     // we finish the seek?
 
@@ -228,7 +388,7 @@ int Disk::ComputeLatency(int newSector, bool writing)
 {
     int rotation;
     int seek = TimeToSeek(newSector, &rotation);
-    int timeAfter = kernel->stats->totalTicks + seek + rotation;
+    int timeAfter = Now() + seek + rotation;
 
 #ifndef NOTRACKBUF // turn this on if you don't want the track buffer stuff
     // check if track buffer applies
@@ -257,7 +417,21 @@ void Disk::UpdateLast(int newSector)
     int seek = TimeToSeek(newSector, &rotate);
 
     if (seek != 0)
-        bufferInit = kernel->stats->totalTicks + seek + rotate;
+        bufferInit = Now() + seek + rotate;
+    kernel->stats->diskSeekTicks += seek;
+    kernel->stats->diskSeekTracks += seek / SeekTime;
     lastSector = newSector;
     DEBUG(dbgDisk, "Updating last sector = " << lastSector << " , " << bufferInit);
 }
+
+//----------------------------------------------------------------------
+// Disk::Now
+//   	Return the simulated time at which the head is free for the
+//	request being timed: the current time, plus whatever the earlier
+//	runs of a multi-sector request have already been charged.
+//----------------------------------------------------------------------
+
+int Disk::Now()
+{
+    return kernel->stats->totalTicks + ticksAhead;
+}
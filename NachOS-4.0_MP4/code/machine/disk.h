@@ -46,6 +46,12 @@
 // disks these days now come with a track buffer.
 //
 // The track buffer simulation can be disabled by compiling with -DNOTRACKBUF
+//
+// The UNIX file can also be mapped into memory (nachos -dm), so that a
+// transfer is a memcpy instead of a system call or two per request.
+// The simulated timing is the same either way.  Stores to the mapping
+// reach the file whenever the host gets around to them, unless they
+// are flushed: the policy says when.
 
 // MP4 Hint: DO NOT change the SectorSize, but other constants are allowed
 const int SectorSize = 128;		// number of bytes per disk sector
@@ -53,6 +59,12 @@ const int SectorsPerTrack = 16384;	// number of sectors per disk track
 const int NumTracks = 32;		// number of tracks per disk
 const int NumSectors = (SectorsPerTrack * NumTracks); // total # of sectors per disk
 
+// When to flush a mapped disk image to the UNIX file
+enum DiskSyncPolicy { DiskSyncNever,	// leave it to the host
+		      DiskSyncAtExit,	// once, when the disk goes away
+		      DiskSyncEachWrite // schedule a flush on every write
+		    };
+
 class Disk : public CallBackObj {
   public:
     Disk(CallBackObj *toCall);          // Create a simulated disk.  
@@ -67,6 +79,16 @@ class Disk : public CallBackObj {
     					// Only one request allowed at a time!
     void WriteRequest(int sectorNumber, char* data);
 
+    void ReadMultiRequest(int *sectorList, int numSectors, char* data);
+    					// Read/write "numSectors" sectors,
+					// sectorList[i] to/from
+					// data[i * SectorSize], as a single
+					// request with a single interrupt.
+					// Runs of sectors adjacent on one
+					// track cost one seek and one host
+					// preadv/pwritev.
+    void WriteMultiRequest(int *sectorList, int numSectors, char* data);
+
     void CallBack();			// Invoked when disk request 
 					// finishes. In turn calls, callWhenDone.
 
@@ -75,18 +97,33 @@ class Disk : public CallBackObj {
 					// newSector will take: 
 					// (seek + rotational delay + transfer)
 
+    int HeadSector() { return lastSector; }
+    					// Where the head is: the last
+					// sector requested
+
   private:
     int fileno;				// UNIX file number for simulated disk 
+    char *image;			// The file, mapped into memory; NULL
+					// if it is read and written instead
+    DiskSyncPolicy syncPolicy;		// When to flush the mapping
     char diskname[32];			// name of simulated disk's file
     CallBackObj *callWhenDone;		// Invoke when any disk request finishes
     bool active;     			// Is a disk operation in progress?
     int lastSector;			// The previous disk request 
     int bufferInit;			// When the track buffer started 
 					// being loaded
+    int ticksAhead;			// Latency already charged to the
+					// runs of the multi-sector request
+					// being timed; 0 otherwise
 
     int TimeToSeek(int newSector, int *rotate); // time to get to the new track
     int ModuloDiff(int to, int from);        // # sectors between to and from
     void UpdateLast(int newSector);
+    int Now();				// simulated time the head has reached
+    void MultiRequest(int *sectorList, int numSectors, char *data,
+		      bool writing);
+    void Transfer(int sector, char **buffers, int *lengths, int count,
+		  bool writing);	// Move the bytes, one way or the other
 };
 
 #endif // DISK_H
@@ -253,6 +253,10 @@ void Interrupt::Halt()
     cout << "This is halt\n";
     kernel->stats->Print();
 	*/
+    // MP4 what the open files still buffer goes to disk first; once
+    // the kernel is torn down, there is no disk to write it to
+    if (kernel->fileSystem != NULL)
+        kernel->fileSystem->Sync();
     delete debug;
 
     delete kernel; // Never returns.
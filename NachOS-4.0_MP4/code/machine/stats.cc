@@ -20,6 +20,9 @@ Statistics::Statistics()
 {
     totalTicks = idleTicks = systemTicks = userTicks = 0;
     numDiskReads = numDiskWrites = 0;
+    diskSeekTicks = diskSeekTracks = diskWaitTicks = maxDiskWaitTicks = 0;
+    numCacheHits = numReadAheads = numReadAheadHits = 0;
+    numJournalCommits = numJournalSectors = numCheckpoints = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
 }
@@ -37,6 +40,13 @@ Statistics::Print()
 		cout << ", system " << systemTicks << ", user " << userTicks <<"\n";
     cout << "Disk I/O: reads " << numDiskReads;
 		cout << ", writes " << numDiskWrites << "\n";
+    cout << "Disk time: seek " << diskSeekTicks << " (" << diskSeekTracks;
+		cout << " tracks), queued " << diskWaitTicks;
+		cout << " (longest " << maxDiskWaitTicks << ")\n";
+    cout << "Buffer cache: hits " << numCacheHits << ", read-ahead ";
+		cout << numReadAheads << " (used " << numReadAheadHits << ")\n";
+    cout << "Journal: commits " << numJournalCommits << " (" << numJournalSectors;
+		cout << " sectors), checkpoints " << numCheckpoints << "\n";
 		cout << "Console I/O: reads " << numConsoleCharsRead;
     cout << ", writes " << numConsoleCharsWritten << "\n";
     cout << "Paging: faults " << numPageFaults << "\n";
@@ -30,6 +30,16 @@ class Statistics {
 
     int numDiskReads;		// number of disk read requests
     int numDiskWrites;		// number of disk write requests
+    int diskSeekTicks;		// time the disk head spent seeking
+    int diskSeekTracks;		// ... and how far it went, in tracks
+    int diskWaitTicks;		// time disk requests spent queued
+    int maxDiskWaitTicks;	// longest time one request was queued
+    int numCacheHits;		// sectors read found in the buffer cache
+    int numReadAheads;		// sectors prefetched by read-ahead
+    int numReadAheadHits;	// ... and later read
+    int numJournalCommits;	// transactions committed to the journal
+    int numJournalSectors;	// sectors they logged
+    int numCheckpoints;		// checkpoints of the journal started
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
@@ -0,0 +1,3 @@
+../build.linux/nachos -f
+../build.linux/nachos -cp FS_test4 /FS_test4
+../build.linux/nachos -e /FS_test4
@@ -0,0 +1 @@
+../build.linux/nachos -f -b FS_partIII.cmd
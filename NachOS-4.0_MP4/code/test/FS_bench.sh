@@ -0,0 +1,14 @@
+#!/bin/bash
+# Run each file system benchmark workload on a freshly formatted disk,
+# and print the results (see ../filesys/fsbench.h).  A workload's line
+# is appended to the CSV file given as the argument (bench.csv if none),
+# so that runs before and after a change can be compared.  Set LAYOUT=-lfs
+# to run them on a log-structured disk.
+
+nachos=${NACHOS:-../build.linux/nachos}
+out=${1:-bench.csv}
+
+for workload in create tree large random small append concurrent batch; do
+    $nachos -f $LAYOUT -bench $workload "$out" > /dev/null
+done
+cat "$out"
@@ -0,0 +1,5 @@
+../build.linux/nachos -f
+../build.linux/nachos -cp num_1000.txt /a
+../build.linux/nachos -clone /a /b
+../build.linux/nachos -r /a
+../build.linux/nachos -p /b
@@ -0,0 +1,3 @@
+../build.linux/nachos -f
+../build.linux/nachos -cpz num_1000.txt /1000
+../build.linux/nachos -p /1000
@@ -0,0 +1,17 @@
+../build.linux/nachos -f
+../build.linux/nachos -mkdir /d
+# enough files for the directory's first leaf to split a few times
+for i in $(seq 1 300); do
+    ../build.linux/nachos -cp num_100.txt /d/f$i
+done
+../build.linux/nachos -l /d
+echo ===================
+for i in $(seq 3 3 300); do
+    ../build.linux/nachos -r /d/f$i
+done
+../build.linux/nachos -l /d
+echo ===================
+../build.linux/nachos -p /d/f1
+../build.linux/nachos -p /d/f151
+../build.linux/nachos -p /d/f299
+../build.linux/nachos -p /d/f150
@@ -0,0 +1,3 @@
+../build.linux/nachos -f
+../build.linux/nachos -cp FS_test5 /FS_test5
+../build.linux/nachos -e /FS_test5
@@ -0,0 +1,9 @@
+# FS_partIII.sh, as a script for nachos -b
+mkdir /t0
+mkdir /t1
+cp num_100.txt /t0/f1
+mkdir /t0/aa
+cp num_100.txt /t0/aa/f1
+ls /
+echo ===================
+lr /
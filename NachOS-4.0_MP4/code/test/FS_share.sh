@@ -0,0 +1,6 @@
+../build.linux/nachos -f
+../build.linux/nachos -cp FS_test1 /FS_test1
+../build.linux/nachos -e /FS_test1
+../build.linux/nachos -cp FS_test3 /FS_test3
+../build.linux/nachos -e /FS_test3
+../build.linux/nachos -p /file1
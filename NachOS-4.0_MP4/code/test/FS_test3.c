@@ -0,0 +1,35 @@
+#include "syscall.h"
+
+int main(void)
+{
+	// you should run FS_test1 first before running this one
+	char check[] = "abcdefghijklmnopqrstuvwxyz\n";
+	char a[4], b[4];
+	OpenFileId fid1, fid2;
+	int i;
+	fid1 = Open("/file1");
+	fid2 = Open("/file1");
+	if (fid1 < 0 || fid2 < 0 || fid1 == fid2)
+		MSG("Failed on opening file twice");
+	// each descriptor has its own seek position
+	if (Read(a, 4, fid1) != 4 || Read(a, 4, fid1) != 4 || Read(b, 4, fid2) != 4)
+		MSG("Failed on reading file");
+	for (i = 0; i < 4; ++i)
+	{
+		if (a[i] != check[4 + i] || b[i] != check[i])
+			MSG("Failed: descriptors share a seek position");
+	}
+	// ReadAt/WriteAt leave the seek position alone
+	if (WriteAt("XY", 2, 10, fid2) != 2 || ReadAt(a, 2, 10, fid1) != 2)
+		MSG("Failed on positional I/O");
+	if (a[0] != 'X' || a[1] != 'Y')
+		MSG("Failed: write through one descriptor not seen through another");
+	if (Read(b, 4, fid2) != 4 || b[0] != check[4])
+		MSG("Failed: positional I/O moved the seek position");
+	if (WriteAt("kl", 2, 10, fid2) != 2)
+		MSG("Failed on positional I/O");
+	if (Close(fid1) != 1 || Close(fid2) != 1 || Close(fid2) == 1)
+		MSG("Failed on closing file");
+	MSG("Passed! ^_^");
+	Halt();
+}
@@ -0,0 +1,56 @@
+#include "syscall.h"
+
+#define Chunk 1024
+#define Chunks 4
+
+char out[Chunks][Chunk], in[Chunks][Chunk];
+
+int main(void)
+{
+	OpenFileId fid;
+	int id[Chunks];
+	int i, j, sum = 0, result;
+	if (Create("/async", 0) != 1)
+		MSG("Failed on creating file");
+	fid = Open("/async");
+	if (fid < 0)
+		MSG("Failed on opening file");
+	for (i = 0; i < Chunks; ++i)
+	{
+		for (j = 0; j < Chunk; ++j)
+			out[i][j] = 'a' + (i + j) % 26;
+		id[i] = AsyncWrite(out[i], Chunk, i * Chunk, fid);
+		if (id[i] < 0)
+			MSG("Failed on starting a write");
+	}
+	// compute while the writes go on; poll the first one now and then
+	result = ASYNC_PENDING;
+	for (i = 0; result == ASYNC_PENDING; ++i)
+	{
+		sum += i;
+		if (i % 100 == 0)
+			result = AsyncPoll(id[0]);
+	}
+	if (result != Chunk)
+		MSG("Failed on writing file");
+	for (i = 1; i < Chunks; ++i)
+		if (AsyncWait(id[i]) != Chunk)
+			MSG("Failed on writing file");
+	if (AsyncWait(id[0]) != -1)
+		MSG("Failed: a request was collected twice");
+	// the requests have files of their own: closing fid doesn't end them
+	for (i = 0; i < Chunks; ++i)
+		id[i] = AsyncRead(in[i], Chunk, i * Chunk, fid);
+	if (Close(fid) != 1)
+		MSG("Failed on closing file");
+	for (i = Chunks - 1; i >= 0; --i)
+	{
+		if (id[i] < 0 || AsyncWait(id[i]) != Chunk)
+			MSG("Failed on reading file");
+		for (j = 0; j < Chunk; ++j)
+			if (in[i][j] != out[i][j])
+				MSG("Failed: read back something else");
+	}
+	MSG("Passed! ^_^");
+	Halt();
+}
@@ -0,0 +1,45 @@
+#include "syscall.h"
+
+#define Size 1000
+
+char buf[Size];
+
+int main(void)
+{
+	OpenFileId fid;
+	char *map;
+	int i;
+	if (Create("/mapped", 0) != 1)
+		MSG("Failed on creating file");
+	fid = Open("/mapped");
+	if (fid < 0)
+		MSG("Failed on opening file");
+	for (i = 0; i < Size; ++i)
+		buf[i] = 'a' + i % 26;
+	if (Write(buf, Size, fid) != Size)
+		MSG("Failed on writing file");
+	map = Mmap(fid);
+	if (map == 0)
+		MSG("Failed on mapping file");
+	// the mapping has a file of its own: closing fid doesn't end it
+	if (Close(fid) != 1)
+		MSG("Failed on closing file");
+	// touch a few bytes here and there; only their pages are read
+	for (i = 7; i < Size; i += 331)
+	{
+		if (map[i] != 'a' + i % 26)
+			MSG("Failed: mapped the wrong bytes");
+		map[i] = 'A' + i % 26;
+	}
+	if (Munmap(map) != 1 || Munmap(map) == 1)
+		MSG("Failed on unmapping file");
+	fid = Open("/mapped");
+	if (ReadAt(buf, Size, 0, fid) != Size)
+		MSG("Failed on reading file");
+	for (i = 0; i < Size; ++i)
+		if (buf[i] != ((i - 7) % 331 == 0 ? 'A' : 'a') + i % 26)
+			MSG("Failed: changes not written back");
+	Close(fid);
+	MSG("Passed! ^_^");
+	Halt();
+}
@@ -1,6 +1,6 @@
 #!/bin/bash
 
-testcases=("FS_partII_a" "FS_partII_b" "FS_partIII")
+testcases=("FS_partII_a" "FS_partII_b" "FS_partIII" "FS_batch" "FS_compress" "FS_lfs" "FS_clone" "FS_dir" "FS_share" "FS_async" "FS_mmap")
 
 mkdir -p .tmp
 
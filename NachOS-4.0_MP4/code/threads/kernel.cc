@@ -15,6 +15,7 @@
 #include "libtest.h"
 #include "string.h"
 #include "synchdisk.h"
+#include "asyncio.h"
 #include "post.h"
 #include "synchconsole.h"
 
@@ -30,9 +31,13 @@ Kernel::Kernel(int argc, char **argv)
     debugUserProg = FALSE;
     consoleIn = NULL;          // default is stdin
     consoleOut = NULL;         // default is stdout
+    diskSchedule = "clook";    // default is the elevator
+    diskMap = NULL;            // default is plain reads and writes
 #ifndef FILESYS_STUB
     formatFlag = FALSE;
+    logFlag = FALSE;
 #endif
+    fileSystem = NULL;          // until Initialize has mounted it
     reliability = 1;            // network reliability, default is 1.0
     hostName = 0;               // machine id, also UNIX socket name
                                 // 0 is the default machine id
@@ -60,9 +65,31 @@ Kernel::Kernel(int argc, char **argv)
 	    	ASSERT(i + 1 < argc);
 	    	consoleOut = argv[i + 1];
 	    	i++;
+		} else if (strcmp(argv[i], "-ds") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	diskSchedule = argv[i + 1];
+	    	if (strcmp(diskSchedule, "fcfs") != 0 &&
+	    	    strcmp(diskSchedule, "clook") != 0 &&
+	    	    strcmp(diskSchedule, "sstf") != 0) {
+	    	    cout << "Partial usage: nachos [-ds fcfs|clook|sstf]\n";
+	    	    Exit(1);
+	    	}
+	    	i++;
+		} else if (strcmp(argv[i], "-dm") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	diskMap = argv[i + 1];
+	    	if (strcmp(diskMap, "never") != 0 &&
+	    	    strcmp(diskMap, "exit") != 0 &&
+	    	    strcmp(diskMap, "write") != 0) {
+	    	    cout << "Partial usage: nachos [-dm never|exit|write]\n";
+	    	    Exit(1);
+	    	}
+	    	i++;
 #ifndef FILESYS_STUB
 		} else if (strcmp(argv[i], "-f") == 0) {
 	    	formatFlag = TRUE;
+		} else if (strcmp(argv[i], "-lfs") == 0) {
+	    	logFlag = TRUE;
 #endif
         } else if (strcmp(argv[i], "-n") == 0) {
             ASSERT(i + 1 < argc);   // next argument is float
@@ -76,8 +103,11 @@ Kernel::Kernel(int argc, char **argv)
             cout << "Partial usage: nachos [-rs randomSeed]\n";
 	   		cout << "Partial usage: nachos [-s]\n";
             cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut]\n";
+            cout << "Partial usage: nachos [-ds fcfs|clook|sstf]\n";
+            cout << "Partial usage: nachos [-dm never|exit|write]\n";
 #ifndef FILESYS_STUB
 	    	cout << "Partial usage: nachos [-nf]\n";
+	    	cout << "Partial usage: nachos [-f [-lfs]]\n";
 #endif
             cout << "Partial usage: nachos [-n #] [-m #]\n";
 		}
@@ -109,12 +139,18 @@ Kernel::Initialize()
     machine = new Machine(debugUserProg);
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
-    synchDisk = new SynchDisk();    //
+    if (strcmp(diskSchedule, "fcfs") == 0)
+        synchDisk = new SynchDisk(DiskFCFS);
+    else if (strcmp(diskSchedule, "sstf") == 0)
+        synchDisk = new SynchDisk(DiskSSTF);
+    else                        // "clook", checked when it was parsed
+        synchDisk = new SynchDisk(DiskCLOOK);
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
-    fileSystem = new FileSystem(formatFlag);
+    fileSystem = new FileSystem(formatFlag, logFlag);
 #endif // FILESYS_STUB
+    asyncIO = new AsyncIO();
 
 	// MP4 mod tag
     /*
@@ -153,6 +189,7 @@ Kernel::~Kernel()
     delete machine;
     delete synchConsoleIn;
     delete synchConsoleOut;
+    delete asyncIO;
     delete synchDisk;
     delete fileSystem;
 	
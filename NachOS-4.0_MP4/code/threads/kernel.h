@@ -24,6 +24,7 @@ class PostOfficeOutput;
 class SynchConsoleInput;
 class SynchConsoleOutput;
 class SynchDisk;
+class AsyncIO;
 
 
 
@@ -65,10 +66,14 @@ class Kernel {
     SynchConsoleOutput *synchConsoleOut;
     SynchDisk *synchDisk;
     FileSystem *fileSystem;     
+    AsyncIO *asyncIO;           // file I/O queued by user programs
     PostOfficeInput *postOfficeIn;
     PostOfficeOutput *postOfficeOut;
 
     int hostName;               // machine identifier
+    char *diskMap;              // map the disk image into memory, and
+                                // msync it "never", at "exit" or on
+                                // each "write"; NULL to not map it
 
   private:
 
@@ -81,8 +86,10 @@ class Kernel {
     double reliability;         // likelihood messages are dropped
     char *consoleIn;            // file to read console input from
     char *consoleOut;           // file to send console output to
+    char *diskSchedule;         // disk request order: fcfs, clook, sstf
 #ifndef FILESYS_STUB
     bool formatFlag;          // format the disk if this is true
+    bool logFlag;             // with -f, lay the disk out as a log
 #endif
 };
 
@@ -4,8 +4,12 @@
 //
 // Usage: nachos -d <debugflags> -rs <random seed #>
 //              -s -x <nachos file> -ci <consoleIn> -co <consoleOut>
-//              -f -cp <unix file> <nachos file>
+//              -ds <disk schedule> -dm <disk sync policy>
+//              -f -lfs -cp <unix file> <nachos file> -cpz <unix file> <nachos file>
+//              -clone <nachos file> <nachos file>
 //              -p <nachos file> -r <nachos file> -l -D
+//              -import <unix directory> <nachos directory> -b <script>
+//              -defrag -bench <workload> <csv file>
 //              -n <network reliability> -m <machine id>
 //              -z -K -C -N
 //
@@ -16,6 +20,9 @@
 //    -x runs a user program
 //    -ci specify file for console input (stdin is the default)
 //    -co specify file for console output (stdout is the default)
+//    -ds picks the disk request order: fcfs, clook (default) or sstf
+//    -dm maps the disk image into host memory; the argument says when
+//        to flush it to the UNIX file: never, at exit, or on each write
 //    -n sets the network reliability
 //    -m sets this machine's host id (needed for the network)
 //    -K run a simple self test of kernel threads and synchronization
@@ -24,11 +31,25 @@
 //
 //    Filesystem-related flags:
 //    -f forces the Nachos disk to be formatted
+//    -lfs with -f, lays the disk out as a log of segments, with a
+//        cleaner thread (see filesys.cc)
 //    -cp copies a file from UNIX to Nachos
+//    -cpz does the same, into a compressed Nachos file
+//    -clone makes a Nachos file a copy of another, sharing its sectors
+//        until either is written (see FileSystem::Clone)
 //    -p prints a Nachos file to stdout
 //    -r removes a Nachos file from the file system
 //    -l lists the contents of the Nachos directory
 //    -D prints the contents of the entire file system
+//    -import copies a UNIX directory, and everything under it, into
+//        a Nachos directory (which must exist)
+//    -b runs the file system commands in a UNIX file, one per line,
+//        all in this one run of Nachos (see RunScript)
+//    -defrag moves the blocks of each file into one run of sectors, in
+//        a kernel thread running alongside the user programs (if any)
+//    -bench runs a file system workload (create, tree, large, random,
+//        small, append, concurrent, batch or all), and appends what it cost
+//        to a UNIX CSV file (see fsbench.h)
 //
 //  Note: the file system flags are not used if the stub filesystem
 //        is being used
@@ -45,6 +66,10 @@
 #include "filesys.h"
 #include "openfile.h"
 #include "sysdep.h"
+#ifndef FILESYS_STUB
+#include "directory.h"
+#include "fsbench.h"
+#endif
 
 // global variables
 Kernel *kernel;
@@ -69,13 +94,21 @@ Cleanup(int x)
 //-------------------------------------------------------------------
 static const int TransferSize = 128;
 
+//-------------------------------------------------------------------
+// Constant used by "Copy"
+//   Copy moves data in larger chunks, so that each Nachos write turns
+//   into one vectored disk request over many sectors
+//-------------------------------------------------------------------
+static const int CopyTransferSize = 64 * TransferSize;
+
 #ifndef FILESYS_STUB
 //----------------------------------------------------------------------
 // Copy
-//      Copy the contents of the UNIX file "from" to the Nachos file "to"
+//      Copy the contents of the UNIX file "from" to the Nachos file "to",
+//      which is compressed if "compressed" is set
 //----------------------------------------------------------------------
 
-static void Copy(char *from, char *to)
+static void Copy(char *from, char *to, bool compressed)
 {
     int fd;
     OpenFile *openFile;
@@ -94,11 +127,14 @@ static void Copy(char *from, char *to)
     fileLength = Tell(fd);
     Lseek(fd, 0, 0);
 
-    // Create a Nachos file of the same length
+    // Create an empty Nachos file; it grows as we write to it.  The
+    // metadata updates of the whole copy are committed as a batch.
     DEBUG('f', "Copying file " << from << " of size " << fileLength << " to file " << to);
-    if (!kernel->fileSystem->Create(to, fileLength))
+    kernel->fileSystem->BeginBatch();
+    if (!kernel->fileSystem->Create(to, 0, compressed))
     { // Create Nachos file
         printf("Copy: couldn't create output file %s\n", to);
+        kernel->fileSystem->EndBatch();
         Close(fd);
         return;
     }
@@ -106,14 +142,21 @@ static void Copy(char *from, char *to)
     openFile = kernel->fileSystem->Open(to);
     ASSERT(openFile != NULL);
 
-    // Copy the data in TransferSize chunks
-    buffer = new char[TransferSize];
-    while ((amountRead = ReadPartial(fd, buffer, sizeof(char) * TransferSize)) > 0)
-        openFile->Write(buffer, amountRead);
-    delete[] buffer;
+    // Allocate all of it up front, so that the writes only move data
+    if (!openFile->Preallocate(fileLength))
+        printf("Copy: not enough space for %s\n", to);
+    else
+    {
+        // Copy the data in CopyTransferSize chunks
+        buffer = new char[CopyTransferSize];
+        while ((amountRead = ReadPartial(fd, buffer, sizeof(char) * CopyTransferSize)) > 0)
+            openFile->Write(buffer, amountRead);
+        delete[] buffer;
+    }
 
     // Close the UNIX and the Nachos files
     delete openFile;
+    kernel->fileSystem->EndBatch();
     Close(fd);
 }
 
@@ -157,6 +200,168 @@ static void CreateDirectory(char *name)
     kernel->fileSystem->CreateDirectory(name); 
 }
 
+#ifndef FILESYS_STUB
+//----------------------------------------------------------------------
+// Import
+//      Copy the files in the UNIX directory "from" into the Nachos
+//      directory "to", and the directories under it into new Nachos
+//      directories, all the way down.  Names too long for Nachos are
+//      skipped.
+//----------------------------------------------------------------------
+
+static void Import(char *from, char *to)
+{
+    void *dir;
+    char *name;
+    bool isDir;
+
+    if ((dir = OpenDirectory(from)) == NULL)
+    {
+        printf("Import: couldn't open input directory %s\n", from);
+        return;
+    }
+    while ((name = NextDirectoryEntry(dir, from, &isDir)) != NULL)
+    {
+        char unixName[512], nachosName[256];
+
+        if (strlen(name) > FileNameMaxLen ||
+            strlen(to) + strlen(name) + 2 > sizeof(nachosName))
+        {
+            printf("Import: skipping %s/%s, name too long\n", from, name);
+            continue;
+        }
+        snprintf(unixName, sizeof(unixName), "%s/%s", from, name);
+        snprintf(nachosName, sizeof(nachosName), "%s/%s",
+                 strcmp(to, "/") ? to : "", name);
+        if (isDir)
+        {
+            CreateDirectory(nachosName);
+            Import(unixName, nachosName);
+        }
+        else
+            Copy(unixName, nachosName, FALSE);
+    }
+    CloseDirectory(dir);
+}
+
+//----------------------------------------------------------------------
+// Clone
+//      Make the Nachos file "to" a clone of the Nachos file "from"
+//----------------------------------------------------------------------
+
+static void Clone(char *from, char *to)
+{
+    if (!kernel->fileSystem->Clone(from, to))
+        printf("Clone: couldn't clone %s as %s\n", from, to);
+}
+
+//----------------------------------------------------------------------
+// RunScript
+//      Run the file system commands in the UNIX file "script", one per
+//      line, in this run of Nachos, so that a series of them shares
+//      one start-up (and what the file system caches) instead of
+//      starting Nachos afresh for each.  The commands are:
+//
+//          mkdir <dir>                 as -mkdir
+//          cp <unix file> <file>       as -cp
+//          cpz <unix file> <file>      as -cpz
+//          clone <file> <file>         as -clone
+//          import <unix dir> <dir>     as -import
+//          rm <file>                   as -r
+//          rr <dir>                    as -rr
+//          ls <dir>                    as -l
+//          lr <dir>                    as -lr
+//          cat <file>                  as -p
+//          defrag                      as -defrag (but done before
+//                                      the next command)
+//          echo <text>                 prints the rest of the line
+//
+//      Blank lines, and lines starting with '#', are skipped.
+//----------------------------------------------------------------------
+
+static void RunScript(char *script)
+{
+    int fd, length;
+    char *text, *line, *next;
+
+    if ((fd = OpenForReadWrite(script, FALSE)) < 0)
+    {
+        printf("Batch: couldn't open script %s\n", script);
+        return;
+    }
+    Lseek(fd, 0, 2);
+    length = Tell(fd);
+    Lseek(fd, 0, 0);
+    text = new char[length + 1];
+    Read(fd, text, length);
+    text[length] = '\0';
+    Close(fd);
+
+    for (line = text; line != NULL; line = next)
+    {
+        char *command, *arg1, *arg2;
+
+        if ((next = strchr(line, '\n')) != NULL)
+            *next++ = '\0';
+        if (!strncmp(line, "echo", 4) && (line[4] == ' ' || line[4] == '\0'))
+        {
+            printf("%s\n", line[4] == ' ' ? line + 5 : "");
+            continue;
+        }
+        command = strtok(line, " \t\r");
+        if (command == NULL || command[0] == '#')
+            continue;
+        if (!strcmp(command, "defrag"))
+        {
+            kernel->fileSystem->Defragment();
+            continue;
+        }
+        arg1 = strtok(NULL, " \t\r");
+        arg2 = (arg1 != NULL) ? strtok(NULL, " \t\r") : NULL;
+
+        if (arg1 == NULL)
+            printf("Batch: %s needs an argument\n", command);
+        else if (!strcmp(command, "mkdir"))
+            CreateDirectory(arg1);
+        else if (!strcmp(command, "rm"))
+            kernel->fileSystem->Remove(arg1, FALSE);
+        else if (!strcmp(command, "rr"))
+            kernel->fileSystem->Remove(arg1, TRUE);
+        else if (!strcmp(command, "ls"))
+            kernel->fileSystem->List(arg1);
+        else if (!strcmp(command, "lr"))
+            kernel->fileSystem->RecursiveList(arg1);
+        else if (!strcmp(command, "cat"))
+            Print(arg1);
+        else if (strcmp(command, "cp") && strcmp(command, "cpz") &&
+                 strcmp(command, "clone") && strcmp(command, "import"))
+            printf("Batch: unknown command %s\n", command);
+        else if (arg2 == NULL)
+            printf("Batch: %s needs two arguments\n", command);
+        else if (!strcmp(command, "cp"))
+            Copy(arg1, arg2, FALSE);
+        else if (!strcmp(command, "cpz"))
+            Copy(arg1, arg2, TRUE);
+        else if (!strcmp(command, "clone"))
+            Clone(arg1, arg2);
+        else
+            Import(arg1, arg2);
+    }
+    delete[] text;
+}
+
+//----------------------------------------------------------------------
+// Defragment
+//      Body of the kernel thread -defrag starts, to defragment the
+//      disk while the user programs run.
+//----------------------------------------------------------------------
+
+static void Defragment(void *unused)
+{
+    kernel->fileSystem->Defragment();
+}
+#endif // FILESYS_STUB
+
 //----------------------------------------------------------------------
 // main
 // 	Bootstrap the operating system kernel.
@@ -182,6 +387,15 @@ int main(int argc, char **argv)
 #ifndef FILESYS_STUB
     char *copyUnixFileName = NULL;   // UNIX file to be copied into Nachos
     char *copyNachosFileName = NULL; // name of copied file in Nachos
+    bool copyCompressed = false;     // compress the copy?
+    char *cloneFromName = NULL;      // Nachos file to be cloned
+    char *cloneToName = NULL;        // name of the clone
+    char *importUnixDirName = NULL;  // UNIX directory to be imported
+    char *importNachosDirName = NULL; // Nachos directory it goes into
+    char *scriptFileName = NULL;     // UNIX file of commands to run
+    bool defragFlag = false;
+    char *benchWorkload = NULL;      // file system benchmark to run
+    char *benchCsvFileName = NULL;   // UNIX file its results go to
     char *printFileName = NULL;
     char *removeFileName = NULL;
     bool dirListFlag = false;
@@ -235,6 +449,45 @@ int main(int argc, char **argv)
             copyNachosFileName = argv[i + 2];
             i += 2;
         }
+        else if (strcmp(argv[i], "-cpz") == 0)
+        {
+            ASSERT(i + 2 < argc);
+            copyUnixFileName = argv[i + 1];
+            copyNachosFileName = argv[i + 2];
+            copyCompressed = true;
+            i += 2;
+        }
+        else if (strcmp(argv[i], "-clone") == 0)
+        {
+            ASSERT(i + 2 < argc);
+            cloneFromName = argv[i + 1];
+            cloneToName = argv[i + 2];
+            i += 2;
+        }
+        else if (strcmp(argv[i], "-import") == 0)
+        {
+            ASSERT(i + 2 < argc);
+            importUnixDirName = argv[i + 1];
+            importNachosDirName = argv[i + 2];
+            i += 2;
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            ASSERT(i + 1 < argc);
+            scriptFileName = argv[i + 1];
+            i++;
+        }
+        else if (strcmp(argv[i], "-defrag") == 0)
+        {
+            defragFlag = true;
+        }
+        else if (strcmp(argv[i], "-bench") == 0)
+        {
+            ASSERT(i + 2 < argc);
+            benchWorkload = argv[i + 1];
+            benchCsvFileName = argv[i + 2];
+            i += 2;
+        }
         else if (strcmp(argv[i], "-p") == 0)
         {
             ASSERT(i + 1 < argc);
@@ -293,8 +546,14 @@ int main(int argc, char **argv)
             cout << "Partial usage: nachos [-K] [-C] [-N]\n";
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-cp UnixFile NachosFile]\n";
+            cout << "Partial usage: nachos [-cpz UnixFile NachosFile]\n";
+            cout << "Partial usage: nachos [-clone NachosFile NachosFile]\n";
             cout << "Partial usage: nachos [-p fileName] [-r fileName]\n";
             cout << "Partial usage: nachos [-l] [-D]\n";
+            cout << "Partial usage: nachos [-import UnixDir NachosDir]\n";
+            cout << "Partial usage: nachos [-b scriptFile]\n";
+            cout << "Partial usage: nachos [-defrag]\n";
+            cout << "Partial usage: nachos [-bench workload CsvFile]\n";
 #endif //FILESYS_STUB
         }
     }
@@ -331,7 +590,15 @@ int main(int argc, char **argv)
     }
     if (copyUnixFileName != NULL && copyNachosFileName != NULL)
     {
-        Copy(copyUnixFileName, copyNachosFileName);
+        Copy(copyUnixFileName, copyNachosFileName, copyCompressed);
+    }
+    if (importUnixDirName != NULL && importNachosDirName != NULL)
+    {
+        Import(importUnixDirName, importNachosDirName);
+    }
+    if (cloneFromName != NULL && cloneToName != NULL)
+    {
+        Clone(cloneFromName, cloneToName);
     }
     if (dumpFlag)
     {
@@ -352,6 +619,23 @@ int main(int argc, char **argv)
     {
         Print(printFileName);
     }
+    if (scriptFileName != NULL)
+    {
+        RunScript(scriptFileName);
+    }
+    if (defragFlag)
+    {
+        Thread *defragThread = new Thread("defrag", 0);
+
+        defragThread->Fork((VoidFunctionPtr) Defragment, NULL);
+    }
+    if (benchWorkload != NULL)
+    {
+        FSBenchmark benchmark(benchCsvFileName);
+
+        if (!benchmark.Run(benchWorkload))
+            printf("No such benchmark workload: %s\n", benchWorkload);
+    }
 #endif // FILESYS_STUB
 
     // finally, run an initial user program if requested to do so
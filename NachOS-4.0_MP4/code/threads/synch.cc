@@ -295,3 +295,91 @@ void Condition::Broadcast(Lock* conditionLock)
         Signal(conditionLock);
     }
 }
+
+//----------------------------------------------------------------------
+// RWLock::RWLock
+// 	Initialize a reader/writer lock, so that it can be used for
+//	synchronization.  Initially, nobody holds it.
+//
+//	"debugName" is an arbitrary name, useful for debugging.
+//----------------------------------------------------------------------
+
+RWLock::RWLock(char* debugName)
+{
+    name = debugName;
+    lock = new Lock("rwlock");
+    readable = new Condition("rwlock readable");
+    writable = new Condition("rwlock writable");
+    readers = waitingWriters = 0;
+    writer = NULL;
+}
+
+//----------------------------------------------------------------------
+// RWLock::~RWLock
+// 	Deallocate a reader/writer lock.
+//----------------------------------------------------------------------
+
+RWLock::~RWLock()
+{
+    ASSERT(readers == 0 && writer == NULL);
+    delete readable;
+    delete writable;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireRead
+// 	Wait until no thread holds the lock to write, or is waiting to,
+//	then hold it, along with any other readers.
+//----------------------------------------------------------------------
+
+void RWLock::AcquireRead()
+{
+    lock->Acquire();
+    ASSERT(writer != kernel->currentThread);
+    while (writer != NULL || waitingWriters > 0)
+	readable->Wait(lock);
+    readers++;
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireWrite
+// 	Wait until no thread holds the lock, then hold it alone.
+//----------------------------------------------------------------------
+
+void RWLock::AcquireWrite()
+{
+    lock->Acquire();
+    ASSERT(writer != kernel->currentThread);
+    waitingWriters++;
+    while (writer != NULL || readers > 0)
+	writable->Wait(lock);
+    waitingWriters--;
+    writer = kernel->currentThread;
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::Release
+// 	Give up the lock.  The last reader out lets a writer in; a
+//	writer lets in the next writer, if there is one waiting, and
+//	otherwise every reader waiting.
+//----------------------------------------------------------------------
+
+void RWLock::Release()
+{
+    lock->Acquire();
+    if (writer != NULL) {
+	ASSERT(writer == kernel->currentThread);
+	writer = NULL;
+    } else {
+	ASSERT(readers > 0);
+	readers--;
+    }
+    if (readers == 0 && waitingWriters > 0)
+	writable->Signal(lock);
+    else if (waitingWriters == 0)
+	readable->Broadcast(lock);
+    lock->Release();
+}
@@ -7,6 +7,9 @@
 //	interface is given -- they are to be implemented as part of 
 //	the first assignment.
 //
+//	MP4: a fourth, reader/writer locks, is built out of the other
+//	three (for the file system, see filesys.cc).
+//
 //	Note that all the synchronization objects take a "name" as
 //	part of the initialization.  This is solely for debugging purposes.
 //
@@ -141,4 +144,44 @@ class Condition {
     char* name;
     List<Semaphore *> *waitQueue;	// list of waiting threads
 };
+
+// The following class defines a "reader/writer lock": a lock that
+// any number of threads can hold at once to read what it protects,
+// or one thread on its own to change it.
+//
+//	AcquireRead -- wait until no thread holds the lock to write, or
+//		is waiting to, then share the lock with the other readers
+//
+//	AcquireWrite -- wait until no thread holds the lock at all,
+//		then hold it alone
+//
+//	Release -- give up the lock, whichever way it is held
+//
+// A thread waiting to write keeps new readers out, so that a steady
+// stream of them can't keep it waiting forever.  As a consequence, a
+// thread must not acquire the lock to read while it already does.
+
+class RWLock {
+  public:
+    RWLock(char* debugName);		// initialize lock to be FREE
+    ~RWLock();				// deallocate lock
+    char* getName() { return name; }	// debugging assist
+
+    void AcquireRead();
+    void AcquireWrite();
+    void Release();
+    bool IsWriteHeldByCurrentThread() {
+    		return writer == kernel->currentThread; }
+    				// return true if the current thread
+				// holds this lock to write
+
+  private:
+    char *name;			// debugging assist
+    Lock *lock;			// protects the fields below
+    Condition *readable;	// where readers wait for the writers
+    Condition *writable;	// where writers wait for everyone
+    int readers;		// threads holding the lock to read
+    int waitingWriters;		// threads waiting to write
+    Thread *writer;		// thread holding it to write, if any
+};
 #endif // SYNCH_H
@@ -79,6 +79,13 @@ AddrSpace::AddrSpace()
     
     // zero out the entire address space
     bzero(kernel->machine->mainMemory, MemorySize);
+
+    openFiles = new FileDescriptorTable;
+    asyncRequests = new AsyncRequestTable;
+    imagePages = 0;
+    mappings = new List<MappedFile *>;
+    frames = new Bitmap(NumPhysPages);
+    clockHand = 0;
 }
 
 //----------------------------------------------------------------------
@@ -88,7 +95,13 @@ AddrSpace::AddrSpace()
 
 AddrSpace::~AddrSpace()
 {
-   delete pageTable;
+   delete asyncRequests;	// waits for whatever is still going on
+   while (!mappings->IsEmpty())	// writes back what changed
+	Munmap(mappings->Front()->firstPage * PageSize);
+   delete [] pageTable;
+   delete mappings;
+   delete frames;
+   delete openFiles;		// closes whatever is still open
 }
 
 
@@ -142,6 +155,10 @@ AddrSpace::Load(char *fileName)
 
     DEBUG(dbgAddr, "Initializing address space: " << numPages << ", " << size);
 
+    imagePages = numPages;
+    for (unsigned int i = 0; i < imagePages; i++)
+	frames->Mark(i);
+
 // then, copy in the code and data segments into memory
 // Note: this code assumes that virtual address = physical address
     if (noffH.code.size > 0) {
@@ -311,6 +328,212 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
     return NoException;
 }
 
+//----------------------------------------------------------------------
+// AddrSpace::Mmap
+// 	Map a file into the address space, right above the pages in use,
+//	and return the virtual address of its first byte; 0 (which is
+//	always the program's code) if the file is empty.
+//
+//	Nothing is read yet: the pages of the mapping start out invalid,
+//	and the page fault the first access to each causes reads it in
+//	(see PageFault).  The mapping covers the length the file has now.
+//
+//	"file" -- the file, opened for the mapping alone; it is closed
+//		when the mapping is removed
+//----------------------------------------------------------------------
+
+int
+AddrSpace::Mmap(OpenFile *file)
+{
+    int length = file->Length();
+    int pages = divRoundUp(length, PageSize);
+    TranslationEntry *table;
+    MappedFile *mapping;
+    unsigned int i;
+
+    if (length == 0)
+	return 0;
+
+    table = new TranslationEntry[numPages + pages];
+    for (i = 0; i < numPages; i++)
+	table[i] = pageTable[i];
+    for (; i < numPages + pages; i++) {
+	table[i].virtualPage = i;
+	table[i].physicalPage = 0;
+	table[i].valid = FALSE;
+	table[i].use = FALSE;
+	table[i].dirty = FALSE;
+	table[i].readOnly = FALSE;
+    }
+    delete [] pageTable;
+    pageTable = table;
+
+    mapping = new MappedFile;
+    mapping->file = file;
+    mapping->firstPage = numPages;
+    mapping->numPages = pages;
+    mapping->length = length;
+    mappings->Append(mapping);
+    numPages += pages;
+    if (kernel->currentThread->space == this)
+	RestoreState();		// the page table moved
+
+    DEBUG(dbgAddr, "Mapped " << length << " bytes at page " << mapping->firstPage);
+    return mapping->firstPage * PageSize;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Munmap
+// 	Remove the mapping at "addr" (as returned by Mmap), writing the
+//	pages that changed back to the file.  Return FALSE if there is
+//	no mapping there.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::Munmap(int addr)
+{
+    ListIterator<MappedFile *> iter(mappings);
+    MappedFile *mapping = NULL;
+    unsigned int top = imagePages;
+
+    for (; !iter.IsDone(); iter.Next())
+	if (iter.Item()->firstPage * PageSize == addr)
+	    mapping = iter.Item();
+    if (mapping == NULL)
+	return FALSE;
+
+    for (int vpn = mapping->firstPage;
+	 vpn < mapping->firstPage + mapping->numPages; vpn++)
+	if (pageTable[vpn].valid)
+	    PageOut(mapping, vpn);
+    mappings->Remove(mapping);
+    delete mapping->file;
+    delete mapping;
+
+    // give back the addresses above the remaining mappings
+    ListIterator<MappedFile *> rest(mappings);
+    for (; !rest.IsDone(); rest.Next())
+	top = max(top, (unsigned int)(rest.Item()->firstPage + rest.Item()->numPages));
+    numPages = top;
+    if (kernel->currentThread->space == this)
+	RestoreState();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::PageFault
+// 	The program touched a page that isn't in memory.  If it is part
+//	of a mapping, find it a physical page and read it in from the
+//	file (the part past the end of the file reads as zeroes); the
+//	instruction that faulted can then be run again.  Return FALSE
+//	if the address isn't mapped.
+//
+//	"vaddr" -- the virtual address that caused the fault
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::PageFault(int vaddr)
+{
+    unsigned int vpn = (unsigned) vaddr / PageSize;
+    MappedFile *mapping = (vpn < numPages) ? FindMapping(vpn) : NULL;
+    TranslationEntry *entry;
+    int frame, offset;
+    char *page;
+
+    if (mapping == NULL)
+	return FALSE;
+    entry = &pageTable[vpn];
+    ASSERT(!entry->valid);
+
+    frame = FindFrame();
+    offset = (vpn - mapping->firstPage) * PageSize;
+    page = &(kernel->machine->mainMemory[frame * PageSize]);
+    bzero(page, PageSize);
+    mapping->file->ReadAt(page, min(PageSize, mapping->length - offset), offset);
+    kernel->stats->numPageFaults++;
+
+    entry->physicalPage = frame;
+    entry->valid = TRUE;
+    entry->use = FALSE;
+    entry->dirty = FALSE;
+    DEBUG(dbgAddr, "Page " << vpn << " read into frame " << frame);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FindMapping
+// 	Return the mapping virtual page "vpn" belongs to, or NULL.
+//----------------------------------------------------------------------
+
+MappedFile *
+AddrSpace::FindMapping(int vpn)
+{
+    ListIterator<MappedFile *> iter(mappings);
+
+    for (; !iter.IsDone(); iter.Next())
+	if (vpn >= iter.Item()->firstPage &&
+	    vpn < iter.Item()->firstPage + iter.Item()->numPages)
+	    return iter.Item();
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FindFrame
+// 	Return a free physical page.  If there is none, evict a mapped
+//	page: go around the mapped pages in memory ("clock"), giving
+//	each one that was used since we last came by another chance,
+//	and take the first that wasn't.
+//
+//	Like the rest of the address space, this assumes the program has
+//	the machine to itself.
+//----------------------------------------------------------------------
 
+int
+AddrSpace::FindFrame()
+{
+    int frame = frames->FindAndSet();
+
+    ASSERT(imagePages < NumPhysPages);
+    while (frame == -1) {
+	TranslationEntry *entry;
+
+	clockHand = (clockHand + 1) % numPages;
+	entry = &pageTable[clockHand];
+	if ((unsigned int)clockHand < imagePages || !entry->valid)
+	    continue;
+	if (entry->use)
+	    entry->use = FALSE;
+	else {
+	    PageOut(FindMapping(clockHand), clockHand);
+	    frame = frames->FindAndSet();
+	}
+    }
+    return frame;
+}
 
+//----------------------------------------------------------------------
+// AddrSpace::PageOut
+// 	Take a mapped page out of memory, writing it back to the file
+//	if the program changed it.  Only the part within the mapped
+//	length of the file is written.
+//
+//	"mapping" -- the mapping the page belongs to
+//	"vpn" -- the virtual page
+//----------------------------------------------------------------------
 
+void
+AddrSpace::PageOut(MappedFile *mapping, int vpn)
+{
+    TranslationEntry *entry = &pageTable[vpn];
+    int offset = (vpn - mapping->firstPage) * PageSize;
+
+    entry->valid = FALSE;
+    if (entry->dirty) {
+	mapping->file->WriteAt(
+		&(kernel->machine->mainMemory[entry->physicalPage * PageSize]),
+		min(PageSize, mapping->length - offset), offset);
+	entry->dirty = FALSE;
+    }
+    frames->Clear(entry->physicalPage);
+    DEBUG(dbgAddr, "Page " << vpn << " out of frame " << entry->physicalPage);
+}
@@ -15,9 +15,26 @@
 
 #include "copyright.h"
 #include "filesys.h"
+#include "filetable.h"
+#include "asyncio.h"
+#include "bitmap.h"
+#include "list.h"
 
 #define UserStackSize		1024 	// increase this as necessary!
 
+// The following class defines a file mapped into an address space.
+// Its pages start out invalid, and are read from the file the first
+// time the program touches them.
+
+class MappedFile {
+  public:
+    OpenFile *file;			// The file, opened for the mapping alone
+    int firstPage;			// Virtual page of its first byte
+    int numPages;			// Pages it covers
+    int length;				// Bytes of the file mapped (its length
+					// when it was mapped)
+};
+
 class AddrSpace {
   public:
     AddrSpace();			// Create an address space.
@@ -39,11 +56,39 @@ class AddrSpace {
     // is 0 for Read, 1 for Write.
     ExceptionType Translate(unsigned int vaddr, unsigned int *paddr, int mode);
 
+    FileDescriptorTable *OpenFiles() { return openFiles; }
+					// The files the program has open
+    AsyncRequestTable *AsyncRequests() { return asyncRequests; }
+					// ... and its I/O still outstanding
+
+    int Mmap(OpenFile *file);		// Map "file" into the address space,
+					// above everything else; return its
+					// address, 0 if the file is empty
+    bool Munmap(int addr);		// Write back the changed pages of the
+					// mapping at "addr", and remove it
+    bool PageFault(int vaddr);		// Read in the mapped page holding
+					// "vaddr"; FALSE if it isn't mapped
+
   private:
     TranslationEntry *pageTable;	// Assume linear page table translation
 					// for now!
     unsigned int numPages;		// Number of pages in the virtual 
 					// address space
+    FileDescriptorTable *openFiles;	// Descriptors of its open files
+    AsyncRequestTable *asyncRequests;	// Ids of its asynchronous I/O
+    unsigned int imagePages;		// Pages of the program itself, which
+					// stay in memory; mappings follow
+    List<MappedFile *> *mappings;	// Files mapped into the address space
+    Bitmap *frames;			// Physical pages in use
+    int clockHand;			// Where the search for a page to
+					// evict goes on from
+
+    MappedFile *FindMapping(int vpn);	// The mapping page "vpn" is in
+    int FindFrame();			// A free physical page, evicting a
+					// mapped page if need be
+    void PageOut(MappedFile *mapping, int vpn);
+					// Write back mapped page "vpn" if it
+					// changed, and free its frame
 
     void InitRegisters();		// Initialize user-level CPU registers,
 					// before jumping to user code
@@ -53,7 +53,7 @@ void ExceptionHandler(ExceptionType which)
 	int type = kernel->machine->ReadRegister(2);
 	int val;
 	int status, exit, threadID, programID;
-	int size, fileID;	// MP4
+	int size, fileID, position;	// MP4
 	DEBUG(dbgSys, "Received Exception " << which << " type: " << type << "\n");
 	switch (which) {
 		case SyscallException:
@@ -89,6 +89,20 @@ void ExceptionHandler(ExceptionType which)
 					return;
 					ASSERTNOTREACHED();
 					break;
+				case SC_Clone:
+					val = kernel->machine->ReadRegister(4);
+					{
+						char *from = &(kernel->machine->mainMemory[val]);
+						char *to = &(kernel->machine->mainMemory[kernel->machine->ReadRegister(5)]);
+						status = SysClone(from, to);
+						kernel->machine->WriteRegister(2, (int)status);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
 				case SC_Open:
 					val = kernel->machine->ReadRegister(4);
 					{
@@ -132,6 +146,131 @@ void ExceptionHandler(ExceptionType which)
 					return;
 					ASSERTNOTREACHED();
 					break;
+				case SC_ReadAt:
+					val = kernel->machine->ReadRegister(4);
+					size = kernel->machine->ReadRegister(5);
+					position = kernel->machine->ReadRegister(6);
+					fileID = kernel->machine->ReadRegister(7);
+					{
+						char *buffer = &(kernel->machine->mainMemory[val]);
+						int result = SysReadAt(buffer, size, position, fileID);
+						kernel->machine->WriteRegister(2, result);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
+				case SC_WriteAt:
+					val = kernel->machine->ReadRegister(4);
+					size = kernel->machine->ReadRegister(5);
+					position = kernel->machine->ReadRegister(6);
+					fileID = kernel->machine->ReadRegister(7);
+					{
+						char *buffer = &(kernel->machine->mainMemory[val]);
+						int result = SysWriteAt(buffer, size, position, fileID);
+						kernel->machine->WriteRegister(2, result);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
+				case SC_AsyncRead:
+					val = kernel->machine->ReadRegister(4);
+					size = kernel->machine->ReadRegister(5);
+					position = kernel->machine->ReadRegister(6);
+					fileID = kernel->machine->ReadRegister(7);
+					{
+						char *buffer = &(kernel->machine->mainMemory[val]);
+						int result = SysAsyncRead(buffer, size, position, fileID);
+						kernel->machine->WriteRegister(2, result);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
+				case SC_AsyncWrite:
+					val = kernel->machine->ReadRegister(4);
+					size = kernel->machine->ReadRegister(5);
+					position = kernel->machine->ReadRegister(6);
+					fileID = kernel->machine->ReadRegister(7);
+					{
+						char *buffer = &(kernel->machine->mainMemory[val]);
+						int result = SysAsyncWrite(buffer, size, position, fileID);
+						kernel->machine->WriteRegister(2, result);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
+				case SC_AsyncWait:
+					val = kernel->machine->ReadRegister(4);
+					{
+						int result = SysAsyncWait(val);
+						kernel->machine->WriteRegister(2, result);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
+				case SC_AsyncPoll:
+					val = kernel->machine->ReadRegister(4);
+					{
+						int result = SysAsyncPoll(val);
+						kernel->machine->WriteRegister(2, result);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
+				case SC_Mmap:
+					fileID = kernel->machine->ReadRegister(4);
+					{
+						int result = SysMmap(fileID);
+						kernel->machine->WriteRegister(2, result);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
+				case SC_Munmap:
+					val = kernel->machine->ReadRegister(4);
+					{
+						int result = SysMunmap(val);
+						kernel->machine->WriteRegister(2, result);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
+				case SC_Seek:
+					position = kernel->machine->ReadRegister(4);
+					fileID = kernel->machine->ReadRegister(5);
+					{
+						int result = SysSeek(position, fileID);
+						kernel->machine->WriteRegister(2, result);
+					}
+					kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+					kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+					return;
+					ASSERTNOTREACHED();
+					break;
 				case SC_Close:
 					fileID = kernel->machine->ReadRegister(4);
 					{
@@ -188,6 +327,10 @@ void ExceptionHandler(ExceptionType which)
 					DEBUG(dbgAddr, "Program exit\n");
 					val = kernel->machine->ReadRegister(4);
 					cout << "return value:" << val << endl;
+					// MP4 close the program's files (storing what it
+					// wrote), finish its I/O and write back its mappings
+					delete kernel->currentThread->space;
+					kernel->currentThread->space = NULL;
 					kernel->currentThread->Finish();
 					break;
 				default:
@@ -195,6 +338,14 @@ void ExceptionHandler(ExceptionType which)
 					break;
 			}
 			break;
+		case PageFaultException:
+			// a page of a mapped file; the faulting instruction is
+			// run again once it is in (the PC was not advanced)
+			val = kernel->machine->ReadRegister(BadVAddrReg);
+			if (kernel->currentThread->space->PageFault(val))
+				return;
+			cerr << "Page fault at unmapped address " << val << "\n";
+			break;
 		default:
 			cerr << "Unexpected user mode exception " << (int)which << "\n";
 			break;
@@ -14,6 +14,7 @@
 #include "kernel.h"
 
 #include "synchconsole.h"
+#include "asyncio.h"
 
 void SysHalt()
 {
@@ -30,21 +31,135 @@ int SysCreate(char *filename, int size) {
 	return kernel->fileSystem->Create(filename, size);
 }
 
+int SysClone(char *from, char *to) {
+	return kernel->fileSystem->Clone(from, to);
+}
+
+// Each address space has its own descriptors, each with its own seek
+// position; opens of the same file share its header (cf. filetable.h)
+static OpenFile *SysFile(OpenFileId id) {
+	return kernel->currentThread->space->OpenFiles()->Get(id);
+}
+
 OpenFileId SysOpen(char *filename) {
-	// Since only at most 1 file can be opened at a time, we can just return 1 as file id
-	return (kernel->fileSystem->Open(filename) == NULL) ? -1 : 1;
+	OpenFile *file = kernel->fileSystem->Open(filename);
+	OpenFileId id;
+
+	if (file == NULL)
+		return -1;
+	id = kernel->currentThread->space->OpenFiles()->Add(file);
+	if (id == -1)
+		delete file;	// too many files open
+	return id;
 }
 
 int SysRead(char *buffer, int size, OpenFileId id) {
-	return kernel->fileSystem->Read(buffer, size, id);
+	OpenFile *file = SysFile(id);
+	return (file == NULL) ? -1 : file->Read(buffer, size);
 }
 
 int SysWrite(char *buffer, int size, OpenFileId id) {
-	return kernel->fileSystem->Write(buffer, size, id);
+	OpenFile *file = SysFile(id);
+	return (file == NULL) ? -1 : file->Write(buffer, size);
+}
+
+// Positional read/write: the seek position is neither used nor moved
+int SysReadAt(char *buffer, int size, int position, OpenFileId id) {
+	OpenFile *file = SysFile(id);
+	return (file == NULL || position < 0) ? -1 : file->ReadAt(buffer, size, position);
+}
+
+int SysWriteAt(char *buffer, int size, int position, OpenFileId id) {
+	OpenFile *file = SysFile(id);
+	return (file == NULL || position < 0) ? -1 : file->WriteAt(buffer, size, position);
+}
+
+// Seek and Close also fail if an earlier write was lost (cf. OpenFile::Flush)
+int SysSeek(int position, OpenFileId id) {
+	OpenFile *file = SysFile(id);
+
+	if (file == NULL || position < 0)
+		return -1;
+	return file->Seek(position) ? 1 : -1;
 }
 
 int SysClose(OpenFileId id) {
-	return kernel->fileSystem->Close(id);
+	return kernel->currentThread->space->OpenFiles()->Close(id) ? 1 : -1;
+}
+
+// Asynchronous I/O: the request is queued to the kernel's workers
+// (cf. asyncio.h), with an open of the file of its own
+static int SysAsync(char *buffer, int size, int position, OpenFileId id,
+					bool writing) {
+	OpenFile *file = SysFile(id);
+	AsyncRequest *request;
+	int requestId;
+
+	if (file == NULL || size < 0 || position < 0)
+		return -1;
+	request = new AsyncRequest(new OpenFile(file->HeaderSector(), file->Table()),
+							   buffer, size, position, writing);
+	requestId = kernel->currentThread->space->AsyncRequests()->Add(request);
+	if (requestId == -1) {
+		delete request;	// too many requests outstanding
+		return -1;
+	}
+	kernel->asyncIO->Submit(request);
+	return requestId;
+}
+
+int SysAsyncRead(char *buffer, int size, int position, OpenFileId id) {
+	return SysAsync(buffer, size, position, id, FALSE);
+}
+
+int SysAsyncWrite(char *buffer, int size, int position, OpenFileId id) {
+	return SysAsync(buffer, size, position, id, TRUE);
+}
+
+// Collect the result of a request, waiting for it if "wait"
+static int SysAsyncFinish(int requestId, bool wait) {
+	AsyncRequestTable *requests = kernel->currentThread->space->AsyncRequests();
+	AsyncRequest *request = requests->Get(requestId);
+	int result;
+
+	if (request == NULL)
+		return -1;
+	if (wait)
+		kernel->asyncIO->Wait(request);
+	else if (!kernel->asyncIO->Done(request))
+		return ASYNC_PENDING;
+	result = request->result;
+	requests->Remove(requestId);
+	delete request;
+	return result;
+}
+
+int SysAsyncWait(int requestId) {
+	return SysAsyncFinish(requestId, TRUE);
+}
+
+int SysAsyncPoll(int requestId) {
+	return SysAsyncFinish(requestId, FALSE);
+}
+
+// Memory-mapped files: the mapping gets an open of the file of its own,
+// and its pages are read in on page faults (cf. AddrSpace::PageFault)
+int SysMmap(OpenFileId id) {
+	OpenFile *file = SysFile(id);
+	OpenFile *mapped;
+	int addr;
+
+	if (file == NULL)
+		return 0;
+	mapped = new OpenFile(file->HeaderSector(), file->Table());
+	addr = kernel->currentThread->space->Mmap(mapped);
+	if (addr == 0)
+		delete mapped;
+	return addr;
+}
+
+int SysMunmap(int addr) {
+	return kernel->currentThread->space->Munmap(addr) ? 1 : -1;
 }
 // MP4
 
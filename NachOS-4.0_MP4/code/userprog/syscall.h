@@ -34,6 +34,15 @@
 #define SC_ExecV 13
 #define SC_ThreadExit 14
 #define SC_ThreadJoin 15
+#define SC_ReadAt 16
+#define SC_WriteAt 17
+#define SC_AsyncRead 18
+#define SC_AsyncWrite 19
+#define SC_AsyncWait 20
+#define SC_AsyncPoll 21
+#define SC_Mmap 22
+#define SC_Munmap 23
+#define SC_Clone 24
 #define SC_Add 42
 #define SC_MSG 100
 
@@ -121,6 +130,13 @@ int Create(char *name, int size); // FILE_SYS
 /* Remove a Nachos file, with name "name" */
 int Remove(char *name);
 
+/* Create the Nachos file "to" with the contents of the file "from",
+ * sharing its disk sectors until either file is written.
+ * Return 1 on success, 0 if "from" doesn't exist, "to" does, or there
+ * is no room.
+ */
+int Clone(char *from, char *to);
+
 /* Open the Nachos file "name", and return an "OpenFileId" that can 
  * be used to read and write to the file.
  */
@@ -141,12 +157,55 @@ int Write(char *buffer, int size, OpenFileId id);
 int Read(char *buffer, int size, OpenFileId id);
 
 /* Set the seek position of the open file "id"
- * to the byte "position".
+ * to the byte "position".  Return 1 on success, -1 if "id" isn't
+ * open, or if an earlier write to it turned out not to fit on the disk.
  */
 int Seek(int position, OpenFileId id);
 
+/* Read/write "size" bytes at the byte "position" of the open file,
+ * as Read/Write do, but without using or changing its seek position.
+ * Several threads can stream different parts of one file this way
+ * through a single OpenFileId.
+ */
+int ReadAt(char *buffer, int size, int position, OpenFileId id);
+int WriteAt(char *buffer, int size, int position, OpenFileId id);
+
+/* Start reading/writing "size" bytes at the byte "position" of the open
+ * file, as ReadAt/WriteAt do, and return at once, with an id for the
+ * request (a negative error code on failure).  The transfer goes on
+ * while the program runs; "buffer" must be left alone until it is over.
+ */
+int AsyncRead(char *buffer, int size, int position, OpenFileId id);
+int AsyncWrite(char *buffer, int size, int position, OpenFileId id);
+
+/* Wait until the request "id" is over, and return what ReadAt/WriteAt
+ * would have: the number of bytes read/written.  The id is free again
+ * afterwards.
+ */
+int AsyncWait(int id);
+
+/* As AsyncWait, but if the request isn't over yet return ASYNC_PENDING
+ * (and keep the id) instead of waiting.
+ */
+#define ASYNC_PENDING -2
+int AsyncPoll(int id);
+
+/* Map the open file "id" into the address space, and return the address
+ * of its first byte (0 on failure).  The file is read a page at a time,
+ * as the program touches it; the mapping covers the length the file has
+ * when it is mapped.  The mapped bytes cannot be handed to other system
+ * calls, which take buffer addresses as physical.
+ */
+char *Mmap(OpenFileId id);
+
+/* Remove the mapping at "addr", writing the pages the program changed
+ * back to the file.  Return 1 on success, negative error code on failure.
+ */
+int Munmap(char *addr);
+
 /* Close the file, we're done reading and writing to it.
- * Return 1 on success, negative error code on failure
+ * Return 1 on success, negative error code on failure (the file
+ * is closed all the same if what was written to it didn't fit)
  */
 int Close(OpenFileId id);
 
@@ -0,0 +1,937 @@
+// diskinfo.cc
+//	Offline analyzer for a Nachos disk image (DISK_0, as written by
+//	the simulated disk in code/machine/disk.cc).
+//
+//	The image is mapped into memory read-only.  Metadata the journal
+//	committed but had not copied home yet is laid over the image first,
+//	as mounting the disk would, so the report describes the file system
+//	Nachos would see.  Then the directory tree is walked from the root
+//	by a pool of host threads: each thread takes a file header off a
+//	shared queue, follows all its levels of index headers, and (for a
+//	directory) queues the headers of the files in it.  Every sector
+//	reached is marked in a bitmap of its own, which is checked against
+//	the file system's free map at the end.  A sector files share (see
+//	FileSystem::Clone) may be reached once per reference the free map
+//	counts for it; what is below it is only walked through again.
+//
+//	For each file, the report gives its sectors, the runs of adjacent
+//	sectors they form, how often reading the file in order crosses to
+//	another track, and what a sequential read would cost on the
+//	simulated disk (seek, rotation and transfer as in Disk::TimeToSeek
+//	and Disk::ComputeLatency, ignoring the track buffer and the
+//	disk queue) next to the cost if the file were contiguous.  Then
+//	comes the fragmentation of the free space.
+//
+//	The on-disk formats are repeated here from code/filesys (filehdr.h,
+//	directory.h, journal.cc, pbitmap.cc) and code/machine/disk.h; keep
+//	them in step.
+//
+// Usage: diskinfo [-j threads] [-t sectorsPerTrack] [-v] [image]
+//
+//    -j number of host threads (default: one per CPU)
+//    -t sectors per track, for a disk built with a different geometry
+//    -v lists every file, not just the most fragmented ones
+//    image defaults to DISK_0
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// code/machine/disk.h, disk.cc, stats.h
+#define MagicNumber 0x456789ab
+#define MagicSize 4
+#define SectorSize 128
+#define RotationTime 500
+#define SeekTime 500
+
+// code/filesys/filesys.cc, journal.h, journal.cc
+#define FreeMapSector 0
+#define DirectorySector 1
+#define JournalSector 2
+#define JournalStart (JournalSector + 1)
+#define JournalSize 2048
+#define JournalMagic 0x4a524e4c
+#define DescriptorMagic 0x44455343
+#define CommitMagic 0x434d4954
+#define LogLayoutMagic 0x4c4f4753 // in header word 3 of a log-structured disk
+
+// code/filesys/pbitmap.h, pbitmap.cc
+#define SectorsPerSegment 1024
+#define MaxSharedSectors 8192
+#define SharedTableSize ((1 + MaxSharedSectors) * 2 * (int)sizeof(int))
+#define RecordsPerDescriptor ((int)(SectorSize / sizeof(int)) - 3)
+
+// code/filesys/filehdr.h
+#define NumDirect ((SectorSize - 3 * (int)sizeof(int)) / (int)sizeof(int))
+#define InlineLevel -1
+#define MaxLevel 3
+#define CompressedBias 16 // added to the level of a compressed file
+#define SharedBias 32     // ... of a file that shares sectors
+
+struct FileHeader
+{
+    int numBytes;
+    int numSectors;
+    int level;
+    int dataSectors[NumDirect];
+};
+
+// code/filesys/directory.h, directory.cc
+#define FileNameMaxLen 9
+#define DirectoryMagic 0x44495242
+#define DirNodeSectors 8
+#define DirNodeSize (DirNodeSectors * SectorSize)
+
+struct DirectoryEntry
+{
+    int sector;
+    char name[FileNameMaxLen + 1];
+    bool inUse;
+    bool isDir;
+};
+
+#define LeafHeaderSize ((int)sizeof(DirectoryEntry))
+#define LeafEntries ((DirNodeSize - LeafHeaderSize) / (int)sizeof(DirectoryEntry))
+
+struct DirectoryHeader
+{
+    int magic;
+    int root;
+    int numNodes;
+};
+
+#define MaxReported 10 // problems of each kind printed in full
+#define MaxPath 1024
+
+//----------------------------------------------------------------------
+// The image
+//----------------------------------------------------------------------
+
+static char *image;          // The image file, mapped
+static int numSectors;       // Sectors in it
+static int sectorsPerTrack = 16384;
+
+static int logHead = -1;       // Where the log of a log-structured disk
+                               // is, according to the journal header
+static unsigned char *refs;    // References to each sector beyond the
+                               // first, from the free map; NULL if
+                               // the disk keeps no counts
+static int *overlaySectors;  // Sectors the journal holds newer
+static char **overlayImages; //   contents for, sorted, and the
+static int numOverlays;      //   contents (in the log)
+
+//----------------------------------------------------------------------
+// Sector
+// 	Return the contents of sector "s": the journal's copy, if it has
+//	one, or else the image's.
+//----------------------------------------------------------------------
+
+static const char *
+Sector(int s)
+{
+    int lo = 0, hi = numOverlays - 1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (overlaySectors[mid] == s)
+            return overlayImages[mid];
+        if (overlaySectors[mid] < s)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return image + MagicSize + (long)s * SectorSize;
+}
+
+static bool
+ValidSector(int s)
+{
+    return s >= 0 && s < numSectors;
+}
+
+//----------------------------------------------------------------------
+// ReadJournal
+// 	Find the transactions the log has committed beyond its start, as
+//	Journal::Recover does, and remember the newest image of each home
+//	sector they write.  Return the number of transactions.
+//----------------------------------------------------------------------
+
+static int
+ReadJournal()
+{
+    const int *header = (const int *)Sector(JournalSector);
+    int *homes, count = 0, transactions = 0;
+    char **images;
+    int head, sequence;
+
+    if (numSectors <= JournalStart + JournalSize || header[0] != JournalMagic)
+        return 0;
+    head = header[1];
+    sequence = header[2];
+    homes = new int[JournalSize];
+    images = new char *[JournalSize];
+
+    for (;;)
+    {
+        int position = head, found = 0;
+        bool complete = false;
+
+        while (position - head < JournalSize)
+        {
+            const int *record =
+                (const int *)Sector(JournalStart + position % JournalSize);
+
+            if (record[1] != sequence)
+                break;
+            if (record[0] == CommitMagic)
+            {
+                complete = true;
+                position++;
+                break;
+            }
+            if (record[0] != DescriptorMagic || record[2] <= 0 ||
+                record[2] > RecordsPerDescriptor ||
+                count + found + record[2] > JournalSize)
+                break;
+            for (int i = 0; i < record[2]; i++)
+            {
+                homes[count + found + i] = record[3 + i];
+                images[count + found + i] = (char *)Sector(
+                    JournalStart + (position + 1 + i) % JournalSize);
+            }
+            found += record[2];
+            position += 1 + record[2];
+        }
+        if (!complete)
+            break;
+        count += found;
+        head = position;
+        sequence++;
+        transactions++;
+    }
+
+    // sort by sector, stably, and keep the last image of each
+    overlaySectors = new int[count];
+    overlayImages = new char *[count];
+    for (int i = 0; i < count; i++)
+    {
+        int j;
+
+        for (j = numOverlays; j > 0 && overlaySectors[j - 1] > homes[i]; j--)
+            ;
+        if (j > 0 && overlaySectors[j - 1] == homes[i])
+        {
+            overlayImages[j - 1] = images[i];
+            continue;
+        }
+        memmove(&overlaySectors[j + 1], &overlaySectors[j],
+                (numOverlays - j) * sizeof(int));
+        memmove(&overlayImages[j + 1], &overlayImages[j],
+                (numOverlays - j) * sizeof(char *));
+        overlaySectors[j] = homes[i];
+        overlayImages[j] = images[i];
+        numOverlays++;
+    }
+    delete[] homes;
+    delete[] images;
+    return transactions;
+}
+
+//----------------------------------------------------------------------
+// Sectors reached, and problems found
+//----------------------------------------------------------------------
+
+static unsigned *reached; // One bit per sector
+static int *hits;         // Times each shared sector was reached
+static pthread_mutex_t reportLock = PTHREAD_MUTEX_INITIALIZER;
+static int numProblems;
+
+static void
+Problem(const char *format, const char *path, int sector)
+{
+    pthread_mutex_lock(&reportLock);
+    if (numProblems++ < MaxReported)
+    {
+        printf("problem: ");
+        printf(format, path, sector);
+        printf("\n");
+    }
+    pthread_mutex_unlock(&reportLock);
+}
+
+//----------------------------------------------------------------------
+// Reach
+// 	Note that "path" uses sector "s"; complain if something else does
+//	already -- more often than the free map counts, for a shared
+//	sector.  Return false if "s" is not on the disk at all.
+//
+//	"first" -- if not NULL, set to whether "s" was reached for the
+//		first time
+//----------------------------------------------------------------------
+
+static bool
+Reach(int s, const char *path, bool *first = NULL)
+{
+    unsigned bit = 1u << (s % 32);
+    bool again;
+
+    if (!ValidSector(s))
+    {
+        Problem("%s points to sector %d, off the disk", path, s);
+        return false;
+    }
+    again = (__sync_fetch_and_or(&reached[s / 32], bit) & bit) != 0;
+    if (refs != NULL && refs[s] > 0)
+    {
+        if (__sync_fetch_and_add(&hits[s], 1) > refs[s])
+            Problem("%s uses sector %d, more often than it is shared",
+                    path, s);
+    }
+    else if (again)
+        Problem("%s uses sector %d, which is in use already", path, s);
+    if (first != NULL)
+        *first = !again;
+    return true;
+}
+
+//----------------------------------------------------------------------
+// The files
+//----------------------------------------------------------------------
+
+class FileInfo
+{
+public:
+    char *path;
+    bool isDir;
+    int numBytes;
+    int level;
+    bool compressed; // Stored in compressed chunks
+    bool shared;     // Shares sectors with a clone
+    int headers;  // Header sectors, index headers included
+    int sectors;  // Data sectors
+    int runs;     // Runs of adjacent data sectors
+    int crossings; // Times reading in order moves to another track
+    long ticks;   // Sequential read cost, as laid out
+    long ideal;   //   and if the file were contiguous
+};
+
+class SectorList
+{
+public:
+    int *list;
+    int count, size;
+
+    SectorList() : list(new int[64]), count(0), size(64) {}
+    ~SectorList() { delete[] list; }
+    void Append(int s)
+    {
+        if (count == size)
+        {
+            int *bigger = new int[size *= 2];
+
+            memcpy(bigger, list, count * sizeof(int));
+            delete[] list;
+            list = bigger;
+        }
+        list[count++] = s;
+    }
+};
+
+//----------------------------------------------------------------------
+// WalkHeader
+// 	Append the data sectors of the part of a file below "hdr" to
+//	"data", in file order (-1 for a hole), marking them and every
+//	index header on the way as reached -- unless "mark" is false: an
+//	index header another file reached first is only walked through.
+//----------------------------------------------------------------------
+
+static void
+WalkHeader(const FileHeader *hdr, int level, FileInfo *info, SectorList *data,
+           bool mark = true)
+{
+    for (int i = 0; i < NumDirect; i++)
+    {
+        int s = hdr->dataSectors[i];
+        bool first = true;
+
+        if (s == -1)
+        {
+            if (level == 0)
+                data->Append(-1);
+            continue;
+        }
+        if (mark ? !Reach(s, info->path, &first) : !ValidSector(s))
+            continue;
+        if (level == 0)
+            data->Append(s);
+        else
+        {
+            const FileHeader *child = (const FileHeader *)Sector(s);
+
+            info->headers++;
+            if (child->level != level - 1)
+                Problem("%s: index header %d is at the wrong level",
+                        info->path, s);
+            else
+                WalkHeader(child, level - 1, info, data, mark && first);
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Measure
+// 	Count the runs and track crossings of a file's data sectors, and
+//	time a read of them from start to end: each run after the first
+//	costs a seek to its track and the rotation to its first sector,
+//	and every sector costs the time to pass under the head.
+//----------------------------------------------------------------------
+
+static void
+Measure(FileInfo *info, SectorList *data)
+{
+    int last = -1;
+
+    for (int i = 0; i < data->count; i++)
+    {
+        int s = data->list[i];
+
+        if (s == -1)
+            continue;
+        info->sectors++;
+        if (last == -1 ||
+            (s == last + 1 && s % sectorsPerTrack != 0))
+        { // the read starts with the head over the first sector
+            info->ticks += RotationTime;
+            info->runs += (last == -1);
+            last = s;
+            continue;
+        }
+        if (s / sectorsPerTrack != last / sectorsPerTrack)
+            info->crossings++;
+        info->runs++;
+
+        // the head is just past "last"
+        int from = last + 1;
+        int seek = abs(s / sectorsPerTrack - from / sectorsPerTrack) * SeekTime;
+        int passed = (from + seek / RotationTime) % sectorsPerTrack;
+        int rotate = ((s % sectorsPerTrack) - passed + sectorsPerTrack) %
+                     sectorsPerTrack;
+
+        info->ticks += seek + (long)rotate * RotationTime + RotationTime;
+        last = s;
+    }
+    info->ideal = (long)info->sectors * RotationTime;
+}
+
+//----------------------------------------------------------------------
+// The work queue
+//----------------------------------------------------------------------
+
+class WorkItem
+{
+public:
+    int sector;
+    bool isDir;
+    char *path;
+    WorkItem *next;
+};
+
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueChanged = PTHREAD_COND_INITIALIZER;
+static WorkItem *queue;
+static int pending; // Items queued or being worked on
+
+static FileInfo **files;
+static int numFiles, filesSize;
+
+static void
+Enqueue(int sector, bool isDir, char *path)
+{
+    WorkItem *item = new WorkItem;
+
+    item->sector = sector;
+    item->isDir = isDir;
+    item->path = path;
+    pthread_mutex_lock(&queueLock);
+    item->next = queue;
+    queue = item;
+    pending++;
+    pthread_cond_signal(&queueChanged);
+    pthread_mutex_unlock(&queueLock);
+}
+
+static void
+Record(FileInfo *info)
+{
+    pthread_mutex_lock(&queueLock);
+    if (numFiles == filesSize)
+    {
+        FileInfo **bigger = new FileInfo *[filesSize = 2 * filesSize + 64];
+
+        memcpy(bigger, files, numFiles * sizeof(FileInfo *));
+        delete[] files;
+        files = bigger;
+    }
+    files[numFiles++] = info;
+    pthread_mutex_unlock(&queueLock);
+}
+
+//----------------------------------------------------------------------
+// FileBytes
+// 	Copy "count" bytes at "offset" of a file out of its data sectors;
+//	holes read as zeros.
+//----------------------------------------------------------------------
+
+static void
+FileBytes(SectorList *data, int offset, int count, char *into)
+{
+    for (int done = 0; done < count;)
+    {
+        int index = (offset + done) / SectorSize;
+        int within = (offset + done) % SectorSize;
+        int n = SectorSize - within;
+
+        if (n > count - done)
+            n = count - done;
+        if (index >= data->count || data->list[index] == -1)
+            memset(into + done, 0, n);
+        else
+            memcpy(into + done, Sector(data->list[index]) + within, n);
+        done += n;
+    }
+}
+
+//----------------------------------------------------------------------
+// ReadDirectory
+// 	Queue the files a directory holds.  Every node of its B-tree is
+//	looked at; the entries are in the leaves.
+//----------------------------------------------------------------------
+
+static void
+ReadDirectory(FileInfo *info, SectorList *data)
+{
+    DirectoryHeader header;
+    char node[DirNodeSize];
+
+    FileBytes(data, 0, sizeof(header), (char *)&header);
+    if (header.magic != DirectoryMagic || header.numNodes < 0 ||
+        (long)SectorSize + (long)header.numNodes * DirNodeSize > info->numBytes)
+    {
+        Problem("%s: not a directory (sector %d)", info->path,
+                data->count > 0 ? data->list[0] : -1);
+        return;
+    }
+    for (int n = 0; n < header.numNodes; n++)
+    {
+        int isLeaf;
+
+        FileBytes(data, SectorSize + n * DirNodeSize, DirNodeSize, node);
+        memcpy(&isLeaf, node, sizeof(int));
+        if (!isLeaf)
+            continue;
+        for (int i = 0; i < LeafEntries; i++)
+        {
+            DirectoryEntry *entry =
+                (DirectoryEntry *)(node + LeafHeaderSize) + i;
+            int length = strlen(info->path) + FileNameMaxLen + 2;
+            char *path;
+
+            if (!entry->inUse)
+                continue;
+            entry->name[FileNameMaxLen] = '\0';
+            path = new char[length];
+            snprintf(path, length, "%s/%s",
+                     strcmp(info->path, "/") ? info->path : "", entry->name);
+            if (Reach(entry->sector, path))
+                Enqueue(entry->sector, entry->isDir, path);
+            else
+                delete[] path;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Analyze
+// 	Work out everything about the file whose header is in "item".
+//----------------------------------------------------------------------
+
+static void
+Analyze(WorkItem *item)
+{
+    const FileHeader *hdr = (const FileHeader *)Sector(item->sector);
+    FileInfo *info = new FileInfo;
+    SectorList data;
+
+    memset(info, 0, sizeof(FileInfo));
+    info->path = item->path;
+    info->isDir = item->isDir;
+    info->numBytes = hdr->numBytes;
+    info->level = hdr->level;
+    if (info->level >= InlineLevel + SharedBias)
+    {
+        info->shared = true;
+        info->level -= SharedBias;
+    }
+    if (info->level >= InlineLevel + CompressedBias)
+    {
+        info->compressed = true;
+        info->level -= CompressedBias;
+    }
+    info->headers = 1;
+    if (info->level == InlineLevel)
+    {
+        if (hdr->numBytes < 0 || hdr->numBytes > NumDirect * (int)sizeof(int))
+            Problem("%s: bad inline length (header %d)", info->path,
+                    item->sector);
+    }
+    else if (info->level < 0 || info->level > MaxLevel || hdr->numBytes < 0)
+        Problem("%s: bad file header %d", info->path, item->sector);
+    else
+    {
+        WalkHeader(hdr, info->level, info, &data);
+        Measure(info, &data);
+        if (item->isDir)
+            ReadDirectory(info, &data);
+    }
+    Record(info);
+}
+
+static void *
+Worker(void *)
+{
+    for (;;)
+    {
+        WorkItem *item;
+
+        pthread_mutex_lock(&queueLock);
+        while (queue == NULL && pending > 0)
+            pthread_cond_wait(&queueChanged, &queueLock);
+        if (queue == NULL)
+        { // nothing queued, and nothing being worked on to queue more
+            pthread_cond_broadcast(&queueChanged);
+            pthread_mutex_unlock(&queueLock);
+            return NULL;
+        }
+        item = queue;
+        queue = item->next;
+        pthread_mutex_unlock(&queueLock);
+
+        Analyze(item);
+        delete item;
+
+        pthread_mutex_lock(&queueLock);
+        if (--pending == 0)
+            pthread_cond_broadcast(&queueChanged);
+        pthread_mutex_unlock(&queueLock);
+    }
+}
+
+//----------------------------------------------------------------------
+// LoadRefs
+// 	Read the reference counts the free map file keeps after the bits,
+//	if it is long enough to have them, so that the walk knows which
+//	sectors may be reached more than once.  On disk, they are a table
+//	of (sector, count) slots, led by the number of slots in use.
+//----------------------------------------------------------------------
+
+static void
+LoadRefs()
+{
+    const FileHeader *hdr = (const FileHeader *)Sector(FreeMapSector);
+    FileInfo info;
+    SectorList data;
+    int offset = ((numSectors + 7) / 8 + SectorSize - 1) / SectorSize * SectorSize;
+    int inUse;
+
+    if (hdr->level < 0 || hdr->level > MaxLevel ||
+        hdr->numBytes < offset + SharedTableSize)
+        return;
+    memset(&info, 0, sizeof(info));
+    info.path = (char *)"(free map)";
+    WalkHeader(hdr, hdr->level, &info, &data, false);
+    refs = new unsigned char[numSectors]();
+    hits = new int[numSectors]();
+    FileBytes(&data, offset, sizeof(inUse), (char *)&inUse);
+    if (inUse < 0 || inUse > MaxSharedSectors)
+    {
+        Problem("%s: bad number of sectors shared, %d", info.path, inUse);
+        return;
+    }
+    for (int slot = 0; slot < inUse; slot++)
+    {
+        int pair[2]; // sector, references beyond the first
+
+        FileBytes(&data, offset + (1 + slot) * sizeof(pair), sizeof(pair),
+                  (char *)pair);
+        if (pair[1] == 0)
+            continue; // free slot
+        if (pair[0] < 0 || pair[0] >= numSectors || pair[1] < 0 ||
+            pair[1] > 255 || refs[pair[0]] != 0)
+            Problem("%s: bad count of sharing, for sector %d", info.path,
+                    pair[0]);
+        else
+            refs[pair[0]] = pair[1];
+    }
+}
+
+//----------------------------------------------------------------------
+// CheckFreeMap
+// 	Compare the free map with the sectors reached, and measure the
+//	fragmentation of the free space.
+//----------------------------------------------------------------------
+
+static void
+CheckFreeMap()
+{
+    const FileHeader *hdr = (const FileHeader *)Sector(FreeMapSector);
+    FileInfo info;
+    SectorList data;
+    int words = (numSectors + 31) / 32;
+    unsigned *map = new unsigned[words];
+    int leaked = 0, lost = 0, numFree = 0, extents = 0, largest = 0;
+    int shared = 0;
+    int histogram[5] = {0, 0, 0, 0, 0}; // 1, 2-7, 8-63, 64-511, 512+
+    int extent = 0, segmentFree = 0, cleanSegments = 0;
+    int numSegments = (numSectors + SectorsPerSegment - 1) / SectorsPerSegment;
+
+    memset(&info, 0, sizeof(info));
+    info.path = (char *)"(free map)";
+    if (hdr->level < 0 || hdr->level > MaxLevel)
+    {
+        Problem("%s: bad file header %d", info.path, FreeMapSector);
+        delete[] map;
+        return;
+    }
+    WalkHeader(hdr, hdr->level, &info, &data);
+    FileBytes(&data, 0, words * sizeof(unsigned), (char *)map);
+
+    for (int s = 0; s <= numSectors; s++)
+    {
+        bool used = (s < numSectors) && (map[s / 32] & (1u << (s % 32)));
+        bool isReached = (s < numSectors) && (reached[s / 32] & (1u << (s % 32)));
+
+        if (s < numSectors && used && !isReached)
+        {
+            leaked++;
+            Problem("%s: sector %d is allocated, but no file uses it",
+                    info.path, s);
+        }
+        if (s < numSectors && !used && isReached)
+        {
+            lost++;
+            Problem("%s: sector %d is in use, but marked free", info.path, s);
+        }
+        if (s < numSectors && refs != NULL && refs[s] > 0)
+        {
+            shared++;
+            if (!used || hits[s] != refs[s] + 1)
+                Problem("%s: sector %d is not shared as often as counted",
+                        info.path, s);
+        }
+        if (s > 0 && (s % SectorsPerSegment == 0 || s == numSectors))
+        {
+            if (segmentFree == (s - 1) % SectorsPerSegment + 1)
+                cleanSegments++;
+            segmentFree = 0;
+        }
+        if (s < numSectors && !used)
+        {
+            numFree++;
+            segmentFree++;
+            extent++;
+            continue;
+        }
+        if (extent > 0)
+        {
+            extents++;
+            if (extent > largest)
+                largest = extent;
+            histogram[extent == 1 ? 0 : extent < 8 ? 1 : extent < 64 ? 2
+                                   : extent < 512 ? 3 : 4]++;
+            extent = 0;
+        }
+    }
+
+    printf("\nFree map: %d of %d sectors free, in %d extents (largest %d)\n",
+           numFree, numSectors, extents, largest);
+    printf("  free extents of 1: %d, 2-7: %d, 8-63: %d, 64-511: %d, 512+: %d\n",
+           histogram[0], histogram[1], histogram[2], histogram[3], histogram[4]);
+    printf("  allocated but not used by any file: %d\n", leaked);
+    printf("  used but marked free: %d\n", lost);
+    if (refs != NULL)
+        printf("  shared by more than one file: %d\n", shared);
+    if (logHead != -1)
+        printf("  log-structured: head at sector %d, %d of %d segments clean\n",
+               logHead, cleanSegments, numSegments);
+    delete[] map;
+}
+
+//----------------------------------------------------------------------
+// Report
+//----------------------------------------------------------------------
+
+static int
+ByPath(const void *a, const void *b)
+{
+    return strcmp((*(FileInfo **)a)->path, (*(FileInfo **)b)->path);
+}
+
+static int
+ByFragmentation(const void *a, const void *b)
+{
+    FileInfo *x = *(FileInfo **)a, *y = *(FileInfo **)b;
+    long over = (x->ticks - x->ideal) - (y->ticks - y->ideal);
+
+    return over < 0 ? 1 : over > 0 ? -1 : 0;
+}
+
+static void
+PrintFile(FileInfo *f)
+{
+    printf("%c %-30s %10d %5d %8d %6d %6d %12ld %12ld\n",
+           f->isDir ? 'D' : 'F', f->path, f->numBytes, f->level, f->sectors,
+           f->runs, f->crossings, f->ticks, f->ideal);
+}
+
+static void
+Report(bool verbose)
+{
+    long sectors = 0, runs = 0, crossings = 0, ticks = 0, ideal = 0;
+    int inline_ = 0, compressed = 0, shared = 0, fragmented = 0;
+
+    for (int i = 0; i < numFiles; i++)
+    {
+        FileInfo *f = files[i];
+
+        sectors += f->sectors;
+        runs += f->runs;
+        crossings += f->crossings;
+        ticks += f->ticks;
+        ideal += f->ideal;
+        if (f->level == InlineLevel)
+            inline_++;
+        if (f->compressed)
+            compressed++;
+        if (f->shared)
+            shared++;
+        if (f->runs > 1)
+            fragmented++;
+    }
+
+    qsort(files, numFiles, sizeof(FileInfo *),
+          verbose ? ByPath : ByFragmentation);
+    printf("\n%s\n", verbose ? "Files:" : "Most fragmented files:");
+    printf("  %-30s %10s %5s %8s %6s %6s %12s %12s\n", "path", "bytes",
+           "level", "sectors", "runs", "tracks", "read ticks", "contiguous");
+    for (int i = 0; i < numFiles && (verbose || i < MaxReported); i++)
+        if (verbose || files[i]->ticks > files[i]->ideal)
+            PrintFile(files[i]);
+
+    printf("\nFiles: %d (%d inline, %d compressed, %d shared, "
+           "%d in more than one run)\n",
+           numFiles, inline_, compressed, shared, fragmented);
+    printf("  data sectors %ld, in %ld runs (%.2f sectors per run), "
+           "%ld track crossings\n",
+           sectors, runs, runs ? (double)sectors / runs : 0.0, crossings);
+    printf("  sequential read of every file: %ld ticks; %ld if contiguous\n",
+           ticks, ideal);
+}
+
+//----------------------------------------------------------------------
+// main
+//----------------------------------------------------------------------
+
+int
+main(int argc, char **argv)
+{
+    const char *name = "DISK_0";
+    int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool verbose = false;
+    struct stat info;
+    pthread_t *threads;
+    int fd, transactions;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            numThreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            sectorsPerTrack = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-v"))
+            verbose = true;
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr,
+                    "usage: diskinfo [-j threads] [-t sectorsPerTrack] [-v] [image]\n");
+            return 2;
+        }
+        else
+            name = argv[i];
+    }
+    if (numThreads < 1)
+        numThreads = 1;
+    if (sectorsPerTrack < 1)
+        sectorsPerTrack = 1;
+
+    if ((fd = open(name, O_RDONLY)) < 0 || fstat(fd, &info) < 0)
+    {
+        perror(name);
+        return 1;
+    }
+    image = (char *)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (info.st_size < MagicSize + SectorSize * (DirectorySector + 1) ||
+        image == MAP_FAILED || *(int *)image != MagicNumber)
+    {
+        fprintf(stderr, "%s: not a Nachos disk\n", name);
+        return 1;
+    }
+    madvise(image, info.st_size, MADV_WILLNEED);
+    numSectors = (info.st_size - MagicSize) / SectorSize;
+    reached = new unsigned[(numSectors + 31) / 32]();
+
+    transactions = ReadJournal();
+    if (((const int *)Sector(JournalSector))[0] == JournalMagic &&
+        ((const int *)Sector(JournalSector))[3] == LogLayoutMagic)
+        logHead = ((const int *)Sector(JournalSector))[4];
+    printf("Disk %s: %d sectors, %d tracks of %d\n", name, numSectors,
+           (numSectors + sectorsPerTrack - 1) / sectorsPerTrack, sectorsPerTrack);
+    if (transactions > 0)
+        printf("Journal: %d transactions (%d sectors) not yet copied home; "
+               "using the journal's copies\n", transactions, numOverlays);
+
+    // the sectors set aside for the metadata, whatever is in them
+    Reach(FreeMapSector, "(free map)");
+    Reach(DirectorySector, "/");
+    if (((const int *)Sector(JournalSector))[0] == JournalMagic)
+        for (int s = JournalSector; s < JournalStart + JournalSize; s++)
+            Reach(s, "(journal)");
+
+    LoadRefs();
+    Enqueue(DirectorySector, true, (char *)"/");
+    threads = new pthread_t[numThreads];
+    for (int i = 0; i < numThreads; i++)
+        pthread_create(&threads[i], NULL, Worker, NULL);
+    for (int i = 0; i < numThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    CheckFreeMap();
+    Report(verbose);
+    if (numProblems > MaxReported)
+        printf("\n(%d more problems not shown)\n", numProblems - MaxReported);
+    printf("\n%d problems\n", numProblems);
+
+    munmap(image, info.st_size);
+    close(fd);
+    return numProblems > 0;
+}